@@ -0,0 +1,118 @@
+#pragma once
+
+#include "benchmark/benchmark.h"
+#include "blackwidow/blackwidow.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace bench {
+
+// The dbs live under $BLACKWIDOW_BENCH_DIR, a tmpfs by default so that the
+// numbers are the engines' and not the disk's.
+inline std::string BenchPath(const std::string& name) {
+  const char* dir = std::getenv("BLACKWIDOW_BENCH_DIR");
+  return std::string(dir != nullptr ? dir : "/dev/shm/blackwidow_bench") +
+         "/" + name;
+}
+
+// One db per engine for the whole run, opened by the first benchmark using
+// it and removed at exit.
+template <typename Engine>
+class BenchDB {
+ public:
+  static Engine* Get(const std::string& name) {
+    static BenchDB db(name);
+    return db.engine_;
+  }
+
+ private:
+  explicit BenchDB(const std::string& name) : path_(BenchPath(name)) {
+    std::string cmd = "rm -rf " + path_;
+    std::system(cmd.c_str());
+    blackwidow::BlackWidowOptions opts;
+    opts.options.create_if_missing = true;
+    engine_ = new Engine(nullptr);
+    blackwidow::Status s = engine_->Open(opts, path_);
+    if (!s.ok()) {
+      fprintf(stderr, "Open %s failed: %s\n", path_.c_str(),
+              s.ToString().c_str());
+      std::abort();
+    }
+  }
+
+  ~BenchDB() {
+    delete engine_;
+    std::string cmd = "rm -rf " + path_;
+    std::system(cmd.c_str());
+  }
+
+  const std::string path_;
+  Engine* engine_;
+};
+
+// Runs `fill` once per `tag` for all benchmarks and threads, the other
+// threads wait for it.
+inline void FillOnce(const std::string& tag, const std::function<void()>& fill) {
+  static std::mutex mu;
+  static std::set<std::string> filled;
+  std::lock_guard<std::mutex> l(mu);
+  if (filled.insert(tag).second) {
+    fill();
+  }
+}
+
+// Fixed length keys "<prefix><number>" padded with '0', drawn uniformly
+// from `num_keys` numbers.
+class KeyGenerator {
+ public:
+  KeyGenerator(const std::string& prefix, size_t key_size, int64_t num_keys)
+    : prefix_(prefix),
+      key_size_(key_size),
+      rng_(std::hash<std::thread::id>()(std::this_thread::get_id())),
+      dist_(0, num_keys - 1) {}
+
+  std::string Next() {
+    return Key(dist_(rng_));
+  }
+
+  std::string Key(int64_t n) const {
+    std::string number = std::to_string(n);
+    std::string key = prefix_;
+    if (key.size() + number.size() < key_size_) {
+      key.append(key_size_ - key.size() - number.size(), '0');
+    }
+    return key + number;
+  }
+
+ private:
+  const std::string prefix_;
+  const size_t key_size_;
+  std::mt19937_64 rng_;
+  std::uniform_int_distribution<int64_t> dist_;
+};
+
+// Keys never used before, over all threads.
+inline std::string UniqueKey(const std::string& prefix) {
+  static std::atomic<uint64_t> next{0};
+  return prefix + std::to_string(next.fetch_add(1));
+}
+
+// NotFound is a result, anything else stops the benchmark; the caller
+// must leave the loop when false is returned.
+inline bool CheckStatus(benchmark::State& state, const blackwidow::Status& s) {
+  if (!s.ok() && !s.IsNotFound()) {
+    state.SkipWithError(s.ToString().c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace bench
@@ -0,0 +1,99 @@
+#include "bench_util.h"
+#include "redis_hashes.h"
+
+namespace {
+
+const int64_t kNumHashes = 1000;
+
+blackwidow::RedisHashes* DB() {
+  return bench::BenchDB<blackwidow::RedisHashes>::Get("hashes");
+}
+
+std::string Field(int64_t n) {
+  return "field" + std::to_string(n);
+}
+
+// Fills every hash of `keys` with `fields` fields once.
+void FillHashes(const std::string& tag,
+                const bench::KeyGenerator& keys,
+                int64_t fields,
+                const std::string& value) {
+  bench::FillOnce(tag, [&]() {
+    std::vector<blackwidow::FieldValue> fvs;
+    for (int64_t j = 0; j < fields; j++) {
+      fvs.push_back({Field(j), value});
+    }
+    for (int64_t i = 0; i < kNumHashes; i++) {
+      DB()->HMSet(keys.Key(i), fvs);
+    }
+  });
+}
+
+// fields per hash, value size
+void BM_HSet(benchmark::State& state) {
+  bench::KeyGenerator keys("hset", 16, kNumHashes);
+  std::mt19937_64 rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::uniform_int_distribution<int64_t> fields(0, state.range(0) - 1);
+  const std::string value(state.range(1), 'v');
+  int32_t ret = 0;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(
+          state, DB()->HSet(keys.Next(), Field(fields(rng)), value, &ret))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_HSet)
+  ->ArgNames({"fields", "value"})
+  ->ArgsProduct({{10, 1000}, {16, 256, 4096}})
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// fields per hash, value size
+void BM_HGet(benchmark::State& state) {
+  const std::string tag = "hget" + std::to_string(state.range(0)) + "_" +
+                          std::to_string(state.range(1));
+  bench::KeyGenerator keys(tag + "_", 16, kNumHashes);
+  FillHashes(tag, keys, state.range(0), std::string(state.range(1), 'v'));
+  std::mt19937_64 rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::uniform_int_distribution<int64_t> fields(0, state.range(0) - 1);
+  std::string value;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(
+          state, DB()->HGet(keys.Next(), Field(fields(rng)), &value))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_HGet)
+  ->ArgNames({"fields", "value"})
+  ->ArgsProduct({{10, 1000}, {16, 256, 4096}})
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// fields per hash
+void BM_HGetAll(benchmark::State& state) {
+  const std::string tag = "hgetall" + std::to_string(state.range(0));
+  bench::KeyGenerator keys(tag + "_", 16, kNumHashes);
+  FillHashes(tag, keys, state.range(0), std::string(64, 'v'));
+  std::vector<blackwidow::FieldValue> fvs;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(state, DB()->HGetAll(keys.Next(), &fvs))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HGetAll)
+  ->ArgNames({"fields"})
+  ->Arg(10)
+  ->Arg(100)
+  ->Arg(1000)
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,61 @@
+#include "bench_util.h"
+#include "redis_lists.h"
+
+namespace {
+
+const int64_t kNumLists = 1000;
+
+blackwidow::RedisLists* DB() {
+  return bench::BenchDB<blackwidow::RedisLists>::Get("lists");
+}
+
+// values per LPush, value size. LPush only creates lists so far, every
+// iteration pushes to a new one.
+void BM_LPush(benchmark::State& state) {
+  const std::vector<std::string> values(state.range(0),
+                                        std::string(state.range(1), 'v'));
+  uint64_t len = 0;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(
+          state, DB()->LPush(bench::UniqueKey("lpush"), values, &len))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * state.range(0) *
+                          state.range(1));
+}
+BENCHMARK(BM_LPush)
+  ->ArgNames({"values", "value"})
+  ->ArgsProduct({{1, 100}, {16, 256, 4096}})
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// value size, pushes one value to an existing list.
+void BM_LPushX(benchmark::State& state) {
+  bench::KeyGenerator keys("lpushx", 16, kNumLists);
+  bench::FillOnce("lpushx", [&]() {
+    uint64_t len = 0;
+    for (int64_t i = 0; i < kNumLists; i++) {
+      DB()->LPush(keys.Key(i), {"v"}, &len);
+    }
+  });
+  const std::string value(state.range(0), 'v');
+  uint64_t len = 0;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(state, DB()->LPushX(keys.Next(), value, &len))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LPushX)
+  ->ArgNames({"value"})
+  ->Arg(16)
+  ->Arg(256)
+  ->Arg(4096)
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,99 @@
+#include "bench_util.h"
+#include "redis_strings.h"
+
+namespace {
+
+const int64_t kNumKeys = 100000;
+
+blackwidow::RedisStrings* DB() {
+  return bench::BenchDB<blackwidow::RedisStrings>::Get("strings");
+}
+
+// key size, value size
+void BM_Set(benchmark::State& state) {
+  bench::KeyGenerator keys("set", state.range(0), kNumKeys);
+  const std::string value(state.range(1), 'v');
+  for (auto _ : state) {
+    if (!bench::CheckStatus(state, DB()->Set(keys.Next(), value))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_Set)
+  ->ArgNames({"key", "value"})
+  ->ArgsProduct({{16, 128}, {16, 256, 4096}})
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// key size, value size
+void BM_Get(benchmark::State& state) {
+  bench::KeyGenerator keys("get", state.range(0), kNumKeys);
+  const std::string value(state.range(1), 'v');
+  bench::FillOnce(
+    "get/" + std::to_string(state.range(0)) + "/" +
+      std::to_string(state.range(1)),
+    [&]() {
+      for (int64_t i = 0; i < kNumKeys; i++) {
+        DB()->Set(keys.Key(i), value);
+      }
+    });
+  std::string result;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(state, DB()->Get(keys.Next(), &result))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_Get)
+  ->ArgNames({"key", "value"})
+  ->ArgsProduct({{16, 128}, {16, 256, 4096}})
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// keys per MSet, value size
+void BM_MSet(benchmark::State& state) {
+  bench::KeyGenerator keys("mset", 16, kNumKeys);
+  const std::string value(state.range(1), 'v');
+  std::vector<blackwidow::KeyValue> kvs(state.range(0));
+  for (auto _ : state) {
+    for (auto& kv : kvs) {
+      kv.key = keys.Next();
+      kv.value = value;
+    }
+    if (!bench::CheckStatus(state, DB()->MSet(kvs))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * state.range(0) *
+                          state.range(1));
+}
+BENCHMARK(BM_MSet)
+  ->ArgNames({"batch", "value"})
+  ->ArgsProduct({{10, 100}, {16, 256}})
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// number of counters, few of them means contention on the same keys
+void BM_Incr(benchmark::State& state) {
+  bench::KeyGenerator keys("incr", 16, state.range(0));
+  int64_t result = 0;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(state, DB()->Incr(keys.Next(), &result))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Incr)
+  ->ArgNames({"counters"})
+  ->Arg(16)
+  ->Arg(kNumKeys)
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+}  // namespace
@@ -0,0 +1,122 @@
+#include "bench_util.h"
+#include "redis_zsets.h"
+
+namespace {
+
+const int64_t kNumZsets = 100;
+
+blackwidow::RedisZsets* DB() {
+  return bench::BenchDB<blackwidow::RedisZsets>::Get("zsets");
+}
+
+std::vector<blackwidow::ScoreMember> Members(int64_t n) {
+  std::vector<blackwidow::ScoreMember> sms;
+  for (int64_t i = 0; i < n; i++) {
+    sms.push_back({static_cast<double>(i), "member" + std::to_string(i)});
+  }
+  return sms;
+}
+
+// Zsets of `size` members scored 0 ... size - 1.
+void FillZsets(const std::string& tag,
+               const bench::KeyGenerator& keys,
+               int64_t size) {
+  bench::FillOnce(tag, [&]() {
+    std::vector<blackwidow::ScoreMember> sms = Members(size);
+    int32_t ret = 0;
+    for (int64_t i = 0; i < kNumZsets; i++) {
+      DB()->ZAdd(keys.Key(i), sms, &ret);
+    }
+  });
+}
+
+// members per zset. ZAdd only creates zsets so far, every iteration adds a
+// new one.
+void BM_ZAdd(benchmark::State& state) {
+  const std::vector<blackwidow::ScoreMember> sms = Members(state.range(0));
+  int32_t ret = 0;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(
+          state, DB()->ZAdd(bench::UniqueKey("zadd"), sms, &ret))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ZAdd)
+  ->ArgNames({"members"})
+  ->Arg(1)
+  ->Arg(10)
+  ->Arg(100)
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// members per zset
+void BM_ZScore(benchmark::State& state) {
+  const std::string tag = "zscore" + std::to_string(state.range(0));
+  bench::KeyGenerator keys(tag + "_", 16, kNumZsets);
+  FillZsets(tag, keys, state.range(0));
+  bench::KeyGenerator members("member", 0, state.range(0));
+  double score = 0;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(
+          state, DB()->ZScore(keys.Next(), members.Next(), &score))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ZScore)
+  ->ArgNames({"members"})
+  ->Arg(10)
+  ->Arg(1000)
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// members per zset, ZRank walks the score cf up to the member.
+void BM_ZRank(benchmark::State& state) {
+  const std::string tag = "zrank" + std::to_string(state.range(0));
+  bench::KeyGenerator keys(tag + "_", 16, kNumZsets);
+  FillZsets(tag, keys, state.range(0));
+  bench::KeyGenerator members("member", 0, state.range(0));
+  int32_t rank = 0;
+  for (auto _ : state) {
+    if (!bench::CheckStatus(
+          state, DB()->ZRank(keys.Next(), members.Next(), &rank))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ZRank)
+  ->ArgNames({"members"})
+  ->Arg(10)
+  ->Arg(1000)
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+// members per zset, percent of the members in the counted score range
+void BM_ZCount(benchmark::State& state) {
+  const std::string tag = "zcount" + std::to_string(state.range(0));
+  bench::KeyGenerator keys(tag + "_", 16, kNumZsets);
+  FillZsets(tag, keys, state.range(0));
+  const double width = state.range(0) * state.range(1) / 100.0;
+  std::mt19937_64 rng(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::uniform_real_distribution<double> min(0, state.range(0) - width);
+  int32_t count = 0;
+  for (auto _ : state) {
+    double from = min(rng);
+    if (!bench::CheckStatus(
+          state, DB()->ZCount(keys.Next(), from, from + width, &count))) {
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ZCount)
+  ->ArgNames({"members", "percent"})
+  ->ArgsProduct({{100, 10000}, {1, 50}})
+  ->ThreadRange(1, 8)
+  ->UseRealTime();
+
+}  // namespace
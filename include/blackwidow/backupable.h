@@ -0,0 +1,93 @@
+#pragma once
+
+#include "blackwidow/blackwidow.h"
+#include "rocksdb/rate_limiter.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace blackwidow {
+
+struct BackupOptions {
+  // Limits the bytes copied per second by backups and restores, 0 means no
+  // limit.
+  uint64_t rate_bytes_per_sec = 0;
+  // Syncs every copied file.
+  bool sync = true;
+};
+
+struct BackupInfo {
+  uint32_t backup_id = 0;
+  // Unix time the backup was taken.
+  int64_t timestamp = 0;
+  // Bytes and files of the backup, ssts shared with others included.
+  uint64_t size = 0;
+  uint32_t number_files = 0;
+  // Bytes copied by the backup, the ssts no earlier backup had and the
+  // other files.
+  uint64_t new_bytes = 0;
+};
+
+// Incremental backups of a BlackWidow db. Every backup is a consistent
+// checkpoint (BlackWidow::CreateCheckpoint) whose ssts are copied only if
+// no earlier backup has them, ssts never change once written:
+//
+//   <backup_dir>/shared/<db>/<sst number>_<size>_<crc32c>.sst
+//   <backup_dir>/<backup_id>/<db>/...  the other files of the checkpoint
+//   <backup_dir>/<backup_id>/FILES     every file of the backup and its
+//                                      crc32c, checked by the restore
+//   <backup_dir>/<backup_id>/META      written last, marks it complete
+//   <backup_dir>/checkpoint/           while a backup is taken
+//
+// <db> is the type name, or ALL_DB in unified mode.
+class BackupEngine {
+ public:
+  explicit BackupEngine(const std::string& backup_dir,
+                        const BackupOptions& options = BackupOptions());
+  ~BackupEngine();
+
+  BackupEngine(const BackupEngine&) = delete;
+  BackupEngine& operator=(const BackupEngine&) = delete;
+
+  // Loads the complete backups of `backup_dir`, creating it if missing.
+  Status Open();
+  // The checkpoint is taken under `backup_dir`, its ssts are hard links if
+  // that is on the filesystem of `db`, and removed once copied.
+  Status CreateNewBackup(BlackWidow* db, BackupInfo* info = nullptr);
+  // Oldest first.
+  void GetBackupInfo(std::vector<BackupInfo>* infos) const;
+  // Deletes all but the newest `num_backups_to_keep` backups, the
+  // incomplete ones and the ssts no backup uses any more.
+  Status PurgeOldBackups(uint32_t num_backups_to_keep);
+  // Rebuilds the db of `backup_id` at `db_path`, which must not exist.
+  Status RestoreBackup(uint32_t backup_id, const std::string& db_path);
+
+ private:
+  struct BackupFile {
+    // Relative to the db path, e.g. strings/000012.sst.
+    std::string path;
+    uint64_t size;
+    uint32_t checksum = 0;
+  };
+
+  std::string BackupPath(uint32_t backup_id) const;
+  // The shared copy of a sst.
+  std::string SharedPath(const BackupFile& file) const;
+  // Copies `src` to `dst` and returns the crc32c of the bytes, an empty
+  // `dst` only reads `src` for its checksum.
+  Status CopyFile(const std::string& src, const std::string& dst,
+                  uint64_t* size, uint32_t* checksum);
+  Status LoadBackup(uint32_t backup_id, std::vector<BackupFile>* files,
+                    BackupInfo* info) const;
+
+  const std::string backup_dir_;
+  const BackupOptions options_;
+  rocksdb::Env* const env_;
+  std::unique_ptr<rocksdb::RateLimiter> rate_limiter_;
+  std::map<uint32_t, BackupInfo> backups_;
+};
+
+}  // namespace blackwidow
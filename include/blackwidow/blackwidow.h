@@ -1,18 +1,26 @@
 #pragma once
 
+#include <pthread.h>
+#include <atomic>
+#include <functional>
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <queue>
 #include <string>
 #include <unistd.h>  // NOTE
 #include <vector>
 #include "rocksdb/convenience.h"
+#include "rocksdb/db.h"
 #include "rocksdb/filter_policy.h"
 #include "rocksdb/options.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/status.h"
 #include "rocksdb/table.h"
 
+#include "blackwidow/db_checkpoint.h"
+
 namespace blackwidow {
 
 const double ZSET_SCORE_MAX = std::numeric_limits<double>::max();
@@ -49,26 +57,108 @@ class RedisStrings;
 class RedisHashes;
 class RedisSets;
 class RedisLists;
-class RedisZSets;
+class RedisZsets;
+class Redis;
+class RecoveryProgressWalFilter;
 class HyperLogLog;
 enum class OptionType;
 
 template <typename T1, typename T2>
 class LRUCache;
 
+// Progress of the recovery of one db in BlackWidow::Open.
+struct RecoveryProgress {
+  // STRINGS_DB ..., or ALL_DB in unified mode.
+  std::string type;
+  // The db is open, reported once at the end.
+  bool done = false;
+  // WAL replayed so far, in records and write batch bytes.
+  uint64_t wal_records = 0;
+  uint64_t wal_bytes = 0;
+  // Live ssts of the db, only known when done.
+  uint64_t sst_files = 0;
+  uint64_t elapsed_micros = 0;
+};
+
+// Called from the threads opening the dbs, possibly at the same time.
+using RecoveryProgressCallback = std::function<void(const RecoveryProgress&)>;
+
 struct BlackWidowOptions {
   rocksdb::Options options;
   rocksdb::BlockBasedTableOptions table_options;
+  // Capacity of the block cache of every column family, or of the single
+  // block cache of all types when share_block_cache is set.
   size_t block_cache_size;
   bool share_block_cache;
+  // Memtable memory of all types together, 0 disables it. Writes stall
+  // when it is reached. With share_block_cache the memtables are also
+  // charged to the shared block cache, block_cache_size then bounds blocks
+  // and memtables together.
+  size_t write_buffer_manager_size;
+  // Flush and compaction write rate of all types together, 0 disables it.
+  int64_t rate_bytes_per_sec;
   size_t statistics_max_size;
   size_t small_compaction_threshold;
+  // HSet on an existing hash writes the field without reading the old value
+  // when the bloom filter rules the field out, and without comparing it
+  // when it exists. The field count stays exact.
+  bool hashes_fast_hset;
+  // A strings compaction above the bottommost level where at least this
+  // fraction of the input records were overwritten versions marks its key
+  // range to be compacted down, so the old versions of hot keys do not
+  // linger in the lower levels. 0 disables it.
+  double strings_overwrite_compaction_ratio;
+  // Minimum seconds between two such marked ranges.
+  int64_t strings_overwrite_compaction_interval;
+  // Strings values of at least this many bytes are stored as a meta record
+  // and chunks of strings_chunk_size bytes, so SetBit and Append rewrite
+  // only the chunks they touch. 0 disables it.
+  uint64_t strings_chunk_threshold;
+  uint32_t strings_chunk_size;
+  // Every this many seconds the background thread compacts the meta ssts
+  // whose ttl values are all expired and make up at least
+  // expired_files_ratio of the sst. 0 disables it.
+  int64_t expired_files_compaction_interval;
+  double expired_files_ratio;
+  // Hosts all types as column families of a single db, with one WAL and
+  // one set of memtables and background threads. db_write_buffer_size of
+  // `options` then bounds the memtables of all types together. A db must
+  // be reopened in the mode it was created in.
+  bool unified_db;
+  // Reports the recovery of every db every recovery_progress_interval
+  // bytes of replayed WAL, and when it is done.
+  RecoveryProgressCallback recovery_progress_callback;
+  uint64_t recovery_progress_interval;
+  // Threads opening the ssts of one db on open. 0 keeps
+  // options.max_file_opening_threads, or splits the cpus among the dbs
+  // opened in parallel if that is the rocksdb default.
+  int max_file_opening_threads;
+  // Counts, times and sizes every command per thread, see
+  // BlackWidow::GetStats.
+  bool command_stats;
+  // Also counts the blocks every command reads from the ssts. Turns on the
+  // rocksdb perf context counters of the threads running commands.
+  bool command_stats_block_reads;
 
   explicit BlackWidowOptions()
       : block_cache_size(0),
         share_block_cache(false),
+        write_buffer_manager_size(0),
+        rate_bytes_per_sec(0),
         statistics_max_size(0),
-        small_compaction_threshold(5000) {}
+        small_compaction_threshold(5000),
+        hashes_fast_hset(false),
+        strings_overwrite_compaction_ratio(0.5),
+        strings_overwrite_compaction_interval(60),
+        strings_chunk_threshold(1024 * 1024),
+        strings_chunk_size(64 * 1024),
+        expired_files_compaction_interval(300),
+        expired_files_ratio(0.5),
+        unified_db(false),
+        recovery_progress_interval(64 * 1024 * 1024),
+        max_file_opening_threads(0),
+        command_stats(true),
+        command_stats_block_reads(false) {}
 
   Status ResetOptions(const OptionType& option_type,
                       const std::unordered_map<std::string, std::string>& options_map);
@@ -129,6 +219,18 @@ struct ScoreMember {
   }
 };
 
+// The whole value of a hash key, input of a bulk load.
+struct KeyFieldValues {
+  std::string key;
+  std::vector<FieldValue> fvs;
+};
+
+// The whole value of a zset key, input of a bulk load.
+struct KeyScoreMembers {
+  std::string key;
+  std::vector<ScoreMember> score_members;
+};
+
 enum BeforeOrAfter {
   Before,
   After
@@ -177,6 +279,33 @@ enum BitOpType {
   kBitOpDefault
 };
 
+enum BitFieldOverflow {
+  kBitFieldWrap,
+  kBitFieldSat,
+  kBitFieldFail
+};
+
+// One GET, SET or INCRBY of BITFIELD, on the i<bits> (1 - 64) or u<bits>
+// (1 - 63) integer starting at bit `offset`.
+struct BitFieldOp {
+  enum Type { kGet, kSet, kIncrBy };
+  Type type = kGet;
+  bool is_signed = true;
+  int bits = 8;
+  uint64_t offset = 0;
+  // The new value of kSet, the increment of kIncrBy.
+  int64_t value = 0;
+  BitFieldOverflow overflow = kBitFieldWrap;
+};
+
+struct BitFieldResult {
+  // The value read by kGet, the old value of kSet, the new one of kIncrBy.
+  int64_t value = 0;
+  // The operation overflowed under kBitFieldFail and changed nothing,
+  // redis replies nil.
+  bool failed = false;
+};
+
 enum Operation {
   kNone = 0,
   kCleanAll,
@@ -195,6 +324,59 @@ enum Operation {
 #define O_M_LOGN
 
 
+// Usage of one column family, or the sum of those of a type, see
+// BlackWidow::GetUsage.
+struct ColumnFamilyUsage {
+  // Memtables, also the ones waiting for flush.
+  uint64_t memtables = 0;
+  // Index and filter blocks held outside the block cache.
+  uint64_t table_readers = 0;
+  // The block cache of the column family, possibly shared with others.
+  uint64_t block_cache = 0;
+  uint64_t block_cache_pinned = 0;
+  // Estimated bytes compactions still have to rewrite.
+  uint64_t pending_compaction_bytes = 0;
+  uint64_t live_sst_size = 0;
+  // Of the whole db, the column families of a db report the same count.
+  uint64_t background_errors = 0;
+};
+
+struct EngineUsage {
+  // By column family name.
+  std::map<std::string, ColumnFamilyUsage> column_families;
+  // The sum of the column families. block_cache only counts the caches of
+  // this type, as in MemoryUsage, and the background errors of the db are
+  // counted once.
+  ColumnFamilyUsage total;
+};
+
+struct MemoryUsage {
+  // Memtables, also the ones waiting for flush.
+  uint64_t memtables = 0;
+  // Index and filter blocks held outside the block cache.
+  uint64_t table_readers = 0;
+  // Block caches, in use and pinned by readers.
+  uint64_t block_cache = 0;
+  uint64_t block_cache_pinned = 0;
+};
+
+// One command summed over all threads, see BlackWidow::GetStats.
+struct CommandStats {
+  uint64_t count = 0;
+  // Failed commands, NotFound is not a failure.
+  uint64_t errors = 0;
+  // Keys, fields and values passed in, and values returned.
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+  // Blocks read from the ssts, with command_stats_block_reads only.
+  uint64_t block_reads = 0;
+  uint64_t total_micros = 0;
+  uint64_t p50_micros = 0;
+  uint64_t p99_micros = 0;
+  uint64_t p999_micros = 0;
+  uint64_t max_micros = 0;
+};
+
 struct BGTask {
   DataType type;
   Operation operation;
@@ -212,6 +394,57 @@ public:
 
  Status Open(const BlackWidowOptions& bw_options, const std::string& dbpath);
 
+    // Runs `task` in the background thread.
+    Status AddBGTask(const BGTask& task);
+    // Compacts the mostly expired meta ssts of every type, see
+    // Redis::CompactExpiredFiles.
+    Status CompactExpiredFiles(uint64_t* compacted_files);
+    // Memory of every type by name (STRINGS_DB ...), the shared block cache
+    // is only counted in `total`, without the memtables a write buffer
+    // manager charges to it.
+    Status GetMemoryUsage(std::map<std::string, MemoryUsage>* usages,
+                          MemoryUsage* total);
+    // Usage of every type by name (STRINGS_DB ...) and of its column
+    // families, read through integer properties without parsing.
+    Status GetUsage(std::map<std::string, EngineUsage>* usages);
+    // Microseconds the last Open took per type name (STRINGS_DB ...), or
+    // for ALL_DB in unified mode.
+    void GetOpenMicros(std::map<std::string, uint64_t>* open_micros) const;
+    // The commands run since Open by type name (STRINGS_DB ...) and
+    // command name ("GET" ...), see BlackWidowOptions::command_stats.
+    Status GetStats(
+      std::map<std::string, std::map<std::string, CommandStats>>* stats);
+    // Keeps the traces up to `level` in memory: 0 none, 1 errors, 2 info,
+    // 3 debug, 4 every compacted record. The per record traces are kept one
+    // in `sampling` per thread.
+    void SetTraceLevel(int level, uint32_t sampling = 1);
+    // The traces kept so far, oldest first.
+    void GetTraces(std::vector<std::string>* traces) const;
+    // Replace the given keys with ssts built from them and ingested at
+    // once, for initial loads and migrations. The last value of a key or a
+    // field given twice wins, the input is sorted in place.
+    Status BulkLoadStrings(std::vector<KeyValue>* kvs);
+    Status BulkLoadHashes(std::vector<KeyFieldValues>* kfvs);
+    Status BulkLoadZsets(std::vector<KeyScoreMembers>* ksms);
+    // Takes a checkpoint of every db into `dir`, which must not exist. The
+    // writes to all dbs are paused while their checkpoints are taken side
+    // by side, so they hold the same commands; the ssts are hard links.
+    Status CreateCheckpoint(const std::string& dir,
+                            CheckpointInfo* info = nullptr);
+    const std::string& GetDBPath() const {
+      return dbpath_;
+    }
+
+    // Keys Commands, on every type holding the key
+
+    // Deletes `keys` from every type, `count` is the number of keys that
+    // were held by some type.
+    Status Del(const std::vector<std::string>& keys, int64_t* count);
+    // The number of `keys` held by some type, a key given twice counts
+    // twice.
+    Status Exists(const std::vector<std::string>& keys, int64_t* count);
+    // Sets the ttl of `key` in every type holding it, NotFound if none does.
+    Status Expire(const Slice& key, int32_t ttl);
 
     // Strings Commands
 
@@ -222,12 +455,42 @@ public:
     // ...
 
 private:
+    // Opens every type in a db of its own under `dbpath`, the WAL of each
+    // db is replayed in a thread of its own.
+    Status OpenSeparate(const BlackWidowOptions& bw_options,
+                        const std::string& dbpath);
+    // Opens all types as column families of one db at `dbpath`.
+    Status OpenUnified(const BlackWidowOptions& bw_options,
+                       const std::string& dbpath);
+    static void* StartBGThreadWrapper(void* arg);
+    Status StartBGThread();
+    Status RunBGTask();
+    Status DoCompact(const DataType& type);
+    // The created engines with their type names.
+    std::vector<std::pair<Redis*, std::string>> Engines() const;
+
     RedisStrings* strings_db_;
     RedisHashes* hashes_db_;
     RedisSets* sets_db_;
-    RedisZSets* zsets_db_;
+    RedisZsets* zsets_db_;
     RedisLists* lists_db_;
     std::atomic_bool is_opened_;
+    // Shared by all types, see BlackWidowOptions.
+    std::shared_ptr<rocksdb::Cache> block_cache_;
+    std::shared_ptr<rocksdb::WriteBufferManager> write_buffer_manager_;
+    std::shared_ptr<rocksdb::RateLimiter> rate_limiter_;
+    // The db shared by all types in unified mode.
+    rocksdb::DB* db_;
+    std::vector<rocksdb::ColumnFamilyHandle*> handles_;
+    std::map<std::string, uint64_t> open_micros_;
+    std::string dbpath_;
+    // One checkpoint at a time, see WriteGate.
+    std::mutex checkpoint_mutex_;
+    // Referenced by the options of the dbs, kept for their lifetime.
+    std::vector<std::unique_ptr<RecoveryProgressWalFilter>> recovery_filters_;
+
+    int64_t expired_files_compaction_interval_;
+    double expired_files_ratio_;
 
     LRUCache<std::string, std::string>* cursors_store_;
 
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace blackwidow {
+
+// What BlackWidow::CreateCheckpoint took. The checkpoint directory has the
+// layout of a db path and is opened with BlackWidow::Open.
+struct CheckpointInfo {
+  // Sub directories of the dbs in the checkpoint, the type names (STRINGS_DB
+  // ...), or "" for the db of the unified mode.
+  std::vector<std::string> dbs;
+  // Last sequence number of every db in the checkpoint.
+  std::vector<uint64_t> sequences;
+  // Microseconds the writes were paused, 0 in unified mode where one db
+  // checkpoint is consistent by itself.
+  uint64_t pause_micros = 0;
+};
+
+}  // namespace blackwidow
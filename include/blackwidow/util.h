@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
 #include <sys/time.h>
 
 namespace blackwidow {
@@ -18,4 +20,17 @@ int StringMatch(const char* pattern,
                 int string_len,
                 int nocase);
 
+// Parses the whole of `s` as a decimal int64, returns -1 on any garbage or
+// overflow.
+int StrToInt64(const char* s, size_t slen, int64_t* value);
+
+// Parses the whole of `s` as a long double, returns -1 on garbage, nan or
+// inf.
+int StrToLongDouble(const char* s, size_t slen, long double* ldval);
+
+// Formats like redis INCRBYFLOAT does: fixed point with 17 digits after
+// the dot ("%.17Lf"), then the trailing zeros and a dangling dot are cut.
+// Returns -1 for nan, inf and numbers too long for a 5 KB buffer.
+int LongDoubleToStr(long double ldval, std::string* value);
+
 }  // namespace blackwidow
\ No newline at end of file
@@ -0,0 +1,434 @@
+#include "blackwidow/backupable.h"
+#include "crc32c.h"
+
+#include "rocksdb/env.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <sstream>
+
+namespace blackwidow {
+
+namespace {
+
+const size_t kCopyBufferSize = 1024 * 1024;
+// Under the backup dir, the checkpoint ssts are hard links when it is on the
+// filesystem of the db and copies otherwise.
+const std::string kCheckpointDir = "checkpoint";
+const std::string kSharedDir = "shared";
+const std::string kFilesName = "FILES";
+const std::string kMetaName = "META";
+
+std::string JoinPath(const std::string& dir, const std::string& name) {
+  if (name.empty()) {
+    return dir;
+  }
+  if (dir.empty()) {
+    return name;
+  }
+  return dir.back() == '/' ? dir + name : dir + "/" + name;
+}
+
+bool IsSstFile(const std::string& name) {
+  return rocksdb::Slice(name).ends_with(".sst");
+}
+
+bool IsBackupId(const std::string& name) {
+  return !name.empty() &&
+         name.find_first_not_of("0123456789") == std::string::npos;
+}
+
+Status DeleteDirRecursively(rocksdb::Env* env, const std::string& dir) {
+  std::vector<std::string> children;
+  Status s = env->GetChildren(dir, &children);
+  if (!s.ok()) {
+    return s;
+  }
+  for (const auto& child : children) {
+    if (child == "." || child == "..") {
+      continue;
+    }
+    std::string path = JoinPath(dir, child);
+    bool is_dir = false;
+    if (env->IsDirectory(path, &is_dir).ok() && is_dir) {
+      s = DeleteDirRecursively(env, path);
+    } else {
+      s = env->DeleteFile(path);
+    }
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return env->DeleteDir(dir);
+}
+
+}  // namespace
+
+BackupEngine::BackupEngine(const std::string& backup_dir,
+                           const BackupOptions& options)
+  : backup_dir_(backup_dir),
+    options_(options),
+    env_(rocksdb::Env::Default()) {
+  if (options_.rate_bytes_per_sec > 0) {
+    rate_limiter_.reset(
+      rocksdb::NewGenericRateLimiter(options_.rate_bytes_per_sec));
+  }
+}
+
+BackupEngine::~BackupEngine() {}
+
+Status BackupEngine::Open() {
+  backups_.clear();
+  Status s = env_->CreateDirIfMissing(backup_dir_);
+  if (s.ok()) {
+    s = env_->CreateDirIfMissing(JoinPath(backup_dir_, kSharedDir));
+  }
+  std::vector<std::string> children;
+  if (s.ok()) {
+    s = env_->GetChildren(backup_dir_, &children);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  for (const auto& name : children) {
+    if (!IsBackupId(name)) {
+      continue;
+    }
+    uint32_t backup_id = std::strtoul(name.c_str(), nullptr, 10);
+    std::vector<BackupFile> files;
+    BackupInfo info;
+    // A backup without META was interrupted, PurgeOldBackups removes it.
+    if (LoadBackup(backup_id, &files, &info).ok()) {
+      backups_[backup_id] = info;
+    }
+  }
+  return Status::OK();
+}
+
+Status BackupEngine::CreateNewBackup(BlackWidow* db, BackupInfo* info) {
+  const std::string checkpoint_dir = JoinPath(backup_dir_, kCheckpointDir);
+  if (env_->FileExists(checkpoint_dir).ok()) {
+    // Left over by an interrupted backup.
+    DeleteDirRecursively(env_, checkpoint_dir);
+  }
+  CheckpointInfo checkpoint;
+  Status s = db->CreateCheckpoint(checkpoint_dir, &checkpoint);
+  if (!s.ok()) {
+    return s;
+  }
+
+  BackupInfo backup;
+  backup.backup_id = backups_.empty() ? 1 : backups_.rbegin()->first + 1;
+  env_->GetCurrentTime(&backup.timestamp);
+  const std::string backup_path = BackupPath(backup.backup_id);
+  if (env_->FileExists(backup_path).ok()) {
+    DeleteDirRecursively(env_, backup_path);
+  }
+  s = env_->CreateDir(backup_path);
+
+  std::vector<BackupFile> files;
+  for (size_t i = 0; s.ok() && i < checkpoint.dbs.size(); i++) {
+    const std::string& db_name = checkpoint.dbs[i];
+    const std::string src_dir = JoinPath(checkpoint_dir, db_name);
+    s = env_->CreateDirIfMissing(
+      JoinPath(JoinPath(backup_dir_, kSharedDir),
+               db_name.empty() ? ALL_DB : db_name));
+    if (s.ok() && !db_name.empty()) {
+      s = env_->CreateDir(JoinPath(backup_path, db_name));
+    }
+    std::vector<std::string> children;
+    if (s.ok()) {
+      s = env_->GetChildren(src_dir, &children);
+    }
+    std::sort(children.begin(), children.end());
+    for (const auto& name : children) {
+      if (!s.ok()) {
+        break;
+      }
+      if (name == "." || name == "..") {
+        continue;
+      }
+      BackupFile file;
+      file.path = JoinPath(db_name, name);
+      s = env_->GetFileSize(JoinPath(src_dir, name), &file.size);
+      if (!s.ok()) {
+        break;
+      }
+      uint64_t copied = 0;
+      if (!IsSstFile(name)) {
+        s = CopyFile(JoinPath(src_dir, name),
+                     JoinPath(backup_path, file.path), &copied,
+                     &file.checksum);
+      } else {
+        // The checksum is part of the shared name, a sst of a recreated db
+        // with the same number and size is not taken for this one.
+        uint64_t size = 0;
+        s = CopyFile(JoinPath(src_dir, name), "", &size, &file.checksum);
+        if (!s.ok()) {
+          break;
+        }
+        const std::string shared_path = SharedPath(file);
+        if (!env_->FileExists(shared_path).ok()) {
+          // Renamed once complete, an interrupted copy is never shared.
+          uint32_t checksum = 0;
+          s = CopyFile(JoinPath(src_dir, name), shared_path + ".tmp", &copied,
+                       &checksum);
+          if (s.ok() && checksum != file.checksum) {
+            s = Status::Corruption("checksum mismatch", file.path);
+          }
+          if (s.ok()) {
+            s = env_->RenameFile(shared_path + ".tmp", shared_path);
+          }
+        }
+      }
+      backup.new_bytes += copied;
+      backup.size += file.size;
+      backup.number_files++;
+      files.push_back(file);
+    }
+  }
+
+  if (s.ok()) {
+    std::string list;
+    for (const auto& file : files) {
+      list += file.path + " " + std::to_string(file.size) + " " +
+              std::to_string(file.checksum) + "\n";
+    }
+    s = rocksdb::WriteStringToFile(
+      env_, list, JoinPath(backup_path, kFilesName), options_.sync);
+  }
+  if (s.ok()) {
+    std::string meta = std::to_string(backup.timestamp) + " " +
+                       std::to_string(backup.size) + " " +
+                       std::to_string(backup.number_files) + " " +
+                       std::to_string(backup.new_bytes) + "\n";
+    s = rocksdb::WriteStringToFile(
+      env_, meta, JoinPath(backup_path, kMetaName), options_.sync);
+  }
+  DeleteDirRecursively(env_, checkpoint_dir);
+  if (!s.ok()) {
+    return s;
+  }
+  backups_[backup.backup_id] = backup;
+  if (info != nullptr) {
+    *info = backup;
+  }
+  return s;
+}
+
+void BackupEngine::GetBackupInfo(std::vector<BackupInfo>* infos) const {
+  infos->clear();
+  for (const auto& backup : backups_) {
+    infos->push_back(backup.second);
+  }
+}
+
+Status BackupEngine::PurgeOldBackups(uint32_t num_backups_to_keep) {
+  Status s;
+  while (backups_.size() > num_backups_to_keep) {
+    s = DeleteDirRecursively(env_, BackupPath(backups_.begin()->first));
+    if (!s.ok()) {
+      return s;
+    }
+    backups_.erase(backups_.begin());
+  }
+
+  // The ssts still used, a backup that can not be read keeps them all.
+  std::set<std::string> live_ssts;
+  for (const auto& backup : backups_) {
+    std::vector<BackupFile> files;
+    BackupInfo info;
+    s = LoadBackup(backup.first, &files, &info);
+    if (!s.ok()) {
+      return s;
+    }
+    for (const auto& file : files) {
+      if (IsSstFile(file.path)) {
+        live_ssts.insert(SharedPath(file));
+      }
+    }
+  }
+
+  std::vector<std::string> children;
+  s = env_->GetChildren(backup_dir_, &children);
+  for (const auto& name : children) {
+    if (!s.ok()) {
+      return s;
+    }
+    if (IsBackupId(name) &&
+        backups_.find(std::strtoul(name.c_str(), nullptr, 10)) ==
+          backups_.end()) {
+      s = DeleteDirRecursively(env_, JoinPath(backup_dir_, name));
+    }
+  }
+
+  const std::string shared_dir = JoinPath(backup_dir_, kSharedDir);
+  std::vector<std::string> db_names;
+  if (s.ok()) {
+    s = env_->GetChildren(shared_dir, &db_names);
+  }
+  for (const auto& db_name : db_names) {
+    if (db_name == "." || db_name == "..") {
+      continue;
+    }
+    std::vector<std::string> ssts;
+    s = env_->GetChildren(JoinPath(shared_dir, db_name), &ssts);
+    for (const auto& sst : ssts) {
+      if (!s.ok()) {
+        return s;
+      }
+      const std::string path = JoinPath(JoinPath(shared_dir, db_name), sst);
+      if (sst != "." && sst != ".." &&
+          live_ssts.find(path) == live_ssts.end()) {
+        s = env_->DeleteFile(path);
+      }
+    }
+  }
+  return s;
+}
+
+Status BackupEngine::RestoreBackup(uint32_t backup_id,
+                                   const std::string& db_path) {
+  if (backups_.find(backup_id) == backups_.end()) {
+    return Status::NotFound("backup", std::to_string(backup_id));
+  }
+  if (env_->FileExists(db_path).ok()) {
+    return Status::InvalidArgument(db_path, "already exists");
+  }
+  std::vector<BackupFile> files;
+  BackupInfo info;
+  Status s = LoadBackup(backup_id, &files, &info);
+  if (s.ok()) {
+    s = env_->CreateDir(db_path);
+  }
+  for (const auto& file : files) {
+    if (!s.ok()) {
+      break;
+    }
+    size_t slash = file.path.rfind('/');
+    if (slash != std::string::npos) {
+      s = env_->CreateDirIfMissing(
+        JoinPath(db_path, file.path.substr(0, slash)));
+    }
+    uint64_t size = 0;
+    uint32_t checksum = 0;
+    if (s.ok()) {
+      s = CopyFile(IsSstFile(file.path)
+                     ? SharedPath(file)
+                     : JoinPath(BackupPath(backup_id), file.path),
+                   JoinPath(db_path, file.path), &size, &checksum);
+    }
+    if (s.ok() && size != file.size) {
+      s = Status::Corruption("size mismatch", file.path);
+    }
+    if (s.ok() && checksum != file.checksum) {
+      s = Status::Corruption("checksum mismatch", file.path);
+    }
+  }
+  return s;
+}
+
+std::string BackupEngine::BackupPath(uint32_t backup_id) const {
+  return JoinPath(backup_dir_, std::to_string(backup_id));
+}
+
+std::string BackupEngine::SharedPath(const BackupFile& file) const {
+  size_t slash = file.path.rfind('/');
+  std::string db_name =
+    slash == std::string::npos ? ALL_DB : file.path.substr(0, slash);
+  std::string name =
+    slash == std::string::npos ? file.path : file.path.substr(slash + 1);
+  // The number is reused by a db that was created again, the size and the
+  // checksum tell its ssts apart.
+  name = name.substr(0, name.size() - 4) + "_" + std::to_string(file.size) +
+         "_" + std::to_string(file.checksum) + ".sst";
+  return JoinPath(JoinPath(JoinPath(backup_dir_, kSharedDir), db_name), name);
+}
+
+Status BackupEngine::CopyFile(const std::string& src,
+                              const std::string& dst,
+                              uint64_t* size,
+                              uint32_t* checksum) {
+  *size = 0;
+  *checksum = 0;
+  rocksdb::EnvOptions env_options;
+  std::unique_ptr<rocksdb::SequentialFile> src_file;
+  std::unique_ptr<rocksdb::WritableFile> dst_file;
+  Status s = env_->NewSequentialFile(src, &src_file, env_options);
+  if (s.ok() && !dst.empty()) {
+    s = env_->NewWritableFile(dst, &dst_file, env_options);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+
+  size_t buffer_size = kCopyBufferSize;
+  if (rate_limiter_ != nullptr) {
+    buffer_size = std::min<size_t>(buffer_size,
+                                   rate_limiter_->GetSingleBurstBytes());
+  }
+  std::unique_ptr<char[]> buffer(new char[buffer_size]);
+  while (true) {
+    rocksdb::Slice data;
+    s = src_file->Read(buffer_size, &data, buffer.get());
+    if (!s.ok() || data.size() == 0) {
+      break;
+    }
+    if (rate_limiter_ != nullptr) {
+      rate_limiter_->Request(data.size(), rocksdb::Env::IO_LOW, nullptr);
+    }
+    if (dst_file != nullptr) {
+      s = dst_file->Append(data);
+      if (!s.ok()) {
+        break;
+      }
+    }
+    *checksum = crc32c::Extend(*checksum, data.data(), data.size());
+    *size += data.size();
+  }
+  if (dst_file == nullptr) {
+    return s;
+  }
+  if (s.ok() && options_.sync) {
+    s = dst_file->Sync();
+  }
+  if (s.ok()) {
+    s = dst_file->Close();
+  }
+  return s;
+}
+
+Status BackupEngine::LoadBackup(uint32_t backup_id,
+                                std::vector<BackupFile>* files,
+                                BackupInfo* info) const {
+  std::string meta, list;
+  Status s = rocksdb::ReadFileToString(
+    env_, JoinPath(BackupPath(backup_id), kMetaName), &meta);
+  if (s.ok()) {
+    s = rocksdb::ReadFileToString(
+      env_, JoinPath(BackupPath(backup_id), kFilesName), &list);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+
+  info->backup_id = backup_id;
+  std::istringstream meta_in(meta);
+  if (!(meta_in >> info->timestamp >> info->size >> info->number_files >>
+        info->new_bytes)) {
+    return Status::Corruption("bad backup meta", BackupPath(backup_id));
+  }
+  files->clear();
+  std::istringstream list_in(list);
+  BackupFile file;
+  while (list_in >> file.path >> file.size >> file.checksum) {
+    files->push_back(file);
+  }
+  if (files->size() != info->number_files) {
+    return Status::Corruption("bad backup files", BackupPath(backup_id));
+  }
+  return Status::OK();
+}
+
+}  // namespace blackwidow
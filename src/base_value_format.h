@@ -23,7 +23,7 @@ class InternalValue {
   }
 
   void set_timestamp(int32_t timestamp = 0) {
-    timestamp = timestamp;
+    timestamp_ = timestamp;
   }
 
   void SetRelativeTimestamp(int32_t ttl) {
@@ -131,6 +131,12 @@ class ParsedInternalValue {
 
   virtual void StripSuffix() = 0;
 
+  // Whether records in other column families belong to this value, see
+  // MetaLookupCache.
+  virtual bool HasDataRecords() const {
+    return true;
+  }
+
  protected:
   virtual void SetVersionToValue() = 0;
   virtual void SetTimestampToValue()=0;
@@ -0,0 +1,557 @@
+#include "blackwidow/blackwidow.h"
+#include "mutex_impl.h"
+#include "recovery_progress.h"
+#include "redis_hashes.h"
+#include "redis_lists.h"
+#include "redis_strings.h"
+#include "redis_zsets.h"
+#include "trace.h"
+
+#include "rocksdb/cache.h"
+#include "rocksdb/env.h"
+#include "rocksdb/rate_limiter.h"
+#include "rocksdb/write_buffer_manager.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace blackwidow {
+
+// Field ttl index entries walked per RedisHashes::SweepExpiredFields call of
+// the background thread.
+static constexpr uint32_t kFieldSweepBatch = 1024;
+
+static std::string AppendSubDirectory(const std::string& db_path,
+                                      const std::string& sub_db) {
+  if (db_path.back() == '/') {
+    return db_path + sub_db;
+  } else {
+    return db_path + "/" + sub_db;
+  }
+}
+
+BlackWidow::BlackWidow()
+    : strings_db_(nullptr),
+      hashes_db_(nullptr),
+      sets_db_(nullptr),
+      zsets_db_(nullptr),
+      lists_db_(nullptr),
+      is_opened_(false),
+      db_(nullptr),
+      expired_files_compaction_interval_(0),
+      expired_files_ratio_(0),
+      cursors_store_(nullptr),
+      bg_tasks_thread_id(0),
+      current_task_type_(kNone),
+      bg_tasks_should_exit_(false),
+      scan_keynum_exit_(false) {
+  std::shared_ptr<MutexFactory> factory = std::make_shared<MutexFactoryImpl>();
+  bg_tasks_mutex_ = factory->AllocateMutex();
+  bg_tasks_cond_var_ = factory->AllocateCondVar();
+}
+
+BlackWidow::~BlackWidow() {
+  bg_tasks_should_exit_ = true;
+  if (bg_tasks_thread_id != 0) {
+    bg_tasks_mutex_->Lock();
+    bg_tasks_cond_var_->NotifyAll();
+    bg_tasks_mutex_->UnLock();
+    pthread_join(bg_tasks_thread_id, nullptr);
+  }
+
+  delete strings_db_;
+  delete hashes_db_;
+  delete zsets_db_;
+  delete lists_db_;
+
+  // The engines only borrowed the shared db.
+  for (auto handle : handles_) {
+    db_->DestroyColumnFamilyHandle(handle);
+  }
+  delete db_;
+}
+
+Status BlackWidow::Open(const BlackWidowOptions& options,
+                        const std::string& dbpath) {
+  // Every engine opens with the shared objects.
+  BlackWidowOptions bw_options(options);
+  if (bw_options.share_block_cache && bw_options.block_cache_size > 0) {
+    block_cache_ = rocksdb::NewLRUCache(bw_options.block_cache_size);
+    bw_options.table_options.block_cache = block_cache_;
+  }
+  if (bw_options.write_buffer_manager_size > 0) {
+    // Charged to the shared block cache, if any. Writes stall instead of
+    // going over the limit either way.
+    write_buffer_manager_ = std::make_shared<rocksdb::WriteBufferManager>(
+      bw_options.write_buffer_manager_size, block_cache_, true);
+    bw_options.options.write_buffer_manager = write_buffer_manager_;
+  }
+  if (bw_options.rate_bytes_per_sec > 0) {
+    rate_limiter_.reset(
+      rocksdb::NewGenericRateLimiter(bw_options.rate_bytes_per_sec));
+    bw_options.options.rate_limiter = rate_limiter_;
+  }
+
+  strings_db_ = new RedisStrings(this);
+  hashes_db_ = new RedisHashes(this);
+  lists_db_ = new RedisLists(this);
+  zsets_db_ = new RedisZsets(this);
+
+  dbpath_ = dbpath;
+  // The filters of an earlier Open are only used while its dbs recover.
+  recovery_filters_.clear();
+  Status s = bw_options.unified_db ? OpenUnified(bw_options, dbpath)
+                                   : OpenSeparate(bw_options, dbpath);
+  if (!s.ok()) {
+    return s;
+  }
+
+  expired_files_compaction_interval_ =
+    bw_options.expired_files_compaction_interval;
+  expired_files_ratio_ = bw_options.expired_files_ratio;
+  is_opened_.store(true);
+  return StartBGThread();
+}
+
+Status BlackWidow::OpenSeparate(const BlackWidowOptions& bw_options,
+                                const std::string& dbpath) {
+  Status s = rocksdb::Env::Default()->CreateDirIfMissing(dbpath);
+  if (!s.ok()) {
+    return s;
+  }
+
+  // Restart time is dominated by the WAL replays, do them side by side.
+  const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+  BlackWidowOptions engine_options(bw_options);
+  if (bw_options.max_file_opening_threads > 0) {
+    engine_options.options.max_file_opening_threads =
+      bw_options.max_file_opening_threads;
+  } else if (bw_options.options.max_file_opening_threads ==
+             rocksdb::DBOptions().max_file_opening_threads) {
+    // Only split the cpus when the caller left the rocksdb default.
+    int cpus = static_cast<int>(std::thread::hardware_concurrency());
+    engine_options.options.max_file_opening_threads =
+      std::max(1, cpus / static_cast<int>(engines.size()));
+  }
+
+  std::vector<Status> results(engines.size());
+  std::vector<uint64_t> micros(engines.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < engines.size(); i++) {
+    recovery_filters_.emplace_back(new RecoveryProgressWalFilter(
+      engines[i].second, bw_options.recovery_progress_callback,
+      bw_options.recovery_progress_interval));
+  }
+  for (size_t i = 0; i < engines.size(); i++) {
+    threads.emplace_back([&, i]() {
+      BlackWidowOptions opts(engine_options);
+      opts.options.wal_filter = recovery_filters_[i].get();
+      uint64_t start = rocksdb::Env::Default()->NowMicros();
+      results[i] = engines[i].first->Open(
+        opts, AppendSubDirectory(dbpath, engines[i].second));
+      micros[i] = rocksdb::Env::Default()->NowMicros() - start;
+      if (results[i].ok()) {
+        std::vector<rocksdb::LiveFileMetaData> files;
+        engines[i].first->GetDB()->GetLiveFilesMetaData(&files);
+        recovery_filters_[i]->Finish(files.size());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (size_t i = 0; i < engines.size(); i++) {
+    open_micros_[engines[i].second] = micros[i];
+    if (!results[i].ok() && s.ok()) {
+      s = results[i];
+    }
+  }
+  return s;
+}
+
+Status BlackWidow::OpenUnified(const BlackWidowOptions& bw_options,
+                               const std::string& dbpath) {
+  // The strings keep the default cf, their other cfs and the cfs of the
+  // other types are prefixed with the type name, the meta cf of a type
+  // being <type>_meta_cf.
+  const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+
+  rocksdb::DBOptions db_opts(bw_options.options);
+  db_opts.create_missing_column_families = true;
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  // The first cf of every engine, and the end.
+  std::vector<size_t> first_cf;
+  for (const auto& engine : engines) {
+    std::vector<rocksdb::ColumnFamilyDescriptor> engine_cfs;
+    engine.first->PrepareOptions(bw_options, &db_opts, &engine_cfs);
+    first_cf.push_back(column_families.size());
+    for (auto& cf : engine_cfs) {
+      if (engine.first != strings_db_ ||
+          cf.name != rocksdb::kDefaultColumnFamilyName) {
+        cf.name = engine.second + "_" +
+                  (cf.name == rocksdb::kDefaultColumnFamilyName ? "meta_cf"
+                                                                : cf.name);
+      }
+      column_families.push_back(cf);
+    }
+  }
+  first_cf.push_back(column_families.size());
+
+  Status s = Redis::CheckColumnFamilies(db_opts, dbpath, column_families);
+  if (!s.ok()) {
+    return s;
+  }
+  if (bw_options.max_file_opening_threads > 0) {
+    db_opts.max_file_opening_threads = bw_options.max_file_opening_threads;
+  }
+  recovery_filters_.emplace_back(new RecoveryProgressWalFilter(
+    ALL_DB, bw_options.recovery_progress_callback,
+    bw_options.recovery_progress_interval));
+  db_opts.wal_filter = recovery_filters_.back().get();
+  uint64_t start = rocksdb::Env::Default()->NowMicros();
+  s = rocksdb::DB::Open(db_opts, dbpath, column_families, &handles_, &db_);
+  open_micros_[ALL_DB] = rocksdb::Env::Default()->NowMicros() - start;
+  if (!s.ok()) {
+    return s;
+  }
+  std::vector<rocksdb::LiveFileMetaData> files;
+  db_->GetLiveFilesMetaData(&files);
+  recovery_filters_.back()->Finish(files.size());
+  for (size_t i = 0; i < engines.size(); i++) {
+    engines[i].first->OpenShared(
+      db_,
+      std::vector<rocksdb::ColumnFamilyHandle*>(
+        handles_.begin() + first_cf[i], handles_.begin() + first_cf[i + 1]));
+  }
+  return s;
+}
+
+std::vector<std::pair<Redis*, std::string>> BlackWidow::Engines() const {
+  std::vector<std::pair<Redis*, std::string>> engines;
+  for (const auto& engine : {std::make_pair<Redis*>(strings_db_, STRINGS_DB),
+                             std::make_pair<Redis*>(hashes_db_, HASHES_DB),
+                             std::make_pair<Redis*>(lists_db_, LISTS_DB),
+                             std::make_pair<Redis*>(zsets_db_, ZSETS_DB)}) {
+    if (engine.first != nullptr) {
+      engines.push_back(engine);
+    }
+  }
+  return engines;
+}
+
+void BlackWidow::GetOpenMicros(
+  std::map<std::string, uint64_t>* open_micros) const {
+  *open_micros = open_micros_;
+}
+
+void BlackWidow::SetTraceLevel(int level, uint32_t sampling) {
+  Tracer::SetSampling(sampling);
+  Tracer::SetLevel(level);
+}
+
+void BlackWidow::GetTraces(std::vector<std::string>* traces) const {
+  Tracer::Dump(traces);
+}
+
+Status BlackWidow::GetStats(
+  std::map<std::string, std::map<std::string, CommandStats>>* stats) {
+  const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+
+  stats->clear();
+  for (const auto& engine : engines) {
+    engine.first->GetCommandStats(&(*stats)[engine.second]);
+  }
+  return Status::OK();
+}
+
+Status BlackWidow::AddBGTask(const BGTask& task) {
+  bg_tasks_mutex_->Lock();
+  if (task.operation == kCleanAll) {
+    // Just clean all the tasks that will be done by kCleanAll.
+    while (!bg_tasks_queue_.empty()) {
+      bg_tasks_queue_.pop();
+    }
+  }
+  bg_tasks_queue_.push(task);
+  bg_tasks_cond_var_->Notify();
+  bg_tasks_mutex_->UnLock();
+  return Status::OK();
+}
+
+Status BlackWidow::CompactExpiredFiles(uint64_t* compacted_files) {
+  *compacted_files = 0;
+  Status s;
+  for (const auto& engine : Engines()) {
+    uint64_t files = 0;
+    s = engine.first->CompactExpiredFiles(expired_files_ratio_, &files);
+    if (!s.ok()) {
+      return s;
+    }
+    *compacted_files += files;
+  }
+  return s;
+}
+
+Status BlackWidow::GetMemoryUsage(std::map<std::string, MemoryUsage>* usages,
+                                  MemoryUsage* total) {
+  const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+
+  usages->clear();
+  *total = MemoryUsage();
+  for (const auto& engine : engines) {
+    MemoryUsage usage;
+    Status s = engine.first->GetMemoryUsage(&usage);
+    if (!s.ok()) {
+      return s;
+    }
+    total->memtables += usage.memtables;
+    total->table_readers += usage.table_readers;
+    total->block_cache += usage.block_cache;
+    total->block_cache_pinned += usage.block_cache_pinned;
+    (*usages)[engine.second] = usage;
+  }
+  if (block_cache_ != nullptr) {
+    // A write buffer manager charges the memtables to the cache as dummy
+    // entries, they are already counted in `memtables`.
+    uint64_t charged = 0;
+    if (write_buffer_manager_ != nullptr &&
+        write_buffer_manager_->cost_to_cache()) {
+      charged = write_buffer_manager_->dummy_entries_in_cache_usage();
+    }
+    uint64_t cache_usage = block_cache_->GetUsage();
+    total->block_cache += cache_usage - std::min(cache_usage, charged);
+    total->block_cache_pinned += block_cache_->GetPinnedUsage();
+  }
+  return Status::OK();
+}
+
+Status BlackWidow::GetUsage(std::map<std::string, EngineUsage>* usages) {
+  const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+
+  usages->clear();
+  for (const auto& engine : engines) {
+    Status s = engine.first->GetUsage(&(*usages)[engine.second]);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return Status::OK();
+}
+
+Status BlackWidow::BulkLoadStrings(std::vector<KeyValue>* kvs) {
+  return strings_db_->BulkLoad(kvs);
+}
+
+Status BlackWidow::BulkLoadHashes(std::vector<KeyFieldValues>* kfvs) {
+  return hashes_db_->BulkLoad(kfvs);
+}
+
+Status BlackWidow::BulkLoadZsets(std::vector<KeyScoreMembers>* ksms) {
+  return zsets_db_->BulkLoad(ksms);
+}
+
+Status BlackWidow::CreateCheckpoint(const std::string& dir,
+                                    CheckpointInfo* info) {
+  std::lock_guard<std::mutex> l(checkpoint_mutex_);
+  CheckpointInfo result;
+  Status s;
+  if (db_ != nullptr) {
+    // One db, consistent by itself.
+    uint64_t sequence = 0;
+    s = strings_db_->CreateCheckpoint(dir, &sequence);
+    result.dbs.push_back("");
+    result.sequences.push_back(sequence);
+  } else {
+    s = rocksdb::Env::Default()->CreateDir(dir);
+    if (!s.ok()) {
+      return s;
+    }
+    const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+    std::vector<Status> results(engines.size());
+    std::vector<uint64_t> sequences(engines.size());
+    uint64_t start = rocksdb::Env::Default()->NowMicros();
+    for (const auto& engine : engines) {
+      engine.first->PauseWrites();
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < engines.size(); i++) {
+      threads.emplace_back([&, i]() {
+        results[i] = engines[i].first->CreateCheckpoint(
+          AppendSubDirectory(dir, engines[i].second), &sequences[i]);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (const auto& engine : engines) {
+      engine.first->ResumeWrites();
+    }
+    result.pause_micros = rocksdb::Env::Default()->NowMicros() - start;
+
+    for (size_t i = 0; i < engines.size(); i++) {
+      result.dbs.push_back(engines[i].second);
+      result.sequences.push_back(sequences[i]);
+      if (!results[i].ok() && s.ok()) {
+        s = results[i];
+      }
+    }
+  }
+  if (s.ok() && info != nullptr) {
+    *info = result;
+  }
+  return s;
+}
+
+Status BlackWidow::Del(const std::vector<std::string>& keys,
+                       int64_t* count) {
+  *count = 0;
+  const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+  for (const auto& key : keys) {
+    bool deleted = false;
+    for (const auto& engine : engines) {
+      Status s = engine.first->Del(key);
+      if (s.ok()) {
+        deleted = true;
+      } else if (!s.IsNotFound()) {
+        return s;
+      }
+    }
+    if (deleted) {
+      (*count)++;
+    }
+  }
+  return Status::OK();
+}
+
+Status BlackWidow::Exists(const std::vector<std::string>& keys,
+                          int64_t* count) {
+  *count = 0;
+  const std::vector<std::pair<Redis*, std::string>> engines = Engines();
+  for (const auto& key : keys) {
+    for (const auto& engine : engines) {
+      int64_t ttl = 0;
+      Status s = engine.first->TTL(key, &ttl);
+      if (s.ok()) {
+        (*count)++;
+        break;
+      } else if (!s.IsNotFound()) {
+        return s;
+      }
+    }
+  }
+  return Status::OK();
+}
+
+Status BlackWidow::Expire(const Slice& key, int32_t ttl) {
+  bool found = false;
+  for (const auto& engine : Engines()) {
+    Status s = engine.first->Expire(key, ttl);
+    if (s.ok()) {
+      found = true;
+    } else if (!s.IsNotFound()) {
+      return s;
+    }
+  }
+  return found ? Status::OK() : Status::NotFound();
+}
+
+Status BlackWidow::DoCompact(const DataType& type) {
+  Status s;
+  if (type == kAll || type == kStrings) {
+    s = strings_db_->CompactRange(nullptr, nullptr);
+  }
+  if (type == kAll || type == kHashes) {
+    s = hashes_db_->CompactRange(nullptr, nullptr);
+  }
+  if (type == kAll || type == kLists) {
+    s = lists_db_->CompactRange(nullptr, nullptr);
+  }
+  if (type == kAll || type == kZSets) {
+    s = zsets_db_->CompactRange(nullptr, nullptr);
+  }
+  return s;
+}
+
+void* BlackWidow::StartBGThreadWrapper(void* arg) {
+  BlackWidow* bw = reinterpret_cast<BlackWidow*>(arg);
+  bw->RunBGTask();
+  return nullptr;
+}
+
+Status BlackWidow::StartBGThread() {
+  int result =
+    pthread_create(&bg_tasks_thread_id, nullptr, &StartBGThreadWrapper, this);
+  if (result != 0) {
+    bg_tasks_thread_id = 0;
+    return Status::Corruption("pthread_create failed: " +
+                              std::string(strerror(result)));
+  }
+  return Status::OK();
+}
+
+Status BlackWidow::RunBGTask() {
+  BGTask task;
+  int64_t last_expired_scan;
+  rocksdb::Env::Default()->GetCurrentTime(&last_expired_scan);
+
+  while (!bg_tasks_should_exit_) {
+    bool has_task = false;
+    bg_tasks_mutex_->Lock();
+    if (bg_tasks_queue_.empty() && !bg_tasks_should_exit_) {
+      // Wake up for the expired files scan even without tasks.
+      int64_t timeout = expired_files_compaction_interval_ > 0
+                          ? expired_files_compaction_interval_ * 1000000
+                          : -1;
+      bg_tasks_cond_var_->WaitFor(bg_tasks_mutex_, timeout);
+    }
+    if (!bg_tasks_queue_.empty()) {
+      task = bg_tasks_queue_.front();
+      bg_tasks_queue_.pop();
+      has_task = true;
+    }
+    bg_tasks_mutex_->UnLock();
+
+    if (bg_tasks_should_exit_) {
+      break;
+    }
+
+    if (has_task) {
+      current_task_type_ = task.operation;
+      if (task.operation == kCleanAll) {
+        DoCompact(kAll);
+      } else if (task.operation == kCleanStrings) {
+        DoCompact(kStrings);
+      } else if (task.operation == kCleanHashes) {
+        DoCompact(kHashes);
+      } else if (task.operation == kCleanLists) {
+        DoCompact(kLists);
+      } else if (task.operation == kCleanZSets) {
+        DoCompact(kZSets);
+      }
+      current_task_type_ = kNone;
+    }
+
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    if (expired_files_compaction_interval_ > 0 &&
+        now - last_expired_scan >= expired_files_compaction_interval_) {
+      uint64_t compacted_files;
+      CompactExpiredFiles(&compacted_files);
+      // Reclaim expired hash fields too, in batches until one finds nothing
+      // left to delete.
+      if (hashes_db_ != nullptr) {
+        uint32_t swept = 0;
+        Status s;
+        do {
+          s = hashes_db_->SweepExpiredFields(kFieldSweepBatch, &swept);
+        } while (s.ok() && swept > 0 && !bg_tasks_should_exit_);
+      }
+      last_expired_scan = now;
+    }
+  }
+  return Status::OK();
+}
+
+}  // namespace blackwidow
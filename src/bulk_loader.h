@@ -0,0 +1,122 @@
+#pragma once
+
+#include "rocksdb/db.h"
+#include "rocksdb/env.h"
+#include "rocksdb/options.h"
+#include "rocksdb/sst_file_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace blackwidow {
+
+// Collects encoded records of some column families of one db, writes them
+// to one sst per column family with SstFileWriter and ingests all the ssts
+// in one atomic step. The records may be added in any order, they are
+// sorted with the comparator of their column family; a key must not be
+// added twice to the same column family. The ssts are written under the
+// bulk_load directory of the db.
+class BulkLoader {
+ public:
+  explicit BulkLoader(rocksdb::DB* db)
+    : db_(db), sst_dir_(db->GetName() + "/bulk_load") {}
+
+  BulkLoader(const BulkLoader&) = delete;
+  BulkLoader& operator=(const BulkLoader&) = delete;
+
+  void Put(rocksdb::ColumnFamilyHandle* cf,
+           const rocksdb::Slice& key,
+           const rocksdb::Slice& value) {
+    records_[cf].emplace_back(key.ToString(), value.ToString());
+  }
+
+  uint64_t records() const {
+    uint64_t n = 0;
+    for (const auto& cf_records : records_) {
+      n += cf_records.second.size();
+    }
+    return n;
+  }
+
+  // Nothing is visible until every sst is ingested. The memtables
+  // overlapping the ssts are flushed first, so the loaded records are newer
+  // than anything written before.
+  rocksdb::Status Ingest() {
+    rocksdb::Env* env = db_->GetEnv();
+    rocksdb::Status s = env->CreateDirIfMissing(sst_dir_);
+    if (!s.ok()) {
+      return s;
+    }
+
+    std::vector<rocksdb::IngestExternalFileArg> args;
+    std::vector<std::string> files;
+    for (auto& cf_records : records_) {
+      if (cf_records.second.empty()) {
+        continue;
+      }
+      std::string file = sst_dir_ + "/" + std::to_string(env->NowMicros()) +
+                         "_" + std::to_string(next_file_number_++) + "_" +
+                         cf_records.first->GetName() + ".sst";
+      files.push_back(file);
+      s = WriteSst(cf_records.first, &cf_records.second, file);
+      if (!s.ok()) {
+        break;
+      }
+      rocksdb::IngestExternalFileArg arg;
+      arg.column_family = cf_records.first;
+      arg.external_files.push_back(file);
+      arg.options.move_files = true;
+      args.push_back(arg);
+    }
+    if (s.ok() && !args.empty()) {
+      s = db_->IngestExternalFiles(args);
+    }
+
+    // Moved files are hard links, the db keeps its own.
+    for (const auto& file : files) {
+      env->DeleteFile(file);
+    }
+    records_.clear();
+    return s;
+  }
+
+ private:
+  typedef std::vector<std::pair<std::string, std::string>> Records;
+
+  rocksdb::Status WriteSst(rocksdb::ColumnFamilyHandle* cf,
+                           Records* records,
+                           const std::string& file) {
+    // The options of the cf, so the sst has its comparator, table format
+    // and properties collectors.
+    rocksdb::Options options = db_->GetOptions(cf);
+    const rocksdb::Comparator* cmp = options.comparator;
+    std::sort(records->begin(), records->end(),
+              [cmp](const Records::value_type& a, const Records::value_type& b) {
+                return cmp->Compare(a.first, b.first) < 0;
+              });
+
+    rocksdb::SstFileWriter writer(rocksdb::EnvOptions(), options, cf);
+    rocksdb::Status s = writer.Open(file);
+    if (!s.ok()) {
+      return s;
+    }
+    for (const auto& record : *records) {
+      s = writer.Put(record.first, record.second);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return writer.Finish();
+  }
+
+  rocksdb::DB* const db_;
+  const std::string sst_dir_;
+  std::map<rocksdb::ColumnFamilyHandle*, Records> records_;
+  static inline std::atomic<uint64_t> next_file_number_{0};
+};
+
+}  // namespace blackwidow
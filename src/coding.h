@@ -12,6 +12,7 @@
 #endif
 #include <cstdint>
 #include <string.h>
+#include <string>
 
 namespace blackwidow {
 static const bool kLittleEndian = BLACKWIDOW_PLATFORM_IS_LITTLE_ENDIAN;
@@ -70,5 +71,22 @@ inline uint64_t DecodeFixed64(const char* ptr) {
   }
 }
 
+// Computes the smallest string that is bytewise greater than every string
+// starting with `prefix`, suitable for ReadOptions::iterate_upper_bound.
+// Returns false when no such bound exists (prefix made of 0xff only).
+inline bool PrefixSuccessor(const char* prefix, size_t size,
+                            std::string* successor) {
+  successor->assign(prefix, size);
+  while (!successor->empty()) {
+    unsigned char last = static_cast<unsigned char>(successor->back());
+    if (last != 0xff) {
+      successor->back() = static_cast<char>(last + 1);
+      return true;
+    }
+    successor->pop_back();
+  }
+  return false;
+}
+
 }  // namespace blackwidow
 #endif  // SRC_CODING_H_
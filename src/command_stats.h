@@ -0,0 +1,376 @@
+#pragma once
+
+#include "blackwidow/blackwidow.h"
+#include "latency_histogram.h"
+#include "rocksdb/perf_context.h"
+#include "rocksdb/perf_level.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace blackwidow {
+
+// Every timed command of every type, see CommandTimer. HExpire is timed
+// as the HExpireAt it calls, the commands not implemented yet are left out.
+enum Command {
+  // Keys Commands
+  kCmdDel,
+  kCmdExpire,
+  kCmdExpireAt,
+  kCmdPersist,
+  kCmdTTL,
+  // Strings Commands
+  kCmdAppend,
+  kCmdBitCount,
+  kCmdSetBit,
+  kCmdGetBit,
+  kCmdBitOp,
+  kCmdBitPos,
+  kCmdBitField,
+  kCmdIncr,
+  kCmdIncrBy,
+  kCmdIncrByFloat,
+  kCmdIncrByBlind,
+  kCmdIncrByFloatBlind,
+  kCmdDecr,
+  kCmdDecrBy,
+  kCmdMSet,
+  kCmdSet,
+  kCmdStrlen,
+  kCmdSetNx,
+  kCmdSetEx,
+  kCmdGet,
+  kCmdGetSet,
+  kCmdGetRange,
+  kCmdSetRange,
+  kCmdCad,
+  // Hashes Commands
+  kCmdHLen,
+  kCmdHExists,
+  kCmdHSet,
+  kCmdHSetNx,
+  kCmdHMSet,
+  kCmdHGet,
+  kCmdHMGet,
+  kCmdHGetAll,
+  kCmdHVals,
+  kCmdHDel,
+  kCmdHStrlen,
+  kCmdHExpireAt,
+  kCmdHPersist,
+  kCmdHTTL,
+  kCmdHIncrBy,
+  kCmdHIncrByFloat,
+  kCmdHIncrByBlind,
+  // Zsets Commands
+  kCmdZAdd,
+  kCmdZCard,
+  kCmdZScore,
+  kCmdZCount,
+  kCmdZRank,
+  // Lists Commands
+  kCmdLLen,
+  kCmdLPushX,
+  kCmdRPushX,
+  kCmdLPush,
+  kCmdMax
+};
+
+static const char* const CommandNames[kCmdMax] = {
+  "DEL", "EXPIRE", "EXPIREAT", "PERSIST", "TTL",
+  "APPEND", "BITCOUNT", "SETBIT", "GETBIT", "BITOP", "BITPOS", "BITFIELD",
+  "INCR", "INCRBY", "INCRBYFLOAT", "INCRBYBLIND", "INCRBYFLOATBLIND",
+  "DECR", "DECRBY", "MSET", "SET",
+  "STRLEN", "SETNX", "SETEX", "GET", "GETSET", "GETRANGE",
+  "SETRANGE", "CAD",
+  "HLEN", "HEXISTS", "HSET", "HSETNX", "HMSET", "HGET", "HMGET", "HGETALL",
+  "HVALS", "HDEL", "HSTRLEN", "HEXPIREAT", "HPERSIST", "HTTL",
+  "HINCRBY", "HINCRBYFLOAT", "HINCRBYBLIND",
+  "ZADD", "ZCARD", "ZSCORE", "ZCOUNT", "ZRANK",
+  "LLEN", "LPUSHX", "RPUSHX", "LPUSH"};
+
+// Bytes of the keys, fields, members and values passed to or returned by
+// a command.
+inline uint64_t BytesOf(const std::string& value) {
+  return value.size();
+}
+
+inline uint64_t BytesOf(const std::vector<std::string>& values) {
+  uint64_t bytes = 0;
+  for (const auto& value : values) {
+    bytes += value.size();
+  }
+  return bytes;
+}
+
+inline uint64_t BytesOf(const std::vector<KeyValue>& kvs) {
+  uint64_t bytes = 0;
+  for (const auto& kv : kvs) {
+    bytes += kv.key.size() + kv.value.size();
+  }
+  return bytes;
+}
+
+inline uint64_t BytesOf(const std::vector<FieldValue>& fvs) {
+  uint64_t bytes = 0;
+  for (const auto& fv : fvs) {
+    bytes += fv.field.size() + fv.value.size();
+  }
+  return bytes;
+}
+
+inline uint64_t BytesOf(const std::vector<ValueStatus>& vss) {
+  uint64_t bytes = 0;
+  for (const auto& vs : vss) {
+    bytes += vs.value.size();
+  }
+  return bytes;
+}
+
+inline uint64_t BytesOf(const std::vector<ScoreMember>& sms) {
+  uint64_t bytes = 0;
+  for (const auto& sm : sms) {
+    bytes += sizeof(sm.score) + sm.member.size();
+  }
+  return bytes;
+}
+
+// The counters of one command in one thread. Only that thread writes them,
+// with plain loads and stores, GetStats reads them at any time.
+struct CommandCounters {
+  // 16 buckets per power of two, latencies are known within 1/16.
+  static constexpr int kLatencyBits = 4;
+  static constexpr size_t kLatencyBuckets =
+    LatencyHistogram::NumBuckets(kLatencyBits);
+
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> errors;
+  std::atomic<uint64_t> bytes_in;
+  std::atomic<uint64_t> bytes_out;
+  std::atomic<uint64_t> block_reads;
+  std::atomic<uint64_t> latency_sum;
+  std::atomic<uint64_t> latency_max;
+  std::atomic<uint64_t> latency[kLatencyBuckets];
+
+  CommandCounters() {
+    count.store(0);
+    errors.store(0);
+    bytes_in.store(0);
+    bytes_out.store(0);
+    block_reads.store(0);
+    latency_sum.store(0);
+    latency_max.store(0);
+    for (auto& bucket : latency) {
+      bucket.store(0);
+    }
+  }
+
+  static void Add(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n,
+                   std::memory_order_relaxed);
+  }
+};
+
+// Command counters of one engine, kept per thread and summed on read, so a
+// command never takes a lock nor shares a cache line with other threads.
+class CommandStatsRegistry {
+ public:
+  CommandStatsRegistry() : id_(next_id_.fetch_add(1)) {}
+  CommandStatsRegistry(const CommandStatsRegistry&) = delete;
+  CommandStatsRegistry& operator=(const CommandStatsRegistry&) = delete;
+
+  void SetOptions(bool enabled, bool block_reads) {
+    enabled_ = enabled;
+    block_reads_ = block_reads;
+  }
+  bool enabled() const {
+    return enabled_;
+  }
+  bool block_reads() const {
+    return block_reads_;
+  }
+
+  // The counters of `command` in the calling thread.
+  CommandCounters* Counters(Command command) {
+    ThreadCounters* local = Local();
+    CommandCounters* counters =
+      local->commands[command].load(std::memory_order_acquire);
+    if (counters == nullptr) {
+      counters = new CommandCounters();
+      local->commands[command].store(counters, std::memory_order_release);
+    }
+    return counters;
+  }
+
+  // Sums the counters of all threads by command name, the commands never
+  // run are left out.
+  void GetStats(std::map<std::string, CommandStats>* stats) {
+    std::lock_guard<std::mutex> l(mu_);
+    for (int command = 0; command < kCmdMax; command++) {
+      CommandStats sum;
+      LatencyHistogram histogram;
+      for (const auto& thread : threads_) {
+        const CommandCounters* counters =
+          thread->commands[command].load(std::memory_order_acquire);
+        if (counters == nullptr) {
+          continue;
+        }
+        sum.count += counters->count.load(std::memory_order_relaxed);
+        sum.errors += counters->errors.load(std::memory_order_relaxed);
+        sum.bytes_in += counters->bytes_in.load(std::memory_order_relaxed);
+        sum.bytes_out += counters->bytes_out.load(std::memory_order_relaxed);
+        sum.block_reads +=
+          counters->block_reads.load(std::memory_order_relaxed);
+        sum.total_micros +=
+          counters->latency_sum.load(std::memory_order_relaxed);
+        sum.max_micros =
+          std::max(sum.max_micros,
+                   counters->latency_max.load(std::memory_order_relaxed));
+        for (size_t i = 0; i < CommandCounters::kLatencyBuckets; i++) {
+          const int bits = CommandCounters::kLatencyBits;
+          histogram.Record(
+            LatencyHistogram::BucketUpperBound(i, bits),
+            counters->latency[i].load(std::memory_order_relaxed));
+        }
+      }
+      if (sum.count == 0) {
+        continue;
+      }
+      sum.p50_micros = std::min(histogram.Percentile(50), sum.max_micros);
+      sum.p99_micros = std::min(histogram.Percentile(99), sum.max_micros);
+      sum.p999_micros = std::min(histogram.Percentile(99.9), sum.max_micros);
+      (*stats)[CommandNames[command]] = sum;
+    }
+  }
+
+ private:
+  struct ThreadCounters {
+    std::atomic<CommandCounters*> commands[kCmdMax];
+
+    ThreadCounters() {
+      for (auto& command : commands) {
+        command.store(nullptr);
+      }
+    }
+    ~ThreadCounters() {
+      for (auto& command : commands) {
+        delete command.load();
+      }
+    }
+  };
+
+  // The counters of the calling thread, kept by the registry when the
+  // thread exits. The registry ids are never reused, so the pointers of a
+  // destroyed registry are never looked at again.
+  ThreadCounters* Local() {
+    thread_local std::vector<ThreadCounters*> locals;
+    if (locals.size() <= id_) {
+      locals.resize(id_ + 1, nullptr);
+    }
+    if (locals[id_] == nullptr) {
+      std::lock_guard<std::mutex> l(mu_);
+      threads_.emplace_back(new ThreadCounters());
+      locals[id_] = threads_.back().get();
+    }
+    return locals[id_];
+  }
+
+  static inline std::atomic<size_t> next_id_{0};
+
+  const size_t id_;
+  bool enabled_ = true;
+  bool block_reads_ = false;
+  std::mutex mu_;
+  std::vector<std::unique_ptr<ThreadCounters>> threads_;
+};
+
+// Times a command from its construction to its destruction. Commands
+// return through Done so their errors are counted, NotFound is not one.
+class CommandTimer {
+ public:
+  CommandTimer(CommandStatsRegistry* registry,
+               Command command,
+               uint64_t bytes_in = 0)
+    : counters_(nullptr) {
+    if (!registry->enabled()) {
+      return;
+    }
+    counters_ = registry->Counters(command);
+    bytes_in_ = bytes_in;
+    if (registry->block_reads()) {
+      // Counting only, the perf context timers stay off.
+      if (rocksdb::GetPerfLevel() < rocksdb::kEnableCount) {
+        rocksdb::SetPerfLevel(rocksdb::kEnableCount);
+      }
+      block_reads_ = rocksdb::get_perf_context()->block_read_count;
+      count_block_reads_ = true;
+    }
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  ~CommandTimer() {
+    if (counters_ == nullptr) {
+      return;
+    }
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start_).count();
+    CommandCounters::Add(&counters_->count, 1);
+    CommandCounters::Add(&counters_->errors, error_ ? 1 : 0);
+    CommandCounters::Add(&counters_->bytes_in, bytes_in_);
+    if (output_ != nullptr) {
+      bytes_out_ += output_bytes_(output_);
+    }
+    CommandCounters::Add(&counters_->bytes_out, bytes_out_);
+    if (count_block_reads_) {
+      CommandCounters::Add(
+        &counters_->block_reads,
+        rocksdb::get_perf_context()->block_read_count - block_reads_);
+    }
+    CommandCounters::Add(&counters_->latency_sum, micros);
+    if (micros > counters_->latency_max.load(std::memory_order_relaxed)) {
+      counters_->latency_max.store(micros, std::memory_order_relaxed);
+    }
+    CommandCounters::Add(
+      &counters_->latency[LatencyHistogram::BucketIndex(
+        micros, CommandCounters::kLatencyBits)],
+      1);
+  }
+
+  Status Done(const Status& s) {
+    if (!s.ok() && !s.IsNotFound()) {
+      error_ = true;
+    }
+    return s;
+  }
+
+  void AddBytesOut(uint64_t bytes) {
+    bytes_out_ += bytes;
+  }
+
+  // `output` is measured with BytesOf when the command returns.
+  template <typename T>
+  void SetOutput(const T* output) {
+    output_ = output;
+    output_bytes_ = [](const void* output) {
+      return BytesOf(*static_cast<const T*>(output));
+    };
+  }
+
+ private:
+  CommandCounters* counters_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t bytes_in_ = 0;
+  uint64_t bytes_out_ = 0;
+  const void* output_ = nullptr;
+  uint64_t (*output_bytes_)(const void*) = nullptr;
+  uint64_t block_reads_ = 0;
+  bool count_block_reads_ = false;
+  bool error_ = false;
+};
+
+}  // namespace blackwidow
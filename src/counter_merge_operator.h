@@ -0,0 +1,187 @@
+#pragma once
+
+#include "blackwidow/util.h"
+#include "coding.h"
+#include "rocksdb/env.h"
+#include "rocksdb/merge_operator.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace blackwidow {
+
+// Counter operand: |Type(1byte)|Delta|
+//   kIntOperand   Delta is a decimal int64
+//   kFloatOperand Delta is a decimal long double
+//
+// Folds INCRBY/INCRBYFLOAT deltas into a number so that a counter can be
+// updated by a blind DB::Merge instead of a locked read-modify-write.
+//
+// With `has_timestamp_suffix` the stored value is |Number|Timestamp(4bytes)|
+// (StringsValue), the timestamp of the base value is kept and a stale base
+// counts as 0 without ttl.
+//
+// A full merge never fails, a failed merge would turn every later read of
+// the key into Corruption. A base which is not a number is kept unchanged
+// and deltas which overflow are dropped, blind writers can not report these
+// errors anyway.
+class CounterMergeOperator : public rocksdb::MergeOperator {
+ public:
+  static const char kIntOperand = 'i';
+  static const char kFloatOperand = 'f';
+
+  explicit CounterMergeOperator(bool has_timestamp_suffix)
+    : has_timestamp_suffix_(has_timestamp_suffix) {}
+
+  static std::string EncodeIntOperand(int64_t delta) {
+    return kIntOperand + std::to_string(delta);
+  }
+
+  static bool EncodeFloatOperand(long double delta, std::string* operand) {
+    std::string str;
+    if (LongDoubleToStr(delta, &str) != 0) {
+      return false;
+    }
+    operand->assign(1, kFloatOperand);
+    operand->append(str);
+    return true;
+  }
+
+  const char* Name() const override {
+    return "blackwidow.CounterMergeOperator";
+  }
+
+  bool FullMergeV2(const MergeOperationInput& merge_in,
+                   MergeOperationOutput* merge_out) const override {
+    Counter counter;
+    int32_t timestamp = 0;
+    if (merge_in.existing_value != nullptr) {
+      Slice base = *merge_in.existing_value;
+      if (has_timestamp_suffix_ && base.size() >= sizeof(int32_t)) {
+        timestamp = static_cast<int32_t>(
+          DecodeFixed32(base.data() + base.size() - sizeof(int32_t)));
+        base.remove_suffix(sizeof(int32_t));
+        if (timestamp != 0) {
+          int64_t unix_time;
+          rocksdb::Env::Default()->GetCurrentTime(&unix_time);
+          if (timestamp < unix_time) {
+            // Stale, start over from 0.
+            timestamp = 0;
+            base = Slice();
+          }
+        }
+      }
+      if (!base.empty() && !counter.Parse(base)) {
+        merge_out->new_value.assign(merge_in.existing_value->data(),
+                                    merge_in.existing_value->size());
+        return true;
+      }
+    }
+
+    for (const Slice& operand : merge_in.operand_list) {
+      counter.Add(operand);
+    }
+
+    std::string* new_value = &merge_out->new_value;
+    if (!counter.ToString(new_value)) {
+      // Float result out of range, keep the base.
+      if (merge_in.existing_value != nullptr) {
+        new_value->assign(merge_in.existing_value->data(),
+                          merge_in.existing_value->size());
+        return true;
+      }
+      new_value->assign("0");
+    }
+    if (has_timestamp_suffix_) {
+      char buf[sizeof(int32_t)];
+      EncodeFixed32(buf, static_cast<uint32_t>(timestamp));
+      new_value->append(buf, sizeof(buf));
+    }
+    return true;
+  }
+
+  bool PartialMergeMulti(const Slice& key,
+                         const std::deque<Slice>& operand_list,
+                         std::string* new_value,
+                         rocksdb::Logger* logger) const override {
+    Counter counter;
+    for (const Slice& operand : operand_list) {
+      if (!counter.Add(operand)) {
+        // Let the full merge drop the bad delta.
+        return false;
+      }
+    }
+    if (counter.is_float) {
+      return EncodeFloatOperand(counter.fval, new_value);
+    }
+    *new_value = EncodeIntOperand(counter.ival);
+    return true;
+  }
+
+ private:
+  struct Counter {
+    bool is_float = false;
+    int64_t ival = 0;
+    long double fval = 0;
+
+    bool Parse(const Slice& number) {
+      if (StrToInt64(number.data(), number.size(), &ival) == 0) {
+        return true;
+      }
+      if (StrToLongDouble(number.data(), number.size(), &fval) == 0) {
+        is_float = true;
+        return true;
+      }
+      return false;
+    }
+
+    bool Add(const Slice& operand) {
+      if (operand.size() < 2) {
+        return false;
+      }
+      const char* delta = operand.data() + 1;
+      size_t delta_len = operand.size() - 1;
+      if (operand[0] == kIntOperand) {
+        int64_t v;
+        if (StrToInt64(delta, delta_len, &v) != 0) {
+          return false;
+        }
+        if (is_float) {
+          fval += v;
+          return true;
+        }
+        int64_t sum;
+        if (__builtin_add_overflow(ival, v, &sum)) {
+          return false;
+        }
+        ival = sum;
+        return true;
+      } else if (operand[0] == kFloatOperand) {
+        long double v;
+        if (StrToLongDouble(delta, delta_len, &v) != 0) {
+          return false;
+        }
+        if (!is_float) {
+          is_float = true;
+          fval = ival;
+        }
+        fval += v;
+        return true;
+      }
+      return false;
+    }
+
+    bool ToString(std::string* value) const {
+      if (is_float) {
+        return LongDoubleToStr(fval, value) == 0;
+      }
+      *value = std::to_string(ival);
+      return true;
+    }
+  };
+
+  const bool has_timestamp_suffix_;
+};
+
+}  // namespace blackwidow
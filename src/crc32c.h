@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace blackwidow {
+
+namespace crc32c {
+
+// CRC-32C (Castagnoli), the checksum rocksdb uses for its blocks. Table
+// driven, it only checks the backup copies.
+class Table {
+ public:
+  constexpr Table() : entries_() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int k = 0; k < 8; k++) {
+        crc = (crc >> 1) ^ (0x82f63b78 & (0 - (crc & 1)));
+      }
+      entries_[i] = crc;
+    }
+  }
+
+  constexpr uint32_t operator[](size_t i) const {
+    return entries_[i];
+  }
+
+ private:
+  uint32_t entries_[256];
+};
+
+// The crc of the bytes of `crc` followed by data[0, n-1].
+inline uint32_t Extend(uint32_t crc, const char* data, size_t n) {
+  static constexpr Table kTable;
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) {
+    crc = kTable[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+inline uint32_t Value(const char* data, size_t n) {
+  return Extend(0, data, n);
+}
+
+}  // namespace crc32c
+
+}  // namespace blackwidow
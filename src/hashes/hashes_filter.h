@@ -1,8 +1,9 @@
 #ifndef __HASHES_FILTER_H__
 #define __HASHES_FILTER_H__
 
-#include "debug.h"
+#include "trace.h"
 #include "hashes_format.h"
+#include "meta_lookup_cache.h"
 #include "rocksdb/compaction_filter.h"
 #include "rocksdb/env.h"
 
@@ -23,7 +24,7 @@ class HashesMetaFilter : public rocksdb::CompactionFilter {
     rocksdb::Env::Default()->GetCurrentTime(&unix_time_now);
 
     bool should_filter = false;
-    std::string filter_reason = "None";
+    const char* filter_reason = "None";
     ParsedHashesMetaValue parsed_meta_value(existing_value);
     int32_t version = parsed_meta_value.version();
     uint32_t hash_size = parsed_meta_value.hash_size();
@@ -53,16 +54,12 @@ class HashesMetaFilter : public rocksdb::CompactionFilter {
       filter_reason = "NoElements";
     }
 
-    Trace(
-      "[HashesMetaFilter] level-%d, key: %s, value:%s, timestamp:%ld, version:%d, hash_size:%d, "
-      "currentTime: %ld, shouldFilter:%d, filterReason:%s\n",
-      level,
-      key.ToString().c_str(),
-      existing_value.ToString().c_str(),
-      timestamp, version, hash_size,
-      unix_time_now,
-      should_filter,
-      filter_reason.c_str());
+    BW_TRACE_SAMPLED(kTraceVerbose, "HashesMetaFilter",
+                     "level-%d, key: %s, value:%s, timestamp:%ld, version:%d, "
+                     "hash_size:%d, currentTime: %ld, shouldFilter:%d, "
+                     "filterReason:%s",
+                     level, key, existing_value, timestamp, version, hash_size,
+                     unix_time_now, should_filter, filter_reason);
 
     return should_filter;
   }
@@ -82,14 +79,10 @@ class HashesMetaFilterFactory : public rocksdb::CompactionFilterFactory {
 
 class HashesDataFilter : public rocksdb::CompactionFilter {
  public:
-  HashesDataFilter(rocksdb::DB* dbptr, std::vector<rocksdb::ColumnFamilyHandle*>* handles)
-    : db_(dbptr), handles_(handles),
-      cur_key_(""),
-      meta_not_found_(false),
-      cur_meta_version_(0),
-      cur_meta_timestamp_(0) {
-    // read_opts_.fill_cache = false;
-  }
+  HashesDataFilter(rocksdb::DB* dbptr,
+                   std::vector<rocksdb::ColumnFamilyHandle*>* handles,
+                   MetaLookupCache* meta_cache)
+    : meta_resolver_(dbptr, handles, meta_cache) {}
 
   const char* Name() const override {
     return "blackwidow.HashesDataFilter";
@@ -99,96 +92,57 @@ class HashesDataFilter : public rocksdb::CompactionFilter {
               const Slice& key,
               const Slice& existing_value,
               std::string* new_value,
-              bool* value_changed) const {
-
-    // Trace("key: %s, key.data:%p, key.size:%d\n",key.ToString().c_str(), key.data(), key.size());
-
+              bool* value_changed) const override {
     bool should_filter = false;
-    std::string filter_reason = "None";
+    const char* filter_reason = "None";
     ParsedHashesDataKey parsed_data_key(key);
-
-    if(parsed_data_key.user_key().ToString() != cur_key_) {
-      cur_key_ = parsed_data_key.user_key().ToString();
-      std::string meta_value;
-      if(handles_->size() == 0) {
-          // destroyed when close the database, Reserve the kv
-        return false;
-      }
-
-      Status s = db_->Get(read_opts_, (*handles_)[0], cur_key_, &meta_value);
-      if(s.ok()) {
-        meta_not_found_ = false;
-        ParsedHashesMetaValue parsed_meta_value(&meta_value);
-        cur_meta_version_ = parsed_meta_value.version();
-        cur_meta_timestamp_ = parsed_meta_value.timestamp();
-      } else if (s.IsNotFound()) {
-        meta_not_found_ = true;
-      } else {
-        cur_key_ = "";
-        Trace("Get MetaKey failed, reserve.");
-        return false;
-      }
+    const MetaSnapshot* meta = meta_resolver_.Resolve(
+      parsed_data_key.user_key(), parsed_data_key.version());
+    if (meta == nullptr) {
+      BW_TRACE_SAMPLED(kTraceError, "HashesDataFilter",
+                       "Get MetaKey failed, reserve. key:%s", key);
+      return false;
     }
 
-    if(meta_not_found_) {
-      // meta deleted by compactionfilter too.
+    if (meta->IsDeadData(parsed_data_key.version())) {
       should_filter = true;
-      filter_reason = "MetaNotFound";
+      filter_reason = meta->not_found ? "MetaNotFound" : "DeprecatedVersion";
     } else {
-      int64_t unix_time_now;
-      rocksdb::Env::Default()->GetCurrentTime(&unix_time_now);
-      if(cur_meta_timestamp_ != 0 &&
-        cur_meta_timestamp_ < static_cast<int32_t>(unix_time_now)) {
-        should_filter = true;
-        filter_reason = "MetaExpired";
-      }
-
-      if(cur_meta_version_ > parsed_data_key.version()) {
+      // field级别的过期, hash_size由HLen重新计数修正
+      ParsedHashesDataValue parsed_data_value(existing_value);
+      if (parsed_data_value.IsStale()) {
         should_filter = true;
-        filter_reason = "DeprecatedVersion";
-      } else {
-        assert(cur_meta_version_ == parsed_data_key.version());
+        filter_reason = "FieldExpired";
       }
     }
 
-    Trace(
-      "[HashesDataFilter]-level-%d, key:%s, version:%d, field:%s, "
-      "filedValue:%s, "
-      "metaVersion:%d, shouldFilter:%d, filterReason:%s\n",
-      level,
-      cur_key_.c_str(),
-      parsed_data_key.version(),
-      parsed_data_key.field().ToString().c_str(),
-      existing_value.ToString().c_str(),
-      cur_meta_version_,
-      should_filter,
-      filter_reason.c_str());
+    BW_TRACE_SAMPLED(kTraceVerbose, "HashesDataFilter",
+                     "level-%d, key:%s, version:%d, field:%s, metaVersion:%d, "
+                     "shouldFilter:%d, filterReason:%s",
+                     level, meta_resolver_.cur_key(), parsed_data_key.version(),
+                     parsed_data_key.field(), meta->version, should_filter,
+                     filter_reason);
 
     return should_filter;
   }
 
  private:
-  rocksdb::DB* db_;
-  std::vector<rocksdb::ColumnFamilyHandle*>* handles_;
-  rocksdb::ReadOptions read_opts_;
-  // cached meta infos
-  mutable std::string cur_key_;
-  mutable bool meta_not_found_;
-  mutable int32_t cur_meta_version_;
-  mutable int32_t cur_meta_timestamp_;
+  mutable DataFilterMetaResolver<ParsedHashesMetaValue> meta_resolver_;
 };
 
 class HashesDataFilterFactory : public rocksdb::CompactionFilterFactory {
  public:
   HashesDataFilterFactory(rocksdb::DB** db_ptr,
-                        std::vector<rocksdb::ColumnFamilyHandle*>* handles_ptr)
-      : db_ptr_(db_ptr), cf_handles_ptr_(handles_ptr) {
+                        std::vector<rocksdb::ColumnFamilyHandle*>* handles_ptr,
+                        std::shared_ptr<MetaLookupCache> meta_cache)
+      : db_ptr_(db_ptr), cf_handles_ptr_(handles_ptr),
+        meta_cache_(std::move(meta_cache)) {
   }
 
   std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
     const rocksdb::CompactionFilter::Context& context) override {
     return std::unique_ptr<rocksdb::CompactionFilter>(
-           new HashesDataFilter(*db_ptr_, cf_handles_ptr_));
+           new HashesDataFilter(*db_ptr_, cf_handles_ptr_, meta_cache_.get()));
   }
   const char* Name() const override {
     return "blackwidow.HashesDataFilterFactory";
@@ -197,6 +151,7 @@ class HashesDataFilterFactory : public rocksdb::CompactionFilterFactory {
  private:
   rocksdb::DB** db_ptr_;
   std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
+  std::shared_ptr<MetaLookupCache> meta_cache_;
 };
 
 }  // namespace blackwidow
@@ -8,6 +8,11 @@
 
 namespace blackwidow {
 
+// The high bit of HashSize marks a hash whose HashSize is only approximate
+// until it is recounted: the fast HSet does not count new fields, and fields
+// with ttl expire without touching the meta value.
+static const uint32_t kHashSizeUnreconciled = 0x80000000;
+
 // MetaKey:  |UserKey|
 // MetaVal:  |HashSize(4bytes)|Version(4byte)|Timestamp(4byte)|
 class HashesMetaValue : public InternalValue {
@@ -18,7 +23,7 @@ class HashesMetaValue : public InternalValue {
   }
 
   void set_hash_size(uint32_t hash_size) {
-    hash_size_ = hash_size_;
+    hash_size_ = hash_size;
   }
 
   size_t AppendTimestampAndVersion() override {
@@ -68,6 +73,8 @@ class ParsedHashesMetaValue : public ParsedInternalValue {
     // Decode hash_size
     char* ptr = value->data();
     hash_size_ = DecodeFixed32(ptr);
+    unreconciled_ = (hash_size_ & kHashSizeUnreconciled) != 0;
+    hash_size_ &= ~kHashSizeUnreconciled;
     ptr += sizeof(uint32_t);
 
     // Decode version
@@ -89,6 +96,8 @@ class ParsedHashesMetaValue : public ParsedInternalValue {
     // Decode hash_size    
     const char* ptr = value.data();
     hash_size_ = DecodeFixed32(ptr);
+    unreconciled_ = (hash_size_ & kHashSizeUnreconciled) != 0;
+    hash_size_ &= ~kHashSizeUnreconciled;
     ptr += sizeof(uint32_t);
 
     // Decode version
@@ -110,7 +119,17 @@ class ParsedHashesMetaValue : public ParsedInternalValue {
     SetHashSizeToValue();
   }
 
+  bool IsSizeUnreconciled() const {
+    return unreconciled_;
+  }
+
+  void SetSizeUnreconciled(bool unreconciled) {
+    unreconciled_ = unreconciled;
+    SetHashSizeToValue();
+  }
+
   void InitialMetaValue() {
+    this->unreconciled_ = false;
     this->set_hash_size(0);
     this->set_timestamp(0);
     this->UpdateVersion();
@@ -125,7 +144,9 @@ class ParsedHashesMetaValue : public ParsedInternalValue {
   void SetHashSizeToValue() {
     if(value_) {
       char* ptr = value_->data();
-      EncodeFixed32(ptr, hash_size_);
+      EncodeFixed32(ptr,
+                    unreconciled_ ? (hash_size_ | kHashSizeUnreconciled)
+                                  : hash_size_);
     }
   }
 
@@ -158,10 +179,11 @@ class ParsedHashesMetaValue : public ParsedInternalValue {
 
  private:
   uint32_t hash_size_;
+  bool unreconciled_;
 };
 
 // FieldKey: |KeySize(4bytes)|UserKey|Version(4bytes)|Field|
-// FieldVal: |FieldValue|
+// FieldVal: |FieldValue|Timestamp(4bytes)|
 class HashesDataKey {
  public:
   explicit HashesDataKey(const Slice& key, const Slice& field, int32_t version)
@@ -176,7 +198,7 @@ class HashesDataKey {
   const Slice Encode() {
     size_t needed =
       sizeof(uint32_t) + key_.size() + sizeof(int32_t) + field_.size();
-    if (needed > sizeof(space_)) {
+    if (needed > sizeof(space_) && start_ == space_) {
       start_ = new char[needed];
     }
     char* ptr = start_;
@@ -212,7 +234,7 @@ class HashesDataKey {
 };
 
 // FieldKey: |KeySize(4bytes)|UserKey|Version(4bytes)|Field|
-// FieldVal: |FieldValue|
+// FieldVal: |FieldValue|Timestamp(4bytes)|
 class ParsedHashesDataKey {
  public:
   // use this constructor in CompactionFilter
@@ -264,4 +286,119 @@ class ParsedHashesDataKey {
 
 
 
+// FieldVal: |FieldValue|Timestamp(4bytes)|, Timestamp 0 means no ttl.
+class HashesDataValue : public InternalValue {
+ public:
+  explicit HashesDataValue(const Slice& user_value)
+    : InternalValue(user_value) {}
+
+  size_t AppendTimestampAndVersion() override {
+    char* dst = start_;
+    size_t usize = user_value_.size();
+    memcpy(dst, user_value_.data(), usize);
+    dst += usize;
+    EncodeFixed32(dst, timestamp_);
+    return usize + sizeof(int32_t);
+  }
+};
+
+class ParsedHashesDataValue : public ParsedInternalValue {
+ public:
+  static constexpr size_t kHashesDataValueSuffixLength = sizeof(int32_t);
+
+  // Use after DB::Get()
+  explicit ParsedHashesDataValue(std::string* value)
+    : ParsedInternalValue(value) {
+    assert(value->size() >= kHashesDataValueSuffixLength);
+    if (value->size() >= kHashesDataValueSuffixLength) {
+      user_value_ =
+        Slice(value->data(), value->size() - kHashesDataValueSuffixLength);
+      timestamp_ = DecodeFixed32(value->data() + user_value_.size());
+    }
+  }
+
+  // Use this constructor in rocksdb::CompactionFilter::Filter() or iterator.
+  explicit ParsedHashesDataValue(const Slice& value)
+    : ParsedInternalValue(value) {
+    assert(value.size() >= kHashesDataValueSuffixLength);
+    if (value.size() >= kHashesDataValueSuffixLength) {
+      user_value_ =
+        Slice(value.data(), value.size() - kHashesDataValueSuffixLength);
+      timestamp_ = DecodeFixed32(value.data() + user_value_.size());
+    }
+  }
+
+  void StripSuffix() override {
+    if (value_ != nullptr) {
+      value_->erase(value_->size() - kHashesDataValueSuffixLength,
+                    kHashesDataValueSuffixLength);
+    }
+  }
+
+  // Fields do not have version.
+  void SetVersionToValue() override {
+    // NOP
+  }
+
+  void SetTimestampToValue() override {
+    if (value_ != nullptr) {
+      char* dst = const_cast<char*>(value_->data()) + value_->size() -
+        kHashesDataValueSuffixLength;
+      EncodeFixed32(dst, timestamp_);
+    }
+  }
+};
+
+// Expiry index of fields with ttl, ordered by the time they expire.
+// TtlKey: |Timestamp(4bytes big endian)|FieldKey|
+// TtlVal: ||
+class HashesFieldTtlKey {
+ public:
+  HashesFieldTtlKey(int32_t timestamp, const Slice& data_key)
+    : timestamp_(timestamp), data_key_(data_key) {}
+
+  const std::string Encode() const {
+    std::string dst;
+    dst.reserve(sizeof(int32_t) + data_key_.size());
+    uint32_t ts = static_cast<uint32_t>(timestamp_);
+    dst.push_back(static_cast<char>((ts >> 24) & 0xff));
+    dst.push_back(static_cast<char>((ts >> 16) & 0xff));
+    dst.push_back(static_cast<char>((ts >> 8) & 0xff));
+    dst.push_back(static_cast<char>(ts & 0xff));
+    dst.append(data_key_.data(), data_key_.size());
+    return dst;
+  }
+
+ private:
+  const int32_t timestamp_;
+  const Slice data_key_;
+};
+
+class ParsedHashesFieldTtlKey {
+ public:
+  explicit ParsedHashesFieldTtlKey(const Slice& raw_key) {
+    assert(raw_key.size() >= sizeof(int32_t));
+    const unsigned char* ptr =
+      reinterpret_cast<const unsigned char*>(raw_key.data());
+    timestamp_ = static_cast<int32_t>(
+      (static_cast<uint32_t>(ptr[0]) << 24) |
+      (static_cast<uint32_t>(ptr[1]) << 16) |
+      (static_cast<uint32_t>(ptr[2]) << 8) | static_cast<uint32_t>(ptr[3]));
+    data_key_ = Slice(raw_key.data() + sizeof(int32_t),
+                      raw_key.size() - sizeof(int32_t));
+  }
+
+  int32_t timestamp() const {
+    return timestamp_;
+  }
+
+  const Slice data_key() const {
+    return data_key_;
+  }
+
+ private:
+  int32_t timestamp_;
+  Slice data_key_;
+};
+
 }  // namespace blackwidow
@@ -1,40 +1,199 @@
 #include "redis_hashes.h"
+#include "blackwidow/util.h"
+#include "bulk_loader.h"
+#include "counter_merge_operator.h"
 #include "hashes_filter.h"
 #include "hashes_format.h"
 #include "scope_iterator.h"
 #include "scope_record_lock.h"
 #include "scope_snapshot.h"
+#include "ttl_properties_collector.h"
 
-#include <unordered_set>
+#include <algorithm>
+#include <map>
 #include <vector>
 
 namespace blackwidow {
 
-RedisHashes::RedisHashes(BlackWidow* const bw) : Redis(bw, kHashes) {
+// Big hashes are read sequentially by HGetAll/HVals, let the table reader
+// prefetch instead of issuing one read per data block.
+static constexpr uint32_t kHashesReadaheadThreshold = 1024;
+static constexpr size_t kHashesReadaheadSize = 2 * 1024 * 1024;
+
+// Encodes the data keys of `fields` under one version, sorted and without
+// duplicates as DB::MultiGet(sorted_input=true) requires. All data keys of
+// a hash share the same prefix, so sorting the fields sorts the keys.
+static void EncodeSortedDataKeys(const Slice& key,
+                                 int32_t version,
+                                 std::vector<std::string> fields,
+                                 std::vector<std::string>* data_keys) {
+  std::sort(fields.begin(), fields.end());
+  fields.erase(std::unique(fields.begin(), fields.end()), fields.end());
+  data_keys->clear();
+  data_keys->reserve(fields.size());
+  for (const auto& field : fields) {
+    HashesDataKey data_key(key, field, version);
+    data_keys->push_back(data_key.Encode().ToString());
+  }
+}
+
+RedisHashes::RedisHashes(BlackWidow* const bw)
+    : Redis(bw, kHashes),
+      fast_hset_(false),
+      data_meta_cache_(std::make_shared<MetaLookupCache>()) {
   // DO NOTHING
 }
 
 Status RedisHashes::Open(const BlackWidowOptions& bw_options,
                          const std::string& dbpath) {
-  // TODO FIXME.
-  // statistics_store_->SetCapacity(bw_options.statistics_max_size);
-  // small_compaction_threshold_ = bw_options.small_compaction_threshold;
-  rocksdb::Options opts(bw_options.options);
-  rocksdb::Status s = rocksdb::DB::Open(opts, dbpath, &db_);
-  if (s.ok()) {
-    // Create data column family
-    rocksdb::ColumnFamilyOptions cf_opts;
-    rocksdb::ColumnFamilyHandle* cf_handle = nullptr;
-    s = db_->CreateColumnFamily(cf_opts, "data_cf", &cf_handle);
-    if (!s.ok()) {
-      return s;
+  rocksdb::DBOptions db_opt(bw_options.options);
+  std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+  PrepareOptions(bw_options, &db_opt, &cfds);
+  Status s = UpgradeFieldFormat(db_opt, dbpath);
+  if (!s.ok()) {
+    return s;
+  }
+  return OpenDB(db_opt, dbpath, cfds);
+}
+
+// Data values carry a |timestamp(4)| suffix since the field ttl, and a db
+// with field_ttl_cf is known to be written in that format. An older db is
+// rewritten once before it is opened: every data value gets a zero
+// timestamp, then field_ttl_cf is created. The rewrite commits its cursor
+// into kUpgradeColumnFamily with each batch, so an interrupted upgrade
+// resumes after the last rewritten key instead of suffixing a value twice.
+static const char* kUpgradeColumnFamily = "field_format_upgrade_cf";
+static const char* kUpgradeCursor = "cursor";
+static constexpr int kUpgradeBatchSize = 1024;
+
+static Status RewriteDataValues(rocksdb::DB* db,
+                                rocksdb::ColumnFamilyHandle* data_cf,
+                                rocksdb::ColumnFamilyHandle* upgrade_cf) {
+  std::string cursor;
+  Status s = db->Get(rocksdb::ReadOptions(), upgrade_cf, kUpgradeCursor,
+                     &cursor);
+  if (!s.ok() && !s.IsNotFound()) {
+    return s;
+  }
+  const bool resume = s.ok();
+
+  rocksdb::ReadOptions read_opts;
+  read_opts.fill_cache = false;
+  rocksdb::Iterator* it = db->NewIterator(read_opts, data_cf);
+  ScopeIterator it_guard(&it);
+  if (resume) {
+    it->Seek(cursor);
+    if (it->Valid() && it->key() == Slice(cursor)) {
+      it->Next();
     }
-    delete cf_handle;
-    delete db_;
+  } else {
+    it->SeekToFirst();
   }
 
-  // Reopen
-  rocksdb::DBOptions db_opt(bw_options.options);
+  rocksdb::WriteOptions write_opts;
+  write_opts.sync = true;
+  rocksdb::WriteBatch batch;
+  std::string last_key;
+  const char empty_timestamp[sizeof(int32_t)] = {0};
+  for (; it->Valid(); it->Next()) {
+    std::string value = it->value().ToString();
+    value.append(empty_timestamp, sizeof(empty_timestamp));
+    batch.Put(data_cf, it->key(), value);
+    last_key.assign(it->key().data(), it->key().size());
+    if (batch.Count() >= kUpgradeBatchSize) {
+      batch.Put(upgrade_cf, kUpgradeCursor, last_key);
+      s = db->Write(write_opts, &batch);
+      if (!s.ok()) {
+        return s;
+      }
+      batch.Clear();
+    }
+  }
+  if (!it->status().ok()) {
+    return it->status();
+  }
+  if (batch.Count() > 0) {
+    batch.Put(upgrade_cf, kUpgradeCursor, last_key);
+    s = db->Write(write_opts, &batch);
+  }
+  return s;
+}
+
+Status RedisHashes::UpgradeFieldFormat(const rocksdb::DBOptions& db_options,
+                                       const std::string& dbpath) {
+  std::vector<std::string> existing;
+  if (!rocksdb::DB::ListColumnFamilies(db_options, dbpath, &existing).ok()) {
+    // No db yet.
+    return Status::OK();
+  }
+  auto exists = [&existing](const std::string& name) {
+    return std::find(existing.begin(), existing.end(), name) !=
+           existing.end();
+  };
+  const bool upgrading = exists(kUpgradeColumnFamily);
+  const bool upgraded = exists("field_ttl_cf");
+  if ((upgraded && !upgrading) || !exists("data_cf")) {
+    return Status::OK();
+  }
+
+  // Plain options, the compaction filters and the merge operator expect
+  // the new format.
+  std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+  for (const auto& name : existing) {
+    cfds.emplace_back(name, rocksdb::ColumnFamilyOptions());
+  }
+  if (!upgrading) {
+    cfds.emplace_back(kUpgradeColumnFamily, rocksdb::ColumnFamilyOptions());
+  }
+  rocksdb::DBOptions opts(db_options);
+  opts.create_missing_column_families = true;
+  rocksdb::DB* db = nullptr;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  Status s = rocksdb::DB::Open(opts, dbpath, cfds, &handles, &db);
+  if (!s.ok()) {
+    return s;
+  }
+
+  rocksdb::ColumnFamilyHandle* data_cf = nullptr;
+  rocksdb::ColumnFamilyHandle* upgrade_cf = nullptr;
+  for (auto handle : handles) {
+    if (handle->GetName() == "data_cf") {
+      data_cf = handle;
+    } else if (handle->GetName() == kUpgradeColumnFamily) {
+      upgrade_cf = handle;
+    }
+  }
+  if (!upgraded) {
+    s = RewriteDataValues(db, data_cf, upgrade_cf);
+    if (s.ok()) {
+      rocksdb::ColumnFamilyHandle* field_ttl_cf = nullptr;
+      s = db->CreateColumnFamily(
+        rocksdb::ColumnFamilyOptions(), "field_ttl_cf", &field_ttl_cf);
+      if (s.ok()) {
+        handles.push_back(field_ttl_cf);
+      }
+    }
+  }
+  if (s.ok()) {
+    s = db->DropColumnFamily(upgrade_cf);
+  }
+  for (auto handle : handles) {
+    db->DestroyColumnFamilyHandle(handle);
+  }
+  delete db;
+  return s;
+}
+
+void RedisHashes::PrepareOptions(
+  const BlackWidowOptions& bw_options,
+  rocksdb::DBOptions* db_options,
+  std::vector<rocksdb::ColumnFamilyDescriptor>* cfds) {
+  // TODO FIXME.
+  // statistics_store_->SetCapacity(bw_options.statistics_max_size);
+  // small_compaction_threshold_ = bw_options.small_compaction_threshold;
+  fast_hset_ = bw_options.hashes_fast_hset;
+  command_stats_.SetOptions(bw_options.command_stats,
+                            bw_options.command_stats_block_reads);
 
   rocksdb::BlockBasedTableOptions base_table_opts(bw_options.table_options);
   base_table_opts.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, true));
@@ -44,29 +203,33 @@ Status RedisHashes::Open(const BlackWidowOptions& bw_options,
   if (bw_options.share_block_cache == false &&
       bw_options.block_cache_size > 0) {
     meta_cf_table_opts.block_cache =
-      rocksdb::NewLRUCache(bw_options.block_cache_size);
+      NewBlockCache(bw_options.block_cache_size);
     data_cf_table_opts.block_cache =
-      rocksdb::NewLRUCache(bw_options.block_cache_size);
+      NewBlockCache(bw_options.block_cache_size);
   }
 
   rocksdb::ColumnFamilyOptions meta_cf_opt(bw_options.options);
   meta_cf_opt.compaction_filter_factory.reset(new HashesMetaFilterFactory());
+  meta_cf_opt.table_properties_collector_factories.push_back(
+    std::make_shared<TtlPropertiesCollectorFactory<ParsedHashesMetaValue>>());
   meta_cf_opt.table_factory.reset(
     rocksdb::NewBlockBasedTableFactory(meta_cf_table_opts));
 
   rocksdb::ColumnFamilyOptions data_cf_opt(bw_options.options);
   data_cf_opt.compaction_filter_factory.reset(
-    new HashesDataFilterFactory(&db_, &handles_));
+    new HashesDataFilterFactory(&db_, &handles_, data_meta_cache_));
+  data_cf_opt.merge_operator.reset(new CounterMergeOperator(true));
   data_cf_opt.table_factory.reset(
     rocksdb::NewBlockBasedTableFactory(data_cf_table_opts));
 
-  std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
   // metaCf must be the first
-  cfds.push_back(rocksdb::ColumnFamilyDescriptor(
+  cfds->push_back(rocksdb::ColumnFamilyDescriptor(
     rocksdb::kDefaultColumnFamilyName, meta_cf_opt));
   // dataCf must be the second
-  cfds.push_back(rocksdb::ColumnFamilyDescriptor("data_cf", data_cf_opt));
-  return rocksdb::DB::Open(db_opt, dbpath, cfds, &handles_, &db_);
+  cfds->push_back(rocksdb::ColumnFamilyDescriptor("data_cf", data_cf_opt));
+  // fieldTtlCf must be the third
+  cfds->push_back(rocksdb::ColumnFamilyDescriptor(
+    "field_ttl_cf", rocksdb::ColumnFamilyOptions(bw_options.options)));
 }
 
 
@@ -85,24 +248,39 @@ Status RedisHashes::CompactRange(const Slice* begin,
   return s;
 }
 
-Status RedisHashes::GetProperty(const std::string& property, uint64_t* out) {}
-Status RedisHashes::ScanKeyNum(KeyInfo* key_info) {}
+Status RedisHashes::GetProperty(const std::string& property, uint64_t* out) {
+  return GetIntProperty(property, out);
+}
+
+Status RedisHashes::ScanKeyNum(KeyInfo* key_info) {
+  // TODO
+  return Status::OK();
+}
+
 Status RedisHashes::ScanKeys(const std::string& pattern,
-                             std::vector<std::string>* keys) {}
+                             std::vector<std::string>* keys) {
+  // TODO
+  return Status::OK();
+}
+
 Status RedisHashes::PKPatternMatchDel(const std::string& pattern,
-                                      int32_t* ret) {}
+                                      int32_t* ret) {
+  // TODO
+  return Status::OK();
+}
 
 
 Status RedisHashes::Del(const Slice& key) {
+  CommandTimer timer(&command_stats_, kCmdDel, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
-  Status s = db_->Get(default_read_options_, key, &meta_value);
+  Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
   if (s.ok()) {
     ParsedHashesMetaValue parsed_meta_value(&meta_value);
     if (parsed_meta_value.IsStale()) {
-      return Status::NotFound("Expired");
+      return timer.Done(Status::NotFound("Expired"));
     } else if (parsed_meta_value.hash_size() == 0) {
-      return Status::NotFound();
+      return timer.Done(Status::NotFound());
     } else {
       // NOTE: 这里不能直接Delete, 因为只删除metaKey，dataKey还在
       // 如果同一秒重复创建一个同key的hash, 会导致旧的field出现在新的hash里
@@ -114,10 +292,11 @@ Status RedisHashes::Del(const Slice& key) {
       // TODO UpdateSpecificKeyStatistics(key.ToString(), statistic);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisHashes::Expire(const Slice& key, int32_t ttl) {
+  CommandTimer timer(&command_stats_, kCmdExpire, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
@@ -132,10 +311,11 @@ Status RedisHashes::Expire(const Slice& key, int32_t ttl) {
       s = db_->Put(default_write_options_, HASHES_META, key, meta_value);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisHashes::ExpireAt(const Slice& key, int32_t timestamp) {
+  CommandTimer timer(&command_stats_, kCmdExpireAt, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
@@ -157,10 +337,11 @@ Status RedisHashes::ExpireAt(const Slice& key, int32_t timestamp) {
       s = db_->Put(default_write_options_, HASHES_META, key, meta_value);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisHashes::Persist(const Slice& key) {
+  CommandTimer timer(&command_stats_, kCmdPersist, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
@@ -175,15 +356,16 @@ Status RedisHashes::Persist(const Slice& key) {
       s = db_->Put(default_write_options_, HASHES_META, key, meta_value);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisHashes::TTL(const Slice& key, int64_t* timestamp) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdTTL, key.size());
+  rocksdb::PinnableSlice meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
   if (s.ok()) {
-    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    ParsedHashesMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsStale()) {
       *timestamp = -2;
       return Status::NotFound("Expired");
@@ -205,14 +387,18 @@ Status RedisHashes::TTL(const Slice& key, int64_t* timestamp) {
   } else if (s.IsNotFound()) {
     *timestamp = -2;
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisHashes::HLen(const Slice& key, uint32_t* len) {
+  CommandTimer timer(&command_stats_, kCmdHLen, key.size());
   std::string meta_value;
-  ScopeRecordLock l(lock_mgr_, key);
+  const rocksdb::Snapshot* snapshot = nullptr;
+  ScopeSnapshot ss(db_, &snapshot);
+  rocksdb::ReadOptions read_opts;
+  read_opts.snapshot = snapshot;
   *len = 0;
-  Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+  Status s = db_->Get(read_opts, HASHES_META, key, &meta_value);
   if (s.ok()) {
     ParsedHashesMetaValue parsed_meta_value(&meta_value);
     if (parsed_meta_value.IsStale()) {
@@ -221,29 +407,46 @@ Status RedisHashes::HLen(const Slice& key, uint32_t* len) {
     if (parsed_meta_value.hash_size() == 0) {
       return Status::NotFound();
     }
+    if (parsed_meta_value.IsSizeUnreconciled()) {
+      // 只读地重新计数, 不写回meta, 由写操作和过期field的清理写回
+      s = ReconcileHashSize(key, &parsed_meta_value, snapshot);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
+      if (parsed_meta_value.hash_size() == 0) {
+        return Status::NotFound();
+      }
+    }
     *len = parsed_meta_value.hash_size();
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisHashes::HExists(const Slice& key, const Slice& field) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdHExists, key.size() + field.size());
+  rocksdb::PinnableSlice meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
   if (s.ok()) {
-    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    ParsedHashesMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsStale()) {
       return Status::NotFound("Expired");
     } else if (parsed_meta_value.hash_size() == 0) {
       return Status::NotFound();
     } else {
-      std::string field_value;
+      rocksdb::PinnableSlice field_value;
       HashesDataKey data_key(key, field, parsed_meta_value.version());
       s = db_->Get(
         default_read_options_, HASHES_DATA, data_key.Encode(), &field_value);
+      if (s.ok()) {
+        ParsedHashesDataValue parsed_data_value(field_value);
+        if (parsed_data_value.IsStale()) {
+          return Status::NotFound("Expired");
+        }
+      }
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 
@@ -251,6 +454,8 @@ Status RedisHashes::HSet(const Slice& key,
                          const Slice& field,
                          const Slice& value,
                          int32_t* ret) {
+  CommandTimer timer(
+    &command_stats_, kCmdHSet, key.size() + field.size() + value.size());
   std::string meta_value;
   rocksdb::WriteBatch batch;
   ScopeRecordLock l(lock_mgr_, key);
@@ -261,164 +466,317 @@ Status RedisHashes::HSet(const Slice& key,
       parsed_meta_value.InitialMetaValue();
       parsed_meta_value.set_hash_size(1);
       HashesDataKey data_key(key, field, parsed_meta_value.version());
+      HashesDataValue data_value(value);
       batch.Put(HASHES_META, key, meta_value);
-      batch.Put(HASHES_DATA, data_key.Encode(), value);
+      batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
       s = db_->Write(default_write_options_, &batch);
       if (s.ok() && ret) {
         *ret = 1;
       }
+    } else if (fast_hset_) {
+      // Don't compare the values, a new field is usually ruled out by the
+      // bloom filter without reading it.
+      HashesDataKey data_key(key, field, parsed_meta_value.version());
+      HashesDataValue data_value(value);
+      bool exists = false;
+      s = FieldExists(data_key.Encode(), &exists);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
+      if (!exists) {
+        parsed_meta_value.set_hash_size(parsed_meta_value.hash_size() + 1);
+        batch.Put(HASHES_META, key, meta_value);
+      }
+      batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+      s = db_->Write(default_write_options_, &batch);
+      if (s.ok() && ret) {
+        *ret = exists ? 0 : 1;
+      }
     } else {
       std::string field_value;
       HashesDataKey data_key(key, field, parsed_meta_value.version());
+      HashesDataValue data_value(value);
       s = db_->Get(
         default_read_options_, HASHES_DATA, data_key.Encode(), &field_value);
+      bool field_expired = false;
       if (s.ok()) {
-        // If field exists and field_value was equals to the newer, nothing
-        // todo.
-        if (value.ToString() == field_value) {
-          if (ret) {
+        ParsedHashesDataValue parsed_data_value(&field_value);
+        field_expired = parsed_data_value.IsStale();
+        if (!field_expired) {
+          // If field exists and field_value was equals to the newer, nothing
+          // todo. HSet clears the ttl of the field.
+          if (value == parsed_data_value.user_value() &&
+              parsed_data_value.IsPermanentSurvival()) {
+            if (ret) {
+              *ret = 0;
+            }
+            return Status::OK();
+          }
+          // Replace the old value.
+          s = db_->Put(default_write_options_,
+                       HASHES_DATA,
+                       data_key.Encode(),
+                       data_value.Encode());
+          if (s.ok() && ret) {
             *ret = 0;
           }
-          return Status::OK();
-        }
-        // Replace the old value.
-        s = db_->Put(
-          default_write_options_, HASHES_DATA, data_key.Encode(), value);
-        if (s.ok() && ret) {
-          *ret = 0;
         }
-      } else if (s.IsNotFound()) {
+      }
+      if (s.IsNotFound() || field_expired) {
         // Put the filed-value pair and update the hash_size + 1
         parsed_meta_value.set_hash_size(parsed_meta_value.hash_size() + 1);
         batch.Put(HASHES_META, key, meta_value);
-        batch.Put(HASHES_DATA, data_key.Encode(), value);
+        batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
         s = db_->Write(default_write_options_, &batch);
         if (s.ok() && ret) {
           *ret = 1;
         }
-      } else {
+      } else if (!s.ok()) {
         // error on query field.
-        return s;
+        return timer.Done(s);
       }
     }
   } else if (s.IsNotFound()) {
     HashesMetaValue meta_value(1);
     meta_value.UpdateVersion();
     HashesDataKey data_key(key, field, meta_value.version());
+    HashesDataValue data_value(value);
     batch.Put(HASHES_META, key, meta_value.Encode());
-    batch.Put(HASHES_DATA, data_key.Encode(), value);
+    batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
     s = db_->Write(default_write_options_, &batch);
     if (s.ok() && ret) {
       *ret = 1;
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 
 Status RedisHashes::HGet(const Slice& key,
                          const Slice& field,
                          std::string* value) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdHGet, key.size() + field.size());
+  timer.SetOutput(value);
+  rocksdb::PinnableSlice pinned_value;
+  Status s = GetField(key, field, &pinned_value);
+  if (s.ok()) {
+    value->assign(pinned_value.data(), pinned_value.size());
+  } else {
+    value->clear();
+  }
+  return timer.Done(s);
+}
+
+Status RedisHashes::HGet(const Slice& key,
+                         const Slice& field,
+                         rocksdb::PinnableSlice* value) {
+  CommandTimer timer(&command_stats_, kCmdHGet, key.size() + field.size());
+  Status s = GetField(key, field, value);
+  if (s.ok()) {
+    timer.AddBytesOut(value->size());
+  }
+  return timer.Done(s);
+}
+
+Status RedisHashes::GetField(const Slice& key,
+                             const Slice& field,
+                             rocksdb::PinnableSlice* value) {
+  rocksdb::PinnableSlice meta_value;
   const rocksdb::Snapshot* snapshot = nullptr;
   ScopeSnapshot guard(db_, &snapshot);
   rocksdb::ReadOptions read_opts;
   read_opts.snapshot = snapshot;
+  value->Reset();
   Status s = db_->Get(read_opts, HASHES_META, key, &meta_value);
-  if (s.ok()) {
-    ParsedHashesMetaValue parsed_meta_value(&meta_value);
-    if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
-      value->clear();
-      return Status::NotFound();
-    } else {
-      HashesDataKey data_key(key, field, parsed_meta_value.version());
-      return db_->Get(read_opts, HASHES_DATA, data_key.Encode(), value);
-    }
-  } else if (s.IsNotFound()) {
-    value->clear();
+  if (!s.ok()) {
+    return s;
+  }
+  ParsedHashesMetaValue parsed_meta_value(meta_value);
+  if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
+    return Status::NotFound();
   }
+  HashesDataKey data_key(key, field, parsed_meta_value.version());
+  s = db_->Get(read_opts, HASHES_DATA, data_key.Encode(), value);
+  if (!s.ok()) {
+    return s;
+  }
+  ParsedHashesDataValue parsed_data_value(*value);
+  if (parsed_data_value.IsStale()) {
+    value->Reset();
+    return Status::NotFound("Expired");
+  }
+  // 在pinned的value上去掉后缀, 不拷贝
+  value->remove_suffix(ParsedHashesDataValue::kHashesDataValueSuffixLength);
   return s;
 }
 
 Status RedisHashes::HGetAll(const Slice& key, std::vector<FieldValue>* fvs) {
-  std::string meta_value;
-  rocksdb::ReadOptions read_opts;
+  CommandTimer timer(&command_stats_, kCmdHGetAll, key.size());
+  timer.SetOutput(fvs);
+  fvs->clear();
+  return timer.Done(ScanFields(
+    key,
+    [fvs](uint32_t hash_size) { fvs->reserve(hash_size); },
+    [fvs](const Slice& field, const Slice& value) {
+      FieldValue& fv = fvs->emplace_back();
+      fv.field.assign(field.data(), field.size());
+      fv.value.assign(value.data(), value.size());
+      return true;
+    }));
+}
+
+Status RedisHashes::HGetAll(const Slice& key,
+                            const HashSizeVisitor& size_visitor,
+                            const FieldValueVisitor& visitor) {
+  CommandTimer timer(&command_stats_, kCmdHGetAll, key.size());
+  return timer.Done(ScanFields(
+    key, size_visitor, [&](const Slice& field, const Slice& value) {
+      timer.AddBytesOut(field.size() + value.size());
+      return visitor(field, value);
+    }));
+}
+
+Status RedisHashes::HVals(const Slice& key, std::vector<std::string>* vals) {
+  CommandTimer timer(&command_stats_, kCmdHVals, key.size());
+  timer.SetOutput(vals);
+  vals->clear();
+  return timer.Done(ScanFields(
+    key,
+    [vals](uint32_t hash_size) { vals->reserve(hash_size); },
+    [vals](const Slice& field, const Slice& value) {
+      vals->emplace_back(value.data(), value.size());
+      return true;
+    }));
+}
+
+Status RedisHashes::ScanFields(const Slice& key,
+                               const HashSizeVisitor& size_visitor,
+                               const FieldValueVisitor& visitor) {
+  rocksdb::PinnableSlice meta_value;
   const rocksdb::Snapshot* snapshot = nullptr;
   ScopeSnapshot guard(db_, &snapshot);
+  rocksdb::ReadOptions read_opts;
   read_opts.snapshot = snapshot;
   Status s = db_->Get(read_opts, HASHES_META, key, &meta_value);
-  if (s.ok()) {
-    ParsedHashesMetaValue parsed_meta_value(&meta_value);
-    if (parsed_meta_value.IsStale()) {
-      fvs->clear();
-      return Status::NotFound("Expired");
-    } else if (parsed_meta_value.hash_size() == 0) {
-      fvs->clear();
-      return Status::NotFound();
-    } else {
-      fvs->clear();
-      // <keysize><key><version><field>
-      HashesDataKey data_key(key, "", parsed_meta_value.version());
-      const Slice prefix = data_key.Encode();
-      rocksdb::Iterator* it = db_->NewIterator(read_opts, HASHES_DATA);
-      for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
-           it->Next()) {
-        ParsedHashesDataKey parsed_data_key(it->key());
-        fvs->push_back(
-          {parsed_data_key.field().ToString(), it->value().ToString()});
-      }
-      delete it;
+  if (!s.ok()) {
+    return s;
+  }
+
+  ParsedHashesMetaValue parsed_meta_value(meta_value);
+  if (parsed_meta_value.IsStale()) {
+    return Status::NotFound("Expired");
+  } else if (parsed_meta_value.hash_size() == 0) {
+    return Status::NotFound();
+  }
+  uint32_t hash_size = parsed_meta_value.hash_size();
+  if (size_visitor) {
+    size_visitor(hash_size);
+  }
+
+  // <keysize><key><version><field>, all fields of this version share the
+  // prefix, so bound the iterator right behind it instead of checking
+  // starts_with on every step and reading into the next hash's blocks.
+  HashesDataKey data_key(key, "", parsed_meta_value.version());
+  const Slice prefix = data_key.Encode();
+  std::string upper_bound;
+  Slice upper_bound_slice;
+  if (PrefixSuccessor(prefix.data(), prefix.size(), &upper_bound)) {
+    upper_bound_slice = Slice(upper_bound);
+    read_opts.iterate_upper_bound = &upper_bound_slice;
+  }
+  read_opts.pin_data = true;
+  if (hash_size >= kHashesReadaheadThreshold) {
+    read_opts.readahead_size = kHashesReadaheadSize;
+  }
+
+  bool visited = false;
+  rocksdb::Iterator* it = db_->NewIterator(read_opts, HASHES_DATA);
+  ScopeIterator it_guard(&it);
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    ParsedHashesDataValue parsed_data_value(it->value());
+    if (parsed_data_value.IsStale()) {
+      continue;
+    }
+    visited = true;
+    ParsedHashesDataKey parsed_data_key(it->key());
+    if (!visitor(parsed_data_key.field(), parsed_data_value.user_value())) {
+      break;
     }
-  } else if (s.IsNotFound()) {
-    fvs->clear();
   }
-  return s;
+  if (it->status().ok() && !visited) {
+    // Every field has expired.
+    return Status::NotFound();
+  }
+  return it->status();
 }
 
+Status RedisHashes::FieldExists(const Slice& data_key, bool* exists) {
+  *exists = false;
+  std::string field_value;
+  bool value_found = false;
+  if (!db_->KeyMayExist(default_read_options_, HASHES_DATA, data_key,
+                        &field_value, &value_found)) {
+    return Status::OK();
+  }
+  if (!value_found) {
+    Status s =
+      db_->Get(default_read_options_, HASHES_DATA, data_key, &field_value);
+    if (s.IsNotFound()) {
+      return Status::OK();
+    } else if (!s.ok()) {
+      return s;
+    }
+  }
+  ParsedHashesDataValue parsed_data_value(&field_value);
+  *exists = !parsed_data_value.IsStale();
+  return Status::OK();
+}
 
-Status RedisHashes::HVals(const Slice& key, std::vector<std::string>* vals) {
-  std::string meta_value;
-  const rocksdb::Snapshot* snapshot = nullptr;
-  ScopeSnapshot ss(db_, &snapshot);
+Status RedisHashes::ReconcileHashSize(
+  const Slice& key,
+  ParsedHashesMetaValue* parsed_meta_value,
+  const rocksdb::Snapshot* snapshot) {
+  HashesDataKey data_key(key, "", parsed_meta_value->version());
+  const Slice prefix = data_key.Encode();
+  std::string upper_bound;
+  Slice upper_bound_slice;
   rocksdb::ReadOptions read_opts;
   read_opts.snapshot = snapshot;
-  Status s = db_->Get(read_opts, HASHES_META, key, &meta_value);
-  if (s.ok()) {
-    ParsedHashesMetaValue parsed_meta_value(&meta_value);
-    if (parsed_meta_value.IsStale()) {
-      vals->clear();
-      return Status::NotFound("Expired");
-    } else if (parsed_meta_value.hash_size() == 0) {
-      vals->clear();
-      return Status::NotFound();
-    } else {
-      HashesDataKey data_key(key, "", parsed_meta_value.version());
-      Slice prefix = data_key.Encode();
-      rocksdb::Iterator* it = db_->NewIterator(read_opts, HASHES_DATA);
-      for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
-           it->Next()) {
-        vals->push_back(it->value().ToString());
-      }
-      delete it;
+  if (PrefixSuccessor(prefix.data(), prefix.size(), &upper_bound)) {
+    upper_bound_slice = Slice(upper_bound);
+    read_opts.iterate_upper_bound = &upper_bound_slice;
+  }
+  read_opts.fill_cache = false;
+
+  uint32_t hash_size = 0;
+  bool has_field_ttl = false;
+  rocksdb::Iterator* it = db_->NewIterator(read_opts, HASHES_DATA);
+  ScopeIterator it_guard(&it);
+  for (it->Seek(prefix); it->Valid(); it->Next()) {
+    ParsedHashesDataValue parsed_data_value(it->value());
+    if (!parsed_data_value.IsStale()) {
+      hash_size++;
+      has_field_ttl |= !parsed_data_value.IsPermanentSurvival();
     }
-  } else if (s.IsNotFound()) {
-    vals->clear();
   }
-  return s;
+  if (!it->status().ok()) {
+    return it->status();
+  }
+  // Fields with ttl can still expire behind the count.
+  parsed_meta_value->SetSizeUnreconciled(has_field_ttl);
+  parsed_meta_value->set_hash_size(hash_size);
+  return Status::OK();
 }
 
 Status RedisHashes::HDel(const Slice& key,
                          const std::vector<std::string>& fields,
                          int32_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdHDel, key.size() + BytesOf(fields));
   if (fields.size() == 0) {
     *ret = 0;
     return Status::OK();
   }
 
-  // remove duplicated
-  std::unordered_set<std::string> filters(fields.begin(), fields.end());
-  std::vector<std::string> filted_fields(filters.begin(), filters.end());
-
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   rocksdb::WriteBatch batch;
@@ -430,17 +788,37 @@ Status RedisHashes::HDel(const Slice& key,
       return Status::OK();
     } else {
       *ret = 0;
-      std::string field_value;
-      for (const auto& f : filted_fields) {
-        HashesDataKey data_key(key, f, parsed_meta_value.version());
-        s = db_->Get(
-          default_read_options_, HASHES_DATA, data_key.Encode(), &field_value);
-        if (s.ok()) {
-          (*ret)++;
-          batch.Delete(HASHES_DATA, data_key.Encode());
-        } else if (!s.IsNotFound()) {
+      if (parsed_meta_value.IsSizeUnreconciled()) {
+        s = ReconcileHashSize(key, &parsed_meta_value);
+        if (!s.ok()) {
+          return timer.Done(s);
+        }
+        batch.Put(HASHES_META, key, meta_value);
+      }
+      std::vector<std::string> data_keys;
+      EncodeSortedDataKeys(
+        key, parsed_meta_value.version(), fields, &data_keys);
+      std::vector<Slice> keys(data_keys.begin(), data_keys.end());
+      std::vector<rocksdb::PinnableSlice> values(keys.size());
+      std::vector<Status> statuses(keys.size());
+      db_->MultiGet(default_read_options_,
+                    HASHES_DATA,
+                    keys.size(),
+                    keys.data(),
+                    values.data(),
+                    statuses.data(),
+                    true);
+      for (size_t idx = 0; idx < keys.size(); idx++) {
+        if (statuses[idx].ok()) {
+          // Expired fields are not counted, only drop them.
+          ParsedHashesDataValue parsed_data_value(values[idx]);
+          if (!parsed_data_value.IsStale()) {
+            (*ret)++;
+          }
+          batch.Delete(HASHES_DATA, keys[idx]);
+        } else if (!statuses[idx].IsNotFound()) {
           *ret = 0;
-          return s;
+          return timer.Done(statuses[idx]);
         }
       }
       if (*ret > 0) {
@@ -450,6 +828,10 @@ Status RedisHashes::HDel(const Slice& key,
         if (!s.ok()) {
           *ret = 0;
         }
+      } else if (batch.Count() > 0) {
+        // Nothing counted was deleted, still persist the recounted hash size
+        // and drop the expired fields.
+        return timer.Done(db_->Write(default_write_options_, &batch));
       } else {
         return Status::OK();
       }
@@ -458,13 +840,429 @@ Status RedisHashes::HDel(const Slice& key,
     *ret = 0;
     return Status::OK();
   }
-  return s;
+  return timer.Done(s);
+}
+
+Status RedisHashes::HSetNx(const Slice& key,
+                           const Slice& field,
+                           const Slice& value,
+                           int32_t* ret) {
+  CommandTimer timer(
+    &command_stats_, kCmdHSetNx, key.size() + field.size() + value.size());
+  *ret = 0;
+  std::string meta_value;
+  rocksdb::WriteBatch batch;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+  if (s.ok()) {
+    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
+      parsed_meta_value.InitialMetaValue();
+      parsed_meta_value.set_hash_size(1);
+      HashesDataKey data_key(key, field, parsed_meta_value.version());
+      HashesDataValue data_value(value);
+      batch.Put(HASHES_META, key, meta_value);
+      batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+    } else {
+      std::string field_value;
+      HashesDataKey data_key(key, field, parsed_meta_value.version());
+      s = db_->Get(
+        default_read_options_, HASHES_DATA, data_key.Encode(), &field_value);
+      if (s.ok()) {
+        ParsedHashesDataValue parsed_data_value(&field_value);
+        if (!parsed_data_value.IsStale()) {
+          // Field already exists, nothing todo.
+          return Status::OK();
+        }
+      } else if (!s.IsNotFound()) {
+        return timer.Done(s);
+      }
+      HashesDataValue data_value(value);
+      parsed_meta_value.set_hash_size(parsed_meta_value.hash_size() + 1);
+      batch.Put(HASHES_META, key, meta_value);
+      batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+    }
+  } else if (s.IsNotFound()) {
+    HashesMetaValue hashes_meta_value(1);
+    hashes_meta_value.UpdateVersion();
+    HashesDataKey data_key(key, field, hashes_meta_value.version());
+    HashesDataValue data_value(value);
+    batch.Put(HASHES_META, key, hashes_meta_value.Encode());
+    batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+  } else {
+    return timer.Done(s);
+  }
+
+  s = db_->Write(default_write_options_, &batch);
+  if (s.ok()) {
+    *ret = 1;
+  }
+  return timer.Done(s);
+}
+
+Status RedisHashes::HMSet(const Slice& key,
+                          const std::vector<FieldValue>& fvs) {
+  CommandTimer timer(&command_stats_, kCmdHMSet, key.size() + BytesOf(fvs));
+  if (fvs.size() == 0) {
+    return Status::OK();
+  }
+
+  // The last value wins when a field is given more than once. std::map
+  // keeps the fields sorted, which MultiGet(sorted_input=true) relies on.
+  std::map<std::string, Slice> field_values;
+  for (auto it = fvs.rbegin(); it != fvs.rend(); ++it) {
+    field_values.emplace(it->field, it->value);
+  }
+
+  std::string meta_value;
+  rocksdb::WriteBatch batch;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+  if (s.ok()) {
+    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
+      parsed_meta_value.InitialMetaValue();
+      parsed_meta_value.set_hash_size(field_values.size());
+      for (const auto& fv : field_values) {
+        HashesDataKey data_key(key, fv.first, parsed_meta_value.version());
+        HashesDataValue data_value(fv.second);
+        batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+      }
+      batch.Put(HASHES_META, key, meta_value);
+    } else {
+      std::vector<std::string> data_keys;
+      data_keys.reserve(field_values.size());
+      for (const auto& fv : field_values) {
+        HashesDataKey data_key(key, fv.first, parsed_meta_value.version());
+        data_keys.push_back(data_key.Encode().ToString());
+      }
+      std::vector<Slice> keys(data_keys.begin(), data_keys.end());
+      std::vector<rocksdb::PinnableSlice> values(keys.size());
+      std::vector<Status> statuses(keys.size());
+      db_->MultiGet(default_read_options_,
+                    HASHES_DATA,
+                    keys.size(),
+                    keys.data(),
+                    values.data(),
+                    statuses.data(),
+                    true);
+
+      uint32_t added = 0;
+      size_t idx = 0;
+      for (const auto& fv : field_values) {
+        HashesDataValue data_value(fv.second);
+        if (statuses[idx].ok()) {
+          ParsedHashesDataValue parsed_data_value(values[idx]);
+          if (parsed_data_value.IsStale()) {
+            added++;
+            batch.Put(HASHES_DATA, keys[idx], data_value.Encode());
+          } else if (fv.second.compare(parsed_data_value.user_value()) != 0 ||
+                     !parsed_data_value.IsPermanentSurvival()) {
+            // Skip the rewrite if neither the value nor the ttl changes.
+            batch.Put(HASHES_DATA, keys[idx], data_value.Encode());
+          }
+        } else if (statuses[idx].IsNotFound()) {
+          added++;
+          batch.Put(HASHES_DATA, keys[idx], data_value.Encode());
+        } else {
+          return timer.Done(statuses[idx]);
+        }
+        idx++;
+      }
+      if (added > 0) {
+        parsed_meta_value.set_hash_size(parsed_meta_value.hash_size() + added);
+        batch.Put(HASHES_META, key, meta_value);
+      }
+      if (batch.Count() == 0) {
+        return Status::OK();
+      }
+    }
+  } else if (s.IsNotFound()) {
+    HashesMetaValue hashes_meta_value(field_values.size());
+    hashes_meta_value.UpdateVersion();
+    for (const auto& fv : field_values) {
+      HashesDataKey data_key(key, fv.first, hashes_meta_value.version());
+      HashesDataValue data_value(fv.second);
+      batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+    }
+    batch.Put(HASHES_META, key, hashes_meta_value.Encode());
+  } else {
+    return timer.Done(s);
+  }
+  return timer.Done(db_->Write(default_write_options_, &batch));
+}
+
+Status RedisHashes::HMGet(const Slice& key,
+                          const std::vector<std::string>& fields,
+                          std::vector<ValueStatus>* vss) {
+  CommandTimer timer(&command_stats_, kCmdHMGet, key.size() + BytesOf(fields));
+  timer.SetOutput(vss);
+  vss->clear();
+  vss->resize(fields.size());
+
+  rocksdb::PinnableSlice meta_value;
+  const rocksdb::Snapshot* snapshot = nullptr;
+  ScopeSnapshot ss(db_, &snapshot);
+  rocksdb::ReadOptions read_opts;
+  read_opts.snapshot = snapshot;
+  Status s = db_->Get(read_opts, HASHES_META, key, &meta_value);
+  if (s.ok()) {
+    ParsedHashesMetaValue parsed_meta_value(meta_value);
+    if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
+      s = Status::NotFound();
+    } else {
+      // Look the fields up in key order and scatter the results back into
+      // the order they were asked for.
+      std::vector<size_t> order(fields.size());
+      for (size_t idx = 0; idx < order.size(); idx++) {
+        order[idx] = idx;
+      }
+      std::sort(order.begin(), order.end(), [&fields](size_t a, size_t b) {
+        return fields[a] < fields[b];
+      });
+
+      std::vector<std::string> data_keys;
+      data_keys.reserve(fields.size());
+      for (size_t idx : order) {
+        HashesDataKey data_key(key, fields[idx], parsed_meta_value.version());
+        data_keys.push_back(data_key.Encode().ToString());
+      }
+      std::vector<Slice> keys(data_keys.begin(), data_keys.end());
+      std::vector<rocksdb::PinnableSlice> values(keys.size());
+      std::vector<Status> statuses(keys.size());
+      db_->MultiGet(read_opts,
+                    HASHES_DATA,
+                    keys.size(),
+                    keys.data(),
+                    values.data(),
+                    statuses.data(),
+                    true);
+      for (size_t idx = 0; idx < order.size(); idx++) {
+        ValueStatus& vs = (*vss)[order[idx]];
+        vs.status = statuses[idx];
+        if (statuses[idx].ok()) {
+          ParsedHashesDataValue parsed_data_value(values[idx]);
+          if (parsed_data_value.IsStale()) {
+            vs.status = Status::NotFound("Expired");
+          } else {
+            Slice user_value = parsed_data_value.user_value();
+            vs.value.assign(user_value.data(), user_value.size());
+          }
+        }
+      }
+      return Status::OK();
+    }
+  }
+
+  if (s.IsNotFound()) {
+    for (auto& vs : *vss) {
+      vs.status = Status::NotFound();
+    }
+  }
+  return timer.Done(s);
+}
+
+// Read-modify-write of one field, the caller holds the record lock.
+// `get_new_value` computes the new value from the current one, which is
+// nullptr when the field or the hash does not exist. The ttl of a live field
+// is kept.
+template <typename NewValueFunc>
+static Status UpdateField(rocksdb::DB* db,
+                          rocksdb::ColumnFamilyHandle* meta_cf,
+                          rocksdb::ColumnFamilyHandle* data_cf,
+                          const rocksdb::ReadOptions& read_options,
+                          const rocksdb::WriteOptions& write_options,
+                          const Slice& key,
+                          const Slice& field,
+                          NewValueFunc get_new_value) {
+  std::string meta_value;
+  std::string new_value;
+  int32_t timestamp = 0;
+  rocksdb::WriteBatch batch;
+  Status s = db->Get(read_options, meta_cf, key, &meta_value);
+  if (s.ok()) {
+    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
+      parsed_meta_value.InitialMetaValue();
+      s = get_new_value(nullptr, &new_value);
+      if (!s.ok()) {
+        return s;
+      }
+      parsed_meta_value.set_hash_size(1);
+      HashesDataKey data_key(key, field, parsed_meta_value.version());
+      HashesDataValue data_value(new_value);
+      batch.Put(meta_cf, key, meta_value);
+      batch.Put(data_cf, data_key.Encode(), data_value.Encode());
+    } else {
+      std::string old_value;
+      HashesDataKey data_key(key, field, parsed_meta_value.version());
+      s = db->Get(read_options, data_cf, data_key.Encode(), &old_value);
+      bool field_expired = false;
+      if (s.ok()) {
+        ParsedHashesDataValue parsed_data_value(&old_value);
+        field_expired = parsed_data_value.IsStale();
+        if (!field_expired) {
+          Slice old_value_slice = parsed_data_value.user_value();
+          s = get_new_value(&old_value_slice, &new_value);
+          if (!s.ok()) {
+            return s;
+          }
+          timestamp = parsed_data_value.timestamp();
+        }
+      }
+      if (s.IsNotFound() || field_expired) {
+        s = get_new_value(nullptr, &new_value);
+        if (!s.ok()) {
+          return s;
+        }
+        parsed_meta_value.set_hash_size(parsed_meta_value.hash_size() + 1);
+        batch.Put(meta_cf, key, meta_value);
+      } else if (!s.ok()) {
+        return s;
+      }
+      HashesDataValue data_value(new_value);
+      data_value.set_timestamp(timestamp);
+      batch.Put(data_cf, data_key.Encode(), data_value.Encode());
+    }
+  } else if (s.IsNotFound()) {
+    s = get_new_value(nullptr, &new_value);
+    if (!s.ok()) {
+      return s;
+    }
+    HashesMetaValue hashes_meta_value(1);
+    hashes_meta_value.UpdateVersion();
+    HashesDataKey data_key(key, field, hashes_meta_value.version());
+    HashesDataValue data_value(new_value);
+    batch.Put(meta_cf, key, hashes_meta_value.Encode());
+    batch.Put(data_cf, data_key.Encode(), data_value.Encode());
+  } else {
+    return s;
+  }
+  return db->Write(write_options, &batch);
+}
+
+Status RedisHashes::HIncrBy(const Slice& key,
+                            const Slice& field,
+                            int64_t value,
+                            int64_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdHIncrBy, key.size() + field.size());
+  *ret = 0;
+  int64_t new_num = 0;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = UpdateField(
+    db_, HASHES_META, HASHES_DATA, default_read_options_,
+    default_write_options_, key, field,
+    [value, &new_num](const Slice* old_value, std::string* new_value) {
+      int64_t old_num = 0;
+      if (old_value != nullptr &&
+          StrToInt64(old_value->data(), old_value->size(), &old_num) != 0) {
+        return Status::InvalidArgument("hash value is not an integer");
+      }
+      if (__builtin_add_overflow(old_num, value, &new_num)) {
+        return Status::InvalidArgument("Overflow");
+      }
+      *new_value = std::to_string(new_num);
+      return Status::OK();
+    });
+  if (s.ok()) {
+    *ret = new_num;
+  }
+  return timer.Done(s);
+}
+
+Status RedisHashes::HIncrByFloat(const Slice& key,
+                                 const Slice& field,
+                                 const Slice& by,
+                                 std::string* new_value) {
+  CommandTimer timer(&command_stats_, kCmdHIncrByFloat,
+                     key.size() + field.size() + by.size());
+  timer.SetOutput(new_value);
+  new_value->clear();
+  long double delta = 0;
+  if (StrToLongDouble(by.data(), by.size(), &delta) != 0) {
+    return timer.Done(Status::InvalidArgument("value is not a valid float"));
+  }
+
+  std::string result;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = UpdateField(
+    db_, HASHES_META, HASHES_DATA, default_read_options_,
+    default_write_options_, key, field,
+    [delta, &result](const Slice* old_value, std::string* value) {
+      long double old_num = 0;
+      if (old_value != nullptr &&
+          StrToLongDouble(
+            old_value->data(), old_value->size(), &old_num) != 0) {
+        return Status::InvalidArgument("value is not a valid float");
+      }
+      if (LongDoubleToStr(old_num + delta, value) != 0) {
+        return Status::InvalidArgument("Overflow");
+      }
+      result = *value;
+      return Status::OK();
+    });
+  if (s.ok()) {
+    *new_value = std::move(result);
+  }
+  return timer.Done(s);
+}
+
+Status RedisHashes::HIncrByBlind(const Slice& key,
+                                 const Slice& field,
+                                 int64_t value) {
+  CommandTimer timer(
+    &command_stats_, kCmdHIncrByBlind, key.size() + field.size());
+  std::string meta_value;
+  rocksdb::WriteBatch batch;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+  if (s.ok()) {
+    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
+      parsed_meta_value.InitialMetaValue();
+      parsed_meta_value.set_hash_size(1);
+      HashesDataKey data_key(key, field, parsed_meta_value.version());
+      HashesDataValue data_value(std::to_string(value));
+      batch.Put(HASHES_META, key, meta_value);
+      batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+    } else {
+      // Only a new field is counted and put, an existing one gets the delta
+      // merged without reading it.
+      HashesDataKey data_key(key, field, parsed_meta_value.version());
+      bool exists = false;
+      s = FieldExists(data_key.Encode(), &exists);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
+      if (exists) {
+        batch.Merge(HASHES_DATA,
+                    data_key.Encode(),
+                    CounterMergeOperator::EncodeIntOperand(value));
+      } else {
+        parsed_meta_value.set_hash_size(parsed_meta_value.hash_size() + 1);
+        HashesDataValue data_value(std::to_string(value));
+        batch.Put(HASHES_META, key, meta_value);
+        batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+      }
+    }
+  } else if (s.IsNotFound()) {
+    HashesMetaValue hashes_meta_value(1);
+    hashes_meta_value.UpdateVersion();
+    HashesDataKey data_key(key, field, hashes_meta_value.version());
+    HashesDataValue data_value(std::to_string(value));
+    batch.Put(HASHES_META, key, hashes_meta_value.Encode());
+    batch.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+  } else {
+    return timer.Done(s);
+  }
+  return timer.Done(db_->Write(default_write_options_, &batch));
 }
 
 Status RedisHashes::HStrlen(const Slice& key,
                             const Slice& field,
                             int32_t* len) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdHStrlen, key.size() + field.size());
+  rocksdb::PinnableSlice meta_value;
   const rocksdb::Snapshot* snapshot = nullptr;
   ScopeSnapshot ss(db_, &snapshot);
   rocksdb::ReadOptions read_opts;
@@ -472,27 +1270,328 @@ Status RedisHashes::HStrlen(const Slice& key,
   *len = 0;
   Status s = db_->Get(read_opts, HASHES_META, key, &meta_value);
   if (s.ok()) {
-    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    ParsedHashesMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsStale()) {
       return Status::NotFound("Expired");
     } else if (parsed_meta_value.hash_size() == 0) {
       return Status::NotFound();
     } else {
-      std::string field_value;
+      rocksdb::PinnableSlice field_value;
       HashesDataKey data_key(key, field, parsed_meta_value.version());
       s = db_->Get(read_opts, HASHES_DATA, data_key.Encode(), &field_value);
       if (s.ok()) {
-        *len = field_value.size();
+        ParsedHashesDataValue parsed_data_value(field_value);
+        if (parsed_data_value.IsStale()) {
+          return Status::NotFound("Expired");
+        }
+        *len = parsed_data_value.user_value().size();
       }
     }
   }
-  return s;
+  return timer.Done(s);
+}
+
+
+Status RedisHashes::HExpire(const Slice& key,
+                            const Slice& field,
+                            int32_t ttl) {
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
+  return HExpireAt(key, field, static_cast<int32_t>(now) + ttl);
 }
 
+Status RedisHashes::HExpireAt(const Slice& key,
+                              const Slice& field,
+                              int32_t timestamp) {
+  CommandTimer timer(&command_stats_, kCmdHExpireAt, key.size() + field.size());
+  std::string meta_value;
+  rocksdb::WriteBatch batch;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedHashesMetaValue parsed_meta_value(&meta_value);
+  if (parsed_meta_value.IsStale()) {
+    return Status::NotFound("Expired");
+  } else if (parsed_meta_value.hash_size() == 0) {
+    return Status::NotFound();
+  }
+
+  std::string field_value;
+  HashesDataKey data_key(key, field, parsed_meta_value.version());
+  s = db_->Get(
+    default_read_options_, HASHES_DATA, data_key.Encode(), &field_value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedHashesDataValue parsed_data_value(&field_value);
+  if (parsed_data_value.IsStale()) {
+    return Status::NotFound("Expired");
+  }
+
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
+  if (timestamp <= now) {
+    // NOTE: 直接删除field, 计数不准的hash先重新计数, 避免hash_size减到0
+    if (parsed_meta_value.IsSizeUnreconciled()) {
+      s = ReconcileHashSize(key, &parsed_meta_value);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
+    }
+    if (parsed_meta_value.hash_size() > 0) {
+      parsed_meta_value.set_hash_size(parsed_meta_value.hash_size() - 1);
+    }
+    batch.Delete(HASHES_DATA, data_key.Encode());
+    batch.Put(HASHES_META, key, meta_value);
+  } else {
+    parsed_data_value.set_timestamp(timestamp);
+    batch.Put(HASHES_DATA, data_key.Encode(), field_value);
+    HashesFieldTtlKey ttl_key(timestamp, data_key.Encode());
+    batch.Put(HASHES_FIELD_TTL, ttl_key.Encode(), Slice());
+    // The field may expire without touching the meta, HLen has to recount.
+    if (!parsed_meta_value.IsSizeUnreconciled()) {
+      parsed_meta_value.SetSizeUnreconciled(true);
+      batch.Put(HASHES_META, key, meta_value);
+    }
+  }
+  return timer.Done(db_->Write(default_write_options_, &batch));
+}
+
+Status RedisHashes::HPersist(const Slice& key, const Slice& field) {
+  CommandTimer timer(&command_stats_, kCmdHPersist, key.size() + field.size());
+  std::string meta_value;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedHashesMetaValue parsed_meta_value(&meta_value);
+  if (parsed_meta_value.IsStale()) {
+    return Status::NotFound("Expired");
+  } else if (parsed_meta_value.hash_size() == 0) {
+    return Status::NotFound();
+  }
+
+  std::string field_value;
+  HashesDataKey data_key(key, field, parsed_meta_value.version());
+  s = db_->Get(
+    default_read_options_, HASHES_DATA, data_key.Encode(), &field_value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedHashesDataValue parsed_data_value(&field_value);
+  if (parsed_data_value.IsStale()) {
+    return Status::NotFound("Expired");
+  } else if (parsed_data_value.IsPermanentSurvival()) {
+    return Status::OK();
+  }
+  // The index entry is left behind, the sweeper skips it.
+  parsed_data_value.set_timestamp(0);
+  return timer.Done(db_->Put(
+    default_write_options_, HASHES_DATA, data_key.Encode(), field_value));
+}
+
+Status RedisHashes::HTTL(const Slice& key, const Slice& field, int64_t* ttl) {
+  CommandTimer timer(&command_stats_, kCmdHTTL, key.size() + field.size());
+  *ttl = -2;
+  rocksdb::PinnableSlice meta_value;
+  const rocksdb::Snapshot* snapshot = nullptr;
+  ScopeSnapshot ss(db_, &snapshot);
+  rocksdb::ReadOptions read_opts;
+  read_opts.snapshot = snapshot;
+  Status s = db_->Get(read_opts, HASHES_META, key, &meta_value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedHashesMetaValue parsed_meta_value(meta_value);
+  if (parsed_meta_value.IsStale()) {
+    return Status::NotFound("Expired");
+  } else if (parsed_meta_value.hash_size() == 0) {
+    return Status::NotFound();
+  }
+
+  rocksdb::PinnableSlice field_value;
+  HashesDataKey data_key(key, field, parsed_meta_value.version());
+  s = db_->Get(read_opts, HASHES_DATA, data_key.Encode(), &field_value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedHashesDataValue parsed_data_value(field_value);
+  if (parsed_data_value.IsStale()) {
+    return Status::NotFound("Expired");
+  } else if (parsed_data_value.IsPermanentSurvival()) {
+    *ttl = -1;
+  } else {
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    *ttl = parsed_data_value.timestamp() - now;
+  }
+  return Status::OK();
+}
+
+MetaLookupStats RedisHashes::GetDataFilterStats() const {
+  return data_meta_cache_->GetStats();
+}
+
+Status RedisHashes::BulkLoad(std::vector<KeyFieldValues>* kfvs) {
+  // Equal keys and fields keep their input order, the last one wins.
+  std::stable_sort(kfvs->begin(), kfvs->end(),
+                   [](const KeyFieldValues& a, const KeyFieldValues& b) {
+                     return a.key < b.key;
+                   });
+  std::vector<std::string> keys;
+  for (const auto& kfv : *kfvs) {
+    keys.push_back(kfv.key);
+  }
+  // The versions read below must stay the newest until the ssts are in.
+  MultiScopedRecordLock l(lock_mgr_, keys);
+
+  BulkLoader loader(db_);
+  std::string meta_value;
+  for (size_t i = 0; i < kfvs->size(); i++) {
+    if (i + 1 < kfvs->size() && (*kfvs)[i + 1].key == (*kfvs)[i].key) {
+      continue;
+    }
+    const std::string& key = (*kfvs)[i].key;
+    std::vector<FieldValue>& fvs = (*kfvs)[i].fvs;
+    std::stable_sort(fvs.begin(), fvs.end(),
+                     [](const FieldValue& a, const FieldValue& b) {
+                       return a.field < b.field;
+                     });
+    uint32_t hash_size = 0;
+    for (size_t j = 0; j < fvs.size(); j++) {
+      if (j + 1 == fvs.size() || fvs[j + 1].field != fvs[j].field) {
+        hash_size++;
+      }
+    }
+
+    int32_t version = 0;
+    Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+    if (s.ok()) {
+      // Like a Del followed by a HMSet, the old fields are left to the
+      // data filter.
+      ParsedHashesMetaValue parsed_meta_value(&meta_value);
+      parsed_meta_value.InitialMetaValue();
+      parsed_meta_value.set_hash_size(hash_size);
+      version = parsed_meta_value.version();
+      loader.Put(HASHES_META, key, meta_value);
+    } else if (s.IsNotFound()) {
+      if (hash_size == 0) {
+        continue;
+      }
+      HashesMetaValue hashes_meta_value(hash_size);
+      version = hashes_meta_value.UpdateVersion();
+      loader.Put(HASHES_META, key, hashes_meta_value.Encode());
+    } else {
+      return s;
+    }
+
+    for (size_t j = 0; j < fvs.size(); j++) {
+      if (j + 1 < fvs.size() && fvs[j + 1].field == fvs[j].field) {
+        continue;
+      }
+      HashesDataKey data_key(key, fvs[j].field, version);
+      HashesDataValue data_value(fvs[j].value);
+      loader.Put(HASHES_DATA, data_key.Encode(), data_value.Encode());
+    }
+  }
+  return loader.Ingest();
+}
 
 void RedisHashes::ScanDatabase() {
   // TODO
 }
 
+Status RedisHashes::SweepExpiredFields(uint32_t max_entries,
+                                       uint32_t* swept) {
+  *swept = 0;
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
+
+  // Index entries of fields that expired before now, grouped by hash.
+  std::string upper_bound = HashesFieldTtlKey(now, Slice()).Encode();
+  Slice upper_bound_slice(upper_bound);
+  rocksdb::ReadOptions read_opts;
+  read_opts.iterate_upper_bound = &upper_bound_slice;
+  read_opts.fill_cache = false;
+
+  rocksdb::WriteBatch index_batch;
+  std::map<std::string, std::vector<std::string>> expired_data_keys;
+  {
+    rocksdb::Iterator* it = db_->NewIterator(read_opts, HASHES_FIELD_TTL);
+    ScopeIterator it_guard(&it);
+    uint32_t entries = 0;
+    for (it->SeekToFirst(); it->Valid() && entries < max_entries;
+         it->Next(), entries++) {
+      ParsedHashesFieldTtlKey ttl_key(it->key());
+      ParsedHashesDataKey parsed_data_key(ttl_key.data_key());
+      expired_data_keys[parsed_data_key.user_key().ToString()].push_back(
+        ttl_key.data_key().ToString());
+      index_batch.Delete(HASHES_FIELD_TTL, it->key());
+    }
+    if (!it->status().ok()) {
+      return it->status();
+    }
+  }
+
+  for (const auto& entry : expired_data_keys) {
+    const std::string& key = entry.first;
+    std::string meta_value;
+    rocksdb::WriteBatch batch;
+    ScopeRecordLock l(lock_mgr_, key);
+    Status s = db_->Get(default_read_options_, HASHES_META, key, &meta_value);
+    if (s.IsNotFound()) {
+      continue;
+    } else if (!s.ok()) {
+      return s;
+    }
+    ParsedHashesMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale() || parsed_meta_value.hash_size() == 0) {
+      // The whole hash is gone, the data filter drops its fields.
+      continue;
+    }
+
+    for (const auto& data_key : entry.second) {
+      // The index entry may be left from an older version of the hash or an
+      // older ttl of the field.
+      ParsedHashesDataKey parsed_data_key(data_key);
+      if (parsed_data_key.version() != parsed_meta_value.version()) {
+        continue;
+      }
+      std::string field_value;
+      s = db_->Get(default_read_options_, HASHES_DATA, data_key, &field_value);
+      if (s.IsNotFound()) {
+        continue;
+      } else if (!s.ok()) {
+        return s;
+      }
+      ParsedHashesDataValue parsed_data_value(&field_value);
+      if (parsed_data_value.IsStale()) {
+        batch.Delete(HASHES_DATA, data_key);
+        (*swept)++;
+      }
+    }
+    if (batch.Count() == 0) {
+      continue;
+    }
+    // Expired fields are not counted by the recount, so it may run before
+    // they are deleted.
+    if (parsed_meta_value.IsSizeUnreconciled()) {
+      s = ReconcileHashSize(key, &parsed_meta_value);
+      if (!s.ok()) {
+        return s;
+      }
+      batch.Put(HASHES_META, key, meta_value);
+    }
+    s = db_->Write(default_write_options_, &batch);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return db_->Write(default_write_options_, &index_batch);
+}
+
 
 }  // namespace blackwidow
@@ -1,12 +1,27 @@
 #pragma once
 
+#include "meta_lookup_cache.h"
 #include "redis.h"
 #include "rocksdb/db.h"
 
+#include <functional>
+#include <memory>
+
 namespace blackwidow {
 
 #define HASHES_META (handles_[0])
 #define HASHES_DATA (handles_[1])
+#define HASHES_FIELD_TTL (handles_[2])
+
+// Receives the number of fields of a hash before its first field is visited,
+// only a lower bound for hashes written by the fast HSet.
+using HashSizeVisitor = std::function<void(uint32_t hash_size)>;
+// Receives one field-value pair, the slices are only valid during the call.
+// Returning false stops the iteration.
+using FieldValueVisitor =
+  std::function<bool(const Slice& field, const Slice& value)>;
+
+class ParsedHashesMetaValue;
 
 class RedisHashes : public Redis {
  public:
@@ -14,6 +29,10 @@ class RedisHashes : public Redis {
   ~RedisHashes() override = default;
 
   // Common Commands
+  void PrepareOptions(
+    const BlackWidowOptions& bw_options,
+    rocksdb::DBOptions* db_options,
+    std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) override;
   Status Open(const BlackWidowOptions& bw_options,
               const std::string& dbpath) override;
   Status CompactRange(const Slice* begin,
@@ -38,19 +57,90 @@ class RedisHashes : public Redis {
   Status HLen(const Slice& key, uint32_t* len);
   Status HExists(const Slice& key, const Slice& field);
   Status HSet(const Slice& key, const Slice& filed, const Slice& value, int32_t *ret);
-  // Status HSetNx(const Slice& key, const Slice& filed, const Slice& value);
+  Status HSetNx(const Slice& key,
+                const Slice& field,
+                const Slice& value,
+                int32_t* ret);
+  Status HMSet(const Slice& key, const std::vector<FieldValue>& fvs);
   Status HGet(const Slice& key, const Slice& field, std::string* value);
+  // Zero-copy HGet, the value stays pinned in the block cache or the
+  // memtable until `value` is reset.
+  Status HGet(const Slice& key,
+              const Slice& field,
+              rocksdb::PinnableSlice* value);
+  Status HMGet(const Slice& key,
+               const std::vector<std::string>& fields,
+               std::vector<ValueStatus>* vss);
   Status HGetAll(const Slice& key, std::vector<FieldValue>* fvs);
+  // Zero-copy HGetAll, `size_visitor` may be empty.
+  Status HGetAll(const Slice& key,
+                 const HashSizeVisitor& size_visitor,
+                 const FieldValueVisitor& visitor);
   Status HVals(const Slice& key, std::vector<std::string>* vals);
   Status HDel(const Slice& key,
               const std::vector<std::string>& fields,
               int32_t* ret);
   Status HStrlen(const Slice& key, const Slice& field, int32_t* len);
-  // HIncrBy
-  // HIncrByFloat
+
+  // Field TTL Commands. A ttl in the past deletes the field. HLen recounts
+  // hashes that have fields with ttl.
+  Status HExpire(const Slice& key, const Slice& field, int32_t ttl);
+  Status HExpireAt(const Slice& key, const Slice& field, int32_t timestamp);
+  Status HPersist(const Slice& key, const Slice& field);
+  Status HTTL(const Slice& key, const Slice& field, int64_t* ttl);
+  Status HIncrBy(const Slice& key,
+                 const Slice& field,
+                 int64_t value,
+                 int64_t* ret);
+  Status HIncrByFloat(const Slice& key,
+                      const Slice& field,
+                      const Slice& by,
+                      std::string* new_value);
+  // HIncrBy without reading the field, the delta is written as a Merge and
+  // folded on read. The new value is not returned, and a delta against a
+  // non-number value or one that overflows is dropped.
+  Status HIncrByBlind(const Slice& key, const Slice& field, int64_t value);
 
   // Special Commands
   void ScanDatabase();
+  // Deletes expired fields, walking the field ttl index in expiry order, and
+  // stops after `max_entries` index entries. Expired fields are already
+  // invisible to reads, this only reclaims their space early.
+  Status SweepExpiredFields(uint32_t max_entries, uint32_t* swept);
+  // Meta lookups of the data cf compaction filter per compacted record.
+  MetaLookupStats GetDataFilterStats() const;
+  // Replaces the hashes of `kfvs` with ingested meta and data ssts, see
+  // BulkLoader. A hash without fields is deleted.
+  Status BulkLoad(std::vector<KeyFieldValues>* kfvs);
+
+ private:
+  // Iterates all fields of `key` within one snapshot and one bounded seek.
+  Status ScanFields(const Slice& key,
+                    const HashSizeVisitor& size_visitor,
+                    const FieldValueVisitor& visitor);
+  // The user value of one field, pinned, within one snapshot.
+  Status GetField(const Slice& key,
+                  const Slice& field,
+                  rocksdb::PinnableSlice* value);
+  // Whether the field under the locked `data_key` is live. The bloom
+  // filter and the memtable answer for most new fields, the value is only
+  // read when they can't.
+  Status FieldExists(const Slice& data_key, bool* exists);
+  // Recounts the live fields of an unreconciled hash and clears the mark
+  // unless some field has a ttl. Writers put the meta value back, HLen only
+  // reads the count within its `snapshot`.
+  Status ReconcileHashSize(const Slice& key,
+                           ParsedHashesMetaValue* parsed_meta_value,
+                           const rocksdb::Snapshot* snapshot = nullptr);
+
+  // Appends an empty field timestamp to the data values of a db written
+  // before the field ttl, see the comment in redis_hashes.cc.
+  static Status UpgradeFieldFormat(const rocksdb::DBOptions& db_options,
+                                   const std::string& dbpath);
+
+  bool fast_hset_;
+  // Shared by the data cf compaction filters.
+  std::shared_ptr<MetaLookupCache> data_meta_cache_;
 };
 
 
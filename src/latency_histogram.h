@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace blackwidow {
+
+// Histogram of latencies in the manner of HdrHistogram: every power of two
+// is split into kSubBuckets linear buckets, so a recorded value is known to
+// within 1 / kSubBuckets of itself over the whole range. Not thread safe,
+// keep one per thread and Merge them.
+class LatencyHistogram {
+ public:
+  LatencyHistogram() : counts_(kBuckets, 0) {}
+
+  void Record(uint64_t value, uint64_t times = 1) {
+    if (times == 0) {
+      return;
+    }
+    counts_[BucketIndex(value)] += times;
+    min_ = count_ == 0 ? value : std::min(min_, value);
+    max_ = std::max(max_, value);
+    count_ += times;
+    sum_ += value * times;
+  }
+
+  void Merge(const LatencyHistogram& other) {
+    if (other.count_ == 0) {
+      return;
+    }
+    for (size_t i = 0; i < kBuckets; i++) {
+      counts_[i] += other.counts_[i];
+    }
+    min_ = count_ == 0 ? other.min_ : std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    count_ += other.count_;
+    sum_ += other.sum_;
+  }
+
+  void Clear() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = sum_ = min_ = max_ = 0;
+  }
+
+  // The highest value of the bucket holding the `percentile` (0 - 100)
+  // value, never more than the max.
+  uint64_t Percentile(double percentile) const {
+    if (count_ == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(count_ * percentile / 100.0);
+    rank = std::max<uint64_t>(1, std::min(rank, count_));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(BucketUpperBound(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  uint64_t count() const {
+    return count_;
+  }
+  uint64_t min() const {
+    return min_;
+  }
+  uint64_t max() const {
+    return max_;
+  }
+  double mean() const {
+    return count_ == 0 ? 0 : static_cast<double>(sum_) / count_;
+  }
+
+  // The bucket math with every power of two split into 2^sub_bucket_bits
+  // buckets, for coarser histograms kept elsewhere.
+  static constexpr size_t NumBuckets(int sub_bucket_bits) {
+    return (64 - sub_bucket_bits + 1) * (size_t{1} << sub_bucket_bits);
+  }
+
+  static size_t BucketIndex(uint64_t value, int sub_bucket_bits) {
+    const uint64_t sub_buckets = uint64_t{1} << sub_bucket_bits;
+    if (value < sub_buckets) {
+      return value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - sub_bucket_bits;
+    // The sub_bucket_bits bits below the leading one.
+    uint64_t sub = (value >> shift) - sub_buckets;
+    return (shift + 1) * sub_buckets + sub;
+  }
+
+  static uint64_t BucketUpperBound(size_t index, int sub_bucket_bits) {
+    const uint64_t sub_buckets = uint64_t{1} << sub_bucket_bits;
+    if (index < sub_buckets) {
+      return index;
+    }
+    int shift = static_cast<int>(index / sub_buckets) - 1;
+    uint64_t sub = index % sub_buckets;
+    uint64_t lower = (sub_buckets + sub) << shift;
+    return lower + ((uint64_t{1} << shift) - 1);
+  }
+
+  // "count=... mean=... p50=... p99=... p999=... max=..."
+  std::string ToString() const {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "count=%lu mean=%.1f p50=%lu p99=%lu p999=%lu max=%lu",
+             count_, mean(), Percentile(50), Percentile(99),
+             Percentile(99.9), max_);
+    return buf;
+  }
+
+ private:
+  static constexpr int kSubBucketBits = 6;
+  static constexpr size_t kBuckets = (64 - kSubBucketBits + 1)
+                                     << kSubBucketBits;
+
+  static size_t BucketIndex(uint64_t value) {
+    return BucketIndex(value, kSubBucketBits);
+  }
+
+  static uint64_t BucketUpperBound(size_t index) {
+    return BucketUpperBound(index, kSubBucketBits);
+  }
+
+  std::vector<uint64_t> counts_;
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t min_ = 0;
+  uint64_t max_ = 0;
+};
+
+}  // namespace blackwidow
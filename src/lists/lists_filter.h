@@ -1,8 +1,15 @@
 #pragma once
 
+#include "trace.h"
+#include "lists_data_format.h"
+#include "lists_meta_format.h"
+#include "meta_lookup_cache.h"
 #include "rocksdb/compaction_filter.h"
 #include "rocksdb/env.h"
 
+#include <memory>
+#include <vector>
+
 namespace blackwidow {
 
 class ListsMetaFilter : public rocksdb::CompactionFilter {
@@ -17,8 +24,37 @@ class ListsMetaFilter : public rocksdb::CompactionFilter {
               const rocksdb::Slice& existing_value,
               std::string* new_value,
               bool* value_changed) const override {
-    // TODO
-    return false;
+    int64_t unix_time_now;
+    rocksdb::Env::Default()->GetCurrentTime(&unix_time_now);
+
+    bool should_filter = false;
+    const char* filter_reason = "None";
+    ParsedListsMetaValue parsed_meta_value(existing_value);
+    int32_t version = parsed_meta_value.version();
+    uint64_t count = parsed_meta_value.count();
+    int64_t timestamp = static_cast<int64_t>(parsed_meta_value.timestamp());
+
+    // Same as HashesMetaFilter, the version must be older than now,
+    // or the nodes of a list recreated in this second would be orphaned.
+    if (timestamp != 0 && timestamp < unix_time_now &&
+        version < unix_time_now) {
+      should_filter = true;
+      filter_reason = "Expired";
+    }
+
+    if (count == 0 && version < unix_time_now) {
+      should_filter = true;
+      filter_reason = "NoElements";
+    }
+
+    BW_TRACE_SAMPLED(kTraceVerbose, "ListsMetaFilter",
+                     "level-%d, key: %s, timestamp:%ld, version:%d, "
+                     "count:%lu, currentTime: %ld, shouldFilter:%d, "
+                     "filterReason:%s",
+                     level, key, timestamp, version, count, unix_time_now,
+                     should_filter, filter_reason);
+
+    return should_filter;
   }
 };
 
@@ -39,6 +75,11 @@ class ListsMetaFilterFactory : public rocksdb::CompactionFilterFactory {
 class ListsDataFilter : public rocksdb::CompactionFilter {
 
  public:
+  ListsDataFilter(rocksdb::DB* dbptr,
+                  std::vector<rocksdb::ColumnFamilyHandle*>* handles,
+                  MetaLookupCache* meta_cache)
+    : meta_resolver_(dbptr, handles, meta_cache) {}
+
   const char* Name() const override {
     return "blackwidow.ListsDataFilter";
   }
@@ -48,22 +89,54 @@ class ListsDataFilter : public rocksdb::CompactionFilter {
               const rocksdb::Slice& existing_value,
               std::string* new_value,
               bool* value_changed) const override {
-    // TODO
-    return false;
+    ParsedListsDataKey parsed_data_key(key);
+    int32_t version = parsed_data_key.version();
+
+    const MetaSnapshot* meta =
+      meta_resolver_.Resolve(parsed_data_key.key(), version);
+    if (meta == nullptr) {
+      BW_TRACE_SAMPLED(kTraceError, "ListsDataFilter",
+                       "Get MetaKey failed, reserve. key:%s", key);
+      return false;
+    }
+    bool should_filter = meta->IsDeadData(version);
+
+    BW_TRACE_SAMPLED(kTraceVerbose, "ListsDataFilter",
+                     "level-%d, key:%s, version:%d, metaVersion:%d, "
+                     "metaNotFound:%d, shouldFilter:%d",
+                     level, meta_resolver_.cur_key(), version, meta->version,
+                     meta->not_found, should_filter);
+
+    return should_filter;
   }
+
+ private:
+  mutable DataFilterMetaResolver<ParsedListsMetaValue> meta_resolver_;
 };
 
 class ListsDataFilterFactory : public rocksdb::CompactionFilterFactory {
  public:
+  ListsDataFilterFactory(rocksdb::DB** db_ptr,
+                         std::vector<rocksdb::ColumnFamilyHandle*>* handles_ptr,
+                         std::shared_ptr<MetaLookupCache> meta_cache)
+    : db_ptr_(db_ptr), cf_handles_ptr_(handles_ptr),
+      meta_cache_(std::move(meta_cache)) {}
+
   const char* Name() const override {
     return "blackwidow.ListsDataFilterFactory";
   }
 
   std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
     const rocksdb::CompactionFilter::Context& context) override {
-    return std::unique_ptr<ListsDataFilter>(new ListsDataFilter());
+    return std::unique_ptr<ListsDataFilter>(
+      new ListsDataFilter(*db_ptr_, cf_handles_ptr_, meta_cache_.get()));
   }
+
+ private:
+  rocksdb::DB** db_ptr_;
+  std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
+  std::shared_ptr<MetaLookupCache> meta_cache_;
 };
 
 
-}  // namespace blackwidow
\ No newline at end of file
+}  // namespace blackwidow
@@ -202,6 +202,9 @@ class ParsedListsMetaValue : public ParsedInternalValue {
 
   void set_count(uint64_t count) {
     count_ = count;
+    if (value_ != nullptr) {
+      EncodeFixed64(value_->data(), count_);
+    }
   }
 
   void ModifyCount(uint64_t delta) {
@@ -266,6 +269,7 @@ class ParsedListsMetaValue : public ParsedInternalValue {
     set_count(0);
     set_left_index(kInitialListsLeftSequence);
     set_right_index(kInitialListsRightSequence);
+    SetIndexToValue();
     set_timestamp(0);
     return UpdateVersion();
   }
@@ -4,6 +4,7 @@
 #include "lists_filter.h"
 #include "lists_meta_format.h"
 #include "scope_record_lock.h"
+#include "ttl_properties_collector.h"
 
 #include <string>
 #include <vector>
@@ -15,28 +16,24 @@ const rocksdb::Comparator* ListsDataKeyComparator() {
   return &c;
 }
 
-RedisLists::RedisLists(BlackWidow* const bw) : Redis(bw, kLists) {}
+RedisLists::RedisLists(BlackWidow* const bw)
+    : Redis(bw, kLists),
+      data_meta_cache_(std::make_shared<MetaLookupCache>()) {}
 
 Status RedisLists::Open(const BlackWidowOptions& bw_options,
                         const std::string& dbpath) {
-  rocksdb::Options opts = bw_options.options;
-  Status status = rocksdb::DB::Open(opts, dbpath, &db_);
-  if (status.ok()) {
-    rocksdb::ColumnFamilyHandle* cf;
-    rocksdb::ColumnFamilyOptions cfo;
-    cfo.comparator = ListsDataKeyComparator();
-    status = db_->CreateColumnFamily(cfo, "data_cf", &cf);
-    if (!status.ok()) {
-      return status;
-    }
-
-    // Close DB
-    delete cf;
-    delete db_;
-  }
-
-  // ReOpen with column families
   rocksdb::DBOptions db_opts(bw_options.options);
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  PrepareOptions(bw_options, &db_opts, &column_families);
+  return OpenDB(db_opts, dbpath, column_families);
+}
+
+void RedisLists::PrepareOptions(
+  const BlackWidowOptions& bw_options,
+  rocksdb::DBOptions* db_options,
+  std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) {
+  command_stats_.SetOptions(bw_options.command_stats,
+                            bw_options.command_stats_block_reads);
   rocksdb::ColumnFamilyOptions meta_cf_opts(bw_options.options);
   rocksdb::ColumnFamilyOptions data_cf_opts(bw_options.options);
 
@@ -49,32 +46,34 @@ Status RedisLists::Open(const BlackWidowOptions& bw_options,
   rocksdb::BlockBasedTableOptions data_block_opts(base_block_opts);
 
   if (!bw_options.share_block_cache && bw_options.block_cache_size > 0) {
-    meta_block_opts.block_cache = std::shared_ptr<rocksdb::Cache>(
-      rocksdb::NewLRUCache(bw_options.block_cache_size));
-    data_block_opts.block_cache = std::shared_ptr<rocksdb::Cache>(
-      rocksdb::NewLRUCache(bw_options.block_cache_size));
+    meta_block_opts.block_cache = NewBlockCache(bw_options.block_cache_size);
+    data_block_opts.block_cache = NewBlockCache(bw_options.block_cache_size);
   }
 
   /* Setup Meta column family */
   meta_cf_opts.comparator = rocksdb::BytewiseComparator();
   meta_cf_opts.compaction_filter_factory =
     std::make_shared<ListsMetaFilterFactory>();
+  meta_cf_opts.table_properties_collector_factories.push_back(
+    std::make_shared<TtlPropertiesCollectorFactory<ParsedListsMetaValue>>());
   meta_cf_opts.table_factory = std::shared_ptr<rocksdb::TableFactory>(
     rocksdb::NewBlockBasedTableFactory(meta_block_opts));
 
   /* Setup Data column family */
   data_cf_opts.comparator = ListsDataKeyComparator();
   data_cf_opts.compaction_filter_factory =
-    std::make_shared<ListsDataFilterFactory>();
+    std::make_shared<ListsDataFilterFactory>(&db_, &handles_, data_meta_cache_);
   data_cf_opts.table_factory = std::shared_ptr<rocksdb::TableFactory>(
-    rocksdb::NewBlockBasedTableFactory(meta_block_opts));
+    rocksdb::NewBlockBasedTableFactory(data_block_opts));
 
-  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
-  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+  column_families->push_back(rocksdb::ColumnFamilyDescriptor(
     rocksdb::kDefaultColumnFamilyName, meta_cf_opts));
-  column_families.push_back(
+  column_families->push_back(
     rocksdb::ColumnFamilyDescriptor("data_cf", data_cf_opts));
-  return rocksdb::DB::Open(db_opts, dbpath, column_families, &handles_, &db_);
+}
+
+MetaLookupStats RedisLists::GetDataFilterStats() const {
+  return data_meta_cache_->GetStats();
 }
 
 Status RedisLists::CompactRange(const rocksdb::Slice* begin,
@@ -90,12 +89,7 @@ Status RedisLists::CompactRange(const rocksdb::Slice* begin,
 }
 
 Status RedisLists::GetProperty(const std::string& property, uint64_t* out) {
-  std::string value;
-  db_->GetProperty(LISTS_META_CF_HANDLE, property, &value);
-  *out = std::strtoull(value.c_str(), nullptr, 10);
-  db_->GetProperty(LISTS_DATA_CF_HANDLE, property, &value);
-  *out += std::strtoull(value.c_str(), nullptr, 10);
-  return Status::OK();
+  return GetIntProperty(property, out);
 }
 
 Status RedisLists::ScanKeyNum(KeyInfo* key_info) {
@@ -116,28 +110,130 @@ Status RedisLists::PKPatternMatchDel(const std::string& pattern, int32_t* ret) {
 
 
 Status RedisLists::Del(const Slice& key) {
-  // TODO
-  return Status::OK();
+  CommandTimer timer(&command_stats_, kCmdDel, key.size());
+  std::string meta_value;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s =
+    db_->Get(default_read_options_, LISTS_META_CF_HANDLE, key, &meta_value);
+  if (s.ok()) {
+    ParsedListsMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale()) {
+      return timer.Done(Status::NotFound("Expired"));
+    } else if (parsed_meta_value.count() == 0) {
+      return timer.Done(Status::NotFound());
+    } else {
+      // 和hash一样只重置meta, 旧version的节点由compaction清理
+      parsed_meta_value.InitialMetaValue();
+      s = db_->Put(default_write_options_, LISTS_META_CF_HANDLE, key,
+                   meta_value);
+    }
+  }
+  return timer.Done(s);
 }
+
 Status RedisLists::Expire(const Slice& key, int32_t ttl) {
-  return Status::OK();
+  CommandTimer timer(&command_stats_, kCmdExpire, key.size());
+  std::string meta_value;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s =
+    db_->Get(default_read_options_, LISTS_META_CF_HANDLE, key, &meta_value);
+  if (s.ok()) {
+    ParsedListsMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale()) {
+      return timer.Done(Status::NotFound("Expired"));
+    } else if (parsed_meta_value.count() == 0) {
+      return timer.Done(Status::NotFound());
+    } else {
+      parsed_meta_value.SetRelativeTimestamp(ttl);
+      s = db_->Put(default_write_options_, LISTS_META_CF_HANDLE, key,
+                   meta_value);
+    }
+  }
+  return timer.Done(s);
 }
+
 Status RedisLists::ExpireAt(const Slice& key, int32_t timestamp) {
-  return Status::OK();
+  CommandTimer timer(&command_stats_, kCmdExpireAt, key.size());
+  std::string meta_value;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s =
+    db_->Get(default_read_options_, LISTS_META_CF_HANDLE, key, &meta_value);
+  if (s.ok()) {
+    ParsedListsMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale()) {
+      return timer.Done(Status::NotFound("Expired"));
+    } else if (parsed_meta_value.count() == 0) {
+      return timer.Done(Status::NotFound());
+    } else {
+      int64_t now;
+      rocksdb::Env::Default()->GetCurrentTime(&now);
+      if (timestamp < now) {
+        parsed_meta_value.InitialMetaValue();
+      } else {
+        parsed_meta_value.set_timestamp(timestamp);
+      }
+      s = db_->Put(default_write_options_, LISTS_META_CF_HANDLE, key,
+                   meta_value);
+    }
+  }
+  return timer.Done(s);
 }
+
 Status RedisLists::Persist(const Slice& key) {
-  return Status::OK();
+  CommandTimer timer(&command_stats_, kCmdPersist, key.size());
+  std::string meta_value;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s =
+    db_->Get(default_read_options_, LISTS_META_CF_HANDLE, key, &meta_value);
+  if (s.ok()) {
+    ParsedListsMetaValue parsed_meta_value(&meta_value);
+    if (parsed_meta_value.IsStale()) {
+      return timer.Done(Status::NotFound("Expired"));
+    } else if (parsed_meta_value.count() == 0) {
+      return timer.Done(Status::NotFound());
+    } else {
+      parsed_meta_value.set_timestamp(0);
+      s = db_->Put(default_write_options_, LISTS_META_CF_HANDLE, key,
+                   meta_value);
+    }
+  }
+  return timer.Done(s);
 }
+
 Status RedisLists::TTL(const Slice& key, int64_t* timestamp) {
-  return Status::OK();
+  CommandTimer timer(&command_stats_, kCmdTTL, key.size());
+  rocksdb::PinnableSlice meta_value;
+  Status s =
+    db_->Get(default_read_options_, LISTS_META_CF_HANDLE, key, &meta_value);
+  if (s.ok()) {
+    ParsedListsMetaValue parsed_meta_value(meta_value);
+    if (parsed_meta_value.IsStale()) {
+      *timestamp = -2;
+      return timer.Done(Status::NotFound("Expired"));
+    } else if (parsed_meta_value.count() == 0) {
+      *timestamp = -2;
+      return timer.Done(Status::NotFound());
+    } else if (parsed_meta_value.IsPermanentSurvival()) {
+      *timestamp = -1;
+    } else {
+      int64_t ttl = parsed_meta_value.timestamp();
+      int64_t now = 0;
+      rocksdb::Env::Default()->GetCurrentTime(&now);
+      *timestamp = ttl <= now ? -2 : ttl - now;
+    }
+  } else if (s.IsNotFound()) {
+    *timestamp = -2;
+  }
+  return timer.Done(s);
 }
 
 Status RedisLists::LLen(const Slice& key, uint64_t* len) {
+  CommandTimer timer(&command_stats_, kCmdLLen, key.size());
   *len = 0;
-  std::string meta_value;
+  rocksdb::PinnableSlice meta_value;
   Status s = db_->Get(default_read_options_, LISTS_META_CF_HANDLE, key, &meta_value);
   if (s.ok()) {
-    ParsedListsMetaValue parsed_meta_value(&meta_value);
+    ParsedListsMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsStale()) {
       return Status::NotFound("Stale");
     }
@@ -146,10 +242,11 @@ Status RedisLists::LLen(const Slice& key, uint64_t* len) {
     }
     *len = parsed_meta_value.count();
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisLists::LPushX(const Slice& key, const Slice& value, uint64_t* len) {
+  CommandTimer timer(&command_stats_, kCmdLPushX, key.size() + value.size());
   *len = 0;
   std::string meta_value;
   rocksdb::WriteBatch batch;
@@ -171,14 +268,15 @@ Status RedisLists::LPushX(const Slice& key, const Slice& value, uint64_t* len) {
       batch.Put(LISTS_META_CF_HANDLE, key, meta_value);
       batch.Put(LISTS_DATA_CF_HANDLE, data_key.Encode(), value);
       *len = parsed_meta_value.count();
-      return db_->Write(default_write_options_, &batch);
+      return timer.Done(db_->Write(default_write_options_, &batch));
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 // Right push iff list exists
 Status RedisLists::RPushX(const Slice& key, const Slice& value, uint64_t* len) {
+  CommandTimer timer(&command_stats_, kCmdRPushX, key.size() + value.size());
   *len = 0;
   std::string meta_value;
   rocksdb::WriteBatch batch;
@@ -199,15 +297,16 @@ Status RedisLists::RPushX(const Slice& key, const Slice& value, uint64_t* len) {
       ListsDataKey data_key(key, version, index);
       batch.Put(LISTS_META_CF_HANDLE, key, meta_value);
       batch.Put(LISTS_DATA_CF_HANDLE, data_key.Encode(), value);
-      return db_->Write(default_write_options_, &batch);
+      return timer.Done(db_->Write(default_write_options_, &batch));
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisLists::LPush(const Slice& key,
                          const std::vector<std::string>& values,
                          uint64_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdLPush, key.size() + BytesOf(values));
   if(values.size()==0) {
     *ret = 0;
     return Status::OK();
@@ -244,9 +343,9 @@ Status RedisLists::LPush(const Slice& key,
         }
         batch.Put(LISTS_META_CF_HANDLE, key, raw_meta_val.Encode());
         *ret = values.size();
-        return db_->Write(default_write_options_, &batch);
+        return timer.Done(db_->Write(default_write_options_, &batch));
   } else {
-    return s;
+    return timer.Done(s);
   }
 }
 
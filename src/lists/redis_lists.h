@@ -1,7 +1,10 @@
 #pragma once
 
+#include "meta_lookup_cache.h"
 #include "redis.h"
 
+#include <memory>
+
 namespace blackwidow {
 
 #define LISTS_META_CF_HANDLE (handles_[0])
@@ -13,6 +16,10 @@ class RedisLists : public Redis {
   ~RedisLists() override = default;
 
   // Common Commands defined in Redis
+  void PrepareOptions(
+    const BlackWidowOptions& bw_options,
+    rocksdb::DBOptions* db_options,
+    std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) override;
   Status Open(const BlackWidowOptions& bw_options,
               const std::string& dbpath) override;
   Status CompactRange(const rocksdb::Slice* begin,
@@ -42,6 +49,13 @@ class RedisLists : public Redis {
                const std::vector<std::string>& values,
                uint64_t* ret);
   Status LPop(const Slice &key, std::string *element);
+
+  // Meta lookups of the data cf compaction filter.
+  MetaLookupStats GetDataFilterStats() const;
+
+ private:
+  // Shared by the data cf compaction filters.
+  std::shared_ptr<MetaLookupCache> data_meta_cache_;
 };
 
 }  // namespace blackwidow
\ No newline at end of file
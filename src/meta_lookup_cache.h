@@ -0,0 +1,236 @@
+#pragma once
+
+#include "rocksdb/db.h"
+#include "rocksdb/env.h"
+#include "rocksdb/slice.h"
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace blackwidow {
+
+// What a data CompactionFilter needs to know about the meta of a key.
+struct MetaSnapshot {
+  bool not_found = false;
+  int32_t version = 0;
+  int32_t timestamp = 0;
+  // Unix time when the meta value was read.
+  int64_t lookup_time = 0;
+
+  // Whether a data record of `data_version` is dead for sure. A cached meta
+  // can be older than the real one, so only facts that no later write can
+  // undo are used:
+  //  - versions only grow, an older data version never comes back;
+  //  - a key expired or missing at lookup time is recreated with a version
+  //    not less than the time it is recreated.
+  bool IsDeadData(int32_t data_version) const {
+    if (not_found) {
+      return data_version < lookup_time;
+    }
+    if (data_version < version) {
+      return true;
+    }
+    return timestamp != 0 && timestamp < lookup_time &&
+           data_version <= version;
+  }
+
+  // Whether the snapshot is too old to judge a record of `data_version`.
+  bool IsOutdated(int32_t data_version) const {
+    return not_found ? data_version >= lookup_time : data_version > version;
+  }
+};
+
+struct MetaLookupStats {
+  // Data records seen by the filters.
+  uint64_t records = 0;
+  // Meta lookups served by the cache.
+  uint64_t cache_hits = 0;
+  // Meta lookups that went to the db.
+  uint64_t db_lookups = 0;
+};
+
+// Bounded cache of meta snapshots shared by all data compaction filters of
+// one column family, subcompactions and consecutive compactions over the
+// same key range resolve a key with one db read. A snapshot is only used
+// for `max_age` seconds after its lookup, a key deleted or expired later is
+// judged dead by the compactions after that.
+class MetaLookupCache {
+ public:
+  explicit MetaLookupCache(size_t capacity = kDefaultCapacity,
+                           int64_t max_age = kDefaultMaxAge)
+    : shard_capacity_(capacity / kNumShards + 1), max_age_(max_age) {
+    read_opts_.fill_cache = false;
+  }
+
+  MetaLookupCache(const MetaLookupCache&) = delete;
+  MetaLookupCache& operator=(const MetaLookupCache&) = delete;
+
+  // Resolves the meta of `key` for a data record of `data_version`, reads
+  // the db through `cf` when there is no usable snapshot.
+  template <typename ParsedMetaValue>
+  rocksdb::Status Lookup(rocksdb::DB* db,
+                         rocksdb::ColumnFamilyHandle* cf,
+                         const rocksdb::Slice& key,
+                         int32_t data_version,
+                         MetaSnapshot* meta) {
+    Shard& shard = shards_[SliceHash()(key) % kNumShards];
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    {
+      std::lock_guard<std::mutex> l(shard.mu);
+      auto iter = shard.index.find(key);
+      if (iter != shard.index.end() &&
+          now - iter->second->second.lookup_time < max_age_ &&
+          !iter->second->second.IsOutdated(data_version)) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+        *meta = iter->second->second;
+        cache_hits_.fetch_add(1, std::memory_order_relaxed);
+        return rocksdb::Status::OK();
+      }
+    }
+
+    db_lookups_.fetch_add(1, std::memory_order_relaxed);
+    MetaSnapshot snapshot;
+    // Take the time before the read, a later time would claim too much.
+    snapshot.lookup_time = now;
+    rocksdb::PinnableSlice meta_value;
+    rocksdb::Status s = db->Get(read_opts_, cf, key, &meta_value);
+    if (s.ok()) {
+      ParsedMetaValue parsed_meta_value(meta_value);
+      snapshot.version = parsed_meta_value.version();
+      snapshot.timestamp = parsed_meta_value.timestamp();
+      // A value without data records, e.g. a string stored whole, is
+      // judged as a missing one.
+      snapshot.not_found = !parsed_meta_value.HasDataRecords();
+    } else if (s.IsNotFound()) {
+      snapshot.not_found = true;
+    } else {
+      return s;
+    }
+    *meta = snapshot;
+
+    std::lock_guard<std::mutex> l(shard.mu);
+    auto iter = shard.index.find(key);
+    if (iter != shard.index.end()) {
+      iter->second->second = snapshot;
+      shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+      return rocksdb::Status::OK();
+    }
+    shard.lru.emplace_front(std::string(key.data(), key.size()), snapshot);
+    shard.index.emplace(rocksdb::Slice(shard.lru.front().first),
+                        shard.lru.begin());
+    if (shard.index.size() > shard_capacity_) {
+      shard.index.erase(rocksdb::Slice(shard.lru.back().first));
+      shard.lru.pop_back();
+    }
+    return rocksdb::Status::OK();
+  }
+
+  void AddRecords(uint64_t records) {
+    records_.fetch_add(records, std::memory_order_relaxed);
+  }
+
+  MetaLookupStats GetStats() const {
+    MetaLookupStats stats;
+    stats.records = records_.load(std::memory_order_relaxed);
+    stats.cache_hits = cache_hits_.load(std::memory_order_relaxed);
+    stats.db_lookups = db_lookups_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+  static constexpr size_t kDefaultCapacity = 64 * 1024;
+  // Covers the subcompactions of one compaction and the compactions it
+  // triggers right away.
+  static constexpr int64_t kDefaultMaxAge = 3;
+
+ private:
+  static constexpr size_t kNumShards = 16;
+
+  struct SliceHash {
+    size_t operator()(const rocksdb::Slice& key) const {
+      return std::hash<std::string_view>()(
+        std::string_view(key.data(), key.size()));
+    }
+  };
+
+  // The index keys point into the keys of the lru nodes, a lookup does not
+  // copy the key.
+  struct Shard {
+    std::mutex mu;
+    std::list<std::pair<std::string, MetaSnapshot>> lru;
+    std::unordered_map<
+      rocksdb::Slice,
+      std::list<std::pair<std::string, MetaSnapshot>>::iterator,
+      SliceHash> index;
+  };
+
+  const size_t shard_capacity_;
+  const int64_t max_age_;
+  rocksdb::ReadOptions read_opts_;
+  Shard shards_[kNumShards];
+  std::atomic<uint64_t> records_{0};
+  std::atomic<uint64_t> cache_hits_{0};
+  std::atomic<uint64_t> db_lookups_{0};
+};
+
+// Per compaction filter state. Records of one key are adjacent in a data
+// column family, so the meta is only resolved again when the user key
+// changes or a record is newer than the resolved meta.
+template <typename ParsedMetaValue>
+class DataFilterMetaResolver {
+ public:
+  DataFilterMetaResolver(rocksdb::DB* db,
+                         std::vector<rocksdb::ColumnFamilyHandle*>* handles,
+                         MetaLookupCache* cache)
+    : db_(db), handles_(handles), cache_(cache),
+      has_cur_key_(false), records_(0) {}
+
+  ~DataFilterMetaResolver() {
+    cache_->AddRecords(records_);
+  }
+
+  // Returns nullptr if the meta can not be read, the record must be kept.
+  const MetaSnapshot* Resolve(const rocksdb::Slice& user_key,
+                              int32_t data_version) {
+    records_++;
+    if (has_cur_key_ && user_key == rocksdb::Slice(cur_key_) &&
+        !cur_meta_.IsOutdated(data_version)) {
+      return &cur_meta_;
+    }
+    if (handles_->size() == 0) {
+      // destroyed when close the database, Reserve the kv
+      return nullptr;
+    }
+    // The meta cf must be the first.
+    rocksdb::Status s = cache_->Lookup<ParsedMetaValue>(
+      db_, (*handles_)[0], user_key, data_version, &cur_meta_);
+    if (!s.ok()) {
+      has_cur_key_ = false;
+      return nullptr;
+    }
+    cur_key_.assign(user_key.data(), user_key.size());
+    has_cur_key_ = true;
+    return &cur_meta_;
+  }
+
+  const std::string& cur_key() const {
+    return cur_key_;
+  }
+
+ private:
+  rocksdb::DB* db_;
+  std::vector<rocksdb::ColumnFamilyHandle*>* handles_;
+  MetaLookupCache* cache_;
+  std::string cur_key_;
+  bool has_cur_key_;
+  MetaSnapshot cur_meta_;
+  uint64_t records_;
+};
+
+}  // namespace blackwidow
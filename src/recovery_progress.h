@@ -0,0 +1,67 @@
+#pragma once
+
+#include "blackwidow/blackwidow.h"
+#include "rocksdb/env.h"
+#include "rocksdb/wal_filter.h"
+#include "rocksdb/write_batch.h"
+
+#include <string>
+
+namespace blackwidow {
+
+// Counts the WAL records replayed by DB::Open and reports them every
+// `interval_bytes`. It never changes the replay.
+class RecoveryProgressWalFilter : public rocksdb::WalFilter {
+ public:
+  RecoveryProgressWalFilter(const std::string& type,
+                            const RecoveryProgressCallback& callback,
+                            uint64_t interval_bytes)
+    : callback_(callback),
+      interval_bytes_(interval_bytes),
+      next_report_bytes_(interval_bytes),
+      start_micros_(rocksdb::Env::Default()->NowMicros()) {
+    progress_.type = type;
+  }
+
+  const char* Name() const override {
+    return "blackwidow.RecoveryProgressWalFilter";
+  }
+
+  WalProcessingOption LogRecordFound(unsigned long long log_number,
+                                     const std::string& log_file_name,
+                                     const rocksdb::WriteBatch& batch,
+                                     rocksdb::WriteBatch* new_batch,
+                                     bool* batch_changed) override {
+    progress_.wal_records += batch.Count();
+    progress_.wal_bytes += batch.GetDataSize();
+    if (progress_.wal_bytes >= next_report_bytes_) {
+      next_report_bytes_ = progress_.wal_bytes + interval_bytes_;
+      Report();
+    }
+    return WalProcessingOption::kContinueProcessing;
+  }
+
+  // Reports the end of the open, with the number of live ssts.
+  void Finish(uint64_t sst_files) {
+    progress_.done = true;
+    progress_.sst_files = sst_files;
+    Report();
+  }
+
+ private:
+  void Report() {
+    progress_.elapsed_micros =
+      rocksdb::Env::Default()->NowMicros() - start_micros_;
+    if (callback_) {
+      callback_(progress_);
+    }
+  }
+
+  const RecoveryProgressCallback callback_;
+  const uint64_t interval_bytes_;
+  uint64_t next_report_bytes_;
+  const uint64_t start_micros_;
+  RecoveryProgress progress_;
+};
+
+}  // namespace blackwidow
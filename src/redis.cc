@@ -1,4 +1,12 @@
 #include "redis.h"
+#include "ttl_properties_collector.h"
+
+#include "rocksdb/env.h"
+#include "rocksdb/metadata.h"
+#include "rocksdb/utilities/checkpoint.h"
+
+#include <limits>
+#include <map>
 
 namespace blackwidow
 {
@@ -8,7 +16,10 @@ Redis::Redis(BlackWidow *const bw, const DataType & type)
     type_(type),
     lock_mgr_(new LockMgr(1000, 0, std::make_shared<MutexFactoryImpl>())),
     db_(nullptr),
-    small_compaction_threshold_(5000) {
+    owns_db_(true),
+    scan_cursors_store_(nullptr),
+    small_compaction_threshold_(5000),
+    statistics_store_(nullptr) {
   handles_.clear();
 }
 
@@ -17,11 +28,16 @@ Redis::~Redis() {
   handles_.clear();
 
   for(auto handle : tmp_handlers) {
+    if (db_ == nullptr || !owns_db_) {
+      break;
+    }
     //delete handle;
     db_->DestroyColumnFamilyHandle(handle);
   }
 
-  delete db_;
+  if (owns_db_) {
+    delete db_;
+  }
   delete lock_mgr_;
   delete statistics_store_;
   delete scan_cursors_store_;
@@ -30,6 +46,195 @@ Redis::~Redis() {
 
 
 
+void Redis::OpenShared(
+  rocksdb::DB* db,
+  const std::vector<rocksdb::ColumnFamilyHandle*>& handles) {
+  owns_db_ = false;
+  db_ = db;
+  handles_ = handles;
+}
+
+Status Redis::CheckColumnFamilies(
+  const rocksdb::DBOptions& db_options,
+  const std::string& dbpath,
+  const std::vector<rocksdb::ColumnFamilyDescriptor>& column_families) {
+  std::vector<std::string> existing;
+  Status s = rocksdb::DB::ListColumnFamilies(db_options, dbpath, &existing);
+  if (!s.ok()) {
+    // A new db, or an error DB::Open reports anyway.
+    return Status::OK();
+  }
+  for (const auto& name : existing) {
+    bool known = false;
+    for (const auto& cf : column_families) {
+      if (cf.name == name) {
+        known = true;
+        break;
+      }
+    }
+    if (!known) {
+      // 比如用另一种模式(unified_db)创建的db
+      return Status::InvalidArgument(dbpath + ": unknown column family",
+                                     name);
+    }
+  }
+  return Status::OK();
+}
+
+Status Redis::OpenDB(
+  const rocksdb::DBOptions& db_options,
+  const std::string& dbpath,
+  const std::vector<rocksdb::ColumnFamilyDescriptor>& column_families) {
+  Status s = CheckColumnFamilies(db_options, dbpath, column_families);
+  if (!s.ok()) {
+    return s;
+  }
+  // 一次打开, 新建的db或者老版本缺少的列族直接创建
+  rocksdb::DBOptions opts(db_options);
+  opts.create_missing_column_families = true;
+  rocksdb::DB* db = nullptr;
+  s = rocksdb::DB::Open(opts, dbpath, column_families, &handles_, &db);
+  if (s.ok()) {
+    db_ = new GatedDB(db, &write_gate_);
+  }
+  return s;
+}
+
+Status Redis::CreateCheckpoint(const std::string& dir, uint64_t* sequence) {
+  rocksdb::Checkpoint* checkpoint = nullptr;
+  Status s = rocksdb::Checkpoint::Create(db_->GetRootDB(), &checkpoint);
+  if (!s.ok()) {
+    return s;
+  }
+  // Never flush: a flush would make a paused checkpoint wait for it.
+  s = checkpoint->CreateCheckpoint(
+    dir, std::numeric_limits<uint64_t>::max(), sequence);
+  delete checkpoint;
+  return s;
+}
+
+void Redis::PauseWrites() {
+  if (owns_db_) {
+    write_gate_.Close();
+  }
+}
+
+void Redis::ResumeWrites() {
+  if (owns_db_) {
+    write_gate_.Open();
+  }
+}
+
+std::shared_ptr<rocksdb::Cache> Redis::NewBlockCache(size_t capacity) {
+  std::shared_ptr<rocksdb::Cache> cache = rocksdb::NewLRUCache(capacity);
+  block_caches_.push_back(cache);
+  return cache;
+}
+
+Status Redis::GetMemoryUsage(MemoryUsage* usage) {
+  EngineUsage engine_usage;
+  Status s = GetUsage(&engine_usage);
+  if (!s.ok()) {
+    return s;
+  }
+  *usage = MemoryUsage();
+  usage->memtables = engine_usage.total.memtables;
+  usage->table_readers = engine_usage.total.table_readers;
+  usage->block_cache = engine_usage.total.block_cache;
+  usage->block_cache_pinned = engine_usage.total.block_cache_pinned;
+  return s;
+}
+
+Status Redis::GetUsage(EngineUsage* usage) {
+  *usage = EngineUsage();
+  for (auto handle : handles_) {
+    ColumnFamilyUsage cf;
+    db_->GetIntProperty(handle, rocksdb::DB::Properties::kCurSizeAllMemTables,
+                        &cf.memtables);
+    db_->GetIntProperty(handle,
+                        rocksdb::DB::Properties::kEstimateTableReadersMem,
+                        &cf.table_readers);
+    db_->GetIntProperty(handle, rocksdb::DB::Properties::kBlockCacheUsage,
+                        &cf.block_cache);
+    db_->GetIntProperty(handle,
+                        rocksdb::DB::Properties::kBlockCachePinnedUsage,
+                        &cf.block_cache_pinned);
+    db_->GetIntProperty(
+      handle, rocksdb::DB::Properties::kEstimatePendingCompactionBytes,
+      &cf.pending_compaction_bytes);
+    db_->GetIntProperty(handle, rocksdb::DB::Properties::kLiveSstFilesSize,
+                        &cf.live_sst_size);
+    db_->GetIntProperty(handle, rocksdb::DB::Properties::kBackgroundErrors,
+                        &cf.background_errors);
+
+    usage->total.memtables += cf.memtables;
+    usage->total.table_readers += cf.table_readers;
+    usage->total.pending_compaction_bytes += cf.pending_compaction_bytes;
+    usage->total.live_sst_size += cf.live_sst_size;
+    usage->total.background_errors = cf.background_errors;
+    usage->column_families[handle->GetName()] = cf;
+  }
+  // The column families may share a block cache.
+  for (const auto& cache : block_caches_) {
+    usage->total.block_cache += cache->GetUsage();
+    usage->total.block_cache_pinned += cache->GetPinnedUsage();
+  }
+  return Status::OK();
+}
+
+// Properties of the whole db, every column family reports the same value.
+static bool IsDBWideProperty(const std::string& property) {
+  using Properties = rocksdb::DB::Properties;
+  return property == Properties::kBackgroundErrors ||
+         property == Properties::kNumRunningCompactions ||
+         property == Properties::kNumRunningFlushes ||
+         property == Properties::kIsWriteStopped ||
+         property == Properties::kActualDelayedWriteRate ||
+         property == Properties::kNumSnapshots ||
+         property == Properties::kOldestSnapshotTime ||
+         property == Properties::kIsFileDeletionsEnabled ||
+         property == Properties::kMinLogNumberToKeep ||
+         property == Properties::kMinObsoleteSstNumberToKeep;
+}
+
+static bool IsBlockCacheProperty(const std::string& property) {
+  using Properties = rocksdb::DB::Properties;
+  return property == Properties::kBlockCacheCapacity ||
+         property == Properties::kBlockCacheUsage ||
+         property == Properties::kBlockCachePinnedUsage;
+}
+
+Status Redis::GetIntProperty(const std::string& property, uint64_t* out) {
+  *out = 0;
+  if (IsBlockCacheProperty(property) && !block_caches_.empty()) {
+    // One cache of this type per column family.
+    for (const auto& cache : block_caches_) {
+      if (property == rocksdb::DB::Properties::kBlockCacheCapacity) {
+        *out += cache->GetCapacity();
+      } else if (property == rocksdb::DB::Properties::kBlockCacheUsage) {
+        *out += cache->GetUsage();
+      } else {
+        *out += cache->GetPinnedUsage();
+      }
+    }
+    return Status::OK();
+  }
+  // Without caches of this type the column families share one cache.
+  const bool once =
+    IsDBWideProperty(property) || IsBlockCacheProperty(property);
+  for (auto handle : handles_) {
+    uint64_t value = 0;
+    if (!db_->GetIntProperty(handle, property, &value)) {
+      return Status::InvalidArgument("not an integer property", property);
+    }
+    *out += value;
+    if (once) {
+      break;
+    }
+  }
+  return Status::OK();
+}
+
 Status Redis::SetOptions(const OptionType& option_type, const std::unordered_map<std::string, std::string>& options) {
         if(option_type == OptionType::kDB) {
           return db_->SetDBOptions(options);
@@ -58,6 +263,57 @@ Status Redis::SetSmallCompactionThreshold(size_t small_compaction_threshold) {
   return Status::OK();
 }
 
+Status Redis::CompactExpiredFiles(double ratio, uint64_t* compacted_files) {
+  *compacted_files = 0;
+  // meta列族(strings的数据)总是第一个列族
+  rocksdb::ColumnFamilyHandle* cf = handles_[0];
+  rocksdb::TablePropertiesCollection props;
+  Status s = db_->GetPropertiesOfAllTables(cf, &props);
+  if (!s.ok()) {
+    return s;
+  }
+
+  int64_t now;
+  rocksdb::Env::Default()->GetCurrentTime(&now);
+  rocksdb::ColumnFamilyMetaData cf_meta;
+  db_->GetColumnFamilyMetaData(cf, &cf_meta);
+  // level -> expired files
+  std::map<int, std::vector<std::string>> expired_files;
+  for (const auto& level_meta : cf_meta.levels) {
+    if (level_meta.level == 0) {
+      continue;
+    }
+    for (const auto& file : level_meta.files) {
+      if (file.being_compacted) {
+        continue;
+      }
+      // The keys of `props` are full paths, `name` is "/NNNNNN.sst".
+      auto iter = props.find(file.db_path + file.name);
+      if (iter == props.end()) {
+        continue;
+      }
+      TtlProperties ttl_props;
+      if (ttl_props.Decode(iter->second->user_collected_properties) &&
+          ttl_props.IsMostlyExpired(now, ratio)) {
+        expired_files[level_meta.level].push_back(file.name);
+      }
+    }
+  }
+
+  // Rewrite in place, the compaction filter drops the expired values.
+  rocksdb::CompactionOptions compact_opts;
+  for (const auto& level_files : expired_files) {
+    s = db_->CompactFiles(compact_opts, cf, level_files.second,
+                          level_files.first);
+    if (!s.ok()) {
+      // Picked up by a concurrent compaction, try again next time.
+      continue;
+    }
+    *compacted_files += level_files.second.size();
+  }
+  return Status::OK();
+}
+
 
 
 
@@ -4,14 +4,17 @@
 #include <string>
 #include <vector>
 
+#include "rocksdb/cache.h"
 #include "rocksdb/db.h"
 #include "rocksdb/slice.h"
 #include "rocksdb/status.h"
 
 #include "blackwidow/blackwidow.h"
+#include "command_stats.h"
 #include "lock_mgr.h"
 #include "lru_cache.h"
 #include "mutex_impl.h"
+#include "write_gate.h"
 
 namespace blackwidow {
 
@@ -31,6 +34,46 @@ class Redis {
  // Aux Methods
   Status SetMaxCacheStatisticKeys(size_t max_cache_statistic_keys);
   Status SetSmallCompactionThreshold(size_t small_compaction_threshold);
+  // Compacts the ssts of the meta column family whose ttl values are all
+  // expired and make up at least `ratio` of the sst, see
+  // TtlPropertiesCollector. Level 0 ssts are left to the L0 trigger.
+  Status CompactExpiredFiles(double ratio, uint64_t* compacted_files);
+  // Memory of this type, block caches shared with other types excluded.
+  // The memory part of GetUsage.
+  Status GetMemoryUsage(MemoryUsage* usage);
+  // Memory, compaction backlog, sst size and errors of every column family
+  // of this type.
+  Status GetUsage(EngineUsage* usage);
+  // Hard links the ssts of the db into `dir`, which must not exist, and
+  // copies the WAL instead of flushing the memtables. `sequence` is the
+  // last sequence number in the checkpoint.
+  Status CreateCheckpoint(const std::string& dir, uint64_t* sequence);
+  // Blocks the writes to a db of its own until ResumeWrites, once the
+  // writes in flight are done. The db shared by all types has no gate.
+  void PauseWrites();
+  void ResumeWrites();
+  // The commands of this type run so far by command name.
+  void GetCommandStats(std::map<std::string, CommandStats>* stats) {
+    command_stats_.GetStats(stats);
+  }
+
+  // Fills the column families of this type, the meta cf first, and adds
+  // what the type needs to `db_options`. The names are the ones used in a
+  // db of its own, where the first cf is the default one.
+  virtual void PrepareOptions(
+    const BlackWidowOptions& bw_options,
+    rocksdb::DBOptions* db_options,
+    std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) = 0;
+  // Uses the column families `handles`, in PrepareOptions order, of a db
+  // shared by all types. The db and the handles stay owned by the caller.
+  void OpenShared(rocksdb::DB* db,
+                  const std::vector<rocksdb::ColumnFamilyHandle*>& handles);
+  // Fails if the db at `dbpath` has a column family not in
+  // `column_families`, e.g. it was created in the other BlackWidow mode.
+  static Status CheckColumnFamilies(
+    const rocksdb::DBOptions& db_options,
+    const std::string& dbpath,
+    const std::vector<rocksdb::ColumnFamilyDescriptor>& column_families);
 
   // Common Commands
   virtual Status Open(const BlackWidowOptions& bw_options,
@@ -54,12 +97,33 @@ class Redis {
   // TODO: PKExpireScan
 
  protected:
+  // Opens a db of its own with the column families of PrepareOptions,
+  // the missing ones are created.
+  Status OpenDB(const rocksdb::DBOptions& db_options,
+                const std::string& dbpath,
+                const std::vector<rocksdb::ColumnFamilyDescriptor>&
+                  column_families);
+
+  // Sums the integer `property` over the column families of this type,
+  // InvalidArgument if it is not an integer property. A property of the
+  // whole db, or of a block cache the column families share, is read once.
+  Status GetIntProperty(const std::string& property, uint64_t* out);
+
+  // A block cache of this type only, see GetMemoryUsage.
+  std::shared_ptr<rocksdb::Cache> NewBlockCache(size_t capacity);
+
   BlackWidow* const bw_;
   DataType type_;
   LockMgr* lock_mgr_;
 
   rocksdb::DB* db_;
   std::vector<rocksdb::ColumnFamilyHandle*> handles_;
+  // False if db_ and handles_ are shared with the other types.
+  bool owns_db_;
+  // Every write to a db of its own passes it, see GatedDB.
+  WriteGate write_gate_;
+  CommandStatsRegistry command_stats_;
+  std::vector<std::shared_ptr<rocksdb::Cache>> block_caches_;
   rocksdb::WriteOptions default_write_options_;
   rocksdb::ReadOptions default_read_options_;
   rocksdb::CompactRangeOptions default_compact_range_options_;
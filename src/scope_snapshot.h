@@ -23,4 +23,31 @@ class ScopeSnapshot {
   const rocksdb::Snapshot** snapshot_;
 };
 
+// A snapshot taken on the first Get only, for reads that need one in rare
+// cases.
+class LazySnapshot {
+ public:
+  explicit LazySnapshot(rocksdb::DB* db) : db_(db), snapshot_(nullptr) {}
+
+  ~LazySnapshot() {
+    if (snapshot_ != nullptr) {
+      db_->ReleaseSnapshot(snapshot_);
+    }
+  }
+
+  LazySnapshot(const LazySnapshot&) = delete;
+  LazySnapshot& operator=(const LazySnapshot&) = delete;
+
+  const rocksdb::Snapshot* Get() {
+    if (snapshot_ == nullptr) {
+      snapshot_ = db_->GetSnapshot();
+    }
+    return snapshot_;
+  }
+
+ private:
+  rocksdb::DB* const db_;
+  const rocksdb::Snapshot* snapshot_;
+};
+
 }  // namespace blackwidow
\ No newline at end of file
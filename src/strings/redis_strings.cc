@@ -1,43 +1,133 @@
 #include "redis_strings.h"
 #include "blackwidow/util.h"
+#include "bulk_loader.h"
+#include "counter_merge_operator.h"
 #include "scope_record_lock.h"
 #include "scope_snapshot.h"
+#include "strings_bitops.h"
+#include "strings_chunks.h"
 #include "strings_filter.h"
+#include "strings_format.h"
+#include "ttl_properties_collector.h"
 
 namespace blackwidow {
 
-RedisStrings::RedisStrings(BlackWidow* const bw) : Redis(bw, kStrings) {}
+// 和redis一样, value最长512MB
+static constexpr uint64_t kMaxStringLength = 512ULL * 1024 * 1024;
+
+RedisStrings::RedisStrings(BlackWidow* const bw)
+    : Redis(bw, kStrings),
+      chunk_threshold_(0),
+      chunk_size_(0),
+      chunk_meta_cache_(std::make_shared<MetaLookupCache>()) {}
 
 Status RedisStrings::Open(const BlackWidowOptions& bw_options,
                           const std::string& dbpath) {
-  rocksdb::Options ops(bw_options.options);
+  rocksdb::DBOptions db_opts(bw_options.options);
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  PrepareOptions(bw_options, &db_opts, &column_families);
+  return OpenDB(db_opts, dbpath, column_families);
+}
+
+void RedisStrings::PrepareOptions(
+  const BlackWidowOptions& bw_options,
+  rocksdb::DBOptions* db_options,
+  std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) {
+  command_stats_.SetOptions(bw_options.command_stats,
+                            bw_options.command_stats_block_reads);
+  chunk_threshold_ = bw_options.strings_chunk_threshold;
+  chunk_size_ = std::max<uint32_t>(bw_options.strings_chunk_size, 1);
+  rocksdb::ColumnFamilyOptions ops(bw_options.options);
 
   // CompactionFilter中删除ttl过期的string
   ops.compaction_filter_factory.reset(new StringsFilterFactory());
+  // 计数器的增量可以直接Merge写入, 读取或者compaction时再合并
+  ops.merge_operator.reset(new CounterMergeOperator(true));
+  // 频繁覆盖写的key提前向下compaction, 让旧版本尽早被新版本覆盖掉
+  compaction_listener_ = std::make_shared<StringsCompactionListener>(
+    bw_options.strings_overwrite_compaction_ratio,
+    bw_options.strings_overwrite_compaction_interval);
+  db_options->listeners.push_back(compaction_listener_);
+  // 记录每个sst的过期时间, 后台线程据此主动compaction基本已过期的sst
+  ops.table_properties_collector_factories.push_back(
+    std::make_shared<TtlPropertiesCollectorFactory<ParsedStringsValue>>());
 
   // 使用缓存提高查询效率 布隆过滤器减少无效的磁盘seek
   rocksdb::BlockBasedTableOptions table_ops(bw_options.table_options);
   table_ops.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, true));
   if (bw_options.share_block_cache == false &&
       bw_options.block_cache_size > 0) {
-    table_ops.block_cache = rocksdb::NewLRUCache(bw_options.block_cache_size);
+    table_ops.block_cache = NewBlockCache(bw_options.block_cache_size);
   }
   ops.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_ops));
-  return rocksdb::DB::Open(ops, dbpath, &db_);
+
+  // 大value的chunk, 删除/过期/重写后由StringsChunkFilter清理
+  rocksdb::BlockBasedTableOptions chunk_table_ops(table_ops);
+  if (bw_options.share_block_cache == false &&
+      bw_options.block_cache_size > 0) {
+    chunk_table_ops.block_cache = NewBlockCache(bw_options.block_cache_size);
+  }
+  rocksdb::ColumnFamilyOptions chunk_ops(bw_options.options);
+  chunk_ops.compaction_filter_factory.reset(
+    new StringsChunkFilterFactory(&db_, &handles_, chunk_meta_cache_));
+  chunk_ops.table_factory.reset(
+    rocksdb::NewBlockBasedTableFactory(chunk_table_ops));
+
+  // 默认列族必须是第一个
+  column_families->push_back(
+    rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName, ops));
+  column_families->push_back(
+    rocksdb::ColumnFamilyDescriptor("chunk_cf", chunk_ops));
+}
+
+StringsCompactionStats RedisStrings::GetCompactionStats() const {
+  return compaction_listener_->GetStats();
+}
+
+Status RedisStrings::BulkLoad(std::vector<KeyValue>* kvs) {
+  // Equal keys keep their input order, the last one wins. Nothing is read
+  // for the plain values, so unlike MSet their keys are not locked.
+  std::stable_sort(kvs->begin(), kvs->end());
+  BulkLoader loader(db_);
+  std::vector<const KeyValue*> chunked_kvs;
+  for (size_t i = 0; i < kvs->size(); i++) {
+    const KeyValue& kv = (*kvs)[i];
+    if (i + 1 < kvs->size() && (*kvs)[i + 1].key == kv.key) {
+      continue;
+    }
+    if (ShouldChunk(kv.value)) {
+      // 需要读旧的version, 在ingest之后单独写入
+      chunked_kvs.push_back(&kv);
+      continue;
+    }
+    StringsValue strings_value(kv.value);
+    loader.Put(handles_[0], kv.key, strings_value.Encode());
+  }
+  Status s = loader.Ingest();
+  for (size_t i = 0; s.ok() && i < chunked_kvs.size(); i++) {
+    ScopeRecordLock l(lock_mgr_, chunked_kvs[i]->key);
+    s = Aux_SetValue(chunked_kvs[i]->key, chunked_kvs[i]->value, 0);
+  }
+  return s;
 }
 
 Status RedisStrings::CompactRange(const rocksdb::Slice* begin,
                                   const rocksdb::Slice* end,
                                   const ColumnFamilyType& type) {
-  // strings只有1个默认的列族
-  return db_->CompactRange(default_compact_range_options_, begin, end);
+  Status s;
+  if (type == kMeta || type == kMetaAndData) {
+    s = db_->CompactRange(default_compact_range_options_, begin, end);
+  }
+  // chunk key带有前缀, 整个chunk列族一起compaction
+  if (s.ok() && (type == kData || type == kMetaAndData)) {
+    s = db_->CompactRange(
+      default_compact_range_options_, handles_[1], nullptr, nullptr);
+  }
+  return s;
 }
 
 Status RedisStrings::GetProperty(const std::string& property, uint64_t* out) {
-  std::string value;
-  auto s = db_->GetProperty(db_->DefaultColumnFamily(), property, &value);
-  *out = std::strtoull(value.c_str(), NULL, 10);
-  return Status::OK();
+  return GetIntProperty(property, out);
 }
 
 Status RedisStrings::ScanKeyNum(KeyInfo* key_info) {
@@ -57,6 +147,7 @@ Status RedisStrings::PKPatternMatchDel(const std::string& pattern,
 
 
 Status RedisStrings::Del(const Slice& key) {
+  CommandTimer timer(&command_stats_, kCmdDel, key.size());
   std::string value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, key, &value);
@@ -65,12 +156,13 @@ Status RedisStrings::Del(const Slice& key) {
     if (parsed_strings_value.IsStale()) {
       return Status::NotFound("Stale");
     }
-    return db_->Delete(default_write_options_, key);
+    return timer.Done(db_->Delete(default_write_options_, key));
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisStrings::Expire(const Slice& key, int32_t ttl) {
+  CommandTimer timer(&command_stats_, kCmdExpire, key.size());
   std::string value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, key, &value);
@@ -81,12 +173,12 @@ Status RedisStrings::Expire(const Slice& key, int32_t ttl) {
     }
     if (ttl > 0) {
       parsed_strings_value.SetRelativeTimestamp(ttl);
-      return db_->Put(default_write_options_, key, value);
+      return timer.Done(db_->Put(default_write_options_, key, value));
     } else {
-      return db_->Delete(default_write_options_, key);
+      return timer.Done(db_->Delete(default_write_options_, key));
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 static int32_t GetCurrentUnixTime() {
@@ -96,6 +188,7 @@ static int32_t GetCurrentUnixTime() {
 }
 
 Status RedisStrings::ExpireAt(const Slice& key, int32_t timestamp) {
+  CommandTimer timer(&command_stats_, kCmdExpireAt, key.size());
   std::string value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, key, &value);
@@ -106,14 +199,15 @@ Status RedisStrings::ExpireAt(const Slice& key, int32_t timestamp) {
     }
     if (timestamp >= GetCurrentUnixTime()) {
       parsed_strings_value.set_timestamp(timestamp);
-      return db_->Put(default_write_options_, key, value);
+      return timer.Done(db_->Put(default_write_options_, key, value));
     } else {
-      return db_->Delete(default_write_options_, key);
+      return timer.Done(db_->Delete(default_write_options_, key));
     }
   }
-  return s;
+  return timer.Done(s);
 }
 Status RedisStrings::Persist(const Slice& key) {
+  CommandTimer timer(&command_stats_, kCmdPersist, key.size());
   std::string value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, key, &value);
@@ -127,18 +221,19 @@ Status RedisStrings::Persist(const Slice& key) {
         return Status::NotFound("Not have an associated timeout");
       } else {
         parsed_strings_value.set_timestamp(0);
-        return db_->Put(default_write_options_, key, value);
+        return timer.Done(db_->Put(default_write_options_, key, value));
       }
     }
   }
-  return s;
+  return timer.Done(s);
 }
 Status RedisStrings::TTL(const Slice& key, int64_t* timestamp) {
-  std::string value;
+  CommandTimer timer(&command_stats_, kCmdTTL, key.size());
+  rocksdb::PinnableSlice value;
   ScopeRecordLock l(lock_mgr_, key);
-  Status s = db_->Get(default_read_options_, key, &value);
+  Status s = db_->Get(default_read_options_, handles_[0], key, &value);
   if (s.ok()) {
-    ParsedStringsValue parsed_strings_value(&value);
+    ParsedStringsValue parsed_strings_value(value);
     if (parsed_strings_value.IsStale()) {
       *timestamp = -2;
       return Status::NotFound("Stale");
@@ -155,7 +250,7 @@ Status RedisStrings::TTL(const Slice& key, int64_t* timestamp) {
   } else if (s.IsNotFound()) {
     *timestamp = -2;
   }
-  return s;
+  return timer.Done(s);
 }
 
 bool RedisStrings::Scan(const std::string& start_key,
@@ -218,74 +313,95 @@ void RedisStrings::ScanDatabase() {
 Status RedisStrings::Append(const Slice& key,
                             const Slice& value,
                             int32_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdAppend, key.size() + value.size());
   *ret = 0;
   std::string old_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, key, &old_value);
   if (s.ok()) {
     ParsedStringsValue parsed_value(&old_value);
+    ChunkedStringMeta meta;
     if (parsed_value.IsStale()) {
-      StringsValue sv(value);
-      s = db_->Put(default_write_options_, key, sv.Encode());
+      s = Aux_SetValue(key, value, 0);
       if (s.ok()) {
         *ret = value.size();
       }
+    } else if (ChunkedStringMeta::Decode(parsed_value.user_value(), &meta)) {
+      // 只重写最后一个chunk和新增的chunk
+      ChunkedString chunked(db_, handles_[1], key, meta);
+      s = chunked.Write(meta.length, value);
+      if (s.ok()) {
+        s = Aux_FlushChunked(&chunked, parsed_value.timestamp());
+      }
+      if (s.ok()) {
+        *ret = chunked.length();
+      }
     } else {
       // append to old_value
       int32_t timestamp = parsed_value.timestamp();
       parsed_value.StripSuffix();
       old_value.append(value.data(), value.size());
-      StringsValue sv(old_value);
-      sv.set_timestamp(timestamp);
-      s = db_->Put(default_write_options_, key, sv.Encode());
+      s = Aux_SetValue(key, old_value, timestamp);
       if (s.ok()) {
         *ret = old_value.length();
       }
     }
   } else if (s.IsNotFound()) {
-    StringsValue sv(value);
-    s = db_->Put(default_write_options_, key, sv.Encode());
+    s = Aux_SetValue(key, value, 0);
     if (s.ok()) {
       *ret = value.size();
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
-static uint64_t GetBitCount(const char* data, size_t length) {
-  uint64_t bitcount = 0;
-  for (auto i = 0; i < length; i++) {
-    unsigned char c = static_cast<unsigned char>(data[i]);
-    for (auto j = 0; j < 8; j++) {
-      if ((c >> j) & (unsigned char)0x1) {
-        bitcount++;
-      }
-    }
-  }
-  return bitcount;
+Status RedisStrings::BitCount(const Slice& key, uint64_t* ret) {
+  return BitCount(key, 0, -1, ret);
 }
 
-Status RedisStrings::BitCount(const Slice& key, uint64_t* ret) {
-  std::string value;
-  ScopeRecordLock l(lock_mgr_, key);
+Status RedisStrings::BitCount(const Slice& key,
+                              int64_t start_offset,
+                              int64_t end_offset,
+                              uint64_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdBitCount, key.size());
+  // 只读一次, 不需要加锁
+  rocksdb::PinnableSlice value;
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
   *ret = 0;
-  Status s = db_->Get(default_read_options_, key, &value);
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, &value);
   if (s.ok()) {
-    ParsedStringsValue parsed_strings_value(&value);
+    ParsedStringsValue parsed_strings_value(value);
     Slice user_value = parsed_strings_value.user_value();
-    if (!parsed_strings_value.IsStale() && user_value.size() > 0) {
-      *ret = GetBitCount(user_value.data(), user_value.size());
+    ChunkedStringMeta meta;
+    if (parsed_strings_value.IsStale()) {
+      // 过期的key计数为0
+    } else if (ChunkedStringMeta::Decode(user_value, &meta)) {
+      if (NormalizeRange(meta.length, &start_offset, &end_offset)) {
+        ChunkedString chunked(db_, handles_[1], key, meta);
+        s = chunked.Visit(read_options, start_offset,
+                          end_offset - start_offset + 1,
+                          [ret](const Slice& bytes) {
+                            *ret += Popcount(bytes.data(), bytes.size());
+                            return true;
+                          });
+      }
+    } else if (NormalizeRange(user_value.size(), &start_offset,
+                              &end_offset)) {
+      *ret = Popcount(user_value.data() + start_offset,
+                      end_offset - start_offset + 1);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisStrings::SetBit(const Slice& key,
                             uint64_t offset,
                             uint32_t newbit,
                             uint32_t* oldbit) {
+  CommandTimer timer(&command_stats_, kCmdSetBit, key.size());
   if (newbit != 0 && newbit != 1)
-    return Status::InvalidArgument("bit out of range");
+    return timer.Done(Status::InvalidArgument("bit out of range"));
 
   std::string value;
   ScopeRecordLock l(lock_mgr_, key);
@@ -293,17 +409,40 @@ Status RedisStrings::SetBit(const Slice& key,
   Status s = db_->Get(default_read_options_, key, &value);
   if (s.ok()) {
     ParsedStringsValue parsed_strings_value(&value);
+    ChunkedStringMeta meta;
+    if (!parsed_strings_value.IsStale() &&
+        ChunkedStringMeta::Decode(parsed_strings_value.user_value(), &meta)) {
+      // 只重写offset所在的chunk
+      ChunkedString chunked(db_, handles_[1], key, meta);
+      std::string byte;
+      s = chunked.Read(default_read_options_, offset / 8, 1, &byte);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
+      byte.resize(1, 0);
+      *oldbit = ((byte[0] & mask) != 0);
+      if (newbit == 0) {
+        byte[0] &= (~mask);
+      } else {
+        byte[0] |= mask;
+      }
+      s = chunked.Write(offset / 8, byte);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
+      return timer.Done(
+        Aux_FlushChunked(&chunked, parsed_strings_value.timestamp()));
+    }
     if (!parsed_strings_value.IsStale()) {
       int32_t timestamp = parsed_strings_value.timestamp();
       Slice user_value = parsed_strings_value.user_value();
-      char* data = const_cast<char*>(user_value.data());
       size_t old_length = user_value.size();
 
       parsed_strings_value.StripSuffix();
       if (old_length * 8 <= offset) {
-        size_t new_length = ((offset + (8 - 1)) & (~(8 - 1))) / 8;
-        value.resize(new_length);
+        value.resize(offset / 8 + 1);
       }
+      char* data = value.data();
 
       *oldbit = ((data[offset / 8] & mask) != 0);
       if (newbit == 0) {
@@ -312,12 +451,10 @@ Status RedisStrings::SetBit(const Slice& key,
         data[offset / 8] |= mask;
       }
 
-      StringsValue sv(Slice(value.data(), value.size()));
-      sv.set_timestamp(timestamp);
-      return db_->Put(default_write_options_, key, sv.Encode());
+      return timer.Done(Aux_SetValue(key, value, timestamp));
     }
   } else if (!s.IsNotFound()) {
-    return s;
+    return timer.Done(s);
   }
 
   // NotFound or Stale Already.
@@ -330,32 +467,261 @@ Status RedisStrings::SetBit(const Slice& key,
   } else {
     data[offset / 8] |= mask;
   }
-  StringsValue sv(value);
-  return db_->Put(default_write_options_, key, sv.Encode());
+  return timer.Done(Aux_SetValue(key, value, 0));
 }
 
 Status RedisStrings::GetBit(const Slice& key, uint64_t offset, uint32_t* ret) {
-  std::string value;
+  CommandTimer timer(&command_stats_, kCmdGetBit, key.size());
+  rocksdb::PinnableSlice value;
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
   *ret = 0;
-  Status s = db_->Get(default_read_options_, key, &value);
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, &value);
   if (s.ok()) {
-    ParsedStringsValue parsed_strings_value(&value);
+    ParsedStringsValue parsed_strings_value(value);
     Slice user_value = parsed_strings_value.user_value();
-    if (!parsed_strings_value.IsStale() && (user_value.size() * 8) > offset) {
+    const uint64_t pos = offset / 8;
+    const uint64_t sft = offset % 8;
+    ChunkedStringMeta meta;
+    if (parsed_strings_value.IsStale()) {
+      // 过期的key读到0
+    } else if (ChunkedStringMeta::Decode(user_value, &meta)) {
+      ChunkedString chunked(db_, handles_[1], key, meta);
+      std::string byte;
+      s = chunked.Read(read_options, pos, 1, &byte);
+      if (s.ok() && !byte.empty()) {
+        *ret = (static_cast<unsigned char>(byte[0]) &
+                ((unsigned char)0x1 << (7 - sft))) != 0;
+      }
+    } else if ((user_value.size() * 8) > offset) {
       const char* data = user_value.data();
-      const uint64_t pos = offset / 8;
-      const uint64_t sft = offset % 8;
       *ret = (static_cast<unsigned char>(data[pos]) &
               ((unsigned char)0x1 << (7 - sft))) != 0;
     }
   }
-  return s;
+  return timer.Done(s);
+}
+
+Status RedisStrings::BitOp(BitOpType op,
+                           const std::string& dest_key,
+                           const std::vector<std::string>& src_keys,
+                           int64_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdBitOp,
+                     dest_key.size() + BytesOf(src_keys));
+  if (op != kBitOpAnd && op != kBitOpOr && op != kBitOpXor &&
+      op != kBitOpNot) {
+    return timer.Done(Status::InvalidArgument("unknown bitop"));
+  }
+  if (src_keys.empty()) {
+    return timer.Done(Status::InvalidArgument("no source key"));
+  }
+  if (op == kBitOpNot && src_keys.size() != 1) {
+    return timer.Done(
+      Status::InvalidArgument("BITOP NOT must be called with a single "
+                              "source key."));
+  }
+
+  ScopeRecordLock l(lock_mgr_, dest_key);
+  // 所有源key从同一个快照读, 每次只持有一个源value
+  const rocksdb::Snapshot* snapshot = nullptr;
+  ScopeSnapshot ss(db_, &snapshot);
+  rocksdb::ReadOptions read_options(default_read_options_);
+  read_options.snapshot = snapshot;
+
+  std::string result;
+  std::string value;
+  std::string chunked_value;
+  for (size_t i = 0; i < src_keys.size(); i++) {
+    Slice user_value;
+    Status s = db_->Get(read_options, src_keys[i], &value);
+    if (s.ok()) {
+      ParsedStringsValue parsed_strings_value(&value);
+      if (!parsed_strings_value.IsStale()) {
+        user_value = parsed_strings_value.user_value();
+      }
+    } else if (!s.IsNotFound()) {
+      return timer.Done(s);
+    }
+    ChunkedStringMeta meta;
+    if (ChunkedStringMeta::Decode(user_value, &meta)) {
+      ChunkedString chunked(db_, handles_[1], src_keys[i], meta);
+      chunked_value.clear();
+      s = chunked.Read(read_options, 0, meta.length, &chunked_value);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
+      user_value = chunked_value;
+    }
+    if (i == 0) {
+      result.assign(user_value.data(), user_value.size());
+      if (op == kBitOpNot) {
+        BitNot(&result[0], result.size());
+      }
+    } else {
+      BitOpFold(op, user_value.data(), user_value.size(), &result);
+    }
+  }
+
+  rocksdb::WriteBatch batch;
+  if (result.empty()) {
+    batch.Delete(dest_key);
+  } else {
+    Status s = Aux_PutValue(dest_key, result, 0, &batch);
+    if (!s.ok()) {
+      return timer.Done(s);
+    }
+  }
+  *ret = result.size();
+  return timer.Done(db_->Write(default_write_options_, &batch));
+}
+
+Status RedisStrings::BitPos(const Slice& key, int32_t bit, int64_t* ret) {
+  return Aux_BitPos(key, bit, 0, -1, false, ret);
+}
+
+Status RedisStrings::BitPos(const Slice& key,
+                            int32_t bit,
+                            int64_t start_offset,
+                            int64_t* ret) {
+  return Aux_BitPos(key, bit, start_offset, -1, false, ret);
+}
+
+Status RedisStrings::BitPos(const Slice& key,
+                            int32_t bit,
+                            int64_t start_offset,
+                            int64_t end_offset,
+                            int64_t* ret) {
+  return Aux_BitPos(key, bit, start_offset, end_offset, true, ret);
+}
+
+Status RedisStrings::BitField(const Slice& key,
+                              const std::vector<BitFieldOp>& ops,
+                              std::vector<BitFieldResult>* results) {
+  CommandTimer timer(&command_stats_, kCmdBitField, key.size());
+  static const uint64_t kMaxBits = kMaxStringLength * 8;
+  bool read_only = true;
+  for (const auto& op : ops) {
+    const int max_bits = op.is_signed ? 64 : 63;
+    if (op.bits < 1 || op.bits > max_bits) {
+      return timer.Done(Status::InvalidArgument(
+        "Invalid bitfield type. Use something like i16 u8. Note that u64 "
+        "is not supported but i64 is."));
+    }
+    if (op.offset > kMaxBits - op.bits) {
+      return timer.Done(Status::InvalidArgument(
+        "bit offset is not an integer or out of range"));
+    }
+    if (op.type != BitFieldOp::kGet) {
+      read_only = false;
+    }
+  }
+
+  std::unique_ptr<ScopeRecordLock> l;
+  if (!read_only) {
+    l.reset(new ScopeRecordLock(lock_mgr_, key));
+  }
+  std::string value;
+  int32_t timestamp = 0;
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
+  rocksdb::PinnableSlice pinned_value;
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, &pinned_value);
+  std::unique_ptr<ChunkedString> chunked;
+  if (s.ok()) {
+    ParsedStringsValue parsed_strings_value(pinned_value);
+    Slice user_value = parsed_strings_value.user_value();
+    ChunkedStringMeta meta;
+    if (!parsed_strings_value.IsStale()) {
+      timestamp = parsed_strings_value.timestamp();
+      if (ChunkedStringMeta::Decode(user_value, &meta)) {
+        // 只读写op涉及的chunk
+        chunked.reset(new ChunkedString(db_, handles_[1], key, meta));
+      } else {
+        value.assign(user_value.data(), user_value.size());
+      }
+    }
+  } else if (!s.IsNotFound()) {
+    return timer.Done(s);
+  }
+
+  // The bytes holding the bits of `op`, cut at the end of the value.
+  auto load = [&](const BitFieldOp& op, std::string* bytes) {
+    const uint64_t first = op.offset / 8;
+    const uint64_t n = (op.offset % 8 + op.bits + 7) / 8;
+    bytes->clear();
+    if (chunked != nullptr) {
+      return chunked->Read(read_options, first, n, bytes);
+    }
+    if (first < value.size()) {
+      bytes->assign(value, first, n);
+    }
+    return Status::OK();
+  };
+  auto store = [&](const BitFieldOp& op, const std::string& bytes) {
+    const uint64_t first = op.offset / 8;
+    if (chunked != nullptr) {
+      return chunked->Write(first, bytes);
+    }
+    if (value.size() < first + bytes.size()) {
+      value.resize(first + bytes.size(), 0);
+    }
+    memcpy(&value[first], bytes.data(), bytes.size());
+    return Status::OK();
+  };
+
+  results->clear();
+  bool changed = false;
+  std::string bytes;
+  for (const auto& op : ops) {
+    BitFieldResult result;
+    s = load(op, &bytes);
+    if (!s.ok()) {
+      return timer.Done(s);
+    }
+    uint64_t old_bits =
+      GetBitfield(bytes.data(), bytes.size(), op.offset % 8, op.bits);
+    int64_t old_value = op.is_signed ? SignExtend(old_bits, op.bits)
+                                     : static_cast<int64_t>(old_bits);
+    if (op.type == BitFieldOp::kGet) {
+      result.value = old_value;
+      results->push_back(result);
+      continue;
+    }
+
+    int64_t new_value = 0;
+    bool ok = op.type == BitFieldOp::kSet
+      ? BitfieldAdd(op.is_signed, op.bits, op.value, 0, op.overflow,
+                    &new_value)
+      : BitfieldAdd(op.is_signed, op.bits, old_value, op.value, op.overflow,
+                    &new_value);
+    if (!ok) {
+      result.failed = true;
+      results->push_back(result);
+      continue;
+    }
+    bytes.resize((op.offset % 8 + op.bits + 7) / 8, 0);
+    SetBitfield(&bytes[0], op.offset % 8, op.bits, new_value);
+    s = store(op, bytes);
+    if (!s.ok()) {
+      return timer.Done(s);
+    }
+    changed = true;
+    result.value = op.type == BitFieldOp::kSet ? old_value : new_value;
+    results->push_back(result);
+  }
+
+  if (!changed) {
+    return timer.Done(Status::OK());
+  }
+  if (chunked != nullptr) {
+    return timer.Done(Aux_FlushChunked(chunked.get(), timestamp));
+  }
+  return timer.Done(Aux_SetValue(key, value, timestamp));
 }
 
 Status RedisStrings::Aux_Incr(const Slice& key, int64_t delta, int64_t* ret) {
   RecordLockGuard g(lock_mgr_, key);
   std::string old_value;
-  int32_t timestamp = 0;
   int64_t old_num = 0;
   Status s;
   do {
@@ -365,7 +731,6 @@ Status RedisStrings::Aux_Incr(const Slice& key, int64_t delta, int64_t* ret) {
       if (parsed_strings_value.IsStale()) {
         break;
       } else {
-        timestamp = parsed_strings_value.timestamp();
         std::string old_num_str = parsed_strings_value.value().ToString();
         char* endptr = nullptr;
         old_num = std::strtoll(old_num_str.c_str(), &endptr, 10);
@@ -388,33 +753,306 @@ Status RedisStrings::Aux_Incr(const Slice& key, int64_t delta, int64_t* ret) {
     return Status::InvalidArgument("Overflow");
   }
 
-  int64_t new_num = old_num + delta;
-  StringsValue strings_value(std::to_string(new_num));
-  strings_value.set_timestamp(timestamp);
-  s = db_->Put(default_write_options_, key, strings_value.Encode());
+  // 用Merge写入delta而不是Put, 不会覆盖同时写入的blind increment
+  s = db_->Merge(default_write_options_, key,
+                 CounterMergeOperator::EncodeIntOperand(delta));
+  if (!s.ok()) {
+    return s;
+  }
+  *ret = old_num + delta;
+  std::string new_value;
+  s = db_->Get(default_read_options_, key, &new_value);
   if (s.ok()) {
-    *ret = new_num;
+    ParsedStringsValue parsed_strings_value(&new_value);
+    Slice new_num_str = parsed_strings_value.value();
+    int64_t new_num = 0;
+    if (StrToInt64(new_num_str.data(), new_num_str.size(), &new_num) == 0) {
+      *ret = new_num;
+    }
+  } else if (s.IsNotFound()) {
+    s = Status::OK();
   }
   return s;
 }
 
+Status RedisStrings::Aux_BitPos(const Slice& key,
+                                int32_t bit,
+                                int64_t start_offset,
+                                int64_t end_offset,
+                                bool have_end,
+                                int64_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdBitPos, key.size());
+  if (bit != 0 && bit != 1) {
+    return timer.Done(
+      Status::InvalidArgument("The bit argument must be 1 or 0."));
+  }
+  rocksdb::PinnableSlice value;
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
+  // 不存在的key看作全0的无限长字符串
+  *ret = bit ? -1 : 0;
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, &value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedStringsValue parsed_strings_value(value);
+  if (parsed_strings_value.IsStale()) {
+    return Status::NotFound("Stale");
+  }
+  Slice user_value = parsed_strings_value.user_value();
+  ChunkedStringMeta meta;
+  const bool is_chunked = ChunkedStringMeta::Decode(user_value, &meta);
+  const uint64_t length = is_chunked ? meta.length : user_value.size();
+  if (!NormalizeRange(length, &start_offset, &end_offset)) {
+    *ret = -1;
+    return timer.Done(s);
+  }
+  int64_t pos = -1;
+  if (is_chunked) {
+    // 逐个chunk查找, 找到即停止
+    ChunkedString chunked(db_, handles_[1], key, meta);
+    uint64_t scanned = 0;
+    s = chunked.Visit(read_options, start_offset,
+                      end_offset - start_offset + 1,
+                      [&](const Slice& bytes) {
+                        int64_t found = FindBit(bytes.data(), bytes.size(),
+                                                bit);
+                        if (found >= 0) {
+                          pos = scanned * 8 + found;
+                          return false;
+                        }
+                        scanned += bytes.size();
+                        return true;
+                      });
+    if (!s.ok()) {
+      return timer.Done(s);
+    }
+  } else {
+    pos = FindBit(user_value.data() + start_offset,
+                  end_offset - start_offset + 1, bit);
+  }
+  if (pos >= 0) {
+    *ret = start_offset * 8 + pos;
+  } else if (bit == 0 && !have_end) {
+    // 没有指定end时, value之后的0也算在内
+    *ret = (end_offset + 1) * 8;
+  } else {
+    *ret = -1;
+  }
+  return timer.Done(s);
+}
+
+bool RedisStrings::ShouldChunk(const Slice& value) const {
+  ChunkedStringMeta meta;
+  // 和meta格式相同的小value也要分块存储, 否则读的时候无法区分
+  return (chunk_threshold_ > 0 && value.size() >= chunk_threshold_) ||
+         ChunkedStringMeta::Decode(value, &meta);
+}
+
+Status RedisStrings::Aux_PutValue(const Slice& key,
+                                  const Slice& value,
+                                  int32_t timestamp,
+                                  rocksdb::WriteBatch* batch) {
+  if (!ShouldChunk(value)) {
+    StringsValue strings_value(value);
+    strings_value.set_timestamp(timestamp);
+    batch->Put(key, strings_value.Encode());
+    return Status::OK();
+  }
+
+  // 新的version要大于旧chunk的version, 旧chunk由compaction清理
+  ChunkedStringMeta meta;
+  std::string old_value;
+  Status s = db_->Get(default_read_options_, key, &old_value);
+  if (s.ok()) {
+    ParsedStringsValue parsed_strings_value(&old_value);
+    if (!ChunkedStringMeta::Decode(parsed_strings_value.user_value(),
+                                   &meta)) {
+      s = Status::NotFound();
+    }
+  }
+  if (s.IsNotFound()) {
+    // 旧value被整个覆盖或者删除了, 它的chunk还在就说明version可能还没过时
+    s = Aux_MaxChunkVersion(key, &meta.version);
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  int64_t unix_time;
+  rocksdb::Env::Default()->GetCurrentTime(&unix_time);
+  meta.version = meta.version >= static_cast<int32_t>(unix_time)
+                   ? meta.version + 1
+                   : static_cast<int32_t>(unix_time);
+  meta.length = 0;
+  meta.chunk_size = chunk_size_;
+
+  ChunkedString chunked(db_, handles_[1], key, meta);
+  s = chunked.Write(0, value);
+  if (s.ok()) {
+    chunked.Flush(timestamp, batch);
+  }
+  return s;
+}
+
+Status RedisStrings::Aux_MaxChunkVersion(const Slice& key, int32_t* version) {
+  *version = 0;
+  // chunk key按小端的version排序, 每个version seek一次
+  const std::string first_key = StringsChunkKey(key, 0, 0).Encode().ToString();
+  const Slice prefix(first_key.data(),
+                     first_key.size() - sizeof(int32_t) - sizeof(uint32_t));
+  rocksdb::ReadOptions read_options(default_read_options_);
+  read_options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> iter(
+    db_->NewIterator(read_options, handles_[1]));
+  iter->Seek(prefix);
+  while (iter->Valid()) {
+    ParsedStringsChunkKey chunk_key(iter->key());
+    if (chunk_key.user_key() != key) {
+      break;
+    }
+    *version = std::max(*version, chunk_key.version());
+    StringsChunkKey last_key(key, chunk_key.version(), UINT32_MAX);
+    iter->Seek(last_key.Encode());
+    if (iter->Valid() && iter->key() == last_key.Encode()) {
+      iter->Next();
+    }
+  }
+  return iter->status();
+}
+
+Status RedisStrings::Aux_SetValue(const Slice& key,
+                                  const Slice& value,
+                                  int32_t timestamp) {
+  if (!ShouldChunk(value)) {
+    StringsValue strings_value(value);
+    strings_value.set_timestamp(timestamp);
+    return db_->Put(default_write_options_, key, strings_value.Encode());
+  }
+  rocksdb::WriteBatch batch;
+  Status s = Aux_PutValue(key, value, timestamp, &batch);
+  if (!s.ok()) {
+    return s;
+  }
+  return db_->Write(default_write_options_, &batch);
+}
+
+Status RedisStrings::Aux_FlushChunked(ChunkedString* chunked,
+                                      int32_t timestamp) {
+  rocksdb::WriteBatch batch;
+  chunked->Flush(timestamp, &batch);
+  return db_->Write(default_write_options_, &batch);
+}
+
+Status RedisStrings::Aux_GetUnlocked(const Slice& key,
+                                     LazySnapshot* snapshot,
+                                     rocksdb::ReadOptions* read_options,
+                                     rocksdb::PinnableSlice* value) {
+  Status s = db_->Get(*read_options, handles_[0], key, value);
+  if (!s.ok() || read_options->snapshot != nullptr) {
+    return s;
+  }
+  ParsedStringsValue parsed_strings_value(*value);
+  ChunkedStringMeta meta;
+  if (!ChunkedStringMeta::Decode(parsed_strings_value.user_value(), &meta)) {
+    return s;
+  }
+  read_options->snapshot = snapshot->Get();
+  value->Reset();
+  return db_->Get(*read_options, handles_[0], key, value);
+}
+
 Status RedisStrings::Incr(const Slice& key, int64_t* ret) {
-  return this->Aux_Incr(key, 1, ret);
+  CommandTimer timer(&command_stats_, kCmdIncr, key.size());
+  return timer.Done(this->Aux_Incr(key, 1, ret));
 }
 
 Status RedisStrings::IncrBy(const Slice& key, int64_t delta, int64_t* ret) {
-  return this->Aux_Incr(key, delta, ret);
+  CommandTimer timer(&command_stats_, kCmdIncrBy, key.size());
+  return timer.Done(this->Aux_Incr(key, delta, ret));
+}
+
+Status RedisStrings::IncrByFloat(const Slice& key,
+                                 const Slice& value,
+                                 std::string* ret) {
+  CommandTimer timer(
+    &command_stats_, kCmdIncrByFloat, key.size() + value.size());
+  timer.SetOutput(ret);
+  long double delta = 0;
+  if (StrToLongDouble(value.data(), value.size(), &delta) != 0) {
+    return timer.Done(Status::InvalidArgument("Value is not a valid float"));
+  }
+
+  ScopeRecordLock l(lock_mgr_, key);
+  std::string old_value;
+  long double old_num = 0;
+  Status s = db_->Get(default_read_options_, key, &old_value);
+  if (s.ok()) {
+    ParsedStringsValue parsed_strings_value(&old_value);
+    if (!parsed_strings_value.IsStale()) {
+      Slice old_num_str = parsed_strings_value.value();
+      if (StrToLongDouble(
+            old_num_str.data(), old_num_str.size(), &old_num) != 0) {
+        return timer.Done(
+          Status::InvalidArgument("Value is not a valid float"));
+      }
+    }
+  } else if (!s.IsNotFound()) {
+    return timer.Done(s);
+  }
+
+  std::string new_value;
+  std::string operand;
+  if (LongDoubleToStr(old_num + delta, &new_value) != 0 ||
+      !CounterMergeOperator::EncodeFloatOperand(delta, &operand)) {
+    return timer.Done(Status::InvalidArgument("Overflow"));
+  }
+  s = db_->Merge(default_write_options_, key, operand);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  std::string merged_value;
+  s = db_->Get(default_read_options_, key, &merged_value);
+  if (s.ok()) {
+    ParsedStringsValue parsed_strings_value(&merged_value);
+    new_value = parsed_strings_value.value().ToString();
+  } else if (s.IsNotFound()) {
+    s = Status::OK();
+  }
+  *ret = std::move(new_value);
+  return timer.Done(s);
+}
+
+Status RedisStrings::IncrByBlind(const Slice& key, int64_t delta) {
+  CommandTimer timer(&command_stats_, kCmdIncrByBlind, key.size());
+  return timer.Done(db_->Merge(default_write_options_,
+                    key,
+                    CounterMergeOperator::EncodeIntOperand(delta)));
+}
+
+Status RedisStrings::IncrByFloatBlind(const Slice& key, const Slice& value) {
+  CommandTimer timer(
+    &command_stats_, kCmdIncrByFloatBlind, key.size() + value.size());
+  long double delta = 0;
+  std::string operand;
+  if (StrToLongDouble(value.data(), value.size(), &delta) != 0 ||
+      !CounterMergeOperator::EncodeFloatOperand(delta, &operand)) {
+    return timer.Done(Status::InvalidArgument("Value is not a valid float"));
+  }
+  return timer.Done(db_->Merge(default_write_options_, key, operand));
 }
 
 Status RedisStrings::Decr(const Slice& key, int64_t* ret) {
-  return this->Aux_Incr(key, -1, ret);
+  CommandTimer timer(&command_stats_, kCmdDecr, key.size());
+  return timer.Done(this->Aux_Incr(key, -1, ret));
 }
 
 Status RedisStrings::DecrBy(const Slice& key, int64_t delta, int64_t* ret) {
-  return this->Aux_Incr(key, delta * (-1), ret);
+  CommandTimer timer(&command_stats_, kCmdDecrBy, key.size());
+  return timer.Done(this->Aux_Incr(key, delta * (-1), ret));
 }
 
 Status RedisStrings::MSet(const std::vector<KeyValue>& kvlist) {
+  CommandTimer timer(&command_stats_, kCmdMSet, BytesOf(kvlist));
   std::vector<std::string> keys;
   for (const auto& kv : kvlist) {
     keys.push_back(kv.key);
@@ -423,106 +1061,298 @@ Status RedisStrings::MSet(const std::vector<KeyValue>& kvlist) {
   MultiScopedRecordLock l(lock_mgr_, keys);
   rocksdb::WriteBatch batch;
   for (const auto& kv : kvlist) {
-    StringsValue sv(kv.value);
-    batch.Put(kv.key, sv.Encode());
+    Status s = Aux_PutValue(kv.key, kv.value, 0, &batch);
+    if (!s.ok()) {
+      return timer.Done(s);
+    }
   }
-  return db_->Write(default_write_options_, &batch);
+  return timer.Done(db_->Write(default_write_options_, &batch));
 }
 
 Status RedisStrings::Set(const Slice& key, const Slice& value) {
-  StringsValue strings_value(value);
+  CommandTimer timer(&command_stats_, kCmdSet, key.size() + value.size());
   ScopeRecordLock l(lock_mgr_, key);
-  return db_->Put(default_write_options_, key, strings_value.Encode());
+  return timer.Done(Aux_SetValue(key, value, 0));
 }
 
 Status RedisStrings::Get(const Slice& key, std::string* value) {
-  Status s = db_->Get(default_read_options_, key, value);
+  CommandTimer timer(&command_stats_, kCmdGet, key.size());
+  timer.SetOutput(value);
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
+  rocksdb::PinnableSlice pinned_value;
+  value->clear();
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, &pinned_value);
   if (s.ok()) {
-    ParsedStringsValue psv(value);
+    ParsedStringsValue psv(pinned_value);
+    ChunkedStringMeta meta;
     if (psv.IsStale()) {
-      value->clear();
       return Status::NotFound("Stale");
+    } else if (ChunkedStringMeta::Decode(psv.user_value(), &meta)) {
+      // 顺序读出所有chunk
+      ChunkedString chunked(db_, handles_[1], key, meta);
+      value->reserve(meta.length);
+      s = chunked.Read(read_options, 0, meta.length, value);
     } else {
-      psv.StripSuffix();
+      // 只拷贝一次user value, 不再拷贝后erase后缀
+      value->assign(psv.user_value().data(), psv.user_value().size());
     }
-  } else if (s.IsNotFound()) {
-    value->clear();
   }
-  return s;
+  return timer.Done(s);
+}
+
+Status RedisStrings::Get(const Slice& key, rocksdb::PinnableSlice* value) {
+  CommandTimer timer(&command_stats_, kCmdGet, key.size());
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
+  value->Reset();
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedStringsValue psv(*value);
+  ChunkedStringMeta meta;
+  if (psv.IsStale()) {
+    value->Reset();
+    return Status::NotFound("Stale");
+  } else if (ChunkedStringMeta::Decode(psv.user_value(), &meta)) {
+    // chunk不连续, 只能拼接到value自己的buffer中
+    ChunkedString chunked(db_, handles_[1], key, meta);
+    value->Reset();
+    std::string* buf = value->GetSelf();
+    buf->clear();
+    buf->reserve(meta.length);
+    s = chunked.Read(read_options, 0, meta.length, buf);
+    value->PinSelf();
+  } else {
+    value->remove_suffix(ParsedStringsValue::kStringsValueSuffixLength);
+  }
+  timer.AddBytesOut(value->size());
+  return timer.Done(s);
+}
+
+Status RedisStrings::GetStream(
+  const Slice& key,
+  const std::function<bool(const Slice&)>& visitor) {
+  CommandTimer timer(&command_stats_, kCmdGet, key.size());
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
+  rocksdb::PinnableSlice value;
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, &value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedStringsValue psv(value);
+  ChunkedStringMeta meta;
+  if (psv.IsStale()) {
+    return Status::NotFound("Stale");
+  } else if (ChunkedStringMeta::Decode(psv.user_value(), &meta)) {
+    ChunkedString chunked(db_, handles_[1], key, meta);
+    s = chunked.Visit(read_options, 0, meta.length,
+                      [&](const Slice& bytes) {
+                        timer.AddBytesOut(bytes.size());
+                        return visitor(bytes);
+                      });
+  } else {
+    timer.AddBytesOut(psv.user_value().size());
+    visitor(psv.user_value());
+  }
+  return timer.Done(s);
+}
+
+Status RedisStrings::GetRange(const Slice& key,
+                              int64_t start_offset,
+                              int64_t end_offset,
+                              std::string* ret) {
+  CommandTimer timer(&command_stats_, kCmdGetRange, key.size());
+  timer.SetOutput(ret);
+  LazySnapshot snapshot(db_);
+  rocksdb::ReadOptions read_options(default_read_options_);
+  rocksdb::PinnableSlice value;
+  ret->clear();
+  Status s = Aux_GetUnlocked(key, &snapshot, &read_options, &value);
+  if (!s.ok()) {
+    return timer.Done(s);
+  }
+  ParsedStringsValue psv(value);
+  if (psv.IsStale()) {
+    return Status::NotFound("Stale");
+  }
+  Slice user_value = psv.user_value();
+  ChunkedStringMeta meta;
+  const bool is_chunked = ChunkedStringMeta::Decode(user_value, &meta);
+  const uint64_t length = is_chunked ? meta.length : user_value.size();
+  if (!NormalizeRange(length, &start_offset, &end_offset)) {
+    return timer.Done(s);
+  }
+  if (is_chunked) {
+    // 只读范围内的chunk
+    ChunkedString chunked(db_, handles_[1], key, meta);
+    s = chunked.Read(read_options, start_offset,
+                     end_offset - start_offset + 1, ret);
+  } else {
+    ret->assign(user_value.data() + start_offset,
+                end_offset - start_offset + 1);
+  }
+  return timer.Done(s);
+}
+
+Status RedisStrings::SetRange(const Slice& key,
+                              int64_t start_offset,
+                              const Slice& value,
+                              int32_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdSetRange, key.size() + value.size());
+  *ret = 0;
+  if (start_offset < 0) {
+    return timer.Done(Status::InvalidArgument("offset is out of range"));
+  }
+  if (static_cast<uint64_t>(start_offset) + value.size() > kMaxStringLength) {
+    return timer.Done(
+      Status::InvalidArgument("string exceeds maximum allowed size"));
+  }
+  std::string old_value;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, key, &old_value);
+  if (!s.ok() && !s.IsNotFound()) {
+    return timer.Done(s);
+  }
+  int32_t timestamp = 0;
+  if (s.ok()) {
+    ParsedStringsValue parsed_value(&old_value);
+    ChunkedStringMeta meta;
+    if (parsed_value.IsStale()) {
+      old_value.clear();
+    } else if (ChunkedStringMeta::Decode(parsed_value.user_value(), &meta)) {
+      // 只重写范围内的chunk
+      ChunkedString chunked(db_, handles_[1], key, meta);
+      if (!value.empty()) {
+        s = chunked.Write(start_offset, value);
+        if (s.ok()) {
+          s = Aux_FlushChunked(&chunked, parsed_value.timestamp());
+        }
+      }
+      if (s.ok()) {
+        *ret = chunked.length();
+      }
+      return timer.Done(s);
+    } else {
+      timestamp = parsed_value.timestamp();
+      parsed_value.StripSuffix();
+    }
+  } else {
+    old_value.clear();
+  }
+  // 空value不修改, 也不创建key
+  if (value.empty()) {
+    *ret = old_value.size();
+    return timer.Done(Status::OK());
+  }
+  const uint64_t end_offset = start_offset + value.size();
+  if (old_value.size() < end_offset) {
+    old_value.resize(end_offset, '\0');
+  }
+  old_value.replace(start_offset, value.size(), value.data(), value.size());
+  s = Aux_SetValue(key, old_value, timestamp);
+  if (s.ok()) {
+    *ret = old_value.size();
+  }
+  return timer.Done(s);
 }
 
 Status RedisStrings::GetSet(const Slice& key,
                             const Slice& value,
                             std::string* old) {
+  CommandTimer timer(&command_stats_, kCmdGetSet, key.size() + value.size());
+  timer.SetOutput(old);
   ScopeRecordLock l(lock_mgr_, key);
-  auto s = db_->Get(default_read_options_, key, old);
+  rocksdb::PinnableSlice old_value;
+  old->clear();
+  auto s = db_->Get(default_read_options_, handles_[0], key, &old_value);
   if (s.ok()) {
-    ParsedStringsValue parsed_old_value(old);
+    ParsedStringsValue parsed_old_value(old_value);
+    ChunkedStringMeta meta;
     if (parsed_old_value.IsStale()) {
-      old->clear();
+      // 过期的key当作不存在
+    } else if (ChunkedStringMeta::Decode(parsed_old_value.user_value(),
+                                        &meta)) {
+      ChunkedString chunked(db_, handles_[1], key, meta);
+      s = chunked.Read(default_read_options_, 0, meta.length, old);
+      if (!s.ok()) {
+        return timer.Done(s);
+      }
     } else {
-      parsed_old_value.StripSuffix();
+      Slice user_value = parsed_old_value.user_value();
+      old->assign(user_value.data(), user_value.size());
     }
   } else if (!s.IsNotFound()) {
-    return s;
+    return timer.Done(s);
   }
-  StringsValue sv(value);
-  return db_->Put(default_write_options_, key, sv.Encode());
+  return timer.Done(Aux_SetValue(key, value, 0));
 }
 
 Status RedisStrings::Strlen(const Slice& key, uint64_t* length) {
-  std::string value;
-  auto s = this->Get(key, &value);
+  CommandTimer timer(&command_stats_, kCmdStrlen, key.size());
+  rocksdb::PinnableSlice value;
+  *length = 0;
+  Status s = db_->Get(default_read_options_, handles_[0], key, &value);
   if (s.ok()) {
-    *length = value.length();
-  } else {
-    *length = 0;
+    ParsedStringsValue parsed_strings_value(value);
+    if (parsed_strings_value.IsStale()) {
+      return Status::NotFound("Stale");
+    }
+    // chunked string的长度记录在meta中, 不需要读chunk
+    ChunkedStringMeta meta;
+    if (ChunkedStringMeta::Decode(parsed_strings_value.user_value(), &meta)) {
+      *length = meta.length;
+    } else {
+      *length = parsed_strings_value.user_value().size();
+    }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisStrings::SetNx(const Slice& key,
                            const Slice& value,
                            int32_t* ret,
                            const int32_t ttl) {
+  CommandTimer timer(&command_stats_, kCmdSetNx, key.size() + value.size());
   *ret = 0;
   std::string old_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, key, &old_value);
   if (s.ok()) {
     ParsedStringsValue parsed_value(&old_value);
-    if (parsed_value.IsStale()) {
-      StringsValue sv(value);
-      if (ttl > 0) {
-        sv.SetRelativeTimestamp(ttl);
-      }
-      s = db_->Put(default_write_options_, key, sv.Encode());
-      if (s.ok()) {
-        *ret = 1;
-      }
-    }
-  } else if (s.IsNotFound()) {
-    StringsValue sv(value);
-    if (ttl > 0) {
-      sv.SetRelativeTimestamp(ttl);
-    }
-    s = db_->Put(default_write_options_, key, sv.Encode());
-    if (s.ok()) {
-      *ret = 1;
+    if (!parsed_value.IsStale()) {
+      return timer.Done(s);
     }
+  } else if (!s.IsNotFound()) {
+    return timer.Done(s);
   }
-  return s;
+  int32_t timestamp = 0;
+  if (ttl > 0) {
+    int64_t unix_time;
+    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
+    timestamp = static_cast<int32_t>(unix_time) + ttl;
+  }
+  s = Aux_SetValue(key, value, timestamp);
+  if (s.ok()) {
+    *ret = 1;
+  }
+  return timer.Done(s);
 }
 
 Status RedisStrings::SetEx(const Slice& key,
                            const Slice& value,
                            const int32_t ttl) {
+  CommandTimer timer(&command_stats_, kCmdSetEx, key.size() + value.size());
   if (ttl <= 0) {
-    return Status::InvalidArgument("invalid expire time");
+    return timer.Done(Status::InvalidArgument("invalid expire time"));
   }
-  StringsValue sv(value);
-  sv.SetRelativeTimestamp(ttl);
-  return db_->Put(default_write_options_, key, sv.Encode());
+  int64_t unix_time;
+  rocksdb::Env::Default()->GetCurrentTime(&unix_time);
+  ScopeRecordLock l(lock_mgr_, key);
+  return timer.Done(
+    Aux_SetValue(key, value, static_cast<int32_t>(unix_time) + ttl));
 }
 
 // Compare and delete
@@ -532,6 +1362,8 @@ Status RedisStrings::SetEx(const Slice& key,
 Status RedisStrings::Cad(const Slice& key,
                          const Slice& expected_value,
                          int32_t* ret) {
+  CommandTimer timer(
+    &command_stats_, kCmdCad, key.size() + expected_value.size());
   std::string value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, key, &value);
@@ -542,6 +1374,21 @@ Status RedisStrings::Cad(const Slice& key,
       return Status::OK();
     } else {
       Slice actual_value = parsed_value.user_value();
+      std::string chunked_value;
+      ChunkedStringMeta meta;
+      if (ChunkedStringMeta::Decode(actual_value, &meta)) {
+        if (meta.length != expected_value.size()) {
+          *ret = 0;
+          return Status::OK();
+        }
+        ChunkedString chunked(db_, handles_[1], key, meta);
+        s = chunked.Read(default_read_options_, 0, meta.length,
+                         &chunked_value);
+        if (!s.ok()) {
+          return timer.Done(s);
+        }
+        actual_value = chunked_value;
+      }
       if (actual_value.compare(expected_value) != 0) {
         *ret = 0;
         return Status::OK();
@@ -556,8 +1403,7 @@ Status RedisStrings::Cad(const Slice& key,
     *ret = -1;
     return Status::OK();
   }
-  return s;
+  return timer.Done(s);
 }
 
-
 }  // namespace blackwidow
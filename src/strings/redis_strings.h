@@ -1,16 +1,27 @@
+#include "meta_lookup_cache.h"
 #include "redis.h"
+#include "strings_compaction_listener.h"
 #include <algorithm>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace blackwidow {
 
+class ChunkedString;
+class LazySnapshot;
+
 class RedisStrings : public Redis {
  public:
   RedisStrings(BlackWidow* const bw);
   ~RedisStrings() override = default;
 
   // Command Commands Define in ::Redis
+  void PrepareOptions(
+    const BlackWidowOptions& bw_options,
+    rocksdb::DBOptions* db_options,
+    std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) override;
   Status Open(const BlackWidowOptions& bw_options,
               const std::string& dbpath) override;
 
@@ -43,15 +54,56 @@ class RedisStrings : public Redis {
 
   // Special Iterate all data
   void ScanDatabase();
+  // Overwritten versions seen by the compactions.
+  StringsCompactionStats GetCompactionStats() const;
+  // Replaces the keys of `kvs` with one ingested sst, see BulkLoader.
+  Status BulkLoad(std::vector<KeyValue>* kvs);
 
   // String Commands
   Status Append(const Slice& key, const Slice& value, int32_t* ret);
   Status BitCount(const Slice& key, uint64_t* ret);
+  // Bits set in the bytes [start_offset, end_offset], negative offsets
+  // count from the end of the value as in BITCOUNT key start end.
+  Status BitCount(const Slice& key,
+                  int64_t start_offset,
+                  int64_t end_offset,
+                  uint64_t* ret);
   Status SetBit(const Slice& key, uint64_t offset, uint32_t newbit, uint32_t *oldbit);
   Status GetBit(const Slice& key, uint64_t offset, uint32_t* ret);
+  // Stores the AND, OR, XOR of `src_keys` or the NOT of the single one in
+  // `dest_key`, deleting it when the result is empty. ret is the length of
+  // the result.
+  Status BitOp(BitOpType op,
+               const std::string& dest_key,
+               const std::vector<std::string>& src_keys,
+               int64_t* ret);
+  // The position of the first `bit` in the value, in the bytes
+  // [start_offset, end_offset] if given, as BITPOS does.
+  Status BitPos(const Slice& key, int32_t bit, int64_t* ret);
+  Status BitPos(const Slice& key,
+                int32_t bit,
+                int64_t start_offset,
+                int64_t* ret);
+  Status BitPos(const Slice& key,
+                int32_t bit,
+                int64_t start_offset,
+                int64_t end_offset,
+                int64_t* ret);
+  // Runs `ops` in order, the value is written once if any of them changed
+  // it. One result per op.
+  Status BitField(const Slice& key,
+                  const std::vector<BitFieldOp>& ops,
+                  std::vector<BitFieldResult>* results);
   Status Incr(const Slice& key, int64_t* ret);
   Status IncrBy(const Slice& key, int64_t delta, int64_t* ret);
-  // Status IncrByFloat(const Slice &key, )
+  Status IncrByFloat(const Slice& key, const Slice& value, std::string* ret);
+  // Lock free increments for hot counters, written as a Merge without
+  // reading the key. The new value is not returned, and a delta against a
+  // non-number value or one that overflows is dropped. IncrBy and
+  // IncrByFloat check the value first but also write a Merge, so they never
+  // overwrite a blind increment.
+  Status IncrByBlind(const Slice& key, int64_t delta);
+  Status IncrByFloatBlind(const Slice& key, const Slice& value);
   Status Decr(const Slice& key, int64_t* ret);
   Status DecrBy(const Slice& key, int64_t delta, int64_t* ret);
   Status MSet(const std::vector<KeyValue>& kvlist);
@@ -65,12 +117,66 @@ class RedisStrings : public Redis {
                const Slice& value,
                const int32_t ttl);
   Status Get(const Slice& key, std::string* value);
+  // The value pinned in the block cache or the memtable, without a copy. A
+  // chunked value is read into the buffer of `value`.
+  Status Get(const Slice& key, rocksdb::PinnableSlice* value);
+  // Calls `visitor` with the value, a chunk at a time for a chunked one,
+  // until it returns false.
+  Status GetStream(const Slice& key,
+                   const std::function<bool(const Slice&)>& visitor);
+  // The bytes [start_offset, end_offset] of the value as GETRANGE, empty
+  // when the range holds none.
+  Status GetRange(const Slice& key,
+                  int64_t start_offset,
+                  int64_t end_offset,
+                  std::string* ret);
+  // Overwrites the value from `start_offset` with `value`, padding it with
+  // zero bytes up to there, as SETRANGE. ret is the new length.
+  Status SetRange(const Slice& key,
+                  int64_t start_offset,
+                  const Slice& value,
+                  int32_t* ret);
   Status GetSet(const Slice& key, const Slice& value, std::string* old);
   Status Cad(const Slice& key, const Slice& expected_value, int32_t *ret);
 
  private:
   // AUX Utils
   Status Aux_Incr(const Slice& key, int64_t delta, int64_t* ret);
+  Status Aux_BitPos(const Slice& key,
+                    int32_t bit,
+                    int64_t start_offset,
+                    int64_t end_offset,
+                    bool have_end,
+                    int64_t* ret);
+  // Whether `value` is stored in chunks, see ChunkedStringMeta.
+  bool ShouldChunk(const Slice& value) const;
+  // Adds the writes storing `value` under the locked `key` to `batch`, in
+  // chunks of a new version if it is big.
+  Status Aux_PutValue(const Slice& key,
+                      const Slice& value,
+                      int32_t timestamp,
+                      rocksdb::WriteBatch* batch);
+  // The newest version of the chunks still stored for `key`, 0 if none. A
+  // chunked value replaced by a whole one or deleted leaves its chunks
+  // until their version is in the past, so a later chunked value of the key
+  // gets a newer version even if the old one was ahead of the clock.
+  Status Aux_MaxChunkVersion(const Slice& key, int32_t* version);
+  // Stores `value` under the locked `key`.
+  Status Aux_SetValue(const Slice& key, const Slice& value, int32_t timestamp);
+  // Writes the chunks an edit touched and the meta.
+  Status Aux_FlushChunked(ChunkedString* chunked, int32_t timestamp);
+  // Reads the value of `key` for a command that does not lock it. A chunked
+  // value is read again under `snapshot`, set in `read_options`, so the
+  // chunks of its meta are not rewritten and compacted away meanwhile.
+  Status Aux_GetUnlocked(const Slice& key,
+                         LazySnapshot* snapshot,
+                         rocksdb::ReadOptions* read_options,
+                         rocksdb::PinnableSlice* value);
+
+  std::shared_ptr<StringsCompactionListener> compaction_listener_;
+  uint64_t chunk_threshold_;
+  uint32_t chunk_size_;
+  std::shared_ptr<MetaLookupCache> chunk_meta_cache_;
 };
 
 }  // namespace blackwidow
\ No newline at end of file
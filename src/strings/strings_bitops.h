@@ -0,0 +1,372 @@
+#pragma once
+
+#include "blackwidow/blackwidow.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLACKWIDOW_BITOPS_X86 1
+#endif
+
+namespace blackwidow {
+
+namespace bitops {
+
+// Bits set in data[0, length), 64 bits at a time, the tail byte by byte.
+inline uint64_t PopcountPortable(const char* data, size_t length) {
+  uint64_t count = 0;
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    count += __builtin_popcountll(word);
+  }
+  for (; i < length; i++) {
+    count += __builtin_popcount(static_cast<unsigned char>(data[i]));
+  }
+  return count;
+}
+
+#ifdef BLACKWIDOW_BITOPS_X86
+// The same with the popcnt instruction, the portable build calls a libgcc
+// helper for every word instead.
+__attribute__((target("popcnt")))
+inline uint64_t PopcountPopcnt(const char* data, size_t length) {
+  uint64_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    uint64_t words[4];
+    memcpy(words, data + i, sizeof(words));
+    count += __builtin_popcountll(words[0]) + __builtin_popcountll(words[1]) +
+             __builtin_popcountll(words[2]) + __builtin_popcountll(words[3]);
+  }
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    count += __builtin_popcountll(word);
+  }
+  for (; i < length; i++) {
+    count += __builtin_popcount(static_cast<unsigned char>(data[i]));
+  }
+  return count;
+}
+
+// Mula's nibble lookup: vpshufb counts the bits of each nibble of 32 bytes
+// at once, vpsadbw sums the bytes into four 64 bit lanes. The byte counts
+// hold at most 8 * 31 bits, so they are summed every 31 blocks.
+__attribute__((target("avx2,popcnt")))
+inline uint64_t PopcountAvx2(const char* data, size_t length) {
+  const __m256i lookup = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+  while (i + 32 <= length) {
+    __m256i bytes = _mm256_setzero_si256();
+    for (int block = 0; block < 31 && i + 32 <= length; block++, i += 32) {
+      const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+      const __m256i lo = _mm256_and_si256(v, low_mask);
+      const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+      bytes = _mm256_add_epi8(bytes, _mm256_shuffle_epi8(lookup, lo));
+      bytes = _mm256_add_epi8(bytes, _mm256_shuffle_epi8(lookup, hi));
+    }
+    total = _mm256_add_epi64(total,
+                             _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+  }
+  uint64_t count = static_cast<uint64_t>(_mm256_extract_epi64(total, 0)) +
+                   static_cast<uint64_t>(_mm256_extract_epi64(total, 1)) +
+                   static_cast<uint64_t>(_mm256_extract_epi64(total, 2)) +
+                   static_cast<uint64_t>(_mm256_extract_epi64(total, 3));
+  return count + PopcountPopcnt(data + i, length - i);
+}
+#endif
+
+typedef uint64_t (*PopcountFunc)(const char* data, size_t length);
+
+// Picked once from the cpu running us, the binary itself stays portable.
+inline PopcountFunc ResolvePopcount() {
+#ifdef BLACKWIDOW_BITOPS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return PopcountAvx2;
+  }
+  if (__builtin_cpu_supports("popcnt")) {
+    return PopcountPopcnt;
+  }
+#endif
+  return PopcountPortable;
+}
+
+}  // namespace bitops
+
+// Bits set in data[0, length).
+inline uint64_t Popcount(const char* data, size_t length) {
+  static const bitops::PopcountFunc popcount = bitops::ResolvePopcount();
+  return popcount(data, length);
+}
+
+namespace bitops {
+
+inline bool HasAvx2() {
+#ifdef BLACKWIDOW_BITOPS_X86
+  static const bool has_avx2 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  return has_avx2;
+#else
+  return false;
+#endif
+}
+
+template <BitOpType kOp>
+inline uint64_t Bitwise(uint64_t a, uint64_t b) {
+  if (kOp == kBitOpAnd) {
+    return a & b;
+  } else if (kOp == kBitOpOr) {
+    return a | b;
+  }
+  return a ^ b;
+}
+
+// dst[i] = dst[i] op src[i] for i in [0, length), op one of AND, OR, XOR.
+template <BitOpType kOp>
+inline void BitwisePortable(char* dst, const char* src, size_t length) {
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, dst + i, sizeof(a));
+    memcpy(&b, src + i, sizeof(b));
+    a = Bitwise<kOp>(a, b);
+    memcpy(dst + i, &a, sizeof(a));
+  }
+  for (; i < length; i++) {
+    dst[i] = static_cast<char>(
+      Bitwise<kOp>(static_cast<unsigned char>(dst[i]),
+                   static_cast<unsigned char>(src[i])));
+  }
+}
+
+inline void NotPortable(char* data, size_t length) {
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    word = ~word;
+    memcpy(data + i, &word, sizeof(word));
+  }
+  for (; i < length; i++) {
+    data[i] = static_cast<char>(~data[i]);
+  }
+}
+
+#ifdef BLACKWIDOW_BITOPS_X86
+template <BitOpType kOp>
+__attribute__((target("avx2")))
+inline void BitwiseAvx2(char* dst, const char* src, size_t length) {
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    const __m256i b =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    if (kOp == kBitOpAnd) {
+      a = _mm256_and_si256(a, b);
+    } else if (kOp == kBitOpOr) {
+      a = _mm256_or_si256(a, b);
+    } else {
+      a = _mm256_xor_si256(a, b);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a);
+  }
+  BitwisePortable<kOp>(dst + i, src + i, length - i);
+}
+
+__attribute__((target("avx2")))
+inline void NotAvx2(char* data, size_t length) {
+  const __m256i ones = _mm256_set1_epi8(-1);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), ones));
+  }
+  NotPortable(data + i, length - i);
+}
+#endif
+
+template <BitOpType kOp>
+inline void BitwiseInto(char* dst, const char* src, size_t length) {
+#ifdef BLACKWIDOW_BITOPS_X86
+  if (HasAvx2()) {
+    BitwiseAvx2<kOp>(dst, src, length);
+    return;
+  }
+#endif
+  BitwisePortable<kOp>(dst, src, length);
+}
+
+}  // namespace bitops
+
+// Inverts every bit of data[0, length).
+inline void BitNot(char* data, size_t length) {
+#ifdef BLACKWIDOW_BITOPS_X86
+  if (bitops::HasAvx2()) {
+    bitops::NotAvx2(data, length);
+    return;
+  }
+#endif
+  bitops::NotPortable(data, length);
+}
+
+// Folds one more source of BITOP AND, OR or XOR into `result`, the shorter
+// of the two padded with zero bytes.
+inline void BitOpFold(BitOpType op, const char* src, size_t length,
+                      std::string* result) {
+  const size_t common = std::min(result->size(), length);
+  char* dst = &(*result)[0];
+  if (op == kBitOpAnd) {
+    bitops::BitwiseInto<kBitOpAnd>(dst, src, common);
+    memset(dst + common, 0, result->size() - common);
+    result->resize(std::max(result->size(), length), 0);
+    return;
+  }
+  if (op == kBitOpOr) {
+    bitops::BitwiseInto<kBitOpOr>(dst, src, common);
+  } else {
+    bitops::BitwiseInto<kBitOpXor>(dst, src, common);
+  }
+  if (length > common) {
+    result->append(src + common, length - common);
+  }
+}
+
+// The position of the first `bit` (0 or 1) in data[0, length), bit 0 being
+// the most significant bit of the first byte as in GETBIT, or -1. Words
+// holding only the other bit are skipped 64 bits at a time.
+inline int64_t FindBit(const char* data, size_t length, int bit) {
+  const uint64_t skip = bit ? 0 : ~uint64_t{0};
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    if (word != skip) {
+      break;
+    }
+  }
+  for (; i < length; i++) {
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    if (!bit) {
+      c = static_cast<unsigned char>(~c);
+    }
+    if (c != 0) {
+      return i * 8 + __builtin_clz(c) - 24;
+    }
+  }
+  return -1;
+}
+
+// The `bits` (1 - 64) bits at bit `offset` of data[0, length) as an
+// unsigned integer, most significant bit first. Bits past the end read as
+// zeros.
+inline uint64_t GetBitfield(const char* data, size_t length,
+                            uint64_t offset, int bits) {
+  uint64_t value = 0;
+  for (int i = 0; i < bits; i++, offset++) {
+    const uint64_t byte = offset >> 3;
+    uint64_t bit = 0;
+    if (byte < length) {
+      bit = (static_cast<unsigned char>(data[byte]) >> (7 - (offset & 7))) & 1;
+    }
+    value = (value << 1) | bit;
+  }
+  return value;
+}
+
+// Writes the low `bits` bits of `value` at bit `offset` of `data`, which
+// must hold them.
+inline void SetBitfield(char* data, uint64_t offset, int bits,
+                        uint64_t value) {
+  for (int i = bits - 1; i >= 0; i--, offset++) {
+    const unsigned char mask = 1 << (7 - (offset & 7));
+    if ((value >> i) & 1) {
+      data[offset >> 3] |= mask;
+    } else {
+      data[offset >> 3] &= ~mask;
+    }
+  }
+}
+
+// `value` of an i<bits> field, sign extended.
+inline int64_t SignExtend(uint64_t value, int bits) {
+  if (bits < 64 && (value & (uint64_t{1} << (bits - 1)))) {
+    value |= ~uint64_t{0} << bits;
+  }
+  return static_cast<int64_t>(value);
+}
+
+// value + incr stored in an i<bits> (1 - 64) or u<bits> (1 - 63) field,
+// overflowing as BITFIELD OVERFLOW `overflow` does. `value` is read as
+// signed for signed fields. False when it overflows with kBitFieldFail.
+inline bool BitfieldAdd(bool is_signed, int bits, uint64_t value,
+                        int64_t incr, BitFieldOverflow overflow,
+                        int64_t* result) {
+  const uint64_t wrapped = value + static_cast<uint64_t>(incr);
+  const uint64_t mask = bits == 64 ? ~uint64_t{0}
+                                   : (uint64_t{1} << bits) - 1;
+  __int128 sum;
+  __int128 min, max;
+  if (is_signed) {
+    sum = static_cast<__int128>(static_cast<int64_t>(value)) + incr;
+    max = static_cast<__int128>(mask >> 1);
+    min = -max - 1;
+  } else {
+    sum = static_cast<__int128>(value) + incr;
+    max = mask;
+    min = 0;
+  }
+  if (sum >= min && sum <= max) {
+    *result = static_cast<int64_t>(sum);
+    return true;
+  }
+  switch (overflow) {
+    case kBitFieldWrap:
+      *result = is_signed ? SignExtend(wrapped & mask, bits)
+                          : static_cast<int64_t>(wrapped & mask);
+      return true;
+    case kBitFieldSat:
+      *result = static_cast<int64_t>(sum > max ? max : min);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Turns the byte range [*start, *end] of BITCOUNT, GETRANGE and the like,
+// negative offsets counting from the end, into offsets within a value of
+// `length` bytes. False when the range holds no byte.
+inline bool NormalizeRange(int64_t length, int64_t* start, int64_t* end) {
+  if (*start < 0) {
+    *start += length;
+  }
+  if (*end < 0) {
+    *end += length;
+  }
+  if (*start < 0) {
+    *start = 0;
+  }
+  if (*end < 0) {
+    *end = 0;
+  }
+  if (*end >= length) {
+    *end = length - 1;
+  }
+  return length > 0 && *start <= *end;
+}
+
+}  // namespace blackwidow
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "strings_format.h"
+#include "rocksdb/db.h"
+#include "rocksdb/write_batch.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace blackwidow {
+
+using Status = rocksdb::Status;
+
+// Reads and edits one chunked string, see ChunkedStringMeta. The chunks an
+// edit touches are kept until Flush puts them and the meta into a batch,
+// so a small edit of a big value rewrites only a chunk or two.
+class ChunkedString {
+ public:
+  ChunkedString(rocksdb::DB* db,
+                rocksdb::ColumnFamilyHandle* chunk_cf,
+                const Slice& key,
+                const ChunkedStringMeta& meta)
+    : db_(db), chunk_cf_(chunk_cf), key_(key.ToString()), meta_(meta) {}
+
+  ChunkedString(const ChunkedString&) = delete;
+  ChunkedString& operator=(const ChunkedString&) = delete;
+
+  const ChunkedStringMeta& meta() const {
+    return meta_;
+  }
+  uint64_t length() const {
+    return meta_.length;
+  }
+
+  // Calls `visitor` with the bytes [offset, offset + n) of the value, cut
+  // at its end, one chunk at a time, until it returns false. The stored
+  // chunks are read with one iterator.
+  Status Visit(const rocksdb::ReadOptions& read_options,
+               uint64_t offset,
+               uint64_t n,
+               const std::function<bool(const Slice&)>& visitor) {
+    if (offset >= meta_.length || n == 0) {
+      return Status::OK();
+    }
+    const uint64_t end = offset + std::min(n, meta_.length - offset);
+    const uint32_t first = offset / meta_.chunk_size;
+    const uint32_t last = (end - 1) / meta_.chunk_size;
+
+    StringsChunkKey upper_key(key_, meta_.version, last + 1);
+    const std::string upper_bound = upper_key.Encode().ToString();
+    rocksdb::Slice upper_bound_slice(upper_bound);
+    rocksdb::ReadOptions iterator_options(read_options);
+    iterator_options.iterate_upper_bound = &upper_bound_slice;
+    if (last > first) {
+      iterator_options.readahead_size = 2 * meta_.chunk_size;
+    }
+    std::unique_ptr<rocksdb::Iterator> iter(
+      db_->NewIterator(iterator_options, chunk_cf_));
+    iter->Seek(StringsChunkKey(key_, meta_.version, first).Encode());
+
+    for (uint32_t index = first; index <= last; index++) {
+      Slice chunk;
+      auto dirty = dirty_.find(index);
+      if (dirty != dirty_.end()) {
+        chunk = dirty->second;
+      } else {
+        while (iter->Valid() &&
+               ParsedStringsChunkKey(iter->key()).index() < index) {
+          iter->Next();
+        }
+        if (!iter->status().ok()) {
+          return iter->status();
+        }
+        if (!iter->Valid() ||
+            ParsedStringsChunkKey(iter->key()).index() != index) {
+          return Status::Corruption("missing chunk");
+        }
+        chunk = iter->value();
+      }
+      const uint64_t chunk_start = uint64_t{index} * meta_.chunk_size;
+      const uint64_t from = std::max(offset, chunk_start) - chunk_start;
+      const uint64_t to = std::min<uint64_t>(end - chunk_start, chunk.size());
+      if (from >= to) {
+        return Status::Corruption("short chunk");
+      }
+      if (!visitor(Slice(chunk.data() + from, to - from))) {
+        break;
+      }
+    }
+    return Status::OK();
+  }
+
+  // Appends the bytes [offset, offset + n) of the value, cut at its end,
+  // to `out`.
+  Status Read(const rocksdb::ReadOptions& read_options,
+              uint64_t offset,
+              uint64_t n,
+              std::string* out) {
+    return Visit(read_options, offset, n, [out](const Slice& bytes) {
+      out->append(bytes.data(), bytes.size());
+      return true;
+    });
+  }
+
+  // Writes `data` at `offset`, the value grows with zero bytes up to it.
+  Status Write(uint64_t offset, const Slice& data) {
+    Status s = Extend(offset + data.size());
+    uint64_t done = 0;
+    while (s.ok() && done < data.size()) {
+      const uint64_t pos = offset + done;
+      std::string* chunk = nullptr;
+      s = LoadChunk(pos / meta_.chunk_size, &chunk);
+      if (s.ok()) {
+        const uint64_t in_chunk = pos % meta_.chunk_size;
+        if (in_chunk >= chunk->size()) {
+          return Status::Corruption("short chunk");
+        }
+        const uint64_t n = std::min<uint64_t>(data.size() - done,
+                                              chunk->size() - in_chunk);
+        memcpy(&(*chunk)[in_chunk], data.data() + done, n);
+        done += n;
+      }
+    }
+    return s;
+  }
+
+  // Puts the chunks written so far and the meta, with `timestamp`.
+  void Flush(int32_t timestamp, rocksdb::WriteBatch* batch) {
+    for (const auto& chunk : dirty_) {
+      StringsChunkKey chunk_key(key_, meta_.version, chunk.first);
+      batch->Put(chunk_cf_, chunk_key.Encode(), chunk.second);
+    }
+    dirty_.clear();
+    StringsValue strings_value(meta_.Encode());
+    strings_value.set_timestamp(timestamp);
+    batch->Put(key_, strings_value.Encode());
+  }
+
+ private:
+  // Grows the value to `length` bytes. The chunks past the old end are
+  // written whole, old chunks of the same version past it are never read.
+  Status Extend(uint64_t length) {
+    if (length <= meta_.length) {
+      return Status::OK();
+    }
+    uint32_t index = meta_.length / meta_.chunk_size;
+    for (; uint64_t{index} * meta_.chunk_size < length; index++) {
+      const uint64_t chunk_start = uint64_t{index} * meta_.chunk_size;
+      std::string* chunk = nullptr;
+      if (chunk_start < meta_.length) {
+        Status s = LoadChunk(index, &chunk);
+        if (!s.ok()) {
+          return s;
+        }
+      } else {
+        chunk = &dirty_[index];
+        chunk->clear();
+      }
+      chunk->resize(std::min<uint64_t>(meta_.chunk_size, length - chunk_start),
+                    0);
+    }
+    meta_.length = length;
+    return Status::OK();
+  }
+
+  Status LoadChunk(uint32_t index, std::string** chunk) {
+    auto dirty = dirty_.find(index);
+    if (dirty != dirty_.end()) {
+      *chunk = &dirty->second;
+      return Status::OK();
+    }
+    std::string value;
+    StringsChunkKey chunk_key(key_, meta_.version, index);
+    Status s = db_->Get(rocksdb::ReadOptions(), chunk_cf_, chunk_key.Encode(),
+                        &value);
+    if (s.IsNotFound()) {
+      return Status::Corruption("missing chunk");
+    } else if (!s.ok()) {
+      return s;
+    }
+    *chunk = &dirty_[index];
+    (*chunk)->swap(value);
+    return Status::OK();
+  }
+
+  rocksdb::DB* const db_;
+  rocksdb::ColumnFamilyHandle* const chunk_cf_;
+  const std::string key_;
+  ChunkedStringMeta meta_;
+  // Chunks read for an edit or written, by index.
+  std::map<uint32_t, std::string> dirty_;
+};
+
+}  // namespace blackwidow
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "trace.h"
+#include "rocksdb/db.h"
+#include "rocksdb/env.h"
+#include "rocksdb/experimental.h"
+#include "rocksdb/listener.h"
+#include "rocksdb/metadata.h"
+
+#include <atomic>
+#include <string>
+
+namespace blackwidow {
+
+struct StringsCompactionStats {
+  // Finished compactions and their input records.
+  uint64_t compactions = 0;
+  uint64_t input_records = 0;
+  // Input records dropped because a newer version of the key was in the
+  // same compaction.
+  uint64_t replaced_records = 0;
+  // Key ranges marked to be compacted down to the bottommost level.
+  uint64_t suggested_ranges = 0;
+};
+
+// A CompactionFilter only sees one version of a key and can not tell whether
+// a newer one exists, the old version of an overwritten string is only
+// dropped when it meets the newer one in a compaction. Frequently updated
+// keys leave a version in every level that way.
+//
+// Compactions above the bottommost level whose input is mostly overwritten
+// versions show an overwrite heavy key range, the range is marked for
+// compaction so that the new versions are pushed down ahead of the level
+// size triggers and the old versions below are dropped.
+class StringsCompactionListener : public rocksdb::EventListener {
+ public:
+  // `overwrite_ratio` <= 0 disables the marking, `min_interval` is the
+  // minimum number of seconds between two marked ranges.
+  StringsCompactionListener(double overwrite_ratio, int64_t min_interval)
+    : overwrite_ratio_(overwrite_ratio), min_interval_(min_interval) {}
+
+  void OnCompactionCompleted(rocksdb::DB* db,
+                             const rocksdb::CompactionJobInfo& ci) override {
+    // The strings are the default cf, also when the db is shared.
+    if (!ci.status.ok() || ci.stats.num_input_records == 0 ||
+        ci.cf_name != rocksdb::kDefaultColumnFamilyName) {
+      return;
+    }
+    compactions_.fetch_add(1, std::memory_order_relaxed);
+    input_records_.fetch_add(ci.stats.num_input_records,
+                             std::memory_order_relaxed);
+    replaced_records_.fetch_add(ci.stats.num_records_replaced,
+                                std::memory_order_relaxed);
+
+    // Do not chain on the compactions of a marked range.
+    if (overwrite_ratio_ <= 0 ||
+        ci.compaction_reason ==
+          rocksdb::CompactionReason::kFilesMarkedForCompaction ||
+        ci.stats.num_records_replaced <
+          ci.stats.num_input_records * overwrite_ratio_) {
+      return;
+    }
+
+    int64_t now;
+    rocksdb::Env::Default()->GetCurrentTime(&now);
+    int64_t last = last_suggest_time_.load(std::memory_order_relaxed);
+    if (now - last < min_interval_ ||
+        !last_suggest_time_.compare_exchange_strong(last, now)) {
+      return;
+    }
+
+    // The key range of the output files, and whether anything lies below.
+    rocksdb::ColumnFamilyMetaData cf_meta;
+    db->GetColumnFamilyMetaData(db->DefaultColumnFamily(), &cf_meta);
+    std::string smallest, largest;
+    bool has_output = false, has_deeper = false;
+    for (const auto& level_meta : cf_meta.levels) {
+      if (level_meta.level > ci.output_level && !level_meta.files.empty()) {
+        has_deeper = true;
+      }
+      if (level_meta.level != ci.output_level) {
+        continue;
+      }
+      for (const auto& file : level_meta.files) {
+        if (!IsOutputFile(ci, file.name)) {
+          continue;
+        }
+        if (!has_output || file.smallestkey < smallest) {
+          smallest = file.smallestkey;
+        }
+        if (!has_output || file.largestkey > largest) {
+          largest = file.largestkey;
+        }
+        has_output = true;
+      }
+    }
+    if (!has_output || !has_deeper) {
+      return;
+    }
+
+    rocksdb::Slice begin(smallest), end(largest);
+    rocksdb::Status s = rocksdb::experimental::SuggestCompactRange(
+      db, db->DefaultColumnFamily(), &begin, &end);
+    if (s.ok()) {
+      suggested_ranges_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    BW_TRACE(kTraceInfo, "StringsCompactionListener",
+             "OutputLevel-%d, InputRecords: %lu, ReplacedRecords: %lu, "
+             "Range: [%s, %s], Status: %s",
+             ci.output_level, ci.stats.num_input_records,
+             ci.stats.num_records_replaced, smallest, largest,
+             s.ToString());
+  }
+
+  StringsCompactionStats GetStats() const {
+    StringsCompactionStats stats;
+    stats.compactions = compactions_.load(std::memory_order_relaxed);
+    stats.input_records = input_records_.load(std::memory_order_relaxed);
+    stats.replaced_records = replaced_records_.load(std::memory_order_relaxed);
+    stats.suggested_ranges = suggested_ranges_.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  // `name` of SstFileMetaData is "/NNNNNN.sst", the output files are full
+  // paths.
+  static bool IsOutputFile(const rocksdb::CompactionJobInfo& ci,
+                           const std::string& name) {
+    for (const auto& output_file : ci.output_files) {
+      if (rocksdb::Slice(output_file).ends_with(name)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const double overwrite_ratio_;
+  const int64_t min_interval_;
+  std::atomic<int64_t> last_suggest_time_{0};
+  std::atomic<uint64_t> compactions_{0};
+  std::atomic<uint64_t> input_records_{0};
+  std::atomic<uint64_t> replaced_records_{0};
+  std::atomic<uint64_t> suggested_ranges_{0};
+};
+
+}  // namespace blackwidow
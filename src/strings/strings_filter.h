@@ -1,6 +1,7 @@
 #pragma once
 
-#include "debug.h"
+#include "trace.h"
+#include "meta_lookup_cache.h"
 #include "strings_format.h"
 #include "rocksdb/compaction_filter.h"
 #include "rocksdb/env.h"
@@ -29,13 +30,18 @@ class StringsFilter : public rocksdb::CompactionFilter {
     // 如果设置了过期时间且已经过期.
     if(parsed_value.timestamp() != 0 && parsed_value.timestamp() < unix_time) {
       should_filter = true;
+      // 过期的chunk meta的version还没过时就保留, 同一个key新的version要大于它
+      ChunkedStringMeta meta;
+      if (ChunkedStringMeta::Decode(parsed_value.user_value(), &meta) &&
+          meta.version >= unix_time) {
+        should_filter = false;
+      }
     }
 
-    // NOTE: 能否传入db_进来查询最新的key对应的数据, 如果key被删除或者key的值和自己不相等， 说明
-    // 自己的key是旧版本的key, 则这里可以直接删除？
-    // 前提是不影响lruCache. 可以read_options.fill_cache=false
-    // 不然如果一个经常更新的key,可能存在N个版本, 都没设置过期时间， 那么低层的旧数据compaction是
+    // NOTE: 一个经常更新的key,可能存在N个版本, 都没设置过期时间， 那么低层的旧数据compaction是
     // 删不掉的， 一直下沉到更下层。
+    // 这里不通过db_查询最新的数据来判断旧版本: 查询看不到merge的operand和snapshot,
+    // 会误删数据. 旧版本由StringsCompactionListener提前把覆盖写频繁的区间向下compaction清理.
     // example:
     // set user 1 当前位于level4
     // set user 2 当前位于level3
@@ -44,16 +50,11 @@ class StringsFilter : public rocksdb::CompactionFilter {
     // set user 5 当前位于memtable
     // ... 更新版本...
 
-    Trace(
-      "[StringsCompactionFilter] Level-%d, UserKey: %s, UserValue: %s, Timestamp: %d, CurrentTime: %ld, "
-      "ShouldFilter: %d", 
-      level,
-      key.ToString().c_str(), 
-      // parsed_value.value().ToString().c_str(), 
-      "*****",
-      parsed_value.timestamp(), 
-      unix_time, 
-      should_filter);
+    BW_TRACE_SAMPLED(kTraceVerbose, "StringsCompactionFilter",
+                     "Level-%d, UserKey: %s, Timestamp: %d, CurrentTime: %ld, "
+                     "ShouldFilter: %d",
+                     level, key, parsed_value.timestamp(), unix_time,
+                     should_filter);
 
     return should_filter;
   }
@@ -73,5 +74,70 @@ class StringsFilterFactory : public rocksdb::CompactionFilterFactory {
   }
 };
 
+// Drops the chunks of chunked strings that were deleted, expired or
+// rewritten under a new version.
+class StringsChunkFilter : public rocksdb::CompactionFilter {
+ public:
+  StringsChunkFilter(rocksdb::DB* dbptr,
+                     std::vector<rocksdb::ColumnFamilyHandle*>* handles,
+                     MetaLookupCache* meta_cache)
+    : meta_resolver_(dbptr, handles, meta_cache) {}
+
+  const char* Name() const override {
+    return "blackwidow.StringsChunkFilter";
+  }
+
+  bool Filter(int level,
+              const rocksdb::Slice& key,
+              const rocksdb::Slice& existing_value,
+              std::string* new_value,
+              bool* value_changed) const override {
+    ParsedStringsChunkKey parsed_chunk_key(key);
+    const MetaSnapshot* meta = meta_resolver_.Resolve(
+      parsed_chunk_key.user_key(), parsed_chunk_key.version());
+    if (meta == nullptr) {
+      BW_TRACE_SAMPLED(kTraceError, "StringsChunkFilter",
+                       "Get MetaKey failed, reserve. key:%s", key);
+      return false;
+    }
+
+    bool should_filter = meta->IsDeadData(parsed_chunk_key.version());
+    BW_TRACE_SAMPLED(kTraceVerbose, "StringsChunkFilter",
+                     "level-%d, key:%s, version:%d, index:%u, "
+                     "metaVersion:%d, notFound:%d, shouldFilter:%d",
+                     level, meta_resolver_.cur_key(),
+                     parsed_chunk_key.version(), parsed_chunk_key.index(),
+                     meta->version, meta->not_found, should_filter);
+    return should_filter;
+  }
+
+ private:
+  mutable DataFilterMetaResolver<ParsedStringsChunkedMeta> meta_resolver_;
+};
+
+class StringsChunkFilterFactory : public rocksdb::CompactionFilterFactory {
+ public:
+  StringsChunkFilterFactory(
+    rocksdb::DB** db_ptr,
+    std::vector<rocksdb::ColumnFamilyHandle*>* handles_ptr,
+    std::shared_ptr<MetaLookupCache> meta_cache)
+    : db_ptr_(db_ptr), cf_handles_ptr_(handles_ptr),
+      meta_cache_(std::move(meta_cache)) {}
+
+  const char* Name() const override {
+    return "blackwidow.StringsChunkFilterFactory";
+  }
+
+  std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
+    const rocksdb::CompactionFilter::Context& context) override {
+    return std::unique_ptr<rocksdb::CompactionFilter>(
+      new StringsChunkFilter(*db_ptr_, cf_handles_ptr_, meta_cache_.get()));
+  }
+
+ private:
+  rocksdb::DB** db_ptr_;
+  std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
+  std::shared_ptr<MetaLookupCache> meta_cache_;
+};
 
 }  // namespace blackwidow
\ No newline at end of file
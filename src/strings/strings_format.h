@@ -9,6 +9,12 @@ namespace blackwidow {
 // strings format:
 // key   | user_key |
 // val   | user_val | timestamp(4bytes) |
+//
+// big values are stored in chunks, see ChunkedStringMeta:
+// key   | user_key |
+// val   | meta | timestamp(4bytes) |
+// chunk key | key_size(4bytes) | user_key | version(4bytes) | index(4bytes) |
+// chunk val | chunk bytes |
 
 class StringsValue : public InternalValue {
  public:
@@ -84,5 +90,144 @@ class ParsedStringsValue : public ParsedInternalValue {
   static constexpr size_t kStringsValueSuffixLength = sizeof(int32_t);
 };
 
+// The meta of a chunked string, the user value of its key:
+// | magic(8bytes) | version(4bytes) | length(8bytes) | chunk_size(4bytes) |
+// Chunk i holds the bytes [i * chunk_size, (i + 1) * chunk_size) of the
+// value, all chunks below the length exist. A rewritten value gets a new
+// version, the chunks of the old one are dropped by StringsChunkFilter.
+struct ChunkedStringMeta {
+  int32_t version = 0;
+  uint64_t length = 0;
+  uint32_t chunk_size = 0;
+
+  static constexpr char kMagic[] = "\xff" "BWCHUNK";
+  static constexpr size_t kMagicLength = sizeof(kMagic) - 1;
+  static constexpr size_t kEncodedLength =
+    kMagicLength + sizeof(int32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+
+  uint32_t NumChunks() const {
+    return static_cast<uint32_t>((length + chunk_size - 1) / chunk_size);
+  }
+
+  std::string Encode() const {
+    std::string dst(kEncodedLength, 0);
+    char* ptr = &dst[0];
+    memcpy(ptr, kMagic, kMagicLength);
+    ptr += kMagicLength;
+    EncodeFixed32(ptr, static_cast<uint32_t>(version));
+    ptr += sizeof(int32_t);
+    EncodeFixed64(ptr, length);
+    ptr += sizeof(uint64_t);
+    EncodeFixed32(ptr, chunk_size);
+    return dst;
+  }
+
+  // False if `user_value` is a value stored whole. A value that would
+  // decode is always stored chunked, see RedisStrings::Aux_PutValue.
+  static bool Decode(const Slice& user_value, ChunkedStringMeta* meta) {
+    if (user_value.size() != kEncodedLength ||
+        memcmp(user_value.data(), kMagic, kMagicLength) != 0) {
+      return false;
+    }
+    const char* ptr = user_value.data() + kMagicLength;
+    meta->version = static_cast<int32_t>(DecodeFixed32(ptr));
+    ptr += sizeof(int32_t);
+    meta->length = DecodeFixed64(ptr);
+    ptr += sizeof(uint64_t);
+    meta->chunk_size = DecodeFixed32(ptr);
+    return meta->chunk_size > 0;
+  }
+};
+
+// The meta of a strings key as the chunk compaction filter sees it, only
+// a chunked string owns chunks.
+class ParsedStringsChunkedMeta : public ParsedStringsValue {
+ public:
+  explicit ParsedStringsChunkedMeta(std::string* internal_value_str)
+    : ParsedStringsValue(internal_value_str) {
+    DecodeMeta();
+  }
+
+  explicit ParsedStringsChunkedMeta(const Slice& internal_value_slice)
+    : ParsedStringsValue(internal_value_slice) {
+    DecodeMeta();
+  }
+
+  bool HasDataRecords() const override {
+    return chunked_;
+  }
+
+ private:
+  void DecodeMeta() {
+    ChunkedStringMeta meta;
+    chunked_ = ChunkedStringMeta::Decode(user_value_, &meta);
+    version_ = meta.version;
+  }
+
+  bool chunked_;
+};
+
+class StringsChunkKey {
+ public:
+  StringsChunkKey(const Slice& key, int32_t version, uint32_t index) {
+    key_.resize(sizeof(uint32_t) + key.size() + sizeof(int32_t) +
+                sizeof(uint32_t));
+    char* ptr = &key_[0];
+    EncodeFixed32(ptr, static_cast<uint32_t>(key.size()));
+    ptr += sizeof(uint32_t);
+    if (key.size() > 0) {
+      memcpy(ptr, key.data(), key.size());
+      ptr += key.size();
+    }
+    EncodeFixed32(ptr, static_cast<uint32_t>(version));
+    ptr += sizeof(int32_t);
+    // big endian, the chunks of a value sort by index
+    for (int i = 3; i >= 0; i--) {
+      *ptr++ = static_cast<char>((index >> (i * 8)) & 0xff);
+    }
+  }
+
+  const Slice Encode() const {
+    return Slice(key_);
+  }
+
+ private:
+  std::string key_;
+};
+
+class ParsedStringsChunkKey {
+ public:
+  explicit ParsedStringsChunkKey(const Slice& raw_key) {
+    assert(raw_key.size() >= sizeof(uint32_t) * 3);
+    const char* ptr = raw_key.data();
+    uint32_t key_size = DecodeFixed32(ptr);
+    ptr += sizeof(uint32_t);
+    user_key_ = Slice(ptr, key_size);
+    ptr += key_size;
+    version_ = static_cast<int32_t>(DecodeFixed32(ptr));
+    ptr += sizeof(int32_t);
+    index_ = 0;
+    for (int i = 0; i < 4; i++) {
+      index_ = (index_ << 8) | static_cast<unsigned char>(ptr[i]);
+    }
+  }
+
+  const Slice user_key() const {
+    return user_key_;
+  }
+
+  int32_t version() const {
+    return version_;
+  }
+
+  uint32_t index() const {
+    return index_;
+  }
+
+ private:
+  Slice user_key_;
+  int32_t version_;
+  uint32_t index_;
+};
 
 }  // namespace blackwidow
\ No newline at end of file
@@ -0,0 +1,405 @@
+#pragma once
+
+#include "rocksdb/slice.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Traces above this level are compiled out, 0 removes them all.
+#ifndef BLACKWIDOW_TRACE_LEVEL
+#define BLACKWIDOW_TRACE_LEVEL 4
+#endif
+
+namespace blackwidow {
+
+enum TraceLevel {
+  kTraceOff = 0,
+  kTraceError = 1,
+  kTraceInfo = 2,
+  kTraceDebug = 3,
+  // Per record traces of compactions and commands.
+  kTraceVerbose = 4
+};
+
+// Keeps the last kCapacity traces in memory. A trace only copies its
+// arguments into a ring buffer slot, the format is applied by Dump. Tracing
+// is off until SetLevel, a disabled trace costs one relaxed load.
+//
+//   BW_TRACE(kTraceInfo, "compaction", "level:%d, key:%s", level, key);
+//   BW_TRACE_SAMPLED(kTraceVerbose, "filter", "key:%s", key);
+//
+// Arguments are integers, floating points, bools, `const char*`,
+// std::string and Slice; strings are copied up to kMaxStringArg bytes and
+// printed with the unprintable bytes escaped.
+class Tracer {
+ public:
+  static constexpr size_t kCapacity = 4096;
+  static constexpr size_t kMaxStringArg = 64;
+
+  // Records the traces up to `level`, kTraceOff stops tracing.
+  static void SetLevel(int level) {
+    if (level > kTraceOff) {
+      Buffer();
+    }
+    level_.store(level, std::memory_order_relaxed);
+  }
+  static int GetLevel() {
+    return level_.load(std::memory_order_relaxed);
+  }
+  static bool Enabled(int level) {
+    return level <= level_.load(std::memory_order_relaxed);
+  }
+
+  // BW_TRACE_SAMPLED records one in `every` of its calls per thread.
+  static void SetSampling(uint32_t every) {
+    sampling_.store(every == 0 ? 1 : every, std::memory_order_relaxed);
+  }
+  static bool Sample(uint32_t* calls) {
+    return (*calls)++ % sampling_.load(std::memory_order_relaxed) == 0;
+  }
+
+  template <typename... Args>
+  static void Record(int level,
+                     const char* category,
+                     const char* file,
+                     int line,
+                     const char* format,
+                     const Args&... args) {
+    Slot* slots = Buffer();
+    Event event;
+    event.micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    event.thread = ThreadId();
+    event.level = level;
+    event.category = category;
+    event.file = file;
+    event.line = line;
+    event.format = format;
+    event.args_size = 0;
+    event.num_args = 0;
+    event.args_full = false;
+    int unused[] = {0, (event.Append(args), 0)...};
+    (void)unused;
+
+    uint64_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots[ticket % kCapacity];
+    // Busy until the new ticket is published.
+    slot.ticket.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.Store(event);
+    slot.ticket.store(ticket + 1, std::memory_order_release);
+  }
+
+  // Formats the buffered traces, oldest first, one line each:
+  //   <micros> <thread> <level> <category> <file>:<line> <message>
+  static void Dump(std::vector<std::string>* lines) {
+    lines->clear();
+    Slot* slots = buffer_.load(std::memory_order_acquire);
+    if (slots == nullptr) {
+      return;
+    }
+    uint64_t end = next_.load(std::memory_order_acquire);
+    uint64_t begin = end > kCapacity ? end - kCapacity : 0;
+    for (uint64_t ticket = begin; ticket < end; ticket++) {
+      const Slot& slot = slots[ticket % kCapacity];
+      if (slot.ticket.load(std::memory_order_acquire) != ticket + 1) {
+        continue;
+      }
+      Event event;
+      slot.Load(&event);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // Overwritten while copied.
+      if (slot.ticket.load(std::memory_order_relaxed) != ticket + 1) {
+        continue;
+      }
+      lines->push_back(event.ToString());
+    }
+  }
+
+  static void Dump(FILE* out) {
+    std::vector<std::string> lines;
+    Dump(&lines);
+    for (const auto& line : lines) {
+      fprintf(out, "%s\n", line.c_str());
+    }
+  }
+
+  static void Clear() {
+    Slot* slots = buffer_.load(std::memory_order_acquire);
+    if (slots == nullptr) {
+      return;
+    }
+    for (size_t i = 0; i < kCapacity; i++) {
+      slots[i].ticket.store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  enum ArgType : char { kInt, kUint, kDouble, kString };
+
+  struct Event {
+    static constexpr size_t kArgsCapacity = 192;
+
+    uint64_t micros;
+    uint32_t thread;
+    int level;
+    const char* category;
+    const char* file;
+    int line;
+    const char* format;
+    uint16_t args_size;
+    uint16_t num_args;
+    // An argument did not fit, the later ones are dropped too so that
+    // every stored argument keeps its place in the format.
+    bool args_full;
+    char args[kArgsCapacity];
+
+    // The arguments that do not fit are printed as "?".
+    void Put(ArgType type, const void* data, size_t size) {
+      if (args_full || args_size + 1 + size > kArgsCapacity) {
+        args_full = true;
+        return;
+      }
+      args[args_size] = type;
+      memcpy(args + args_size + 1, data, size);
+      args_size += 1 + size;
+      num_args++;
+    }
+
+    void PutString(const char* data, size_t size) {
+      size = std::min(size, kMaxStringArg);
+      if (args_full || args_size + 2 + size > kArgsCapacity) {
+        args_full = true;
+        return;
+      }
+      args[args_size] = kString;
+      args[args_size + 1] = static_cast<char>(size);
+      memcpy(args + args_size + 2, data, size);
+      args_size += 2 + size;
+      num_args++;
+    }
+
+    template <typename T>
+    void Append(const T& arg) {
+      if constexpr (std::is_floating_point<T>::value) {
+        double value = arg;
+        Put(kDouble, &value, sizeof(value));
+      } else if constexpr (std::is_signed<T>::value ||
+                           std::is_enum<T>::value) {
+        int64_t value = static_cast<int64_t>(arg);
+        Put(kInt, &value, sizeof(value));
+      } else if constexpr (std::is_integral<T>::value) {
+        uint64_t value = static_cast<uint64_t>(arg);
+        Put(kUint, &value, sizeof(value));
+      } else if constexpr (std::is_same<T, rocksdb::Slice>::value ||
+                           std::is_same<T, std::string>::value) {
+        PutString(arg.data(), arg.size());
+      } else {
+        const char* value = arg;
+        PutString(value, value == nullptr ? 0 : strlen(value));
+      }
+    }
+
+    std::string ToString() const {
+      static const char* const kLevels[] = {"OFF", "ERROR", "INFO", "DEBUG",
+                                            "VERBOSE"};
+      char header[256];
+      const char* base = strrchr(file, '/');
+      snprintf(header, sizeof(header), "%lu %u %s %s %s:%d ", micros, thread,
+               level >= 0 && level <= kTraceVerbose ? kLevels[level] : "?",
+               category, base == nullptr ? file : base + 1, line);
+      std::string out(header);
+      FormatMessage(&out);
+      while (!out.empty() && out.back() == '\n') {
+        out.pop_back();
+      }
+      return out;
+    }
+
+    // printf with the stored arguments, the length modifiers of the format
+    // are ignored as every number is stored in 64 bits.
+    void FormatMessage(std::string* out) const {
+      size_t pos = 0;
+      uint16_t arg = 0;
+      for (const char* p = format; *p != '\0'; p++) {
+        if (*p != '%') {
+          out->push_back(*p);
+          continue;
+        }
+        if (p[1] == '%') {
+          out->push_back('%');
+          p++;
+          continue;
+        }
+        // %[flags][width][.precision][length]conversion
+        std::string spec("%");
+        p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != nullptr) {
+          spec.push_back(*p++);
+        }
+        while (*p != '\0' && strchr("hljztL", *p) != nullptr) {
+          p++;
+        }
+        if (*p == '\0') {
+          break;
+        }
+        char conversion = *p;
+        if (arg++ >= num_args) {
+          out->push_back('?');
+          continue;
+        }
+        AppendArg(spec, conversion, &pos, out);
+      }
+    }
+
+    void AppendArg(std::string spec,
+                   char conversion,
+                   size_t* pos,
+                   std::string* out) const {
+      char buf[256];
+      ArgType type = static_cast<ArgType>(args[*pos]);
+      if (type == kString) {
+        size_t size = static_cast<unsigned char>(args[*pos + 1]);
+        std::string escaped = Escape(args + *pos + 2, size);
+        *pos += 2 + size;
+        spec.push_back('s');
+        snprintf(buf, sizeof(buf), spec.c_str(), escaped.c_str());
+      } else if (type == kDouble) {
+        double value;
+        memcpy(&value, args + *pos + 1, sizeof(value));
+        *pos += 1 + sizeof(value);
+        spec.push_back(strchr("eEfFgGaA", conversion) ? conversion : 'g');
+        snprintf(buf, sizeof(buf), spec.c_str(), value);
+      } else {
+        uint64_t value;
+        memcpy(&value, args + *pos + 1, sizeof(value));
+        *pos += 1 + sizeof(value);
+        if (strchr("eEfFgGaA", conversion) != nullptr) {
+          spec.push_back(conversion);
+          snprintf(buf, sizeof(buf), spec.c_str(),
+                   type == kInt ? static_cast<double>(
+                                    static_cast<int64_t>(value))
+                                : static_cast<double>(value));
+        } else if (strchr("uxXo", conversion) != nullptr) {
+          spec.append("ll").push_back(conversion);
+          snprintf(buf, sizeof(buf), spec.c_str(),
+                   static_cast<unsigned long long>(value));
+        } else if (conversion == 'c') {
+          spec.push_back('c');
+          snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int>(value));
+        } else {
+          spec.append("ll").push_back(type == kInt ? 'd' : 'u');
+          snprintf(buf, sizeof(buf), spec.c_str(),
+                   static_cast<long long>(value));
+        }
+      }
+      out->append(buf);
+    }
+
+    static std::string Escape(const char* data, size_t size) {
+      std::string escaped;
+      for (size_t i = 0; i < size; i++) {
+        unsigned char c = data[i];
+        if (c >= 0x20 && c < 0x7f && c != '\\') {
+          escaped.push_back(c);
+        } else {
+          char hex[5];
+          snprintf(hex, sizeof(hex), "\\x%02x", c);
+          escaped.append(hex);
+        }
+      }
+      return escaped;
+    }
+  };
+
+  static_assert(std::is_trivially_copyable<Event>::value,
+                "an event is copied word by word");
+
+  // A slot holds the event of `ticket - 1`, or is being written when 0.
+  // The event is kept in atomic words, Dump may read a slot while it is
+  // written and drops the copy if the ticket changed meanwhile.
+  struct Slot {
+    static constexpr size_t kWords =
+      (sizeof(Event) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> ticket{0};
+    std::atomic<uint64_t> words[kWords];
+
+    void Store(const Event& event) {
+      uint64_t buf[kWords] = {0};
+      memcpy(buf, &event, sizeof(event));
+      for (size_t i = 0; i < kWords; i++) {
+        words[i].store(buf[i], std::memory_order_relaxed);
+      }
+    }
+
+    void Load(Event* event) const {
+      uint64_t buf[kWords];
+      for (size_t i = 0; i < kWords; i++) {
+        buf[i] = words[i].load(std::memory_order_relaxed);
+      }
+      memcpy(event, buf, sizeof(*event));
+    }
+  };
+
+  static Slot* Buffer() {
+    Slot* slots = buffer_.load(std::memory_order_acquire);
+    if (slots == nullptr) {
+      std::lock_guard<std::mutex> l(buffer_mutex_);
+      slots = buffer_.load(std::memory_order_relaxed);
+      if (slots == nullptr) {
+        // Kept until the process exits, traces may run in any thread.
+        slots = new Slot[kCapacity];
+        buffer_.store(slots, std::memory_order_release);
+      }
+    }
+    return slots;
+  }
+
+  static uint32_t ThreadId() {
+    static std::atomic<uint32_t> next_thread{1};
+    thread_local uint32_t id = next_thread.fetch_add(1);
+    return id;
+  }
+
+  static inline std::atomic<int> level_{kTraceOff};
+  static inline std::atomic<uint32_t> sampling_{1};
+  static inline std::atomic<uint64_t> next_{0};
+  static inline std::atomic<Slot*> buffer_{nullptr};
+  static inline std::mutex buffer_mutex_;
+};
+
+}  // namespace blackwidow
+
+// The arguments are only evaluated when the trace is recorded.
+#define BW_TRACE(level, category, format, ...)                            \
+  do {                                                                    \
+    if ((level) <= BLACKWIDOW_TRACE_LEVEL &&                              \
+        ::blackwidow::Tracer::Enabled(level)) {                           \
+      ::blackwidow::Tracer::Record((level), (category), __FILE__,         \
+                                   __LINE__, (format), ##__VA_ARGS__);    \
+    }                                                                     \
+  } while (0)
+
+// BW_TRACE for the per record paths, records one in Tracer::SetSampling
+// calls of every thread.
+#define BW_TRACE_SAMPLED(level, category, format, ...)                    \
+  do {                                                                    \
+    if ((level) <= BLACKWIDOW_TRACE_LEVEL &&                              \
+        ::blackwidow::Tracer::Enabled(level)) {                           \
+      thread_local uint32_t bw_trace_calls = 0;                           \
+      if (::blackwidow::Tracer::Sample(&bw_trace_calls)) {                \
+        ::blackwidow::Tracer::Record((level), (category), __FILE__,       \
+                                     __LINE__, (format), ##__VA_ARGS__);  \
+      }                                                                   \
+    }                                                                     \
+  } while (0)
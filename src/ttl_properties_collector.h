@@ -0,0 +1,123 @@
+#pragma once
+
+#include "rocksdb/slice.h"
+#include "rocksdb/table_properties.h"
+
+#include <cstdlib>
+#include <string>
+
+namespace blackwidow {
+
+// User collected properties of a meta (or strings) sst.
+static const std::string kTtlPropertyEntries = "blackwidow.ttl.entries";
+static const std::string kTtlPropertyTtlEntries = "blackwidow.ttl.ttl-entries";
+static const std::string kTtlPropertyMinExpire = "blackwidow.ttl.min-expire";
+static const std::string kTtlPropertyMaxExpire = "blackwidow.ttl.max-expire";
+
+struct TtlProperties {
+  // Values in the sst.
+  uint64_t entries = 0;
+  // Values with an expire time.
+  uint64_t ttl_entries = 0;
+  // Unix time range of the expire times, 0 if there is no ttl value.
+  int64_t min_expire = 0;
+  int64_t max_expire = 0;
+
+  // Returns false if the sst was not written by TtlPropertiesCollector.
+  bool Decode(const rocksdb::UserCollectedProperties& props) {
+    auto entries_iter = props.find(kTtlPropertyEntries);
+    auto ttl_entries_iter = props.find(kTtlPropertyTtlEntries);
+    auto min_iter = props.find(kTtlPropertyMinExpire);
+    auto max_iter = props.find(kTtlPropertyMaxExpire);
+    if (entries_iter == props.end() || ttl_entries_iter == props.end() ||
+        min_iter == props.end() || max_iter == props.end()) {
+      return false;
+    }
+    entries = std::strtoull(entries_iter->second.c_str(), nullptr, 10);
+    ttl_entries = std::strtoull(ttl_entries_iter->second.c_str(), nullptr, 10);
+    min_expire = std::strtoll(min_iter->second.c_str(), nullptr, 10);
+    max_expire = std::strtoll(max_iter->second.c_str(), nullptr, 10);
+    return true;
+  }
+
+  // All ttl values are expired at `now` and make up at least `ratio` of
+  // the sst.
+  bool IsMostlyExpired(int64_t now, double ratio) const {
+    return ttl_entries > 0 && max_expire < now &&
+           ttl_entries >= entries * ratio;
+  }
+};
+
+// Records the expire times of the values in every sst, so that ssts which
+// are mostly expired can be compacted on purpose instead of waiting for a
+// compaction to reach them by chance.
+//
+// ParsedValue is the parsed meta value of the column family (or
+// ParsedStringsValue), constructed from a Slice, with timestamp().
+template <typename ParsedValue>
+class TtlPropertiesCollector : public rocksdb::TablePropertiesCollector {
+ public:
+  TtlPropertiesCollector() = default;
+
+  const char* Name() const override {
+    return "blackwidow.TtlPropertiesCollector";
+  }
+
+  rocksdb::Status AddUserKey(const rocksdb::Slice& key,
+                             const rocksdb::Slice& value,
+                             rocksdb::EntryType type,
+                             rocksdb::SequenceNumber seq,
+                             uint64_t file_size) override {
+    // Merge operands and tombstones carry no timestamp.
+    if (type != rocksdb::kEntryPut) {
+      return rocksdb::Status::OK();
+    }
+    props_.entries++;
+    ParsedValue parsed_value(value);
+    int64_t timestamp = parsed_value.timestamp();
+    if (timestamp == 0) {
+      return rocksdb::Status::OK();
+    }
+    if (props_.ttl_entries == 0 || timestamp < props_.min_expire) {
+      props_.min_expire = timestamp;
+    }
+    if (props_.ttl_entries == 0 || timestamp > props_.max_expire) {
+      props_.max_expire = timestamp;
+    }
+    props_.ttl_entries++;
+    return rocksdb::Status::OK();
+  }
+
+  rocksdb::Status Finish(rocksdb::UserCollectedProperties* props) override {
+    *props = GetReadableProperties();
+    return rocksdb::Status::OK();
+  }
+
+  rocksdb::UserCollectedProperties GetReadableProperties() const override {
+    rocksdb::UserCollectedProperties props;
+    props[kTtlPropertyEntries] = std::to_string(props_.entries);
+    props[kTtlPropertyTtlEntries] = std::to_string(props_.ttl_entries);
+    props[kTtlPropertyMinExpire] = std::to_string(props_.min_expire);
+    props[kTtlPropertyMaxExpire] = std::to_string(props_.max_expire);
+    return props;
+  }
+
+ private:
+  TtlProperties props_;
+};
+
+template <typename ParsedValue>
+class TtlPropertiesCollectorFactory
+  : public rocksdb::TablePropertiesCollectorFactory {
+ public:
+  const char* Name() const override {
+    return "blackwidow.TtlPropertiesCollectorFactory";
+  }
+
+  rocksdb::TablePropertiesCollector* CreateTablePropertiesCollector(
+    rocksdb::TablePropertiesCollectorFactory::Context context) override {
+    return new TtlPropertiesCollector<ParsedValue>();
+  }
+};
+
+}  // namespace blackwidow
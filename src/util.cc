@@ -1,4 +1,9 @@
 #include "blackwidow/util.h"
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <stdio.h>
 
@@ -128,4 +133,67 @@ int StringMatch(const char *pattern, int pattern_len, const char* str,
 }
 
 
+int StrToInt64(const char* s, size_t slen, int64_t* value) {
+  // strtoll needs a terminated buffer and accepts leading spaces.
+  if (slen == 0 || slen >= 32 || isspace(static_cast<unsigned char>(s[0]))) {
+    return -1;
+  }
+  char buf[32];
+  memcpy(buf, s, slen);
+  buf[slen] = '\0';
+
+  char* endptr = nullptr;
+  errno = 0;
+  long long v = strtoll(buf, &endptr, 10);
+  if (errno == ERANGE || endptr != buf + slen) {
+    return -1;
+  }
+  *value = static_cast<int64_t>(v);
+  return 0;
 }
+
+int StrToLongDouble(const char* s, size_t slen, long double* ldval) {
+  if (slen == 0 || slen >= 256 || isspace(static_cast<unsigned char>(s[0]))) {
+    return -1;
+  }
+  char buf[256];
+  memcpy(buf, s, slen);
+  buf[slen] = '\0';
+
+  char* endptr = nullptr;
+  errno = 0;
+  long double v = strtold(buf, &endptr);
+  if ((errno == ERANGE && (v == HUGE_VALL || v == -HUGE_VALL)) ||
+      endptr != buf + slen || std::isnan(v) || std::isinf(v)) {
+    return -1;
+  }
+  *ldval = v;
+  return 0;
+}
+
+int LongDoubleToStr(long double ldval, std::string* value) {
+  if (std::isnan(ldval) || std::isinf(ldval)) {
+    return -1;
+  }
+  // %Lf of a big long double is long, same bound as redis.
+  char buf[5 * 1024];
+  int len = snprintf(buf, sizeof(buf), "%.17Lf", ldval);
+  if (len <= 0 || static_cast<size_t>(len) >= sizeof(buf)) {
+    return -1;
+  }
+  // Strip the trailing zeros and a dangling dot.
+  if (strchr(buf, '.') != nullptr) {
+    char* p = buf + len - 1;
+    while (*p == '0') {
+      p--;
+      len--;
+    }
+    if (*p == '.') {
+      len--;
+    }
+  }
+  value->assign(buf, len);
+  return 0;
+}
+
+}  // namespace blackwidow
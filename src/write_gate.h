@@ -0,0 +1,154 @@
+#pragma once
+
+#include "rocksdb/db.h"
+#include "rocksdb/utilities/stackable_db.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace blackwidow {
+
+// Stops the writes to a db for a moment, e.g. to take checkpoints of all
+// dbs at the same point. While the gate is open a write only touches an
+// atomic counter.
+class WriteGate {
+ public:
+  WriteGate() = default;
+  WriteGate(const WriteGate&) = delete;
+  WriteGate& operator=(const WriteGate&) = delete;
+
+  // Waits while the gate is closed.
+  void Enter() {
+    while (true) {
+      writers_.fetch_add(1);
+      if (!closed_.load()) {
+        return;
+      }
+      Leave();
+      std::unique_lock<std::mutex> l(mu_);
+      cv_.wait(l, [this] { return !closed_.load(); });
+    }
+  }
+
+  void Leave() {
+    if (writers_.fetch_sub(1) == 1 && closed_.load()) {
+      std::lock_guard<std::mutex> l(mu_);
+      cv_.notify_all();
+    }
+  }
+
+  // Returns once the writes in flight are done, the later ones wait for
+  // Open. Only one caller may close the gate at a time.
+  void Close() {
+    std::unique_lock<std::mutex> l(mu_);
+    closed_.store(true);
+    cv_.wait(l, [this] { return writers_.load() == 0; });
+  }
+
+  void Open() {
+    std::lock_guard<std::mutex> l(mu_);
+    closed_.store(false);
+    cv_.notify_all();
+  }
+
+ private:
+  std::atomic<bool> closed_{false};
+  std::atomic<int64_t> writers_{0};
+  std::mutex mu_;
+  std::condition_variable cv_;
+};
+
+// Passes every write of the wrapped db through a WriteGate, the rest goes
+// straight to the db. Owns the wrapped db.
+class GatedDB : public rocksdb::StackableDB {
+ public:
+  GatedDB(rocksdb::DB* db, WriteGate* gate)
+    : rocksdb::StackableDB(db), gate_(gate) {}
+
+  using rocksdb::StackableDB::Delete;
+  using rocksdb::StackableDB::IngestExternalFile;
+  using rocksdb::StackableDB::Merge;
+  using rocksdb::StackableDB::Put;
+  using rocksdb::StackableDB::SingleDelete;
+
+  rocksdb::Status Put(const rocksdb::WriteOptions& options,
+                      rocksdb::ColumnFamilyHandle* column_family,
+                      const rocksdb::Slice& key,
+                      const rocksdb::Slice& value) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::Put(options, column_family, key, value);
+  }
+
+  rocksdb::Status Delete(const rocksdb::WriteOptions& options,
+                         rocksdb::ColumnFamilyHandle* column_family,
+                         const rocksdb::Slice& key) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::Delete(options, column_family, key);
+  }
+
+  rocksdb::Status SingleDelete(const rocksdb::WriteOptions& options,
+                               rocksdb::ColumnFamilyHandle* column_family,
+                               const rocksdb::Slice& key) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::SingleDelete(options, column_family, key);
+  }
+
+  rocksdb::Status DeleteRange(const rocksdb::WriteOptions& options,
+                              rocksdb::ColumnFamilyHandle* column_family,
+                              const rocksdb::Slice& begin_key,
+                              const rocksdb::Slice& end_key) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::DeleteRange(
+      options, column_family, begin_key, end_key);
+  }
+
+  rocksdb::Status Merge(const rocksdb::WriteOptions& options,
+                        rocksdb::ColumnFamilyHandle* column_family,
+                        const rocksdb::Slice& key,
+                        const rocksdb::Slice& value) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::Merge(options, column_family, key, value);
+  }
+
+  rocksdb::Status Write(const rocksdb::WriteOptions& options,
+                        rocksdb::WriteBatch* updates) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::Write(options, updates);
+  }
+
+  rocksdb::Status IngestExternalFile(
+    rocksdb::ColumnFamilyHandle* column_family,
+    const std::vector<std::string>& external_files,
+    const rocksdb::IngestExternalFileOptions& options) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::IngestExternalFile(
+      column_family, external_files, options);
+  }
+
+  rocksdb::Status IngestExternalFiles(
+    const std::vector<rocksdb::IngestExternalFileArg>& args) override {
+    Guard g(gate_);
+    return rocksdb::StackableDB::IngestExternalFiles(args);
+  }
+
+ private:
+  class Guard {
+   public:
+    explicit Guard(WriteGate* gate) : gate_(gate) {
+      gate_->Enter();
+    }
+    ~Guard() {
+      gate_->Leave();
+    }
+
+   private:
+    WriteGate* const gate_;
+  };
+
+  WriteGate* const gate_;
+};
+
+}  // namespace blackwidow
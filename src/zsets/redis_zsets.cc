@@ -1,8 +1,11 @@
 #include "redis_zsets.h"
+#include "bulk_loader.h"
 #include "scope_record_lock.h"
 #include "scope_snapshot.h"
 #include "zsets_format.h"
 #include "zsets_comparator.h"
+#include "zsets_filter.h"
+#include "ttl_properties_collector.h"
 #include "rocksdb/db.h"
 
 namespace blackwidow {
@@ -12,43 +15,42 @@ rocksdb::Comparator *ZsetsScoreKeyComparator() {
   return &cmp;
 }
 
-RedisZsets::RedisZsets(BlackWidow* const bw) : Redis(bw, kZSets) {}
+RedisZsets::RedisZsets(BlackWidow* const bw)
+    : Redis(bw, kZSets),
+      data_meta_cache_(std::make_shared<MetaLookupCache>()) {}
 
 // Common Commands
 Status RedisZsets::Open(const BlackWidowOptions& bw_options,
                         const std::string& dbpath) {
+  rocksdb::DBOptions db_opts(bw_options.options);
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  PrepareOptions(bw_options, &db_opts, &column_families);
+  return OpenDB(db_opts, dbpath, column_families);
+}
+
+void RedisZsets::PrepareOptions(
+  const BlackWidowOptions& bw_options,
+  rocksdb::DBOptions* db_options,
+  std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) {
+  command_stats_.SetOptions(bw_options.command_stats,
+                            bw_options.command_stats_block_reads);
   // TODO
   // statistics_store_->SetCapacity(bw_options.statistics_max_size);
   // small_compaction_threshold_ = bw_options.small_compaction_threshold;
-  rocksdb::Options opts(bw_options.options);
-  Status s = rocksdb::DB::Open(opts, dbpath, &db_);
-  if(s.ok()) {
-    rocksdb::ColumnFamilyHandle *member_cf = nullptr, *score_cf = nullptr;
-    s = db_->CreateColumnFamily(
-      rocksdb::ColumnFamilyOptions(), "member_cf", &member_cf);
-    if(!s.ok()) {
-      return s;
-    }
-
-    rocksdb::ColumnFamilyOptions score_cf_opts;
-    score_cf_opts.comparator = ZsetsScoreKeyComparator();
-    s = db_->CreateColumnFamily(score_cf_opts, "score_cf", &score_cf);
-    if(!s.ok()) {
-      return s;
-    }
-    delete score_cf;
-    delete member_cf;
-    delete db_;
-  }
-
-  rocksdb::DBOptions db_opts(bw_options.options);
   rocksdb::ColumnFamilyOptions meta_cf_opts(bw_options.options);
   rocksdb::ColumnFamilyOptions member_cf_opts(bw_options.options);
   rocksdb::ColumnFamilyOptions score_cf_opts(bw_options.options);
 
-  meta_cf_opts.compaction_filter_factory.reset(); // TODO
-  member_cf_opts.compaction_filter_factory.reset(); // TODO
-  score_cf_opts.compaction_filter_factory.reset(); // TODO
+  meta_cf_opts.compaction_filter_factory =
+    std::make_shared<ZsetsMetaFilterFactory>();
+  meta_cf_opts.table_properties_collector_factories.push_back(
+    std::make_shared<TtlPropertiesCollectorFactory<ParsedZsetsMetaValue>>());
+  member_cf_opts.compaction_filter_factory =
+    std::make_shared<ZsetsDataFilterFactory>(
+      &db_, &handles_, data_meta_cache_, ZsetsDataFilter::kMember);
+  score_cf_opts.compaction_filter_factory =
+    std::make_shared<ZsetsDataFilterFactory>(
+      &db_, &handles_, data_meta_cache_, ZsetsDataFilter::kScore);
   score_cf_opts.comparator = ZsetsScoreKeyComparator();
 
   // Use bloomFilter and LRUCache
@@ -59,21 +61,89 @@ Status RedisZsets::Open(const BlackWidowOptions& bw_options,
   rocksdb::BlockBasedTableOptions score_cf_table_opts(table_opts);
 
   if(!bw_options.share_block_cache && bw_options.block_cache_size > 0) {
-    meta_cf_table_opts.block_cache = rocksdb::NewLRUCache(bw_options.block_cache_size);
-    member_cf_table_opts.block_cache = rocksdb::NewLRUCache(bw_options.block_cache_size);
-    score_cf_table_opts.block_cache = rocksdb::NewLRUCache(bw_options.block_cache_size);
+    meta_cf_table_opts.block_cache = NewBlockCache(bw_options.block_cache_size);
+    member_cf_table_opts.block_cache = NewBlockCache(bw_options.block_cache_size);
+    score_cf_table_opts.block_cache = NewBlockCache(bw_options.block_cache_size);
   }
 
   meta_cf_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(meta_cf_table_opts));
   member_cf_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(member_cf_table_opts));
   score_cf_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(score_cf_table_opts));
 
-  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
-  column_families.push_back(rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName, meta_cf_opts));
-  column_families.push_back(rocksdb::ColumnFamilyDescriptor("member_cf", member_cf_opts));
-  column_families.push_back(rocksdb::ColumnFamilyDescriptor("score_cf", score_cf_opts));
+  column_families->push_back(rocksdb::ColumnFamilyDescriptor(rocksdb::kDefaultColumnFamilyName, meta_cf_opts));
+  column_families->push_back(rocksdb::ColumnFamilyDescriptor("member_cf", member_cf_opts));
+  column_families->push_back(rocksdb::ColumnFamilyDescriptor("score_cf", score_cf_opts));
+}
+
+MetaLookupStats RedisZsets::GetDataFilterStats() const {
+  return data_meta_cache_->GetStats();
+}
+
+Status RedisZsets::BulkLoad(std::vector<KeyScoreMembers>* ksms) {
+  // Equal keys and members keep their input order, the last one wins.
+  std::stable_sort(ksms->begin(), ksms->end(),
+                   [](const KeyScoreMembers& a, const KeyScoreMembers& b) {
+                     return a.key < b.key;
+                   });
+  std::vector<std::string> keys;
+  for (const auto& ksm : *ksms) {
+    keys.push_back(ksm.key);
+  }
+  // The versions read below must stay the newest until the ssts are in.
+  MultiScopedRecordLock l(lock_mgr_, keys);
+
+  BulkLoader loader(db_);
+  std::string meta_value;
+  for (size_t i = 0; i < ksms->size(); i++) {
+    if (i + 1 < ksms->size() && (*ksms)[i + 1].key == (*ksms)[i].key) {
+      continue;
+    }
+    const std::string& key = (*ksms)[i].key;
+    std::vector<ScoreMember>& sms = (*ksms)[i].score_members;
+    std::stable_sort(sms.begin(), sms.end(),
+                     [](const ScoreMember& a, const ScoreMember& b) {
+                       return a.member < b.member;
+                     });
+    uint32_t zset_size = 0;
+    for (size_t j = 0; j < sms.size(); j++) {
+      if (j + 1 == sms.size() || sms[j + 1].member != sms[j].member) {
+        zset_size++;
+      }
+    }
+
+    int32_t version = 0;
+    Status s = db_->Get(default_read_options_, ZSETS_META, key, &meta_value);
+    if (s.ok()) {
+      // Like a Del followed by a ZAdd, the old members are left to the
+      // data filters.
+      ParsedZsetsMetaValue parsed_meta_value(&meta_value);
+      parsed_meta_value.InitialMetaValue();
+      parsed_meta_value.set_zset_size(zset_size);
+      version = parsed_meta_value.version();
+      loader.Put(ZSETS_META, key, meta_value);
+    } else if (s.IsNotFound()) {
+      if (zset_size == 0) {
+        continue;
+      }
+      ZsetsMetaValue zsets_meta_value(zset_size);
+      version = zsets_meta_value.UpdateVersion();
+      loader.Put(ZSETS_META, key, zsets_meta_value.Encode());
+    } else {
+      return s;
+    }
 
-  return rocksdb::DB::Open(db_opts, dbpath, column_families, &handles_, &db_);
+    for (size_t j = 0; j < sms.size(); j++) {
+      if (j + 1 < sms.size() && sms[j + 1].member == sms[j].member) {
+        continue;
+      }
+      ZsetsMemberKey member_key(key, version, sms[j].member);
+      ZsetsScoreKey score_key(key, version, sms[j].score, sms[j].member);
+      loader.Put(
+        ZSETS_MEMBER, member_key.Encode(), score_key.GetScoreAsString());
+      loader.Put(ZSETS_SCORE, score_key.Encode(), EMPTY_SLICE);
+    }
+  }
+  return loader.Ingest();
 }
 
 Status RedisZsets::CompactRange(const Slice* begin,
@@ -90,14 +160,7 @@ Status RedisZsets::CompactRange(const Slice* begin,
 }
 
 Status RedisZsets::GetProperty(const std::string& property, uint64_t* out) {
-  std::string value;
-  db_->GetProperty(handles_[0], property, &value);
-  *out = std::strtoull(value.c_str(), NULL, 10);
-  db_->GetProperty(handles_[1], property, &value);
-  *out += std::strtoull(value.c_str(), NULL, 10);
-  db_->GetProperty(handles_[2], property, &value);
-  *out += std::strtoull(value.c_str(), NULL, 10);
-  return Status::OK();
+  return GetIntProperty(property, out);
 }
 
 Status RedisZsets::ScanKeyNum(KeyInfo* key_info) {
@@ -115,6 +178,7 @@ Status RedisZsets::PKPatternMatchDel(const std::string& pattern, int32_t* ret) {
 
 // Keys Commands
 Status RedisZsets::Del(const Slice& key) {
+  CommandTimer timer(&command_stats_, kCmdDel, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, ZSETS_META, key, &meta_value);
@@ -131,11 +195,12 @@ Status RedisZsets::Del(const Slice& key) {
 
     parsed_meta_value.InitialMetaValue();
     s = db_->Put(default_write_options_, ZSETS_META, key, meta_value);
-    return s;
   }
+  return timer.Done(s);
 }
 
 Status RedisZsets::Expire(const Slice& key, int32_t ttl) {
+  CommandTimer timer(&command_stats_, kCmdExpire, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, ZSETS_META, key, &meta_value);
@@ -150,10 +215,11 @@ Status RedisZsets::Expire(const Slice& key, int32_t ttl) {
       s = db_->Put(default_write_options_, ZSETS_META, key, meta_value);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisZsets::ExpireAt(const Slice& key, int32_t timestamp) {
+  CommandTimer timer(&command_stats_, kCmdExpireAt, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, ZSETS_META, key, &meta_value);
@@ -174,10 +240,11 @@ Status RedisZsets::ExpireAt(const Slice& key, int32_t timestamp) {
       s = db_->Put(default_write_options_, ZSETS_META, key, meta_value);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisZsets::Persist(const Slice& key) {
+  CommandTimer timer(&command_stats_, kCmdPersist, key.size());
   std::string meta_value;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, ZSETS_META, key, &meta_value);
@@ -192,15 +259,16 @@ Status RedisZsets::Persist(const Slice& key) {
       s = db_->Put(default_write_options_, ZSETS_META, key, meta_value);
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisZsets::TTL(const Slice& key, int64_t* timestamp) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdTTL, key.size());
+  rocksdb::PinnableSlice meta_value;
   //   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, ZSETS_META, key, &meta_value);
   if (s.ok()) {
-    ParsedZsetsMetaValue parsed_meta_value(&meta_value);
+    ParsedZsetsMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsExpired()) {
       *timestamp = -2;
       return Status::NotFound("Expired");
@@ -224,12 +292,13 @@ Status RedisZsets::TTL(const Slice& key, int64_t* timestamp) {
   } else if (s.IsNotFound()) {
     *timestamp = -2;
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisZsets::ZAdd(const Slice& key,
                         const std::vector<ScoreMember>& members,
                         int32_t* ret) {
+  CommandTimer timer(&command_stats_, kCmdZAdd, key.size() + BytesOf(members));
   if (members.size() == 0) {
     if (ret)
       *ret = 0;
@@ -293,16 +362,17 @@ Status RedisZsets::ZAdd(const Slice& key,
     }
   }
 
-  return s;
+  return timer.Done(s);
 }
 
 
 Status RedisZsets::ZCard(const Slice& key, int32_t* len) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdZCard, key.size());
+  rocksdb::PinnableSlice meta_value;
   *len = 0;
   Status s = db_->Get(default_read_options_, ZSETS_META, key, &meta_value);
   if (s.ok()) {
-    ParsedZsetsMetaValue parsed_meta_value(&meta_value);
+    ParsedZsetsMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsExpired()) {
       return Status::NotFound("Expired");
     } else if (parsed_meta_value.zset_size() == 0) {
@@ -311,13 +381,14 @@ Status RedisZsets::ZCard(const Slice& key, int32_t* len) {
       *len = parsed_meta_value.zset_size();
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisZsets::ZScore(const Slice& key,
                           const Slice& member,
                           double* score) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdZScore, key.size() + member.size());
+  rocksdb::PinnableSlice meta_value;
   const rocksdb::Snapshot* snapshot = nullptr;
   ScopeSnapshot ss(db_, &snapshot);
   rocksdb::ReadOptions read_opts;
@@ -325,24 +396,24 @@ Status RedisZsets::ZScore(const Slice& key,
 
   Status s = db_->Get(read_opts, ZSETS_META, key, &meta_value);
   if (s.ok()) {
-    ParsedZsetsMetaValue parsed_meta_value(&meta_value);
+    ParsedZsetsMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsExpired()) {
       return Status::NotFound("Expired");
     } else if (parsed_meta_value.zset_size() == 0) {
       return Status::NotFound();
     } else {
-      std::string scorestr;
+      rocksdb::PinnableSlice scorestr;
       ZsetsMemberKey member_key(key, parsed_meta_value.version(), member);
       s = db_->Get(read_opts, ZSETS_MEMBER, member_key.Encode(), &scorestr);
       if (s.ok()) {
         assert(scorestr.size() == 8);
-        uint64_t x = DecodeFixed64(&scorestr[0]);
+        uint64_t x = DecodeFixed64(scorestr.data());
         const double* scoreptr = reinterpret_cast<const double*>(&x);
         *score = *scoreptr;
       }
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisZsets::ZRem(const Slice& key,
@@ -354,12 +425,14 @@ Status RedisZsets::ZCount(const Slice& key,
                           double min,
                           double max,
                           int32_t* count) {
-  if (min < max) {
+  CommandTimer timer(&command_stats_, kCmdZCount, key.size());
+  // An empty range.
+  if (min > max) {
     *count = 0;
-    return Status::OK();
+    return timer.Done(Status::OK());
   }
 
-  std::string meta_value;
+  rocksdb::PinnableSlice meta_value;
   const rocksdb::Snapshot* snapshot = nullptr;
   ScopeSnapshot ss(db_, &snapshot);
   rocksdb::ReadOptions read_opts;
@@ -367,7 +440,7 @@ Status RedisZsets::ZCount(const Slice& key,
 
   Status s = db_->Get(read_opts, ZSETS_META, key, &meta_value);
   if (s.ok()) {
-    ParsedZsetsMetaValue parsed_meta_value(&meta_value);
+    ParsedZsetsMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsExpired()) {
       *count = 0;
       return Status::NotFound("Expired");
@@ -401,11 +474,12 @@ Status RedisZsets::ZCount(const Slice& key,
   } else if (s.IsNotFound()) {
     *count = 0;
   }
-  return s;
+  return timer.Done(s);
 }
 
 Status RedisZsets::ZRank(const Slice& key, const Slice& member, int32_t* rank) {
-  std::string meta_value;
+  CommandTimer timer(&command_stats_, kCmdZRank, key.size() + member.size());
+  rocksdb::PinnableSlice meta_value;
   const rocksdb::Snapshot* snapshot = nullptr;
   ScopeSnapshot ss(db_, &snapshot);
   rocksdb::ReadOptions read_opts;
@@ -413,7 +487,7 @@ Status RedisZsets::ZRank(const Slice& key, const Slice& member, int32_t* rank) {
 
   Status s = db_->Get(read_opts, ZSETS_META, key, &meta_value);
   if (s.ok()) {
-    ParsedZsetsMetaValue parsed_meta_value(&meta_value);
+    ParsedZsetsMetaValue parsed_meta_value(meta_value);
     if (parsed_meta_value.IsExpired()) {
       return Status::NotFound("Expired");
     } else if (parsed_meta_value.zset_size() == 0) {
@@ -453,7 +527,7 @@ Status RedisZsets::ZRank(const Slice& key, const Slice& member, int32_t* rank) {
       }
     }
   }
-  return s;
+  return timer.Done(s);
 }
 
 }  // namespace blackwidow
\ No newline at end of file
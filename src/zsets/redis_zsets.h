@@ -1,7 +1,10 @@
 #pragma once
 
+#include "meta_lookup_cache.h"
 #include "redis.h"
 
+#include <memory>
+
 namespace blackwidow {
 
 #define ZSETS_META (handles_[0])
@@ -15,6 +18,10 @@ class RedisZsets : public Redis {
   ~RedisZsets() override = default;
 
   // Common Commands
+  void PrepareOptions(
+    const BlackWidowOptions& bw_options,
+    rocksdb::DBOptions* db_options,
+    std::vector<rocksdb::ColumnFamilyDescriptor>* column_families) override;
   Status Open(const BlackWidowOptions& bw_options,
               const std::string& dbpath) override;
   Status CompactRange(const Slice* begin,
@@ -42,6 +49,16 @@ class RedisZsets : public Redis {
   O_1 Status ZRem(const Slice& key, const std::vector<std::string>& members); // TODO.
   O_N Status ZCount(const Slice& key, double min, double max, int32_t* count);
   O_N Status ZRank(const Slice& key, const Slice& member, int32_t* rank);   
+
+  // Meta lookups of the member and score cf compaction filters.
+  MetaLookupStats GetDataFilterStats() const;
+  // Replaces the zsets of `ksms` with ingested meta, member and score ssts,
+  // see BulkLoader. A zset without members is deleted.
+  Status BulkLoad(std::vector<KeyScoreMembers>* ksms);
+
+ private:
+  // Shared by the member cf and score cf compaction filters.
+  std::shared_ptr<MetaLookupCache> data_meta_cache_;
 };  // class RedisZsets
 
 
@@ -1,10 +1,14 @@
 #pragma once
 
-#include "debug.h"
+#include "trace.h"
+#include "meta_lookup_cache.h"
 #include "rocksdb/compaction_filter.h"
 #include "rocksdb/env.h"
 #include "zsets_format.h"
 
+#include <memory>
+#include <vector>
+
 namespace blackwidow {
 
 class ZsetsMetaFilter : public rocksdb::CompactionFilter {
@@ -22,12 +26,12 @@ class ZsetsMetaFilter : public rocksdb::CompactionFilter {
     rocksdb::Env::Default()->GetCurrentTime(&unix_time_now);
 
     bool shoudFilter = false;
-    std::string filterReason = "None";
+    const char* filterReason = "None";
 
     ParsedZsetsMetaValue parsed_meta_value(existing_value);
     int32_t version = parsed_meta_value.version();
     int32_t timestamp = parsed_meta_value.timestamp();
-    uint32_t zset_size = parsed_meta_value.zset_szie();
+    uint32_t zset_size = parsed_meta_value.zset_size();
 
     // Note: we need also the check the version.
     if (timestamp != 0 && timestamp < unix_time_now &&
@@ -43,26 +47,111 @@ class ZsetsMetaFilter : public rocksdb::CompactionFilter {
       filterReason = "NoElements";
     }
 
-    Trace(
-      "[ZsetMetaFilter]-level:%d, key:%s, zset_size:%d, version:%d, "
-      "timestamp:%d, now_timestamp:%d, shouldFilter:%d, filterReason:%s\n",
-      level,
-      key.ToString().c_str(),
-      zset_size,
-      version,
-      timestamp,
-      unix_time_now,
-      shoudFilter,
-      filterReason);
+    BW_TRACE_SAMPLED(kTraceVerbose, "ZsetMetaFilter",
+                     "level:%d, key:%s, zset_size:%d, version:%d, "
+                     "timestamp:%d, now_timestamp:%ld, shouldFilter:%d, "
+                     "filterReason:%s",
+                     level, key, zset_size, version, timestamp, unix_time_now,
+                     shoudFilter, filterReason);
 
     return shoudFilter;
   }
 };
 
-
 class ZsetsMetaFilterFactory : public rocksdb::CompactionFilterFactory {
-public:
-    
+ public:
+  std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
+    const rocksdb::CompactionFilter::Context& context) override {
+    return std::unique_ptr<rocksdb::CompactionFilter>(new ZsetsMetaFilter());
+  }
+
+  const char* Name() const override {
+    return "blackwidow.ZsetsMetaFilterFactory";
+  }
+};
+
+// Filters the member cf and the score cf, both keys start with
+// |KeySize(4bytes)|ZsetKey|Version(4bytes)|.
+class ZsetsDataFilter : public rocksdb::CompactionFilter {
+ public:
+  enum DataType { kMember, kScore };
+
+  ZsetsDataFilter(rocksdb::DB* dbptr,
+                  std::vector<rocksdb::ColumnFamilyHandle*>* handles,
+                  MetaLookupCache* meta_cache,
+                  DataType type)
+    : meta_resolver_(dbptr, handles, meta_cache), type_(type) {}
+
+  const char* Name() const override {
+    return type_ == kMember ? "blackwidow.ZsetsMemberFilter"
+                            : "blackwidow.ZsetsScoreFilter";
+  }
+
+  bool Filter(int level,
+              const Slice& key,
+              const Slice& existing_value,
+              std::string* new_value,
+              bool* value_changed) const override {
+    Slice user_key;
+    int32_t version;
+    if (type_ == kMember) {
+      ParsedZsetsMemberKey parsed_member_key(key);
+      user_key = parsed_member_key.user_key();
+      version = parsed_member_key.version();
+    } else {
+      ParsedZsetsScoreKey parsed_score_key(key);
+      user_key = parsed_score_key.key();
+      version = parsed_score_key.version();
+    }
+
+    const MetaSnapshot* meta = meta_resolver_.Resolve(user_key, version);
+    if (meta == nullptr) {
+      BW_TRACE_SAMPLED(kTraceError, Name(),
+                       "Get MetaKey failed, reserve. key:%s", key);
+      return false;
+    }
+    bool should_filter = meta->IsDeadData(version);
+
+    BW_TRACE_SAMPLED(kTraceVerbose, Name(),
+                     "level-%d, key:%s, version:%d, metaVersion:%d, "
+                     "metaNotFound:%d, shouldFilter:%d",
+                     level, meta_resolver_.cur_key(), version, meta->version,
+                     meta->not_found, should_filter);
+
+    return should_filter;
+  }
+
+ private:
+  mutable DataFilterMetaResolver<ParsedZsetsMetaValue> meta_resolver_;
+  const DataType type_;
+};
+
+class ZsetsDataFilterFactory : public rocksdb::CompactionFilterFactory {
+ public:
+  ZsetsDataFilterFactory(rocksdb::DB** db_ptr,
+                         std::vector<rocksdb::ColumnFamilyHandle*>* handles_ptr,
+                         std::shared_ptr<MetaLookupCache> meta_cache,
+                         ZsetsDataFilter::DataType type)
+    : db_ptr_(db_ptr), cf_handles_ptr_(handles_ptr),
+      meta_cache_(std::move(meta_cache)), type_(type) {}
+
+  std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
+    const rocksdb::CompactionFilter::Context& context) override {
+    return std::unique_ptr<rocksdb::CompactionFilter>(new ZsetsDataFilter(
+      *db_ptr_, cf_handles_ptr_, meta_cache_.get(), type_));
+  }
+
+  const char* Name() const override {
+    return type_ == ZsetsDataFilter::kMember
+      ? "blackwidow.ZsetsMemberFilterFactory"
+      : "blackwidow.ZsetsScoreFilterFactory";
+  }
+
+ private:
+  rocksdb::DB** db_ptr_;
+  std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
+  std::shared_ptr<MetaLookupCache> meta_cache_;
+  const ZsetsDataFilter::DataType type_;
 };
 
-}  // namespace blackwidow
\ No newline at end of file
+}  // namespace blackwidow
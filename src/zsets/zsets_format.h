@@ -94,8 +94,20 @@ class ParsedZsetsMetaValue : public ParsedInternalValue {
   // Use this constructor in rocksdb::CompactionFilter
   explicit ParsedZsetsMetaValue(const Slice& value)
     : ParsedInternalValue(value) {
-    // TODO
-    assert(false);
+    assert(value.size() == (sizeof(uint32_t) * 3));
+    const char* ptr = value.data();
+
+    // Decode zset_size
+    zset_size_ = DecodeFixed32(ptr);
+    ptr += sizeof(uint32_t);
+
+    // Decode version
+    version_ = DecodeFixed32(ptr);
+    ptr += sizeof(int32_t);
+
+    // Decode timestamp
+    timestamp_ = DecodeFixed32(ptr);
+    ptr += sizeof(int32_t);
   }
 
   uint32_t zset_size() const {
@@ -176,7 +188,7 @@ class ZsetsMemberKey {
   const Slice Encode() {
     size_t needed =
       sizeof(uint32_t) + key_.size() + sizeof(int32_t) + member_.size();
-    if (needed > sizeof(space_)) {
+    if (needed > sizeof(space_) && start_ == space_) {
       start_ = new char[needed];
     }
     char* ptr = start_;
@@ -0,0 +1,281 @@
+#include "gtest/gtest.h"
+#include "blackwidow/backupable.h"
+#include "blackwidow/blackwidow.h"
+#include "testing_util.h"
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+
+namespace {
+static std::string kTestingPath = "./testdb_blackwidow";
+static const char* kCmdDeleteTestingPath = "rm -rf ./testdb_blackwidow";
+static std::string kBackupPath = "./testdb_blackwidow_backup";
+static std::string kRestorePath = "./testdb_blackwidow_restore";
+static const char* kCmdDeleteCopiesPath =
+  "rm -rf ./testdb_blackwidow_backup ./testdb_blackwidow_restore";
+}  // namespace
+
+// The same key held by several types, in both modes. In unified mode all
+// types share one db, so a command reading the wrong column family finds
+// the value of another type.
+TEST(TestKeysCommands, BlackWidowTest) {
+  for (bool unified : {false, true}) {
+    system(kCmdDeleteTestingPath);
+    testing::Defer df([&]() { system(kCmdDeleteTestingPath); });
+    std::unique_ptr<blackwidow::BlackWidow> bw(new blackwidow::BlackWidow());
+    blackwidow::BlackWidowOptions opts;
+    opts.options.create_if_missing = true;
+    opts.unified_db = unified;
+    blackwidow::Status s = bw->Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+
+    std::vector<blackwidow::KeyValue> kvs = {{"KEY", "value"}};
+    s = bw->BulkLoadStrings(&kvs);
+    EXPECT_TRUE(s.ok());
+    std::vector<blackwidow::KeyFieldValues> kfvs = {{"KEY", {{"f", "v"}}}};
+    s = bw->BulkLoadHashes(&kfvs);
+    EXPECT_TRUE(s.ok());
+    std::vector<blackwidow::KeyScoreMembers> ksms = {{"KEY", {{1, "m"}}}};
+    s = bw->BulkLoadZsets(&ksms);
+    EXPECT_TRUE(s.ok());
+
+    int64_t count = 0;
+    s = bw->Exists({"KEY", "KEY", "NOT_EXISTS"}, &count);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(2, count);
+
+    s = bw->Expire("KEY", 100);
+    EXPECT_TRUE(s.ok());
+    s = bw->Expire("NOT_EXISTS", 100);
+    EXPECT_TRUE(s.IsNotFound());
+
+    s = bw->Del({"KEY", "NOT_EXISTS"}, &count);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(1, count);
+    s = bw->Exists({"KEY"}, &count);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(0, count);
+    s = bw->Del({"KEY"}, &count);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(0, count);
+  }
+}
+
+// In unified mode the checkpoint has one db, the backup keeps its files
+// at the top of the backup.
+TEST(TestUnifiedBackup, BlackWidowTest) {
+  system(kCmdDeleteTestingPath);
+  system(kCmdDeleteCopiesPath);
+  testing::Defer df([&]() {
+    system(kCmdDeleteTestingPath);
+    system(kCmdDeleteCopiesPath);
+  });
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.unified_db = true;
+  blackwidow::BackupEngine backup_engine(kBackupPath);
+  blackwidow::Status s = backup_engine.Open();
+  EXPECT_TRUE(s.ok());
+  {
+    blackwidow::BlackWidow db;
+    s = db.Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+    std::vector<blackwidow::KeyValue> kvs = {{"STRING", "value"}};
+    s = db.BulkLoadStrings(&kvs);
+    EXPECT_TRUE(s.ok());
+    std::vector<blackwidow::KeyFieldValues> kfvs = {{"HASH", {{"f", "v"}}}};
+    s = db.BulkLoadHashes(&kfvs);
+    EXPECT_TRUE(s.ok());
+    blackwidow::BackupInfo info;
+    s = backup_engine.CreateNewBackup(&db, &info);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(1, info.backup_id);
+  }
+
+  s = backup_engine.RestoreBackup(1, kRestorePath);
+  EXPECT_TRUE(s.ok());
+  blackwidow::BlackWidow restored;
+  opts.options.create_if_missing = false;
+  s = restored.Open(opts, kRestorePath);
+  EXPECT_TRUE(s.ok());
+  int64_t count = 0;
+  s = restored.Exists({"STRING", "HASH"}, &count);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, count);
+}
+
+// Memtables charged to the shared block cache by the write buffer manager
+// are counted once, as memtables.
+TEST(TestMemoryUsage, BlackWidowTest) {
+  for (bool share_block_cache : {false, true}) {
+    system(kCmdDeleteTestingPath);
+    testing::Defer df([&]() { system(kCmdDeleteTestingPath); });
+    std::unique_ptr<blackwidow::BlackWidow> bw(new blackwidow::BlackWidow());
+    blackwidow::BlackWidowOptions opts;
+    opts.options.create_if_missing = true;
+    opts.share_block_cache = share_block_cache;
+    opts.block_cache_size = 64 * 1024 * 1024;
+    opts.write_buffer_manager_size = 32 * 1024 * 1024;
+    blackwidow::Status s = bw->Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+
+    std::vector<blackwidow::KeyValue> kvs;
+    for (int i = 0; i < 1000; i++) {
+      kvs.emplace_back("KEY" + std::to_string(i), "value");
+    }
+    s = bw->BulkLoadStrings(&kvs);
+    EXPECT_TRUE(s.ok());
+    // Reads the ssts and writes the memtables.
+    for (int i = 0; i < 1000; i++) {
+      s = bw->Expire("KEY" + std::to_string(i), 100);
+      EXPECT_TRUE(s.ok());
+    }
+
+    std::map<std::string, blackwidow::MemoryUsage> usages;
+    blackwidow::MemoryUsage total;
+    s = bw->GetMemoryUsage(&usages, &total);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(4, usages.size());
+    EXPECT_GT(usages[blackwidow::STRINGS_DB].memtables, 0);
+    EXPECT_GT(total.memtables, 0);
+    EXPECT_GT(total.block_cache, 0);
+    // A few data blocks were read, the charged memtables would be at least
+    // as large as the memtables.
+    EXPECT_LT(total.block_cache, total.memtables);
+    if (share_block_cache) {
+      EXPECT_EQ(0, usages[blackwidow::STRINGS_DB].block_cache);
+    } else {
+      EXPECT_EQ(total.block_cache, usages[blackwidow::STRINGS_DB].block_cache +
+                                     usages[blackwidow::HASHES_DB].block_cache +
+                                     usages[blackwidow::LISTS_DB].block_cache +
+                                     usages[blackwidow::ZSETS_DB].block_cache);
+    }
+  }
+}
+
+// The WAL left by the last run is reported while it is replayed, then
+// every db reports once that it is open.
+TEST(TestRecoveryProgress, BlackWidowTest) {
+  system(kCmdDeleteTestingPath);
+  testing::Defer df([&]() { system(kCmdDeleteTestingPath); });
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  // Keep the memtables in the WAL.
+  opts.options.avoid_flush_during_shutdown = true;
+  {
+    blackwidow::BlackWidow bw;
+    blackwidow::Status s = bw.Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+    std::vector<blackwidow::KeyValue> kvs;
+    for (int i = 0; i < 100; i++) {
+      kvs.emplace_back("KEY" + std::to_string(i), "value");
+    }
+    s = bw.BulkLoadStrings(&kvs);
+    EXPECT_TRUE(s.ok());
+    for (int i = 0; i < 100; i++) {
+      s = bw.Expire("KEY" + std::to_string(i), 100);
+      EXPECT_TRUE(s.ok());
+    }
+  }
+
+  std::mutex mu;
+  std::vector<blackwidow::RecoveryProgress> reports;
+  opts.recovery_progress_interval = 1;
+  opts.recovery_progress_callback =
+    [&](const blackwidow::RecoveryProgress& progress) {
+      std::lock_guard<std::mutex> l(mu);
+      reports.push_back(progress);
+    };
+  blackwidow::BlackWidow bw;
+  blackwidow::Status s = bw.Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  uint64_t strings_records = 0;
+  int done = 0;
+  for (const auto& progress : reports) {
+    if (progress.done) {
+      done++;
+    } else if (progress.type == blackwidow::STRINGS_DB) {
+      EXPECT_GT(progress.wal_records, strings_records);
+      strings_records = progress.wal_records;
+    }
+  }
+  EXPECT_EQ(100, strings_records);
+  EXPECT_EQ(4, done);
+}
+
+// An instance opened again reports through the filters of that Open.
+TEST(TestReopenRecoveryProgress, BlackWidowTest) {
+  system(kCmdDeleteTestingPath);
+  testing::Defer df([&]() { system(kCmdDeleteTestingPath); });
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = false;
+  blackwidow::BlackWidow bw;
+  blackwidow::Status s = bw.Open(opts, kTestingPath);
+  EXPECT_FALSE(s.ok());
+
+  std::mutex mu;
+  std::set<std::string> done;
+  opts.options.create_if_missing = true;
+  opts.recovery_progress_callback =
+    [&](const blackwidow::RecoveryProgress& progress) {
+      std::lock_guard<std::mutex> l(mu);
+      if (progress.done) {
+        done.insert(progress.type);
+      }
+    };
+  s = bw.Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(4, done.size());
+}
+
+// The dbs are opened side by side, a failure of one of them is the result
+// of Open.
+TEST(TestOpenFailure, BlackWidowTest) {
+  system(kCmdDeleteTestingPath);
+  testing::Defer df([&]() { system(kCmdDeleteTestingPath); });
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  {
+    blackwidow::BlackWidow bw;
+    blackwidow::Status s = bw.Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+  }
+
+  // A column family the hashes do not know.
+  const std::string hashes_path = kTestingPath + "/" + blackwidow::HASHES_DB;
+  std::vector<std::string> names;
+  blackwidow::Status s = rocksdb::DB::ListColumnFamilies(
+    rocksdb::DBOptions(), hashes_path, &names);
+  EXPECT_TRUE(s.ok());
+  std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+  for (const auto& name : names) {
+    cfds.emplace_back(name, rocksdb::ColumnFamilyOptions());
+  }
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  rocksdb::DB* db = nullptr;
+  s = rocksdb::DB::Open(rocksdb::DBOptions(), hashes_path, cfds, &handles,
+                        &db);
+  EXPECT_TRUE(s.ok());
+  rocksdb::ColumnFamilyHandle* unknown_cf = nullptr;
+  s = db->CreateColumnFamily(rocksdb::ColumnFamilyOptions(), "unknown_cf",
+                             &unknown_cf);
+  EXPECT_TRUE(s.ok());
+  handles.push_back(unknown_cf);
+  for (auto handle : handles) {
+    db->DestroyColumnFamilyHandle(handle);
+  }
+  delete db;
+
+  blackwidow::BlackWidow bw;
+  s = bw.Open(opts, kTestingPath);
+  EXPECT_TRUE(s.IsInvalidArgument());
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,4 +1,5 @@
 #include "gtest/gtest.h"
+#include "hashes_format.h"
 #include "redis_hashes.h"
 #include "testing_util.h"
 #include "unistd.h"
@@ -52,6 +53,16 @@ TEST(TestHExists, RedisHashesTest) {
   EXPECT_TRUE(s.ok());
   EXPECT_EQ("喜欢RAP和篮球", field_value);
 
+  rocksdb::PinnableSlice pinned_value;
+  s = redis->HGet("USER_17802525", "Name", &pinned_value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("喜欢RAP和篮球", pinned_value.ToString());
+  pinned_value.Reset();
+  s = redis->HGet("USER_17802525", "Age", &pinned_value);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->HGet("USER_NOT_EXIST", "Name", &pinned_value);
+  EXPECT_TRUE(s.IsNotFound());
+
   // s = redis->HSet("USER_17802525", "Birthday", "19961228");
   // EXPECT_TRUE(s.ok());
 }
@@ -166,6 +177,729 @@ TEST(TestHVals, RedisHashesTest) {
   }
 }
 
+TEST(TestHGetAllVisitor, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  char field[32] = {0};
+  for (auto i = 0; i < 2000; i++) {
+    snprintf(field, sizeof(field), "field_%04d", i);
+    s = redis->HSet("BIG_HASH", field, std::to_string(i), nullptr);
+    EXPECT_TRUE(s.ok());
+  }
+  // The neighbour hash must not leak into BIG_HASH's scan.
+  s = redis->HSet("BIG_HASH_2", "field_0000", "x", nullptr);
+  EXPECT_TRUE(s.ok());
+
+  uint32_t reported_size = 0;
+  uint32_t visited = 0;
+  s = redis->HGetAll(
+    "BIG_HASH",
+    [&](uint32_t hash_size) { reported_size = hash_size; },
+    [&](const blackwidow::Slice& f, const blackwidow::Slice& v) {
+      visited++;
+      return true;
+    });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2000, reported_size);
+  EXPECT_EQ(2000, visited);
+
+  // Stop early.
+  visited = 0;
+  s = redis->HGetAll("BIG_HASH", nullptr,
+                     [&](const blackwidow::Slice& f, const blackwidow::Slice& v) {
+                       return ++visited < 10;
+                     });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(10, visited);
+
+  std::vector<blackwidow::FieldValue> fvs;
+  s = redis->HGetAll("BIG_HASH", &fvs);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2000, fvs.size());
+  EXPECT_EQ("field_0000", fvs.front().field);
+  EXPECT_EQ("1999", fvs.back().value);
+
+  std::vector<std::string> vals;
+  s = redis->HVals("BIG_HASH_2", &vals);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, vals.size());
+
+  s = redis->HGetAll("NOT_EXISTS", nullptr,
+                     [&](const blackwidow::Slice& f, const blackwidow::Slice& v) {
+                       return true;
+                     });
+  EXPECT_TRUE(s.IsNotFound());
+}
+
+TEST(TestHMSetAndHMGet, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::string key = "USER_PROFILE_17802525";
+  std::vector<blackwidow::ValueStatus> vss;
+  uint32_t hash_size = 0;
+  int32_t ret = -1;
+
+  s = redis->HMGet(key, {"name", "age"}, &vss);
+  EXPECT_TRUE(s.IsNotFound());
+  EXPECT_EQ(2, vss.size());
+  EXPECT_TRUE(vss[0].status.IsNotFound());
+
+  // The last value of a duplicated field wins.
+  s = redis->HMSet(key, {{"name", "guoxiang"}, {"age", "24"}, {"name", "guoxiangCN"}});
+  EXPECT_TRUE(s.ok());
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, hash_size);
+
+  s = redis->HMSet(key, {{"age", "25"}, {"city", "Shenzhen"}});
+  EXPECT_TRUE(s.ok());
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(3, hash_size);
+
+  s = redis->HMGet(key, {"city", "gender", "name", "age", "city"}, &vss);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(5, vss.size());
+  EXPECT_EQ("Shenzhen", vss[0].value);
+  EXPECT_TRUE(vss[1].status.IsNotFound());
+  EXPECT_EQ("guoxiangCN", vss[2].value);
+  EXPECT_EQ("25", vss[3].value);
+  EXPECT_EQ("Shenzhen", vss[4].value);
+
+  s = redis->HSetNx(key, "name", "nobody", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, ret);
+  s = redis->HSetNx(key, "gender", "male", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, ret);
+
+  int32_t deleted = 0;
+  s = redis->HDel(key, {"gender", "city", "gender", "not_exists"}, &deleted);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, deleted);
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, hash_size);
+}
+
+TEST(TestBulkLoad, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  uint32_t hash_size = 0;
+  std::string value;
+  s = redis->HMSet("hash_old", {{"old_field", "v"}, {"kept_field", "v"}});
+  EXPECT_TRUE(s.ok());
+
+  std::vector<blackwidow::KeyFieldValues> kfvs;
+  for (int i = 0; i < 100; i++) {
+    blackwidow::KeyFieldValues kfv;
+    kfv.key = "hash_" + std::to_string(i);
+    for (int j = 0; j < 10; j++) {
+      kfv.fvs.push_back({"field" + std::to_string(j), std::to_string(i * j)});
+    }
+    kfvs.push_back(kfv);
+  }
+  // The last of a duplicated key wins.
+  kfvs.push_back({"hash_0", {{"only_field", "0"}}});
+  kfvs.push_back({"hash_old", {{"kept_field", "v1"}, {"new_field", "v2"},
+                               {"kept_field", "v3"}}});
+  s = redis->BulkLoad(&kfvs);
+  EXPECT_TRUE(s.ok());
+
+  s = redis->HLen("hash_99", &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(10, hash_size);
+  s = redis->HGet("hash_99", "field9", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("891", value);
+  s = redis->HLen("hash_0", &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, hash_size);
+
+  // A loaded hash replaces the old one.
+  s = redis->HLen("hash_old", &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, hash_size);
+  s = redis->HGet("hash_old", "old_field", &value);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->HGet("hash_old", "kept_field", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("v3", value);
+
+  // Written after the load as usual.
+  int32_t ret = 0;
+  s = redis->HSet("hash_old", "new_field", "v4", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, ret);
+}
+
+TEST(TestFastHSet, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  opts.hashes_fast_hset = true;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::string key = "FAST_HSET_HASH";
+  std::string value;
+  uint32_t hash_size = 0;
+  int32_t ret = 0;
+
+  for (int i = 0; i < 100; i++) {
+    s = redis->HSet(key, "field" + std::to_string(i), "v1", &ret);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(1, ret);
+  }
+  // Overwrites must not be counted.
+  for (int i = 0; i < 10; i++) {
+    s = redis->HSet(key, "field" + std::to_string(i), "v2", &ret);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(0, ret);
+  }
+  // Also once the fields are flushed out of the memtable.
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+  for (int i = 10; i < 20; i++) {
+    s = redis->HSet(key, "field" + std::to_string(i), "v2", &ret);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(0, ret);
+  }
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(100, hash_size);
+
+  s = redis->HGet(key, "field5", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("v2", value);
+
+  s = redis->HSet(key, "field100", "v1", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, ret);
+  int32_t deleted = 0;
+  s = redis->HDel(key, {"field0", "field1", "not_exists"}, &deleted);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, deleted);
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(99, hash_size);
+}
+
+TEST(TestHIncrBy, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::string key = "COUNTERS";
+  std::string value;
+  int64_t num = 0;
+  uint32_t hash_size = 0;
+
+  s = redis->HIncrBy(key, "pv", 5, &num);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(5, num);
+  s = redis->HIncrBy(key, "pv", -2, &num);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(3, num);
+
+  s = redis->HIncrByFloat(key, "score", "1.25", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("1.25", value);
+
+  // Same error as the strings INCRBY on a non-number.
+  s = redis->HSet(key, "name", "guoxiangCN", nullptr);
+  EXPECT_TRUE(s.ok());
+  s = redis->HIncrBy(key, "name", 1, &num);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  s = redis->HIncrByFloat(key, "name", "1.5", &value);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  int32_t deleted = 0;
+  s = redis->HDel(key, {"name"}, &deleted);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, deleted);
+
+  for (int i = 0; i < 100; i++) {
+    s = redis->HIncrByBlind(key, "pv", 1);
+    EXPECT_TRUE(s.ok());
+    s = redis->HIncrByBlind(key, "uv", 1);
+    EXPECT_TRUE(s.ok());
+  }
+  s = redis->HGet(key, "pv", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("103", value);
+  s = redis->HGet(key, "uv", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("100", value);
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(3, hash_size);
+
+  s = redis->HSet(key, "name", "guoxiangCN", nullptr);
+  EXPECT_TRUE(s.ok());
+  s = redis->HIncrBy(key, "name", 1, &num);
+  EXPECT_FALSE(s.ok());
+}
+
+TEST(TestFieldExpire, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::string key = "SESSIONS";
+  std::string value;
+  std::vector<blackwidow::FieldValue> fvs;
+  uint32_t hash_size = 0;
+  uint32_t swept = 0;
+  int64_t ttl = 0;
+
+  s = redis->HMSet(key, {{"s1", "u1"}, {"s2", "u2"}, {"s3", "u3"}});
+  EXPECT_TRUE(s.ok());
+
+  s = redis->HTTL(key, "s1", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, ttl);
+  s = redis->HExpire(key, "s1", 100);
+  EXPECT_TRUE(s.ok());
+  s = redis->HTTL(key, "s1", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_LE(99, ttl);
+  EXPECT_GE(100, ttl);
+  s = redis->HPersist(key, "s1");
+  EXPECT_TRUE(s.ok());
+  s = redis->HTTL(key, "s1", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, ttl);
+
+  s = redis->HExpire(key, "s2", 1);
+  EXPECT_TRUE(s.ok());
+  s = redis->HExpire(key, "not_exists", 1);
+  EXPECT_TRUE(s.IsNotFound());
+  std::this_thread::sleep_for(std::chrono::milliseconds(2100));
+
+  s = redis->HGet(key, "s2", &value);
+  EXPECT_TRUE(s.IsNotFound());
+  rocksdb::PinnableSlice pinned_value;
+  s = redis->HGet(key, "s2", &pinned_value);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, hash_size);
+  s = redis->HGetAll(key, &fvs);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, fvs.size());
+
+  s = redis->SweepExpiredFields(100, &swept);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, swept);
+  s = redis->SweepExpiredFields(100, &swept);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, swept);
+
+  // A field set again by HSet loses its ttl.
+  s = redis->HExpire(key, "s3", 100);
+  EXPECT_TRUE(s.ok());
+  s = redis->HSet(key, "s3", "u3", nullptr);
+  EXPECT_TRUE(s.ok());
+  s = redis->HTTL(key, "s3", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, ttl);
+
+  // A ttl in the past deletes the field.
+  s = redis->HExpire(key, "s1", -1);
+  EXPECT_TRUE(s.ok());
+  s = redis->HLen(key, &hash_size);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, hash_size);
+}
+
+// A db written before the field ttl has no field_ttl_cf and data values
+// without the timestamp suffix, Open rewrites them once.
+TEST(TestUpgradeFieldFormat, RedisHashesTest) {
+  std::string key = "LEGACY";
+  std::string f1_key =
+    blackwidow::HashesDataKey(key, "f1", 0).Encode().ToString();
+  std::string f2_key =
+    blackwidow::HashesDataKey(key, "f2", 0).Encode().ToString();
+  // Writes a legacy hash {f1: v1, f2: v2}, `interrupted` leaves it as an
+  // upgrade that stopped after f1.
+  auto write_legacy_db = [&](bool interrupted) {
+    system(kCmdDeleteTestingPath);
+    rocksdb::DBOptions db_opts;
+    db_opts.create_if_missing = true;
+    db_opts.create_missing_column_families = true;
+    std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+    cfds.emplace_back(rocksdb::kDefaultColumnFamilyName,
+                      rocksdb::ColumnFamilyOptions());
+    cfds.emplace_back("data_cf", rocksdb::ColumnFamilyOptions());
+    if (interrupted) {
+      cfds.emplace_back("field_format_upgrade_cf",
+                        rocksdb::ColumnFamilyOptions());
+    }
+    std::vector<rocksdb::ColumnFamilyHandle*> handles;
+    rocksdb::DB* db = nullptr;
+    EXPECT_TRUE(
+      rocksdb::DB::Open(db_opts, kTestingPath, cfds, &handles, &db).ok());
+    blackwidow::HashesMetaValue meta_value(2);
+    EXPECT_TRUE(
+      db->Put(rocksdb::WriteOptions(), handles[0], key, meta_value.Encode())
+        .ok());
+    std::string f1_value = "v1";
+    if (interrupted) {
+      f1_value.append(sizeof(int32_t), '\0');
+      EXPECT_TRUE(
+        db->Put(rocksdb::WriteOptions(), handles[2], "cursor", f1_key).ok());
+    }
+    EXPECT_TRUE(
+      db->Put(rocksdb::WriteOptions(), handles[1], f1_key, f1_value).ok());
+    EXPECT_TRUE(
+      db->Put(rocksdb::WriteOptions(), handles[1], f2_key, "v2").ok());
+    for (auto handle : handles) {
+      db->DestroyColumnFamilyHandle(handle);
+    }
+    delete db;
+  };
+
+  for (bool interrupted : {false, true}) {
+    write_legacy_db(interrupted);
+    blackwidow::RedisHashes* redis = new blackwidow::RedisHashes(nullptr);
+    blackwidow::BlackWidowOptions opts;
+    blackwidow::Status s = redis->Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+
+    std::string value;
+    uint32_t hash_size = 0;
+    s = redis->HGet(key, "f1", &value);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ("v1", value);
+    s = redis->HGet(key, "f2", &value);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ("v2", value);
+    s = redis->HLen(key, &hash_size);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(2, hash_size);
+    s = redis->HExpire(key, "f2", 100);
+    EXPECT_TRUE(s.ok());
+    delete redis;
+
+    // Reopening an upgraded db leaves the values alone.
+    redis = new blackwidow::RedisHashes(nullptr);
+    s = redis->Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+    s = redis->HGet(key, "f1", &value);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ("v1", value);
+    int64_t ttl = 0;
+    s = redis->HTTL(key, "f2", &ttl);
+    EXPECT_TRUE(s.ok());
+    EXPECT_LE(99, ttl);
+    EXPECT_GE(100, ttl);
+    delete redis;
+  }
+  system(kCmdDeleteTestingPath);
+}
+
+TEST(TestDataFilterMetaCache, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::vector<blackwidow::FieldValue> fvs;
+  for (int k = 0; k < 10; k++) {
+    std::string key = "HASH_" + std::to_string(k);
+    for (int i = 0; i < 100; i++) {
+      s = redis->HSet(key, "field" + std::to_string(i), "value", nullptr);
+      EXPECT_TRUE(s.ok());
+    }
+  }
+  // The old fields of a deleted and recreated hash are dropped.
+  s = redis->Del("HASH_0");
+  EXPECT_TRUE(s.ok());
+  s = redis->HSet("HASH_0", "new_field", "value", nullptr);
+  EXPECT_TRUE(s.ok());
+
+  s = redis->CompactRange(nullptr, nullptr, blackwidow::kData);
+  EXPECT_TRUE(s.ok());
+
+  blackwidow::MetaLookupStats stats = redis->GetDataFilterStats();
+  EXPECT_EQ(1001, stats.records);
+  // One lookup per hash, not per record.
+  EXPECT_LE(stats.db_lookups, 11);
+
+  s = redis->HGetAll("HASH_0", &fvs);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, fvs.size());
+  s = redis->HGetAll("HASH_9", &fvs);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(100, fvs.size());
+}
+
+// A hash deleted after its meta was cached is dropped once the cached
+// snapshot is too old to be used.
+TEST(TestDataFilterMetaCacheMaxAge, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::vector<blackwidow::FieldValue> fvs;
+  for (int k = 0; k < 10; k++) {
+    std::string key = "HASH_" + std::to_string(k);
+    for (int i = 0; i < 10; i++) {
+      s = redis->HSet(key, "field" + std::to_string(i), "value", nullptr);
+      EXPECT_TRUE(s.ok());
+    }
+  }
+  s = redis->CompactRange(nullptr, nullptr, blackwidow::kData);
+  EXPECT_TRUE(s.ok());
+  blackwidow::MetaLookupStats stats = redis->GetDataFilterStats();
+  EXPECT_EQ(100, stats.records);
+  EXPECT_EQ(10, stats.db_lookups);
+
+  s = redis->Del("HASH_0");
+  EXPECT_TRUE(s.ok());
+  std::this_thread::sleep_for(std::chrono::milliseconds(
+    blackwidow::MetaLookupCache::kDefaultMaxAge * 1000 + 100));
+
+  s = redis->CompactRange(nullptr, nullptr, blackwidow::kData);
+  EXPECT_TRUE(s.ok());
+  stats = redis->GetDataFilterStats();
+  EXPECT_EQ(200, stats.records);
+  EXPECT_EQ(20, stats.db_lookups);
+
+  // The fields of HASH_0 are gone.
+  s = redis->CompactRange(nullptr, nullptr, blackwidow::kData);
+  EXPECT_TRUE(s.ok());
+  stats = redis->GetDataFilterStats();
+  EXPECT_EQ(290, stats.records);
+
+  s = redis->HGetAll("HASH_0", &fvs);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->HGetAll("HASH_9", &fvs);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(10, fvs.size());
+}
+
+TEST(TestMemoryUsage, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  opts.block_cache_size = 8 * 1024 * 1024;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  for (int i = 0; i < 100; i++) {
+    s = redis->HSet("HASH", "field" + std::to_string(i), "value", nullptr);
+    EXPECT_TRUE(s.ok());
+  }
+  blackwidow::MemoryUsage usage;
+  s = redis->GetMemoryUsage(&usage);
+  EXPECT_TRUE(s.ok());
+  EXPECT_GT(usage.memtables, 0);
+
+  // Read back from the ssts through the block caches of the engine.
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+  std::vector<blackwidow::FieldValue> fvs;
+  s = redis->HGetAll("HASH", &fvs);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(100, fvs.size());
+  s = redis->GetMemoryUsage(&usage);
+  EXPECT_TRUE(s.ok());
+  EXPECT_GT(usage.block_cache, 0);
+}
+
+TEST(TestUsage, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  opts.block_cache_size = 8 * 1024 * 1024;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  int32_t ret = 0;
+  for (int i = 0; i < 100; i++) {
+    s = redis->HSet("HASH" + std::to_string(i), "field", "value", &ret);
+    EXPECT_TRUE(s.ok());
+  }
+  uint64_t memtables = 0;
+  s = redis->GetProperty("rocksdb.cur-size-all-mem-tables", &memtables);
+  EXPECT_TRUE(s.ok());
+  EXPECT_GT(memtables, 0);
+  s = redis->GetProperty("rocksdb.stats", &memtables);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  // The caches of the meta and the data cf.
+  uint64_t capacity = 0;
+  s = redis->GetProperty("rocksdb.block-cache-capacity", &capacity);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2 * 8 * 1024 * 1024, capacity);
+  // Of the whole db, not summed over the cfs.
+  uint64_t running_compactions = 0;
+  s = redis->GetProperty("rocksdb.num-running-compactions",
+                         &running_compactions);
+  EXPECT_TRUE(s.ok());
+  EXPECT_LE(running_compactions, 1);
+
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+  uint64_t num_keys = 0;
+  s = redis->GetProperty("rocksdb.estimate-num-keys", &num_keys);
+  EXPECT_TRUE(s.ok());
+  // The meta and the data record of every hash.
+  EXPECT_EQ(200, num_keys);
+
+  blackwidow::EngineUsage usage;
+  s = redis->GetUsage(&usage);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, usage.column_families.count("default"));
+  EXPECT_EQ(1, usage.column_families.count("data_cf"));
+  EXPECT_GT(usage.column_families["default"].live_sst_size, 0);
+  EXPECT_GT(usage.column_families["data_cf"].live_sst_size, 0);
+  EXPECT_EQ(0, usage.total.background_errors);
+  uint64_t live_sst_size = 0;
+  for (const auto& cf : usage.column_families) {
+    live_sst_size += cf.second.live_sst_size;
+  }
+  EXPECT_EQ(live_sst_size, usage.total.live_sst_size);
+}
+
+// A block cache shared by the cfs is counted once.
+TEST(TestSharedCacheProperty, RedisHashesTest) {
+  blackwidow::RedisHashes* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisHashes(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  opts.share_block_cache = true;
+  opts.table_options.block_cache = rocksdb::NewLRUCache(4 * 1024 * 1024);
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  uint64_t capacity = 0;
+  s = redis->GetProperty("rocksdb.block-cache-capacity", &capacity);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(4 * 1024 * 1024, capacity);
+  blackwidow::MemoryUsage usage;
+  s = redis->GetMemoryUsage(&usage);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, usage.block_cache);
+}
+
 #define NO_EXPIRE  (-1)
 #define KEY_ABSENT (-2)
 TEST(TestExpireAndTTL, RedisHashesTest) {
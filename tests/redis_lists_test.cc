@@ -104,6 +104,64 @@ TEST(TestLPush, RedisListsTest) {
   EXPECT_EQ(listlen, vec.size());
 }
 
+TEST(TestKeysCommands, RedisListsTest) {
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+
+  blackwidow::RedisLists *redis = new blackwidow::RedisLists(nullptr);
+  testing::Defer df([&]() {
+    delete redis;
+    ::system(kCmdDeleteTestingPath);
+  });
+
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  int64_t ttl = 0;
+  std::uint64_t listlen = 0;
+  s = redis->TTL("NOT_EXISTS", &ttl);
+  EXPECT_TRUE(s.IsNotFound());
+  EXPECT_EQ(-2, ttl);
+  s = redis->Expire("NOT_EXISTS", 100);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->Del("NOT_EXISTS");
+  EXPECT_TRUE(s.IsNotFound());
+
+  s = redis->LPush("LIST", {"a", "b"}, &listlen);
+  EXPECT_TRUE(s.ok());
+  s = redis->TTL("LIST", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, ttl);
+  s = redis->Expire("LIST", 100);
+  EXPECT_TRUE(s.ok());
+  s = redis->TTL("LIST", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_LE(99, ttl);
+  EXPECT_GE(100, ttl);
+  s = redis->Persist("LIST");
+  EXPECT_TRUE(s.ok());
+  s = redis->TTL("LIST", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, ttl);
+
+  s = redis->Del("LIST");
+  EXPECT_TRUE(s.ok());
+  s = redis->LLen("LIST", &listlen);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->TTL("LIST", &ttl);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->Del("LIST");
+  EXPECT_TRUE(s.IsNotFound());
+
+  s = redis->LPush("EXPIRED", {"a"}, &listlen);
+  EXPECT_TRUE(s.ok());
+  s = redis->ExpireAt("EXPIRED", 1);
+  EXPECT_TRUE(s.ok());
+  s = redis->LLen("EXPIRED", &listlen);
+  EXPECT_TRUE(s.IsNotFound());
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
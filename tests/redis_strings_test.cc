@@ -1,16 +1,27 @@
 #include "redis_strings.h"
+#include "blackwidow/backupable.h"
+#include "strings_format.h"
+#include <atomic>
 #include <chrono>
+#include <fstream>
 #include <iostream>
 #include <thread>
 
 #include "gtest/gtest.h"
 #include "testing_util.h"
+#include "trace.h"
 
 using namespace std::chrono_literals;
 
 namespace {
 static std::string kTestingPath = "./testdb_strings";
 static const char* kCmdDeleteTestingPath = "rm -rf ./testdb_strings";
+static std::string kCheckpointPath = "./testdb_strings_checkpoint";
+static std::string kBackupPath = "./testdb_strings_backup";
+static std::string kRestorePath = "./testdb_strings_restore";
+static const char* kCmdDeleteCopiesPath =
+  "rm -rf ./testdb_strings_checkpoint ./testdb_strings_backup "
+  "./testdb_strings_restore";
 }  // namespace
 
 TEST(TestSetAndGet, RedisStringsTest) {
@@ -341,6 +352,47 @@ TEST(TestBitCount, RedisStringTest) {
   s = redis->BitCount("QAQ", &bitcount);
   EXPECT_TRUE(s.ok());
   EXPECT_EQ(118, bitcount);
+
+  // BITCOUNT key start end, "foobar" as in the redis docs.
+  s = redis->Set("QAQ", "foobar");
+  EXPECT_TRUE(s.ok());
+  s = redis->BitCount("QAQ", 0, 0, &bitcount);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(4, bitcount);
+  s = redis->BitCount("QAQ", 1, 1, &bitcount);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(6, bitcount);
+  s = redis->BitCount("QAQ", -2, -1, &bitcount);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(7, bitcount);
+  s = redis->BitCount("QAQ", -100, 100, &bitcount);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(26, bitcount);
+  s = redis->BitCount("QAQ", 4, 2, &bitcount);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, bitcount);
+  s = redis->BitCount("QAQ", 6, 10, &bitcount);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, bitcount);
+
+  // Every length around the 32 byte blocks and the 31 block batches.
+  std::string bitmap;
+  for (int i = 0; i < 8192; i++) {
+    bitmap.push_back(static_cast<char>((i * 2654435761u) >> 13));
+  }
+  for (size_t length : {1, 7, 31, 32, 33, 991, 992, 993, 8192}) {
+    uint64_t expected = 0;
+    for (size_t i = 0; i < length; i++) {
+      for (int j = 0; j < 8; j++) {
+        expected += (static_cast<unsigned char>(bitmap[i]) >> j) & 0x1;
+      }
+    }
+    s = redis->Set("QAQ", bitmap);
+    EXPECT_TRUE(s.ok());
+    s = redis->BitCount("QAQ", 0, length - 1, &bitcount);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(expected, bitcount);
+  }
 }
 
 TEST(TestGetBit, RedisStringsTest) {
@@ -448,6 +500,248 @@ TEST(TestSetBit, RedisStringsTest) {
   // EXPECT_EQ(bitcount, 0);
 }
 
+TEST(TestBitOp, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  s = redis->Set("A", std::string("\xf0\x0f\xaa", 3));
+  EXPECT_TRUE(s.ok());
+  s = redis->Set("B", std::string("\xff\x01", 2));
+  EXPECT_TRUE(s.ok());
+
+  int64_t len = 0;
+  std::string value;
+  s = redis->BitOp(blackwidow::kBitOpAnd, "DEST", {"A", "B"}, &len);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(3, len);
+  s = redis->Get("DEST", &value);
+  EXPECT_EQ(std::string("\xf0\x01\x00", 3), value);
+
+  s = redis->BitOp(blackwidow::kBitOpOr, "DEST", {"A", "B", "NONE"}, &len);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(3, len);
+  s = redis->Get("DEST", &value);
+  EXPECT_EQ(std::string("\xff\x0f\xaa", 3), value);
+
+  s = redis->BitOp(blackwidow::kBitOpXor, "DEST", {"B", "A"}, &len);
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("DEST", &value);
+  EXPECT_EQ(std::string("\x0f\x0e\xaa", 3), value);
+
+  s = redis->BitOp(blackwidow::kBitOpNot, "DEST", {"A"}, &len);
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("DEST", &value);
+  EXPECT_EQ(std::string("\x0f\xf0\x55", 3), value);
+
+  // The destination may be one of the sources.
+  s = redis->BitOp(blackwidow::kBitOpXor, "A", {"A", "A"}, &len);
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("A", &value);
+  EXPECT_EQ(std::string(3, '\0'), value);
+
+  // An empty result deletes the destination.
+  s = redis->BitOp(blackwidow::kBitOpAnd, "DEST", {"NONE", "NONE2"}, &len);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, len);
+  s = redis->Get("DEST", &value);
+  EXPECT_TRUE(s.IsNotFound());
+
+  s = redis->BitOp(blackwidow::kBitOpNot, "DEST", {"A", "B"}, &len);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  s = redis->BitOp(blackwidow::kBitOpOr, "DEST", {}, &len);
+  EXPECT_TRUE(s.IsInvalidArgument());
+}
+
+TEST(TestBitPos, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  int64_t pos = 0;
+  s = redis->BitPos("NONE", 1, &pos);
+  EXPECT_TRUE(s.IsNotFound());
+  EXPECT_EQ(-1, pos);
+  s = redis->BitPos("NONE", 0, &pos);
+  EXPECT_TRUE(s.IsNotFound());
+  EXPECT_EQ(0, pos);
+
+  // The examples of the redis docs.
+  s = redis->Set("mykey", std::string("\xff\xf0\x00", 3));
+  EXPECT_TRUE(s.ok());
+  s = redis->BitPos("mykey", 0, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(12, pos);
+  s = redis->Set("mykey", std::string("\x00\xff\xf0", 3));
+  EXPECT_TRUE(s.ok());
+  s = redis->BitPos("mykey", 1, 0, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(8, pos);
+  s = redis->BitPos("mykey", 1, 2, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(16, pos);
+  s = redis->BitPos("mykey", 1, 2, -1, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(16, pos);
+  s = redis->Set("mykey", std::string(3, '\0'));
+  EXPECT_TRUE(s.ok());
+  s = redis->BitPos("mykey", 1, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, pos);
+
+  // Past the end of the value only without an end offset.
+  s = redis->Set("mykey", std::string(100, '\xff'));
+  EXPECT_TRUE(s.ok());
+  s = redis->BitPos("mykey", 0, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(800, pos);
+  s = redis->BitPos("mykey", 0, 0, 99, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, pos);
+
+  // A bit deep into a long value, past the word scan.
+  std::string value(1000, '\0');
+  value[777] = 0x04;
+  s = redis->Set("mykey", value);
+  EXPECT_TRUE(s.ok());
+  s = redis->BitPos("mykey", 1, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(777 * 8 + 5, pos);
+  s = redis->BitPos("mykey", 1, 778, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1, pos);
+
+  s = redis->BitPos("mykey", 2, &pos);
+  EXPECT_TRUE(s.IsInvalidArgument());
+}
+
+TEST(TestBitField, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  using blackwidow::BitFieldOp;
+  std::vector<blackwidow::BitFieldResult> results;
+
+  // BITFIELD mykey INCRBY i5 100 1 GET u4 0
+  BitFieldOp incr;
+  incr.type = BitFieldOp::kIncrBy;
+  incr.is_signed = true;
+  incr.bits = 5;
+  incr.offset = 100;
+  incr.value = 1;
+  BitFieldOp get;
+  get.type = BitFieldOp::kGet;
+  get.is_signed = false;
+  get.bits = 4;
+  get.offset = 0;
+  s = redis->BitField("mykey", {incr, get}, &results);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, results.size());
+  EXPECT_EQ(1, results[0].value);
+  EXPECT_EQ(0, results[1].value);
+  uint64_t len = 0;
+  s = redis->Strlen("mykey", &len);
+  EXPECT_EQ(14, len);
+
+  // BITFIELD mykey SET i8 #0 100 SET i8 #1 200
+  BitFieldOp set;
+  set.type = BitFieldOp::kSet;
+  set.is_signed = true;
+  set.bits = 8;
+  set.offset = 0;
+  set.value = 100;
+  BitFieldOp set2 = set;
+  set2.offset = 8;
+  set2.value = 200;
+  s = redis->BitField("mykey", {set, set2}, &results);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, results[0].value);
+  EXPECT_EQ(0, results[1].value);
+  get.is_signed = true;
+  get.bits = 8;
+  get.offset = 8;
+  s = redis->BitField("mykey", {get}, &results);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-56, results[0].value);
+
+  // BITFIELD mykey INCRBY u2 102 1 OVERFLOW SAT / FAIL
+  incr.is_signed = false;
+  incr.bits = 2;
+  incr.offset = 102;
+  for (int i = 0; i < 4; i++) {
+    s = redis->BitField("mykey", {incr}, &results);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ((i + 1) % 4, results[0].value);
+  }
+  incr.overflow = blackwidow::kBitFieldSat;
+  for (int i = 0; i < 4; i++) {
+    s = redis->BitField("mykey", {incr}, &results);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(std::min(i + 1, 3), results[0].value);
+  }
+  incr.overflow = blackwidow::kBitFieldFail;
+  s = redis->BitField("mykey", {incr}, &results);
+  EXPECT_TRUE(s.ok());
+  EXPECT_TRUE(results[0].failed);
+
+  // The value keeps its ttl.
+  s = redis->SetEx("ttlkey", "v", 100);
+  EXPECT_TRUE(s.ok());
+  set.bits = 64;
+  set.offset = 3;
+  set.value = -12345;
+  s = redis->BitField("ttlkey", {set}, &results);
+  EXPECT_TRUE(s.ok());
+  get.bits = 64;
+  get.offset = 3;
+  s = redis->BitField("ttlkey", {get}, &results);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-12345, results[0].value);
+  int64_t ttl = 0;
+  s = redis->TTL("ttlkey", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_GT(ttl, 0);
+
+  get.is_signed = false;
+  get.bits = 64;
+  s = redis->BitField("mykey", {get}, &results);
+  EXPECT_TRUE(s.IsInvalidArgument());
+}
+
 TEST(TestCad, RedisStringsTest) {
    blackwidow::RedisStrings* redis = nullptr;
 
@@ -485,6 +779,885 @@ TEST(TestCad, RedisStringsTest) {
   EXPECT_EQ(1, ret);
 }
 
+TEST(TestGetRangeAndSetRange, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::string value;
+  s = redis->Set("GETRANGE_KEY", "This is a string");
+  EXPECT_TRUE(s.ok());
+  s = redis->GetRange("GETRANGE_KEY", 0, 3, &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("This", value);
+  s = redis->GetRange("GETRANGE_KEY", -3, -1, &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("ing", value);
+  s = redis->GetRange("GETRANGE_KEY", 0, -1, &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("This is a string", value);
+  s = redis->GetRange("GETRANGE_KEY", 10, 100, &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("string", value);
+  s = redis->GetRange("GETRANGE_KEY", 5, 3, &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("", value);
+  s = redis->GetRange("GETRANGE_NOT_EXIST", 0, -1, &value);
+  EXPECT_TRUE(s.IsNotFound());
+
+  int32_t ret = 0;
+  s = redis->SetRange("SETRANGE_KEY", 6, "Redis", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(11, ret);
+  s = redis->Get("SETRANGE_KEY", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(std::string(6, '\0') + "Redis", value);
+  s = redis->Set("SETRANGE_KEY", "Hello World");
+  EXPECT_TRUE(s.ok());
+  s = redis->SetRange("SETRANGE_KEY", 6, "Redis", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(11, ret);
+  s = redis->Get("SETRANGE_KEY", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("Hello Redis", value);
+  s = redis->SetRange("SETRANGE_KEY", -1, "Redis", &ret);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  // Like redis, a string is at most 512MB.
+  s = redis->SetRange("SETRANGE_KEY", 512LL * 1024 * 1024 - 4, "Redis", &ret);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  s = redis->SetRange("SETRANGE_KEY", 1LL << 40, "", &ret);
+  EXPECT_TRUE(s.IsInvalidArgument());
+  s = redis->Get("SETRANGE_KEY", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("Hello Redis", value);
+
+  // An empty value neither changes nor creates the key.
+  s = redis->SetRange("SETRANGE_EMPTY", 10, "", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, ret);
+  s = redis->Get("SETRANGE_EMPTY", &value);
+  EXPECT_TRUE(s.IsNotFound());
+
+  // The ttl is kept.
+  s = redis->Expire("SETRANGE_KEY", 100);
+  EXPECT_TRUE(s.ok());
+  s = redis->SetRange("SETRANGE_KEY", 0, "J", &ret);
+  EXPECT_TRUE(s.ok());
+  int64_t ttl = 0;
+  s = redis->TTL("SETRANGE_KEY", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_GT(ttl, 0);
+
+  rocksdb::PinnableSlice pinned;
+  s = redis->Get("SETRANGE_KEY", &pinned);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("Jello Redis", pinned.ToString());
+  pinned.Reset();
+  s = redis->Get("GETRANGE_NOT_EXIST", &pinned);
+  EXPECT_TRUE(s.IsNotFound());
+
+  std::string streamed;
+  s = redis->GetStream("SETRANGE_KEY", [&](const rocksdb::Slice& bytes) {
+    streamed.append(bytes.data(), bytes.size());
+    return true;
+  });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("Jello Redis", streamed);
+}
+
+TEST(TestChunkedString, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  // 100字节以上的value分成16字节的chunk
+  opts.strings_chunk_threshold = 100;
+  opts.strings_chunk_size = 16;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::string big;
+  for (int i = 0; i < 250; i++) {
+    big.push_back('a' + i % 26);
+  }
+  std::string value;
+  uint64_t length = 0;
+  s = redis->Set("BIG", big);
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("BIG", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, value);
+  s = redis->Strlen("BIG", &length);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(250, length);
+
+  // Appending rewrites only the last chunk and the new ones.
+  int32_t ret = 0;
+  s = redis->Append("BIG", "0123456789", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(260, ret);
+  big += "0123456789";
+  s = redis->Get("BIG", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, value);
+
+  // A value growing past the threshold is chunked.
+  std::string small(90, 'x');
+  s = redis->Set("GROW", small);
+  EXPECT_TRUE(s.ok());
+  s = redis->Append("GROW", std::string(20, 'y'), &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(110, ret);
+  s = redis->Get("GROW", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(small + std::string(20, 'y'), value);
+
+  // Bits across chunks.
+  uint32_t bit = 0;
+  s = redis->SetBit("BIG", 8 * 200 + 7, 1, &bit);
+  EXPECT_TRUE(s.ok());
+  big[200] |= 1;
+  s = redis->GetBit("BIG", 8 * 200 + 7, &bit);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, bit);
+  s = redis->SetBit("BIG", 8 * 300, 1, &bit);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, bit);
+  big.resize(301, '\0');
+  big[300] = '\x80';
+  s = redis->Get("BIG", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, value);
+
+  uint64_t count = 0;
+  uint64_t expected = 0;
+  for (unsigned char c : big.substr(10, 200)) {
+    expected += __builtin_popcount(c);
+  }
+  s = redis->BitCount("BIG", 10, 209, &count);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(expected, count);
+
+  int64_t pos = 0;
+  s = redis->BitPos("BIG", 1, 261, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(8 * 300, pos);
+  s = redis->BitPos("BIG", 0, 261, &pos);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(8 * 261, pos);
+
+  // Ranges across chunks.
+  std::string range;
+  s = redis->GetRange("BIG", 30, 69, &range);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big.substr(30, 40), range);
+  s = redis->SetRange("BIG", 40, std::string(20, 'z'), &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(301, ret);
+  big.replace(40, 20, std::string(20, 'z'));
+  s = redis->SetRange("BIG", 310, "end", &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(313, ret);
+  big.resize(310, '\0');
+  big += "end";
+  s = redis->Get("BIG", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, value);
+
+  rocksdb::PinnableSlice pinned;
+  s = redis->Get("BIG", &pinned);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, pinned.ToString());
+  std::string streamed;
+  int pieces = 0;
+  s = redis->GetStream("BIG", [&](const rocksdb::Slice& bytes) {
+    streamed.append(bytes.data(), bytes.size());
+    pieces++;
+    return true;
+  });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, streamed);
+  EXPECT_EQ(20, pieces);
+
+  int32_t cad = 0;
+  s = redis->Cad("GROW", small, &cad);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, cad);
+
+  // The ttl is kept on the meta.
+  s = redis->Expire("BIG", 100);
+  EXPECT_TRUE(s.ok());
+  int64_t ttl = 0;
+  s = redis->TTL("BIG", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_GT(ttl, 0);
+  s = redis->Get("BIG", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, value);
+
+  // Overwritten, deleted or shrunk, the chunks are dropped by compaction.
+  s = redis->Set("BIG", big);
+  EXPECT_TRUE(s.ok());
+  s = redis->Set("GROW", "small");
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("GROW", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("small", value);
+  std::this_thread::sleep_for(1100ms);
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+  uint64_t num_keys = 0;
+  s = redis->GetProperty("rocksdb.estimate-num-keys", &num_keys);
+  EXPECT_TRUE(s.ok());
+  // Two metas and the 20 chunks of BIG.
+  EXPECT_EQ(2 + 20, num_keys);
+  s = redis->Get("BIG", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big, value);
+}
+
+TEST(TestChunkedStringReset, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df([&]() {
+    if (redis != nullptr)
+      delete redis;
+    system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  opts.strings_chunk_threshold = 100;
+  opts.strings_chunk_size = 16;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  // DEL or a small SET, then a big SET within the same second: the new
+  // chunks must outlive a compaction that still sees the old version.
+  for (const std::string key : {"DEL_KEY", "SMALL_KEY"}) {
+    std::string value;
+    for (int i = 0; i < 3; i++) {
+      // 连续覆盖, version会超过当前时间
+      s = redis->Set(key, std::string(200, 'a' + i));
+      EXPECT_TRUE(s.ok());
+    }
+    s = redis->CompactRange(nullptr, nullptr);
+    EXPECT_TRUE(s.ok());
+
+    if (key == "DEL_KEY") {
+      s = redis->Del(key);
+    } else {
+      s = redis->Set(key, "small");
+    }
+    EXPECT_TRUE(s.ok());
+    std::string big(250, 'z');
+    s = redis->Set(key, big);
+    EXPECT_TRUE(s.ok());
+
+    for (int i = 0; i < 2; i++) {
+      s = redis->CompactRange(nullptr, nullptr);
+      EXPECT_TRUE(s.ok());
+      s = redis->Get(key, &value);
+      EXPECT_TRUE(s.ok());
+      EXPECT_EQ(big, value);
+    }
+  }
+}
+
+TEST(TestIncrByBlind, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df2([&]() {
+    if (redis != nullptr)
+      delete redis;
+    ::system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 1000; i++) {
+        redis->IncrByBlind("counter", 1);
+      }
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+
+  std::string value;
+  s = redis->Get("counter", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("8000", value);
+
+  int64_t num = 0;
+  s = redis->IncrBy("counter", 10, &num);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(8010, num);
+
+  // The ttl of the base value survives the merge.
+  s = redis->Expire("counter", 100);
+  EXPECT_TRUE(s.ok());
+  s = redis->IncrByBlind("counter", -10);
+  EXPECT_TRUE(s.ok());
+  s = redis->IncrByFloatBlind("counter", "0.5");
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("counter", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("8000.5", value);
+  int64_t ttl = 0;
+  s = redis->TTL("counter", &ttl);
+  EXPECT_TRUE(s.ok());
+  EXPECT_GT(ttl, 0);
+
+  s = redis->IncrByFloat("counter", "1.5", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("8002", value);
+
+  // Locked and blind increments of one key do not lose each other.
+  s = redis->Set("mixed", "0");
+  EXPECT_TRUE(s.ok());
+  threads.clear();
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      int64_t ret = 0;
+      for (int i = 0; i < 500; i++) {
+        if (t % 2 == 0) {
+          redis->IncrByBlind("mixed", 1);
+        } else {
+          redis->IncrBy("mixed", 1, &ret);
+        }
+      }
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  s = redis->Get("mixed", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("2000", value);
+
+  // A delta against a non-number is dropped.
+  s = redis->Set("name", "guoxiangCN");
+  EXPECT_TRUE(s.ok());
+  s = redis->IncrByBlind("name", 1);
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("name", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("guoxiangCN", value);
+  s = redis->IncrBy("name", 1, &num);
+  EXPECT_TRUE(s.IsInvalidArgument());
+}
+
+TEST(TestCompactionStats, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df2([&]() {
+    if (redis != nullptr)
+      delete redis;
+    ::system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  // Two versions of every key in different files.
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 100; i++) {
+      s = redis->Set("key" + std::to_string(i), "round" + std::to_string(round));
+      EXPECT_TRUE(s.ok());
+    }
+    s = redis->CompactRange(nullptr, nullptr);
+    EXPECT_TRUE(s.ok());
+  }
+
+  blackwidow::StringsCompactionStats stats = redis->GetCompactionStats();
+  EXPECT_GE(stats.compactions, 2);
+  EXPECT_GE(stats.input_records, 300);
+  EXPECT_GE(stats.replaced_records, 100);
+  // A full compaction writes the bottommost level, nothing to mark.
+  EXPECT_EQ(0, stats.suggested_ranges);
+
+  std::string value;
+  s = redis->Get("key99", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("round1", value);
+}
+
+TEST(TestCompactExpiredFiles, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df2([&]() {
+    if (redis != nullptr)
+      delete redis;
+    ::system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  for (int i = 0; i < 90; i++) {
+    s = redis->SetEx("ttl_key" + std::to_string(i), "value", 1);
+    EXPECT_TRUE(s.ok());
+  }
+  for (int i = 0; i < 10; i++) {
+    s = redis->Set("key" + std::to_string(i), "value");
+    EXPECT_TRUE(s.ok());
+  }
+  // Move the values out of level 0 before they expire.
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+
+  uint64_t compacted_files = 0;
+  s = redis->CompactExpiredFiles(0.5, &compacted_files);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, compacted_files);
+
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+  s = redis->CompactExpiredFiles(0.5, &compacted_files);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, compacted_files);
+
+  uint64_t num_keys = 0;
+  s = redis->GetProperty("rocksdb.estimate-num-keys", &num_keys);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(10, num_keys);
+
+  // Nothing left to reclaim.
+  s = redis->CompactExpiredFiles(0.5, &compacted_files);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, compacted_files);
+}
+
+// A db created before chunk_cf existed gets it on open, a db with a cf
+// this version does not know is refused.
+TEST(TestMissingColumnFamily, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df2([&]() {
+    if (redis != nullptr)
+      delete redis;
+    ::system(kCmdDeleteTestingPath);
+  });
+  ::system(kCmdDeleteTestingPath);
+
+  rocksdb::Options db_opts;
+  db_opts.create_if_missing = true;
+  rocksdb::DB* db = nullptr;
+  blackwidow::Status s = rocksdb::DB::Open(db_opts, kTestingPath, &db);
+  EXPECT_TRUE(s.ok());
+  blackwidow::StringsValue strings_value("old_value");
+  s = db->Put(rocksdb::WriteOptions(), "OLD_KEY", strings_value.Encode());
+  EXPECT_TRUE(s.ok());
+  delete db;
+
+  blackwidow::BlackWidowOptions opts;
+  opts.strings_chunk_threshold = 100;
+  opts.strings_chunk_size = 32;
+  redis = new blackwidow::RedisStrings(nullptr);
+  s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+  std::string value;
+  s = redis->Get("OLD_KEY", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("old_value", value);
+  // Chunked, into the created chunk_cf.
+  const std::string big_value(1000, 'b');
+  s = redis->Set("BIG_KEY", big_value);
+  EXPECT_TRUE(s.ok());
+  s = redis->Get("BIG_KEY", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(big_value, value);
+  delete redis;
+  redis = nullptr;
+
+  // E.g. a db of a newer version, or one of the unified mode.
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  std::vector<rocksdb::ColumnFamilyDescriptor> cfds;
+  std::vector<std::string> names;
+  s = rocksdb::DB::ListColumnFamilies(rocksdb::DBOptions(), kTestingPath,
+                                      &names);
+  EXPECT_TRUE(s.ok());
+  for (const auto& name : names) {
+    cfds.emplace_back(name, rocksdb::ColumnFamilyOptions());
+  }
+  s = rocksdb::DB::Open(db_opts, kTestingPath, cfds, &handles, &db);
+  EXPECT_TRUE(s.ok());
+  rocksdb::ColumnFamilyHandle* unknown_cf = nullptr;
+  s = db->CreateColumnFamily(rocksdb::ColumnFamilyOptions(), "unknown_cf",
+                             &unknown_cf);
+  EXPECT_TRUE(s.ok());
+  handles.push_back(unknown_cf);
+  for (auto handle : handles) {
+    db->DestroyColumnFamilyHandle(handle);
+  }
+  delete db;
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.IsInvalidArgument());
+}
+
+TEST(TestCheckpoint, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+  blackwidow::RedisStrings* copy = nullptr;
+
+  testing::Defer df2([&]() {
+    if (redis != nullptr)
+      delete redis;
+    if (copy != nullptr)
+      delete copy;
+    ::system(kCmdDeleteTestingPath);
+    ::system(kCmdDeleteCopiesPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  s = redis->Set("flushed", "v1");
+  EXPECT_TRUE(s.ok());
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+  s = redis->Set("in_wal", "v2");
+  EXPECT_TRUE(s.ok());
+
+  // A write waits for ResumeWrites.
+  redis->PauseWrites();
+  std::atomic<bool> written(false);
+  std::thread writer([&]() {
+    redis->Set("after_checkpoint", "v3");
+    written = true;
+  });
+  std::this_thread::sleep_for(100ms);
+  EXPECT_FALSE(written);
+  uint64_t sequence = 0;
+  s = redis->CreateCheckpoint(kCheckpointPath, &sequence);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, sequence);
+  redis->ResumeWrites();
+  writer.join();
+  EXPECT_TRUE(written);
+
+  copy = new blackwidow::RedisStrings(nullptr);
+  s = copy->Open(opts, kCheckpointPath);
+  EXPECT_TRUE(s.ok());
+  std::string value;
+  s = copy->Get("flushed", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("v1", value);
+  s = copy->Get("in_wal", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("v2", value);
+  s = copy->Get("after_checkpoint", &value);
+  EXPECT_TRUE(s.IsNotFound());
+}
+
+TEST(TestIncrementalBackup, RedisStringsTest) {
+  blackwidow::RedisStrings* restored = nullptr;
+
+  testing::Defer df2([&]() {
+    if (restored != nullptr)
+      delete restored;
+    ::system(kCmdDeleteTestingPath);
+    ::system(kCmdDeleteCopiesPath);
+  });
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  blackwidow::BackupEngine backup_engine(kBackupPath);
+  blackwidow::Status s = backup_engine.Open();
+  EXPECT_TRUE(s.ok());
+
+  blackwidow::BackupInfo first, second;
+  {
+    blackwidow::BlackWidow db;
+    s = db.Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+    std::vector<blackwidow::KeyValue> kvs;
+    for (int i = 0; i < 100; i++) {
+      kvs.emplace_back("key" + std::to_string(i), "v1");
+    }
+    s = db.BulkLoadStrings(&kvs);
+    EXPECT_TRUE(s.ok());
+    s = backup_engine.CreateNewBackup(&db, &first);
+    EXPECT_TRUE(s.ok());
+
+    kvs.clear();
+    kvs.emplace_back("key0", "v2");
+    s = db.BulkLoadStrings(&kvs);
+    EXPECT_TRUE(s.ok());
+    s = backup_engine.CreateNewBackup(&db, &second);
+    EXPECT_TRUE(s.ok());
+  }
+
+  // Only the new sst and the small files are copied again.
+  EXPECT_EQ(1, first.backup_id);
+  EXPECT_EQ(2, second.backup_id);
+  EXPECT_GT(second.size, second.new_bytes);
+
+  // Reopened, the first backup goes and the ssts of the second stay.
+  blackwidow::BackupEngine reopened(kBackupPath);
+  s = reopened.Open();
+  EXPECT_TRUE(s.ok());
+  s = reopened.PurgeOldBackups(1);
+  EXPECT_TRUE(s.ok());
+  std::vector<blackwidow::BackupInfo> infos;
+  reopened.GetBackupInfo(&infos);
+  EXPECT_EQ(1, infos.size());
+  EXPECT_EQ(2, infos.empty() ? 0 : infos[0].backup_id);
+
+  s = reopened.RestoreBackup(2, kRestorePath);
+  EXPECT_TRUE(s.ok());
+  restored = new blackwidow::RedisStrings(nullptr);
+  s = restored->Open(opts, kRestorePath + "/" + blackwidow::STRINGS_DB);
+  EXPECT_TRUE(s.ok());
+  std::string value;
+  s = restored->Get("key0", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("v2", value);
+  s = restored->Get("key99", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("v1", value);
+}
+
+// A db created again reuses the sst numbers, its ssts of the same size
+// must not be taken for the ones of the earlier backup.
+TEST(TestBackupRecreatedDb, RedisStringsTest) {
+  blackwidow::RedisStrings* restored = nullptr;
+
+  testing::Defer df2([&]() {
+    if (restored != nullptr)
+      delete restored;
+    ::system(kCmdDeleteTestingPath);
+    ::system(kCmdDeleteCopiesPath);
+  });
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  blackwidow::BackupEngine backup_engine(kBackupPath);
+  blackwidow::Status s = backup_engine.Open();
+  EXPECT_TRUE(s.ok());
+
+  for (const std::string value : {"v1", "v2"}) {
+    ::system(kCmdDeleteTestingPath);
+    blackwidow::BlackWidow db;
+    s = db.Open(opts, kTestingPath);
+    EXPECT_TRUE(s.ok());
+    std::vector<blackwidow::KeyValue> kvs;
+    for (int i = 0; i < 100; i++) {
+      kvs.emplace_back("key" + std::to_string(i), value);
+    }
+    s = db.BulkLoadStrings(&kvs);
+    EXPECT_TRUE(s.ok());
+    s = backup_engine.CreateNewBackup(&db);
+    EXPECT_TRUE(s.ok());
+  }
+
+  s = backup_engine.RestoreBackup(2, kRestorePath);
+  EXPECT_TRUE(s.ok());
+  restored = new blackwidow::RedisStrings(nullptr);
+  s = restored->Open(opts, kRestorePath + "/" + blackwidow::STRINGS_DB);
+  EXPECT_TRUE(s.ok());
+  std::string value;
+  s = restored->Get("key0", &value);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ("v2", value);
+  delete restored;
+  restored = nullptr;
+
+  // A shared sst damaged in place fails the restore.
+  rocksdb::Env* env = rocksdb::Env::Default();
+  const std::string shared_dir =
+    kBackupPath + "/shared/" + blackwidow::STRINGS_DB;
+  std::vector<std::string> ssts;
+  s = env->GetChildren(shared_dir, &ssts);
+  EXPECT_TRUE(s.ok());
+  for (const auto& sst : ssts) {
+    if (sst == "." || sst == "..") {
+      continue;
+    }
+    std::fstream file(shared_dir + "/" + sst,
+                      std::ios::in | std::ios::out | std::ios::binary);
+    char byte = 0;
+    file.read(&byte, 1);
+    byte = ~byte;
+    file.seekp(0);
+    file.write(&byte, 1);
+  }
+  ::system("rm -rf ./testdb_strings_restore");
+  s = backup_engine.RestoreBackup(2, kRestorePath);
+  EXPECT_TRUE(s.IsCorruption());
+}
+
+TEST(TestCommandStats, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df2([&]() {
+    if (redis != nullptr)
+      delete redis;
+    ::system(kCmdDeleteTestingPath);
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      std::string value;
+      for (int i = 0; i < 100; i++) {
+        std::string key = "key" + std::to_string(t * 100 + i);
+        redis->Set(key, "value");
+        redis->Get(key, &value);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::string value;
+  s = redis->Get("missing", &value);
+  EXPECT_TRUE(s.IsNotFound());
+  int64_t ret = 0;
+  s = redis->Incr("key0", &ret);
+  EXPECT_FALSE(s.ok());
+
+  std::map<std::string, blackwidow::CommandStats> stats;
+  redis->GetCommandStats(&stats);
+  EXPECT_EQ(3, stats.size());
+  EXPECT_EQ(400, stats["SET"].count);
+  EXPECT_EQ(0, stats["SET"].errors);
+  // "key0" ... "key399" take 2290 bytes, and "value" each.
+  EXPECT_EQ(2290 + 400 * 5, stats["SET"].bytes_in);
+  EXPECT_EQ(401, stats["GET"].count);
+  EXPECT_EQ(0, stats["GET"].errors);
+  EXPECT_EQ(400 * 5, stats["GET"].bytes_out);
+  EXPECT_EQ(1, stats["INCR"].count);
+  EXPECT_EQ(1, stats["INCR"].errors);
+  EXPECT_TRUE(stats["GET"].p50_micros <= stats["GET"].p99_micros);
+  EXPECT_TRUE(stats["GET"].p99_micros <= stats["GET"].max_micros);
+
+  // A BITFIELD which only reads is counted too.
+  std::vector<blackwidow::BitFieldResult> results;
+  s = redis->BitField("key0", {blackwidow::BitFieldOp()}, &results);
+  EXPECT_TRUE(s.ok());
+  redis->GetCommandStats(&stats);
+  EXPECT_EQ(1, stats["BITFIELD"].count);
+  EXPECT_EQ(0, stats["BITFIELD"].errors);
+}
+
+TEST(TestCompactionTrace, RedisStringsTest) {
+  blackwidow::RedisStrings* redis = nullptr;
+
+  testing::Defer df2([&]() {
+    if (redis != nullptr)
+      delete redis;
+    ::system(kCmdDeleteTestingPath);
+    blackwidow::Tracer::SetLevel(blackwidow::kTraceOff);
+    blackwidow::Tracer::Clear();
+  });
+
+  redis = new blackwidow::RedisStrings(nullptr);
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  // Off by default.
+  s = redis->Set("untraced_key", "value");
+  EXPECT_TRUE(s.ok());
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+  std::vector<std::string> traces;
+  blackwidow::Tracer::Dump(&traces);
+  EXPECT_TRUE(traces.empty());
+
+  blackwidow::Tracer::SetSampling(1);
+  blackwidow::Tracer::SetLevel(blackwidow::kTraceVerbose);
+  s = redis->Set("traced_key", "value");
+  EXPECT_TRUE(s.ok());
+  s = redis->CompactRange(nullptr, nullptr);
+  EXPECT_TRUE(s.ok());
+  blackwidow::Tracer::Dump(&traces);
+  bool found = false;
+  for (const auto& trace : traces) {
+    if (trace.find("StringsCompactionFilter") != std::string::npos &&
+        trace.find("UserKey: traced_key") != std::string::npos) {
+      found = true;
+    }
+  }
+  EXPECT_TRUE(found);
+}
+
+// Arguments past the first one that does not fit are all dropped, none is
+// printed in the place of another.
+TEST(TestTraceArgsOverflow, RedisStringsTest) {
+  testing::Defer df2([&]() {
+    blackwidow::Tracer::SetLevel(blackwidow::kTraceOff);
+    blackwidow::Tracer::Clear();
+  });
+
+  blackwidow::Tracer::SetLevel(blackwidow::kTraceInfo);
+  const std::string arg(blackwidow::Tracer::kMaxStringArg, 'a');
+  BW_TRACE(blackwidow::kTraceInfo, "overflow", "%s %s %s %d|", arg, arg, arg,
+           7);
+  std::vector<std::string> traces;
+  blackwidow::Tracer::Dump(&traces);
+  bool found = false;
+  for (const auto& trace : traces) {
+    if (trace.find("overflow") != std::string::npos) {
+      found = true;
+      EXPECT_NE(std::string::npos, trace.find(arg + " " + arg + " ? ?|"));
+    }
+  }
+  EXPECT_TRUE(found);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
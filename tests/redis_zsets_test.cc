@@ -82,6 +82,171 @@ TEST(TestZAdd, RedisZsetsTest) {
   EXPECT_TRUE(s.IsNotFound());
 }
 
+TEST(TestDataFilter, RedisZsetsTest) {
+  blackwidow::RedisZsets* redis = nullptr;
+  testing::Defer d([&]() {
+    if (redis != nullptr) {
+      delete redis;
+    }
+    system(kCmdDeleteTestingPath);
+  });
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+
+  redis = new blackwidow::RedisZsets(nullptr);
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  int32_t ret = -3;
+  int32_t len = -3;
+  double score = 0;
+  std::vector<blackwidow::ScoreMember> sm;
+  for (int i = 0; i < 100; i++) {
+    sm.push_back({static_cast<double>(i), "member" + std::to_string(i)});
+  }
+  s = redis->ZAdd("zset_a", sm, &ret);
+  EXPECT_TRUE(s.ok());
+  s = redis->ZAdd("zset_b", sm, &ret);
+  EXPECT_TRUE(s.ok());
+
+  // The old members of a deleted and recreated zset are dropped.
+  s = redis->Del("zset_a");
+  EXPECT_TRUE(s.ok());
+  s = redis->ZAdd("zset_a", {{1.5, "new_member"}}, &ret);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, ret);
+
+  s = redis->CompactRange(nullptr, nullptr, blackwidow::kData);
+  EXPECT_TRUE(s.ok());
+
+  blackwidow::MetaLookupStats stats = redis->GetDataFilterStats();
+  // Member cf and score cf.
+  EXPECT_EQ(2 * 201, stats.records);
+  EXPECT_LE(stats.db_lookups, 4);
+
+  s = redis->ZCard("zset_a", &len);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, len);
+  s = redis->ZScore("zset_a", "member1", &score);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->ZScore("zset_a", "new_member", &score);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1.5, score);
+  s = redis->ZScore("zset_b", "member99", &score);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(99, score);
+}
+
+TEST(TestZCount, RedisZsetsTest) {
+  blackwidow::RedisZsets* redis = nullptr;
+  testing::Defer d([&]() {
+    if (redis != nullptr) {
+      delete redis;
+    }
+    system(kCmdDeleteTestingPath);
+  });
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+
+  redis = new blackwidow::RedisZsets(nullptr);
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  int32_t ret = 0;
+  int32_t count = -1;
+  std::vector<blackwidow::ScoreMember> sm;
+  for (int i = 0; i < 10; i++) {
+    sm.push_back({static_cast<double>(i), "member" + std::to_string(i)});
+  }
+  s = redis->ZAdd("ZCOUNT_KEY", sm, &ret);
+  EXPECT_TRUE(s.ok());
+
+  s = redis->ZCount("ZCOUNT_KEY", 2, 5, &count);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(4, count);
+  s = redis->ZCount("ZCOUNT_KEY", 3, 3, &count);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(1, count);
+  s = redis->ZCount("ZCOUNT_KEY", blackwidow::ZSET_SCORE_MIN,
+                    blackwidow::ZSET_SCORE_MAX, &count);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(10, count);
+  // An empty range, not the whole zset.
+  s = redis->ZCount("ZCOUNT_KEY", 5, 2, &count);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(0, count);
+}
+
+TEST(TestBulkLoad, RedisZsetsTest) {
+  blackwidow::RedisZsets* redis = nullptr;
+  testing::Defer d([&]() {
+    if (redis != nullptr) {
+      delete redis;
+    }
+    system(kCmdDeleteTestingPath);
+  });
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.error_if_exists = false;
+
+  redis = new blackwidow::RedisZsets(nullptr);
+  blackwidow::Status s = redis->Open(opts, kTestingPath);
+  EXPECT_TRUE(s.ok());
+
+  int32_t ret = -3;
+  int32_t len = -3;
+  double score = 0;
+  s = redis->ZAdd("zset_old", {{1, "old_member"}, {2, "kept_member"}}, &ret);
+  EXPECT_TRUE(s.ok());
+  s = redis->ZAdd("zset_del", {{1, "member"}}, &ret);
+  EXPECT_TRUE(s.ok());
+
+  std::vector<blackwidow::KeyScoreMembers> ksms;
+  for (int i = 0; i < 100; i++) {
+    blackwidow::KeyScoreMembers ksm;
+    ksm.key = "zset_" + std::to_string(i);
+    for (int j = 0; j < 10; j++) {
+      ksm.score_members.push_back(
+        {static_cast<double>(i * j), "member" + std::to_string(j)});
+    }
+    ksms.push_back(ksm);
+  }
+  // The last score of a duplicated member wins.
+  ksms.push_back({"zset_old", {{5, "kept_member"}, {-1.5, "new_member"},
+                               {6, "kept_member"}}});
+  ksms.push_back({"zset_del", {}});
+  s = redis->BulkLoad(&ksms);
+  EXPECT_TRUE(s.ok());
+
+  s = redis->ZCard("zset_99", &len);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(10, len);
+  s = redis->ZScore("zset_99", "member9", &score);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(99 * 9, score);
+
+  // A loaded zset replaces the old one.
+  s = redis->ZCard("zset_old", &len);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(2, len);
+  s = redis->ZScore("zset_old", "old_member", &score);
+  EXPECT_TRUE(s.IsNotFound());
+  s = redis->ZScore("zset_old", "kept_member", &score);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(6, score);
+  s = redis->ZScore("zset_old", "new_member", &score);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(-1.5, score);
+
+  s = redis->ZCard("zset_del", &len);
+  EXPECT_TRUE(s.IsNotFound());
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
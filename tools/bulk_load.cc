@@ -0,0 +1,150 @@
+// Loads a tab separated text file into a BlackWidow db with ssts ingested
+// per batch, see BlackWidow::BulkLoadStrings.
+//
+//   strings: key<TAB>value
+//   hashes:  key<TAB>field<TAB>value
+//   zsets:   key<TAB>score<TAB>member
+//
+// The lines of a hash or a zset must be adjacent, a key seen again in a
+// later batch replaces the one loaded before.
+
+#include "blackwidow/blackwidow.h"
+#include "rocksdb/env.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+void Usage(const char* prog) {
+  fprintf(stderr,
+          "Usage: %s <db_path> <strings|hashes|zsets> <input_file> "
+          "[batch_keys]\n",
+          prog);
+}
+
+// Splits `line` at the first `n` - 1 tabs.
+bool Split(const std::string& line, size_t n, std::vector<std::string>* parts) {
+  parts->clear();
+  size_t pos = 0;
+  while (parts->size() + 1 < n) {
+    size_t tab = line.find('\t', pos);
+    if (tab == std::string::npos) {
+      return false;
+    }
+    parts->push_back(line.substr(pos, tab - pos));
+    pos = tab + 1;
+  }
+  parts->push_back(line.substr(pos));
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 4) {
+    Usage(argv[0]);
+    return 1;
+  }
+  const std::string db_path = argv[1];
+  const std::string type = argv[2];
+  const std::string input_file = argv[3];
+  const size_t batch_keys = argc > 4 ? std::strtoull(argv[4], nullptr, 10)
+                                     : 100000;
+  if ((type != "strings" && type != "hashes" && type != "zsets") ||
+      batch_keys == 0) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  std::ifstream input(input_file);
+  if (!input) {
+    fprintf(stderr, "Can not open %s\n", input_file.c_str());
+    return 1;
+  }
+
+  blackwidow::BlackWidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  blackwidow::BlackWidow db;
+  blackwidow::Status s = db.Open(bw_options, db_path);
+  if (!s.ok()) {
+    fprintf(stderr, "Open %s failed: %s\n", db_path.c_str(),
+            s.ToString().c_str());
+    return 1;
+  }
+
+  std::vector<blackwidow::KeyValue> kvs;
+  std::vector<blackwidow::KeyFieldValues> kfvs;
+  std::vector<blackwidow::KeyScoreMembers> ksms;
+  uint64_t lines = 0, keys = 0;
+  const uint64_t start_micros = rocksdb::Env::Default()->NowMicros();
+
+  auto flush = [&]() {
+    if (type == "strings") {
+      keys += kvs.size();
+      s = db.BulkLoadStrings(&kvs);
+      kvs.clear();
+    } else if (type == "hashes") {
+      keys += kfvs.size();
+      s = db.BulkLoadHashes(&kfvs);
+      kfvs.clear();
+    } else {
+      keys += ksms.size();
+      s = db.BulkLoadZsets(&ksms);
+      ksms.clear();
+    }
+    return s.ok();
+  };
+
+  std::string line;
+  std::vector<std::string> parts;
+  while (std::getline(input, line)) {
+    lines++;
+    if (!Split(line, type == "strings" ? 2 : 3, &parts)) {
+      fprintf(stderr, "Bad line %lu: %s\n", lines, line.c_str());
+      return 1;
+    }
+    if (type == "strings") {
+      kvs.emplace_back(parts[0], parts[1]);
+      if (kvs.size() >= batch_keys && !flush()) {
+        break;
+      }
+    } else if (type == "hashes") {
+      // Only cut a batch where a new key starts.
+      if (kfvs.empty() || kfvs.back().key != parts[0]) {
+        if (kfvs.size() >= batch_keys && !flush()) {
+          break;
+        }
+        kfvs.push_back({parts[0], {}});
+      }
+      kfvs.back().fvs.push_back({parts[1], parts[2]});
+    } else {
+      if (ksms.empty() || ksms.back().key != parts[0]) {
+        if (ksms.size() >= batch_keys && !flush()) {
+          break;
+        }
+        ksms.push_back({parts[0], {}});
+      }
+      ksms.back().score_members.push_back(
+        {std::strtod(parts[1].c_str(), nullptr), parts[2]});
+    }
+  }
+  if (s.ok()) {
+    flush();
+  }
+  if (!s.ok()) {
+    fprintf(stderr, "Bulk load failed at line %lu: %s\n", lines,
+            s.ToString().c_str());
+    return 1;
+  }
+
+  const uint64_t micros = rocksdb::Env::Default()->NowMicros() - start_micros;
+  printf("Loaded %lu %s keys from %lu lines in %.3f s, %.0f lines/s\n",
+         keys, type.c_str(), lines, micros / 1e6,
+         micros ? lines * 1e6 / micros : 0.0);
+  return 0;
+}
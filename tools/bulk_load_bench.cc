@@ -0,0 +1,122 @@
+// Compares loading generated keys with the write path against BulkLoad.
+//
+//   bulk_load_bench <db_path> [keys] [fields_per_hash] [value_size]
+
+#include "redis_hashes.h"
+#include "redis_strings.h"
+#include "rocksdb/env.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace {
+
+const size_t kBatchKeys = 100000;
+
+std::string Key(uint64_t i) {
+  char buf[32];
+  // Not in key order, like most real inputs.
+  snprintf(buf, sizeof(buf), "key%016lx", (i * 0x9E3779B97F4A7C15ULL));
+  return buf;
+}
+
+void Report(const char* name, uint64_t records, uint64_t micros) {
+  printf("%-16s %10lu records %10.3f s %12.0f records/s\n", name, records,
+         micros / 1e6, micros ? records * 1e6 / micros : 0.0);
+}
+
+// Runs `fn` on a fresh db at `path`, returns false if it failed.
+template <typename Engine>
+bool Run(const char* name,
+         const std::string& path,
+         uint64_t records,
+         const std::function<blackwidow::Status(Engine*)>& fn) {
+  std::string cmd = "rm -rf " + path;
+  system(cmd.c_str());
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  Engine engine(nullptr);
+  blackwidow::Status s = engine.Open(opts, path);
+  if (s.ok()) {
+    uint64_t start = rocksdb::Env::Default()->NowMicros();
+    s = fn(&engine);
+    Report(name, records, rocksdb::Env::Default()->NowMicros() - start);
+  }
+  if (!s.ok()) {
+    fprintf(stderr, "%s failed: %s\n", name, s.ToString().c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr,
+            "Usage: %s <db_path> [keys] [fields_per_hash] [value_size]\n",
+            argv[0]);
+    return 1;
+  }
+  const std::string path = argv[1];
+  const uint64_t keys = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+  const uint64_t fields = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10;
+  const size_t value_size = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 100;
+  const std::string value(value_size, 'v');
+
+  bool ok = Run<blackwidow::RedisStrings>(
+    "strings set", path, keys, [&](blackwidow::RedisStrings* db) {
+      blackwidow::Status s;
+      for (uint64_t i = 0; i < keys && s.ok(); i++) {
+        s = db->Set(Key(i), value);
+      }
+      return s;
+    });
+  ok = ok && Run<blackwidow::RedisStrings>(
+    "strings bulk", path, keys, [&](blackwidow::RedisStrings* db) {
+      blackwidow::Status s;
+      std::vector<blackwidow::KeyValue> kvs;
+      for (uint64_t i = 0; i < keys && s.ok(); i++) {
+        kvs.emplace_back(Key(i), value);
+        if (kvs.size() == kBatchKeys || i + 1 == keys) {
+          s = db->BulkLoad(&kvs);
+          kvs.clear();
+        }
+      }
+      return s;
+    });
+
+  std::vector<blackwidow::FieldValue> fvs;
+  for (uint64_t j = 0; j < fields; j++) {
+    fvs.push_back({"field" + std::to_string(j), value});
+  }
+  ok = ok && Run<blackwidow::RedisHashes>(
+    "hashes hmset", path, keys * fields, [&](blackwidow::RedisHashes* db) {
+      blackwidow::Status s;
+      for (uint64_t i = 0; i < keys && s.ok(); i++) {
+        s = db->HMSet(Key(i), fvs);
+      }
+      return s;
+    });
+  ok = ok && Run<blackwidow::RedisHashes>(
+    "hashes bulk", path, keys * fields, [&](blackwidow::RedisHashes* db) {
+      blackwidow::Status s;
+      std::vector<blackwidow::KeyFieldValues> kfvs;
+      for (uint64_t i = 0; i < keys && s.ok(); i++) {
+        kfvs.push_back({Key(i), fvs});
+        if (kfvs.size() * fields >= kBatchKeys || i + 1 == keys) {
+          s = db->BulkLoad(&kfvs);
+          kfvs.clear();
+        }
+      }
+      return s;
+    });
+
+  std::string cmd = "rm -rf " + path;
+  system(cmd.c_str());
+  return ok ? 0 : 1;
+}
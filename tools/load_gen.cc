@@ -0,0 +1,443 @@
+// YCSB style load generator: drives the engines with a mix of reads and
+// writes over zipfian keys, then prints the latency percentiles of every
+// command. RocksDB write stalls are reported every interval while it runs.
+//
+//   load_gen --db_path=./load_gen_db --threads=8 --duration=60 \
+//            --keys=1000000 --zipf=0.99 --read_ratio=0.8 \
+//            --value_min=16 --value_max=1024 --ttl_ratio=0.1 \
+//            --strings=4 --hashes=2 --zsets=1 --lists=1
+
+#include "latency_histogram.h"
+#include "redis_hashes.h"
+#include "redis_lists.h"
+#include "redis_strings.h"
+#include "redis_zsets.h"
+#include "rocksdb/env.h"
+#include "rocksdb/statistics.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Config {
+  std::string db_path = "./load_gen_db";
+  int threads = 8;
+  // Seconds.
+  int duration = 60;
+  int report_interval = 1;
+  uint64_t keys = 1000000;
+  // Zipfian constant, 0 draws the keys uniformly.
+  double zipf = 0.99;
+  double read_ratio = 0.8;
+  // Value sizes are uniform in [value_min, value_max].
+  uint32_t value_min = 16;
+  uint32_t value_max = 1024;
+  // Writes that also set a ttl, uniform in [ttl_min, ttl_max] seconds.
+  double ttl_ratio = 0;
+  int ttl_min = 60;
+  int ttl_max = 3600;
+  // Fields of a hash and members of a zset are drawn from this many.
+  uint32_t fields = 100;
+  // Share of the operations per type, 0 leaves the type out.
+  std::map<std::string, int> weights = {
+    {"strings", 1}, {"hashes", 1}, {"zsets", 1}, {"lists", 1}};
+};
+
+enum Command {
+  kGet,
+  kSet,
+  kSetEx,
+  kHGet,
+  kHSet,
+  kZScore,
+  kZAdd,
+  kLLen,
+  kLPush,
+  kExpire,
+  kNumCommands
+};
+
+const char* kCommandNames[kNumCommands] = {
+  "GET", "SET", "SETEX", "HGET", "HSET", "ZSCORE", "ZADD", "LLEN", "LPUSH",
+  "EXPIRE"};
+
+// Zipfian ranks as in YCSB (Gray et al., Quickly Generating Billion-Record
+// Synthetic Databases), scrambled so that the hot keys are spread over the
+// key space instead of being its head.
+class ZipfianGenerator {
+ public:
+  ZipfianGenerator(uint64_t items, double theta)
+    : items_(items), theta_(theta) {
+    if (theta_ <= 0) {
+      return;
+    }
+    for (uint64_t i = 1; i <= items_; i++) {
+      zetan_ += 1 / std::pow(static_cast<double>(i), theta_);
+    }
+    double zeta2 = 1 + 1 / std::pow(2.0, theta_);
+    alpha_ = 1 / (1 - theta_);
+    eta_ = (1 - std::pow(2.0 / items_, 1 - theta_)) / (1 - zeta2 / zetan_);
+  }
+
+  uint64_t Next(std::mt19937_64* rng) const {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    double u = uniform(*rng);
+    if (theta_ <= 0) {
+      return static_cast<uint64_t>(u * items_) % items_;
+    }
+    double uz = u * zetan_;
+    uint64_t rank;
+    if (uz < 1) {
+      rank = 0;
+    } else if (uz < 1 + std::pow(0.5, theta_)) {
+      rank = 1;
+    } else {
+      rank = static_cast<uint64_t>(
+        items_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    }
+    return Scramble(rank) % items_;
+  }
+
+ private:
+  // FNV-1a of the rank.
+  static uint64_t Scramble(uint64_t rank) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 8; i++) {
+      hash ^= (rank >> (i * 8)) & 0xff;
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  const uint64_t items_;
+  const double theta_;
+  double zetan_ = 0;
+  double alpha_ = 0;
+  double eta_ = 0;
+};
+
+struct Engines {
+  std::unique_ptr<blackwidow::RedisStrings> strings;
+  std::unique_ptr<blackwidow::RedisHashes> hashes;
+  std::unique_ptr<blackwidow::RedisZsets> zsets;
+  std::unique_ptr<blackwidow::RedisLists> lists;
+
+  std::vector<std::pair<std::string, blackwidow::Redis*>> All() const {
+    std::vector<std::pair<std::string, blackwidow::Redis*>> all;
+    if (strings) all.emplace_back("strings", strings.get());
+    if (hashes) all.emplace_back("hashes", hashes.get());
+    if (zsets) all.emplace_back("zsets", zsets.get());
+    if (lists) all.emplace_back("lists", lists.get());
+    return all;
+  }
+};
+
+struct alignas(64) WorkerStats {
+  std::atomic<uint64_t> ops{0};
+  std::atomic<uint64_t> errors{0};
+  blackwidow::LatencyHistogram histograms[kNumCommands];
+};
+
+class Worker {
+ public:
+  Worker(const Config& config,
+         const Engines& engines,
+         const ZipfianGenerator& keys,
+         uint64_t seed,
+         WorkerStats* stats)
+    : config_(config),
+      engines_(engines),
+      keys_(keys),
+      rng_(seed),
+      stats_(stats) {
+    std::vector<int> weights;
+    for (const auto& type : {"strings", "hashes", "zsets", "lists"}) {
+      weights.push_back(config.weights.at(type));
+    }
+    types_ = std::discrete_distribution<int>(weights.begin(), weights.end());
+  }
+
+  void Run(const std::atomic<bool>& stop) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::uniform_int_distribution<uint32_t> value_size(config_.value_min,
+                                                       config_.value_max);
+    std::uniform_int_distribution<int> ttl(config_.ttl_min, config_.ttl_max);
+    std::uniform_int_distribution<uint32_t> field(0, config_.fields - 1);
+    const std::string values(config_.value_max, 'v');
+
+    while (!stop.load(std::memory_order_relaxed)) {
+      const int type = types_(rng_);
+      const std::string key = "key:" + std::to_string(keys_.Next(&rng_));
+      const bool read = uniform(rng_) < config_.read_ratio;
+      const bool with_ttl = !read && uniform(rng_) < config_.ttl_ratio;
+      const blackwidow::Slice value(values.data(), value_size(rng_));
+      const std::string member = "f" + std::to_string(field(rng_));
+      std::string result;
+
+      switch (type) {
+        case 0:
+          if (read) {
+            Time(kGet, [&]() { return engines_.strings->Get(key, &result); });
+          } else if (with_ttl) {
+            Time(kSetEx, [&]() {
+              return engines_.strings->SetEx(key, value, ttl(rng_));
+            });
+          } else {
+            Time(kSet, [&]() { return engines_.strings->Set(key, value); });
+          }
+          break;
+        case 1:
+          if (read) {
+            Time(kHGet, [&]() {
+              return engines_.hashes->HGet(key, member, &result);
+            });
+          } else {
+            Time(kHSet, [&]() {
+              int32_t ret = 0;
+              return engines_.hashes->HSet(key, member, value, &ret);
+            });
+          }
+          break;
+        case 2:
+          if (read) {
+            Time(kZScore, [&]() {
+              double score = 0;
+              return engines_.zsets->ZScore(key, member, &score);
+            });
+          } else {
+            Time(kZAdd, [&]() {
+              int32_t ret = 0;
+              return engines_.zsets->ZAdd(
+                key, {{static_cast<double>(field(rng_)), member}}, &ret);
+            });
+          }
+          break;
+        default:
+          if (read) {
+            Time(kLLen, [&]() {
+              uint64_t len = 0;
+              return engines_.lists->LLen(key, &len);
+            });
+          } else {
+            Time(kLPush, [&]() {
+              uint64_t len = 0;
+              blackwidow::Status s = engines_.lists->LPushX(key, value, &len);
+              if (s.IsNotFound()) {
+                s = engines_.lists->LPush(key, {value.ToString()}, &len);
+              }
+              return s;
+            });
+          }
+          break;
+      }
+      if (with_ttl && type != 0) {
+        blackwidow::Redis* db = nullptr;
+        switch (type) {
+          case 1: db = engines_.hashes.get(); break;
+          case 2: db = engines_.zsets.get(); break;
+          default: db = engines_.lists.get(); break;
+        }
+        Time(kExpire, [&]() { return db->Expire(key, ttl(rng_)); });
+      }
+    }
+  }
+
+ private:
+  template <typename F>
+  void Time(Command command, const F& fn) {
+    auto start = std::chrono::steady_clock::now();
+    blackwidow::Status s = fn();
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    stats_->histograms[command].Record(micros);
+    stats_->ops.fetch_add(1, std::memory_order_relaxed);
+    if (!s.ok() && !s.IsNotFound()) {
+      stats_->errors.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  const Config& config_;
+  const Engines& engines_;
+  const ZipfianGenerator& keys_;
+  std::mt19937_64 rng_;
+  std::discrete_distribution<int> types_;
+  WorkerStats* const stats_;
+};
+
+bool ParseFlags(int argc, char** argv, Config* config) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* eq = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) != 0 || eq == nullptr) {
+      fprintf(stderr, "Bad flag %s, flags are --name=value\n", arg);
+      return false;
+    }
+    std::string name(arg + 2, eq - arg - 2);
+    std::string value(eq + 1);
+    if (name == "db_path") {
+      config->db_path = value;
+    } else if (name == "threads") {
+      config->threads = std::atoi(value.c_str());
+    } else if (name == "duration") {
+      config->duration = std::atoi(value.c_str());
+    } else if (name == "report_interval") {
+      config->report_interval = std::max(1, std::atoi(value.c_str()));
+    } else if (name == "keys") {
+      config->keys = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "zipf") {
+      config->zipf = std::atof(value.c_str());
+    } else if (name == "read_ratio") {
+      config->read_ratio = std::atof(value.c_str());
+    } else if (name == "value_min") {
+      config->value_min = std::atoi(value.c_str());
+    } else if (name == "value_max") {
+      config->value_max = std::atoi(value.c_str());
+    } else if (name == "ttl_ratio") {
+      config->ttl_ratio = std::atof(value.c_str());
+    } else if (name == "ttl_min") {
+      config->ttl_min = std::atoi(value.c_str());
+    } else if (name == "ttl_max") {
+      config->ttl_max = std::atoi(value.c_str());
+    } else if (name == "fields") {
+      config->fields = std::max(1, std::atoi(value.c_str()));
+    } else if (config->weights.count(name)) {
+      config->weights[name] = std::max(0, std::atoi(value.c_str()));
+    } else {
+      fprintf(stderr, "Unknown flag --%s\n", name.c_str());
+      return false;
+    }
+  }
+  if (config->keys == 0 || config->zipf == 1 ||
+      config->value_min > config->value_max ||
+      config->ttl_min > config->ttl_max || config->threads <= 0) {
+    fprintf(stderr, "Bad flag values\n");
+    return false;
+  }
+  int total = 0;
+  for (const auto& weight : config->weights) {
+    total += weight.second;
+  }
+  if (total == 0) {
+    fprintf(stderr, "No type to drive\n");
+    return false;
+  }
+  return true;
+}
+
+template <typename Engine>
+std::unique_ptr<Engine> OpenEngine(const blackwidow::BlackWidowOptions& opts,
+                                   const std::string& path) {
+  std::unique_ptr<Engine> engine(new Engine(nullptr));
+  blackwidow::Status s = engine->Open(opts, path);
+  if (!s.ok()) {
+    fprintf(stderr, "Open %s failed: %s\n", path.c_str(),
+            s.ToString().c_str());
+    std::exit(1);
+  }
+  return engine;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  if (!ParseFlags(argc, argv, &config)) {
+    return 1;
+  }
+
+  blackwidow::BlackWidowOptions opts;
+  opts.options.create_if_missing = true;
+  opts.options.statistics = rocksdb::CreateDBStatistics();
+  rocksdb::Env::Default()->CreateDirIfMissing(config.db_path);
+  Engines engines;
+  if (config.weights["strings"] > 0) {
+    engines.strings = OpenEngine<blackwidow::RedisStrings>(
+      opts, config.db_path + "/strings");
+  }
+  if (config.weights["hashes"] > 0) {
+    engines.hashes = OpenEngine<blackwidow::RedisHashes>(
+      opts, config.db_path + "/hashes");
+  }
+  if (config.weights["zsets"] > 0) {
+    engines.zsets = OpenEngine<blackwidow::RedisZsets>(
+      opts, config.db_path + "/zsets");
+  }
+  if (config.weights["lists"] > 0) {
+    engines.lists = OpenEngine<blackwidow::RedisLists>(
+      opts, config.db_path + "/lists");
+  }
+
+  const ZipfianGenerator keys(config.keys, config.zipf);
+  std::vector<std::unique_ptr<WorkerStats>> stats;
+  std::vector<std::thread> threads;
+  std::atomic<bool> stop(false);
+  for (int i = 0; i < config.threads; i++) {
+    stats.emplace_back(new WorkerStats());
+    threads.emplace_back([&, i]() {
+      Worker worker(config, engines, keys, 0x5eed + i, stats[i].get());
+      worker.Run(stop);
+    });
+  }
+
+  // Throughput and write stalls over time.
+  printf("%6s %10s %8s %12s %14s %8s\n", "secs", "ops/s", "errors",
+         "stall_us", "delayed_rate", "stopped");
+  uint64_t last_ops = 0, last_stall = 0;
+  for (int elapsed = 0; elapsed < config.duration;) {
+    std::this_thread::sleep_for(std::chrono::seconds(config.report_interval));
+    elapsed += config.report_interval;
+    uint64_t ops = 0, errors = 0;
+    for (const auto& s : stats) {
+      ops += s->ops.load(std::memory_order_relaxed);
+      errors += s->errors.load(std::memory_order_relaxed);
+    }
+    uint64_t stall = opts.options.statistics->getTickerCount(
+      rocksdb::STALL_MICROS);
+    uint64_t delayed_rate = 0, stopped = 0;
+    for (const auto& engine : engines.All()) {
+      uint64_t value = 0;
+      if (engine.second->GetDB()->GetIntProperty(
+            rocksdb::DB::Properties::kActualDelayedWriteRate, &value)) {
+        delayed_rate += value;
+      }
+      if (engine.second->GetDB()->GetIntProperty(
+            rocksdb::DB::Properties::kIsWriteStopped, &value)) {
+        stopped += value;
+      }
+    }
+    printf("%6d %10lu %8lu %12lu %14lu %8lu\n", elapsed,
+           (ops - last_ops) / config.report_interval, errors,
+           stall - last_stall, delayed_rate, stopped);
+    fflush(stdout);
+    last_ops = ops;
+    last_stall = stall;
+  }
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  printf("\nLatency in microseconds:\n");
+  for (int command = 0; command < kNumCommands; command++) {
+    blackwidow::LatencyHistogram histogram;
+    for (const auto& s : stats) {
+      histogram.Merge(s->histograms[command]);
+    }
+    if (histogram.count() > 0) {
+      printf("%-8s %s\n", kCommandNames[command],
+             histogram.ToString().c_str());
+    }
+  }
+  return 0;
+}